@@ -0,0 +1,619 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-archive-index.c
+ * Listing of the entries stored in an archive
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-archive-index.h"
+
+#include "autoar-private.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+/**
+ * SECTION:autoar-archive-index
+ * @Short_description: Listing of the entries stored in an archive
+ * @Title: AutoarArchiveIndex
+ * @Include: gnome-autoar/autoar.h
+ *
+ * The #AutoarArchiveIndex object records the path, type, size, modification
+ * time and data offset of every entry in an archive. It is created by
+ * autoar_extractor_list() or while #AutoarExtractor scans the archive, and it
+ * can be passed to another #AutoarExtractor working on the same archive with
+ * autoar_extractor_set_index() to avoid scanning it again.
+ *
+ * If #AutoarExtractor:use-index-cache is set, indexes of local files are also
+ * stored in the gnome-autoar directory inside the user cache directory
+ * (usually <filename>~/.cache</filename>). The cached copy is keyed on the
+ * device, inode, size and modification time of the archive, so it is only
+ * used as long as the archive is not modified.
+ **/
+
+/* Increase when the serialized form changes */
+#define CACHE_VERSION 3
+#define CACHE_VARIANT_TYPE "(utttxuuva(suxxx))"
+
+/* Reads swapped in a cache written on a machine of the other byte order */
+#define CACHE_BYTE_ORDER 0x01020304
+
+#define CACHE_FLAG_RAW       (1 << 0)
+#define CACHE_FLAG_ENCRYPTED (1 << 1)
+#define CACHE_FLAG_SEEKABLE  (1 << 2)
+
+typedef struct _AutoarArchiveIndexEntry AutoarArchiveIndexEntry;
+
+struct _AutoarArchiveIndexEntry
+{
+  char *path;
+  GFileType file_type;
+  gint64 size;
+  gint64 mtime;
+  gint64 offset;
+};
+
+struct _AutoarArchiveIndex
+{
+  GObject parent_instance;
+
+  GFile *source_file;
+
+  GArray *entries;
+  GHashTable *path_to_entry;
+  guint64 total_size;
+
+  /* Cache key, valid only if has_key is set */
+  gboolean has_key;
+  guint64 device;
+  guint64 inode;
+  guint64 file_size;
+  gint64 file_mtime;
+
+  guint raw       : 1;
+  guint encrypted : 1;
+  guint seekable  : 1;
+
+  /* Restart points of the decompressor, see AutoarDecoder */
+  GVariant *seek_points;
+};
+
+G_DEFINE_TYPE (AutoarArchiveIndex, autoar_archive_index, G_TYPE_OBJECT)
+
+static void
+autoar_archive_index_entry_clear (void *data)
+{
+  AutoarArchiveIndexEntry *entry = data;
+
+  g_free (entry->path);
+}
+
+static void
+autoar_archive_index_dispose (GObject *object)
+{
+  AutoarArchiveIndex *self;
+
+  self = AUTOAR_ARCHIVE_INDEX (object);
+
+  g_debug ("AutoarArchiveIndex: dispose");
+
+  g_clear_object (&self->source_file);
+
+  G_OBJECT_CLASS (autoar_archive_index_parent_class)->dispose (object);
+}
+
+static void
+autoar_archive_index_finalize (GObject *object)
+{
+  AutoarArchiveIndex *self;
+
+  self = AUTOAR_ARCHIVE_INDEX (object);
+
+  g_debug ("AutoarArchiveIndex: finalize");
+
+  g_clear_pointer (&self->path_to_entry, g_hash_table_unref);
+  g_clear_pointer (&self->entries, g_array_unref);
+  g_clear_pointer (&self->seek_points, g_variant_unref);
+
+  G_OBJECT_CLASS (autoar_archive_index_parent_class)->finalize (object);
+}
+
+static void
+autoar_archive_index_class_init (AutoarArchiveIndexClass *klass)
+{
+  GObjectClass *object_class;
+
+  object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = autoar_archive_index_dispose;
+  object_class->finalize = autoar_archive_index_finalize;
+}
+
+static void
+autoar_archive_index_init (AutoarArchiveIndex *self)
+{
+  self->entries = g_array_new (FALSE, FALSE, sizeof (AutoarArchiveIndexEntry));
+  g_array_set_clear_func (self->entries, autoar_archive_index_entry_clear);
+  self->path_to_entry = NULL;
+  self->total_size = 0;
+  self->has_key = FALSE;
+}
+
+static gboolean
+autoar_archive_index_query_key (AutoarArchiveIndex *self,
+                                GCancellable       *cancellable)
+{
+  g_autoptr (GFileInfo) info = NULL;
+
+  info = g_file_query_info (self->source_file,
+                            G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+                            G_FILE_ATTRIBUTE_UNIX_INODE ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            NULL);
+  if (info == NULL ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_INODE) ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    return FALSE;
+
+  self->device = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+  self->inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+  self->file_size = g_file_info_get_size (info);
+  self->file_mtime =
+    g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+    g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  self->has_key = TRUE;
+
+  return TRUE;
+}
+
+static char *
+autoar_archive_index_get_cache_path (AutoarArchiveIndex *self)
+{
+  g_autofree char *key = NULL;
+  g_autofree char *name = NULL;
+
+  key = g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%"
+                         G_GUINT64_FORMAT ":%" G_GINT64_FORMAT,
+                         self->device, self->inode,
+                         self->file_size, self->file_mtime);
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key, -1);
+
+  return g_build_filename (g_get_user_cache_dir (), "gnome-autoar", "index",
+                           name, NULL);
+}
+
+/* Private functions used by AutoarExtractor */
+
+AutoarArchiveIndex *
+autoar_archive_index_new (GFile        *source_file,
+                          GCancellable *cancellable)
+{
+  AutoarArchiveIndex *self;
+
+  self = g_object_new (AUTOAR_TYPE_ARCHIVE_INDEX, NULL);
+  self->source_file = g_object_ref (source_file);
+
+  autoar_archive_index_query_key (self, cancellable);
+
+  return self;
+}
+
+void
+autoar_archive_index_add_entry (AutoarArchiveIndex *self,
+                                const char         *path,
+                                GFileType           file_type,
+                                gint64              size,
+                                gint64              mtime,
+                                gint64              offset)
+{
+  AutoarArchiveIndexEntry entry;
+
+  entry.path = g_strdup (path);
+  entry.file_type = file_type;
+  entry.size = size;
+  entry.mtime = mtime;
+  entry.offset = offset;
+
+  g_array_append_val (self->entries, entry);
+  if (size > 0)
+    self->total_size += size;
+
+  /* The table is rebuilt on the next lookup */
+  g_clear_pointer (&self->path_to_entry, g_hash_table_unref);
+}
+
+void
+autoar_archive_index_set_flags (AutoarArchiveIndex *self,
+                                gboolean            raw,
+                                gboolean            encrypted,
+                                gboolean            seekable)
+{
+  self->raw = raw;
+  self->encrypted = encrypted;
+  self->seekable = seekable;
+}
+
+gboolean
+autoar_archive_index_get_raw (AutoarArchiveIndex *self)
+{
+  return self->raw;
+}
+
+gboolean
+autoar_archive_index_get_encrypted (AutoarArchiveIndex *self)
+{
+  return self->encrypted;
+}
+
+gboolean
+autoar_archive_index_get_seekable (AutoarArchiveIndex *self)
+{
+  return self->seekable;
+}
+
+void
+autoar_archive_index_set_seek_points (AutoarArchiveIndex *self,
+                                      GVariant           *seek_points)
+{
+  g_clear_pointer (&self->seek_points, g_variant_unref);
+  if (seek_points != NULL)
+    self->seek_points = g_variant_ref_sink (seek_points);
+}
+
+GVariant *
+autoar_archive_index_get_seek_points (AutoarArchiveIndex *self)
+{
+  return self->seek_points;
+}
+
+AutoarArchiveIndex *
+autoar_archive_index_load_cached (GFile        *source_file,
+                                  GCancellable *cancellable)
+{
+  g_autoptr (AutoarArchiveIndex) self = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GVariantIter) iter = NULL;
+  g_autoptr (GVariant) seek_points = NULL;
+  g_autofree char *path = NULL;
+  char *contents;
+  gsize length;
+  guint32 version, flags;
+  guint64 device, inode, file_size;
+  gint64 file_mtime;
+  guint32 byte_order;
+  const char *entry_path;
+  guint32 file_type;
+  gint64 size, mtime, offset;
+
+  self = autoar_archive_index_new (source_file, cancellable);
+  if (!self->has_key)
+    return NULL;
+
+  path = autoar_archive_index_get_cache_path (self);
+  if (!g_file_get_contents (path, &contents, &length, NULL)) {
+    g_debug ("autoar_archive_index_load_cached: %s: cache miss", path);
+    return NULL;
+  }
+
+  bytes = g_bytes_new_take (contents, length);
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_VARIANT_TYPE),
+                                      bytes, FALSE);
+  g_variant_ref_sink (variant);
+
+  g_variant_get_child (variant, 6, "u", &byte_order);
+  if (byte_order == GUINT32_SWAP_LE_BE (CACHE_BYTE_ORDER)) {
+    GVariant *swapped;
+
+    swapped = g_variant_byteswap (variant);
+    g_variant_unref (variant);
+    variant = swapped;
+  } else if (byte_order != CACHE_BYTE_ORDER) {
+    g_debug ("autoar_archive_index_load_cached: %s: invalid entry", path);
+    return NULL;
+  }
+
+  g_variant_get (variant, CACHE_VARIANT_TYPE,
+                 &version, &device, &inode, &file_size, &file_mtime,
+                 &flags, &byte_order, &seek_points, &iter);
+
+  if (version != CACHE_VERSION ||
+      device != self->device || inode != self->inode ||
+      file_size != self->file_size || file_mtime != self->file_mtime) {
+    g_debug ("autoar_archive_index_load_cached: %s: stale entry", path);
+    return NULL;
+  }
+
+  while (g_variant_iter_next (iter, "(&suxxx)",
+                              &entry_path, &file_type, &size, &mtime, &offset)) {
+    autoar_archive_index_add_entry (self, entry_path, file_type,
+                                    size, mtime, offset);
+  }
+
+  autoar_archive_index_set_flags (self,
+                                  (flags & CACHE_FLAG_RAW) != 0,
+                                  (flags & CACHE_FLAG_ENCRYPTED) != 0,
+                                  (flags & CACHE_FLAG_SEEKABLE) != 0);
+
+  /* An empty tuple is stored when there are no restart points */
+  if (!g_variant_is_of_type (seek_points, G_VARIANT_TYPE_UNIT))
+    autoar_archive_index_set_seek_points (self, seek_points);
+
+  g_debug ("autoar_archive_index_load_cached: %s: %u entries",
+           path, self->entries->len);
+
+  return g_steal_pointer (&self);
+}
+
+void
+autoar_archive_index_save_cached (AutoarArchiveIndex *self)
+{
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *path = NULL;
+  g_autofree char *dirname = NULL;
+  GVariantBuilder builder;
+  guint32 flags;
+  guint i;
+
+  if (!self->has_key)
+    return;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suxxx)"));
+  for (i = 0; i < self->entries->len; i++) {
+    AutoarArchiveIndexEntry *entry;
+
+    entry = &g_array_index (self->entries, AutoarArchiveIndexEntry, i);
+    g_variant_builder_add (&builder, "(suxxx)",
+                           entry->path, (guint32) entry->file_type,
+                           entry->size, entry->mtime, entry->offset);
+  }
+
+  flags = (self->raw ? CACHE_FLAG_RAW : 0) |
+          (self->encrypted ? CACHE_FLAG_ENCRYPTED : 0) |
+          (self->seekable ? CACHE_FLAG_SEEKABLE : 0);
+
+  /* The byte order mark detects caches shared between machines of
+   * different byte order. */
+  variant = g_variant_new (CACHE_VARIANT_TYPE,
+                           (guint32) CACHE_VERSION,
+                           self->device, self->inode,
+                           self->file_size, self->file_mtime,
+                           flags, (guint32) CACHE_BYTE_ORDER,
+                           self->seek_points ?
+                             self->seek_points : g_variant_new ("()"),
+                           &builder);
+  g_variant_ref_sink (variant);
+
+  path = autoar_archive_index_get_cache_path (self);
+  dirname = g_path_get_dirname (path);
+  if (g_mkdir_with_parents (dirname, 0700) < 0) {
+    g_debug ("autoar_archive_index_save_cached: %s: unable to create", dirname);
+    return;
+  }
+
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error)) {
+    g_debug ("autoar_archive_index_save_cached: %s", error->message);
+    return;
+  }
+
+  g_debug ("autoar_archive_index_save_cached: %s: %u entries",
+           path, self->entries->len);
+}
+
+/**
+ * autoar_archive_index_get_source_file:
+ * @self: an #AutoarArchiveIndex
+ *
+ * Gets the archive described by this index.
+ *
+ * Returns: (transfer none): a #GFile
+ **/
+GFile *
+autoar_archive_index_get_source_file (AutoarArchiveIndex *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_ARCHIVE_INDEX (self), NULL);
+  return self->source_file;
+}
+
+/**
+ * autoar_archive_index_get_n_entries:
+ * @self: an #AutoarArchiveIndex
+ *
+ * Gets the number of entries in the archive, including directories.
+ *
+ * Returns: the number of entries
+ **/
+guint
+autoar_archive_index_get_n_entries (AutoarArchiveIndex *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_ARCHIVE_INDEX (self), 0);
+  return self->entries->len;
+}
+
+/**
+ * autoar_archive_index_get_total_size:
+ * @self: an #AutoarArchiveIndex
+ *
+ * Gets the sum of the sizes of all entries, as stored in the archive headers.
+ *
+ * Returns: the total size in bytes
+ **/
+guint64
+autoar_archive_index_get_total_size (AutoarArchiveIndex *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_ARCHIVE_INDEX (self), 0);
+  return self->total_size;
+}
+
+static AutoarArchiveIndexEntry *
+autoar_archive_index_get_entry (AutoarArchiveIndex *self,
+                                guint               i)
+{
+  g_return_val_if_fail (AUTOAR_IS_ARCHIVE_INDEX (self), NULL);
+  g_return_val_if_fail (i < self->entries->len, NULL);
+
+  return &g_array_index (self->entries, AutoarArchiveIndexEntry, i);
+}
+
+/**
+ * autoar_archive_index_get_entry_path:
+ * @self: an #AutoarArchiveIndex
+ * @i: the position of the entry
+ *
+ * Gets the path of the @i-th entry, converted to UTF-8 if the archive uses
+ * another encoding. The path is not sanitized, so it may contain ".." or
+ * start with "/".
+ *
+ * Returns: (transfer none): the path of the entry
+ **/
+const char *
+autoar_archive_index_get_entry_path (AutoarArchiveIndex *self,
+                                     guint               i)
+{
+  AutoarArchiveIndexEntry *entry = autoar_archive_index_get_entry (self, i);
+  return entry != NULL ? entry->path : NULL;
+}
+
+/**
+ * autoar_archive_index_get_entry_file_type:
+ * @self: an #AutoarArchiveIndex
+ * @i: the position of the entry
+ *
+ * Gets the type of the @i-th entry. Hard links are reported as
+ * %G_FILE_TYPE_REGULAR, and devices, FIFOs and sockets as
+ * %G_FILE_TYPE_SPECIAL.
+ *
+ * Returns: a #GFileType
+ **/
+GFileType
+autoar_archive_index_get_entry_file_type (AutoarArchiveIndex *self,
+                                          guint               i)
+{
+  AutoarArchiveIndexEntry *entry = autoar_archive_index_get_entry (self, i);
+  return entry != NULL ? entry->file_type : G_FILE_TYPE_UNKNOWN;
+}
+
+/**
+ * autoar_archive_index_get_entry_size:
+ * @self: an #AutoarArchiveIndex
+ * @i: the position of the entry
+ *
+ * Gets the size of the @i-th entry.
+ *
+ * Returns: the size in bytes, or -1 if the archive does not store it
+ **/
+gint64
+autoar_archive_index_get_entry_size (AutoarArchiveIndex *self,
+                                     guint               i)
+{
+  AutoarArchiveIndexEntry *entry = autoar_archive_index_get_entry (self, i);
+  return entry != NULL ? entry->size : -1;
+}
+
+/**
+ * autoar_archive_index_get_entry_mtime:
+ * @self: an #AutoarArchiveIndex
+ * @i: the position of the entry
+ *
+ * Gets the modification time of the @i-th entry.
+ *
+ * Returns: seconds since the Epoch
+ **/
+gint64
+autoar_archive_index_get_entry_mtime (AutoarArchiveIndex *self,
+                                      guint               i)
+{
+  AutoarArchiveIndexEntry *entry = autoar_archive_index_get_entry (self, i);
+  return entry != NULL ? entry->mtime : 0;
+}
+
+/**
+ * autoar_archive_index_get_entry_offset:
+ * @self: an #AutoarArchiveIndex
+ * @i: the position of the entry
+ *
+ * Gets the offset of the header of the @i-th entry in the uncompressed
+ * archive stream. The offset is only meaningful for formats without a
+ * central directory, like tar or cpio.
+ *
+ * Returns: the offset in bytes, or -1 if it is unknown
+ **/
+gint64
+autoar_archive_index_get_entry_offset (AutoarArchiveIndex *self,
+                                       guint               i)
+{
+  AutoarArchiveIndexEntry *entry = autoar_archive_index_get_entry (self, i);
+  return entry != NULL ? entry->offset : -1;
+}
+
+/**
+ * autoar_archive_index_lookup:
+ * @self: an #AutoarArchiveIndex
+ * @path: the path of an entry
+ * @i: (out) (optional): return location for the position of the entry
+ *
+ * Looks up an entry by its path, as returned by
+ * autoar_archive_index_get_entry_path(). If the archive contains more entries
+ * with the same path, the last one is returned, as it is the one which ends
+ * up on the disk when the archive is extracted.
+ *
+ * Returns: %TRUE if the entry was found
+ **/
+gboolean
+autoar_archive_index_lookup (AutoarArchiveIndex *self,
+                             const char         *path,
+                             guint              *i)
+{
+  gpointer value;
+
+  g_return_val_if_fail (AUTOAR_IS_ARCHIVE_INDEX (self), FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  if (self->path_to_entry == NULL) {
+    guint j;
+
+    self->path_to_entry = g_hash_table_new (g_str_hash, g_str_equal);
+    for (j = 0; j < self->entries->len; j++) {
+      AutoarArchiveIndexEntry *entry;
+
+      entry = &g_array_index (self->entries, AutoarArchiveIndexEntry, j);
+      g_hash_table_insert (self->path_to_entry, entry->path, GUINT_TO_POINTER (j));
+    }
+  }
+
+  if (!g_hash_table_lookup_extended (self->path_to_entry, path, NULL, &value))
+    return FALSE;
+
+  if (i != NULL)
+    *i = GPOINTER_TO_UINT (value);
+
+  return TRUE;
+}
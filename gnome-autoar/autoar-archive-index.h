@@ -0,0 +1,59 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-archive-index.h
+ * Listing of the entries stored in an archive
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_ARCHIVE_INDEX_H
+#define AUTOAR_ARCHIVE_INDEX_H
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define AUTOAR_TYPE_ARCHIVE_INDEX autoar_archive_index_get_type ()
+
+G_DECLARE_FINAL_TYPE (AutoarArchiveIndex, autoar_archive_index, AUTOAR, ARCHIVE_INDEX, GObject)
+
+GFile       *autoar_archive_index_get_source_file     (AutoarArchiveIndex *self);
+guint        autoar_archive_index_get_n_entries       (AutoarArchiveIndex *self);
+guint64      autoar_archive_index_get_total_size      (AutoarArchiveIndex *self);
+
+const char  *autoar_archive_index_get_entry_path      (AutoarArchiveIndex *self,
+                                                       guint               i);
+GFileType    autoar_archive_index_get_entry_file_type (AutoarArchiveIndex *self,
+                                                       guint               i);
+gint64       autoar_archive_index_get_entry_size      (AutoarArchiveIndex *self,
+                                                       guint               i);
+gint64       autoar_archive_index_get_entry_mtime     (AutoarArchiveIndex *self,
+                                                       guint               i);
+gint64       autoar_archive_index_get_entry_offset    (AutoarArchiveIndex *self,
+                                                       guint               i);
+
+gboolean     autoar_archive_index_lookup              (AutoarArchiveIndex *self,
+                                                       const char         *path,
+                                                       guint              *i);
+
+G_END_DECLS
+
+#endif /* AUTOAR_ARCHIVE_INDEX_H */
@@ -23,6 +23,11 @@
  *
  */
 
+/* For SEEK_DATA and SEEK_HOLE */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include "config.h"
 #include "autoar-compressor.h"
 
@@ -30,9 +35,17 @@
 #include "autoar-private.h"
 #include "autoar-format-filter.h"
 #include "autoar-enum-types.h"
+#include "autoar-encoder.h"
+#include "autoar-prefetcher.h"
+#include "autoar-ignore.h"
+#include "autoar-scanner.h"
+#include "autoar-volumes.h"
+#include "autoar-zip-writer.h"
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <stdarg.h>
@@ -71,23 +84,80 @@
 G_DEFINE_QUARK (autoar-compressor, autoar_compressor)
 
 #define BUFFER_SIZE (64 * 1024)
+#define HOLE_BUFFER_SIZE (1024 * 1024)
+#define IN_FLIGHT_BUDGET (64 * 1024 * 1024)
 #define ARCHIVE_WRITE_RETRY_TIMES 5
 
 #define INVALID_FORMAT 1
 #define INVALID_FILTER 2
 
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_VARIANT_TYPE "(uua(sutxxx))"
+/* Reads swapped in a snapshot saved on a machine of the other byte order */
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define DELETED_ENTRY_NAME ".autoar-deleted"
+
+/* Identifies the hard links which are deferred by the link resolver */
+typedef struct
+{
+  dev_t dev;
+  la_int64_t ino;
+} AutoarInode;
+
+/* An entry of the existing archive, see AUTOAR_WRITE_MODE_UPDATE */
+typedef struct
+{
+  mode_t filetype;
+  gint64 size;
+  time_t mtime;
+} AutoarArchivedEntry;
+
+/* A file of the snapshot of an incremental archive, see
+ * autoar_compressor_set_snapshot_file() */
+typedef struct
+{
+  guint32 filetype;
+  guint64 ino;
+  gint64 size;
+  gint64 mtime;
+  gint64 ctime;
+} AutoarSnapshotEntry;
+
+/* A file which has been archived with its data, see
+ * autoar_compressor_set_deduplicate() */
+typedef struct
+{
+  GFile *file;
+  char *pathname;
+  gint64 mtime;
+  gint64 ctime;
+  /* Computed once another file of the same size is found */
+  char *digest;
+} AutoarCompressorContent;
+
+/* An entry added by autoar_compressor_add_stream() */
+typedef struct
+{
+  char *pathname;
+  GInputStream *istream;
+  guint64 size;
+  GFileInfo *info;
+  gint64 added_time;
+} AutoarCompressorStream;
+
 struct _AutoarCompressor
 {
   GObject parent_instance;
 
   GList *source_files;
   GFile *output_file;
+  GOutputStream *output_stream;
   AutoarFormat format;
   AutoarFilter filter;
 
   int output_is_dest : 1;
 
-  guint64 size; /* This field is currently unused */
+  guint64 size;
   guint64 completed_size;
 
   guint files;
@@ -97,8 +167,14 @@ struct _AutoarCompressor
   gint64 notify_interval;
 
   GOutputStream *ostream;
+  GIOStream     *iostream;
+  /* The end of the existing archive, which is overwritten by the appended
+   * entries, and its offset */
+  GBytes        *existing_tail;
+  guint64        existing_offset;
   void          *buffer;
   gssize         buffer_size;
+  void          *zeros;
   GError        *error;
 
   GCancellable *cancellable;
@@ -107,7 +183,9 @@ struct _AutoarCompressor
   struct archive_entry              *entry;
   struct archive_entry_linkresolver *resolver;
   GFile                             *dest;
-  GHashTable                        *pathname_to_g_file;
+  GHashTable                        *deferred_files;
+  GPtrArray                         *streams;
+  GHashTable                        *archived;
   char                              *source_basename_noext;
   char                              *extension;
 
@@ -115,6 +193,43 @@ struct _AutoarCompressor
   gboolean create_top_level_directory;
 
   gchar *passphrase;
+  GHashTable *filter_options;
+  AutoarCompressionLevel compression_level;
+  guint threads;
+  guint64 in_flight_budget;
+  AutoarStoreDetection store_detection;
+  AutoarReadOrder read_order;
+  AutoarWriteMode write_mode;
+  GFile *snapshot_file;
+  gint64 newer_than;
+  guint64 volume_size;
+  AutoarIgnore *excludes;
+  AutoarIgnore *includes;
+  gboolean exclude_caches;
+  char *ignore_file_name;
+  gboolean deduplicate;
+  gboolean rsyncable;
+  gboolean reproducible;
+  gint64 source_date_epoch;
+
+  /* The newest mtime of the entries of a reproducible archive, or -1 */
+  gint64 clamp_mtime;
+
+  /* The lists of the files archived with their data, by their size */
+  GHashTable *contents;
+
+  /* The files of the previous snapshot, and of the one being taken */
+  GHashTable *snapshot;
+  GHashTable *snapshot_next;
+
+  guint stored_files;
+  guint64 stored_size;
+  guint64 deflated_size;
+  gint64 deflate_time;
+
+  AutoarEncoder *encoder;
+  AutoarZipWriter *zip_writer;
+  AutoarPrefetcher *prefetcher;
 };
 
 G_DEFINE_TYPE (AutoarCompressor, autoar_compressor, G_TYPE_OBJECT)
@@ -134,15 +249,34 @@ enum
   PROP_0,
   PROP_SOURCE_FILES,
   PROP_OUTPUT_FILE,
+  PROP_OUTPUT_STREAM,
   PROP_FORMAT,
   PROP_FILTER,
   PROP_CREATE_TOP_LEVEL_DIRECTORY,
-  PROP_SIZE, /* This property is currently unused */
+  PROP_SIZE,
   PROP_COMPLETED_SIZE,
   PROP_FILES,
   PROP_COMPLETED_FILES,
   PROP_OUTPUT_IS_DEST,
-  PROP_NOTIFY_INTERVAL
+  PROP_NOTIFY_INTERVAL,
+  PROP_COMPRESSION_LEVEL,
+  PROP_THREADS,
+  PROP_IN_FLIGHT_BUDGET,
+  PROP_STORE_DETECTION,
+  PROP_READ_ORDER,
+  PROP_WRITE_MODE,
+  PROP_SNAPSHOT_FILE,
+  PROP_NEWER_THAN,
+  PROP_VOLUME_SIZE,
+  PROP_EXCLUDE_CACHES,
+  PROP_IGNORE_FILE_NAME,
+  PROP_DEDUPLICATE,
+  PROP_RSYNCABLE,
+  PROP_REPRODUCIBLE,
+  PROP_SOURCE_DATE_EPOCH,
+  PROP_STORED_FILES,
+  PROP_STORED_SIZE,
+  PROP_SAVED_TIME
 };
 
 static guint autoar_compressor_signals[LAST_SIGNAL] = { 0 };
@@ -164,6 +298,9 @@ autoar_compressor_get_property (GObject    *object,
     case PROP_OUTPUT_FILE:
       g_value_set_object (value, self->output_file);
       break;
+    case PROP_OUTPUT_STREAM:
+      g_value_set_object (value, self->output_stream);
+      break;
     case PROP_FORMAT:
       g_value_set_enum (value, self->format);
       break;
@@ -191,6 +328,60 @@ autoar_compressor_get_property (GObject    *object,
     case PROP_NOTIFY_INTERVAL:
       g_value_set_int64 (value, self->notify_interval);
       break;
+    case PROP_COMPRESSION_LEVEL:
+      g_value_set_enum (value, self->compression_level);
+      break;
+    case PROP_THREADS:
+      g_value_set_uint (value, self->threads);
+      break;
+    case PROP_IN_FLIGHT_BUDGET:
+      g_value_set_uint64 (value, self->in_flight_budget);
+      break;
+    case PROP_STORE_DETECTION:
+      g_value_set_flags (value, self->store_detection);
+      break;
+    case PROP_READ_ORDER:
+      g_value_set_enum (value, self->read_order);
+      break;
+    case PROP_WRITE_MODE:
+      g_value_set_enum (value, self->write_mode);
+      break;
+    case PROP_SNAPSHOT_FILE:
+      g_value_set_object (value, self->snapshot_file);
+      break;
+    case PROP_NEWER_THAN:
+      g_value_set_int64 (value, self->newer_than);
+      break;
+    case PROP_VOLUME_SIZE:
+      g_value_set_uint64 (value, self->volume_size);
+      break;
+    case PROP_EXCLUDE_CACHES:
+      g_value_set_boolean (value, self->exclude_caches);
+      break;
+    case PROP_IGNORE_FILE_NAME:
+      g_value_set_string (value, self->ignore_file_name);
+      break;
+    case PROP_DEDUPLICATE:
+      g_value_set_boolean (value, self->deduplicate);
+      break;
+    case PROP_RSYNCABLE:
+      g_value_set_boolean (value, self->rsyncable);
+      break;
+    case PROP_REPRODUCIBLE:
+      g_value_set_boolean (value, self->reproducible);
+      break;
+    case PROP_SOURCE_DATE_EPOCH:
+      g_value_set_int64 (value, self->source_date_epoch);
+      break;
+    case PROP_STORED_FILES:
+      g_value_set_uint (value, self->stored_files);
+      break;
+    case PROP_STORED_SIZE:
+      g_value_set_uint64 (value, self->stored_size);
+      break;
+    case PROP_SAVED_TIME:
+      g_value_set_int64 (value, autoar_compressor_get_saved_time (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -217,7 +408,11 @@ autoar_compressor_set_property (GObject      *object,
       break;
     case PROP_OUTPUT_FILE:
       autoar_common_g_object_unref (self->output_file);
-      self->output_file = g_object_ref (g_value_get_object (value));
+      self->output_file = g_value_dup_object (value);
+      break;
+    case PROP_OUTPUT_STREAM:
+      autoar_common_g_object_unref (self->output_stream);
+      self->output_stream = g_value_dup_object (value);
       break;
     case PROP_FORMAT:
       self->format = g_value_get_enum (value);
@@ -234,6 +429,51 @@ autoar_compressor_set_property (GObject      *object,
     case PROP_NOTIFY_INTERVAL:
       self->notify_interval = g_value_get_int64 (value);
       break;
+    case PROP_COMPRESSION_LEVEL:
+      self->compression_level = g_value_get_enum (value);
+      break;
+    case PROP_THREADS:
+      autoar_compressor_set_threads (self, g_value_get_uint (value));
+      break;
+    case PROP_IN_FLIGHT_BUDGET:
+      autoar_compressor_set_in_flight_budget (self, g_value_get_uint64 (value));
+      break;
+    case PROP_STORE_DETECTION:
+      autoar_compressor_set_store_detection (self, g_value_get_flags (value));
+      break;
+    case PROP_READ_ORDER:
+      autoar_compressor_set_read_order (self, g_value_get_enum (value));
+      break;
+    case PROP_WRITE_MODE:
+      autoar_compressor_set_write_mode (self, g_value_get_enum (value));
+      break;
+    case PROP_SNAPSHOT_FILE:
+      autoar_compressor_set_snapshot_file (self, g_value_get_object (value));
+      break;
+    case PROP_NEWER_THAN:
+      autoar_compressor_set_newer_than (self, g_value_get_int64 (value));
+      break;
+    case PROP_VOLUME_SIZE:
+      autoar_compressor_set_volume_size (self, g_value_get_uint64 (value));
+      break;
+    case PROP_EXCLUDE_CACHES:
+      autoar_compressor_set_exclude_caches (self, g_value_get_boolean (value));
+      break;
+    case PROP_IGNORE_FILE_NAME:
+      autoar_compressor_set_ignore_file_name (self, g_value_get_string (value));
+      break;
+    case PROP_DEDUPLICATE:
+      autoar_compressor_set_deduplicate (self, g_value_get_boolean (value));
+      break;
+    case PROP_RSYNCABLE:
+      autoar_compressor_set_rsyncable (self, g_value_get_boolean (value));
+      break;
+    case PROP_REPRODUCIBLE:
+      autoar_compressor_set_reproducible (self, g_value_get_boolean (value));
+      break;
+    case PROP_SOURCE_DATE_EPOCH:
+      autoar_compressor_set_source_date_epoch (self, g_value_get_int64 (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -272,6 +512,22 @@ autoar_compressor_get_output_file (AutoarCompressor *self)
   return self->output_file;
 }
 
+/**
+ * autoar_compressor_get_output_stream:
+ * @self: an #AutoarCompressor
+ *
+ * Gets the stream which the new archive is written to, if it has been
+ * created by autoar_compressor_new_to_stream().
+ *
+ * Returns: (transfer none) (nullable): a #GOutputStream
+ **/
+GOutputStream*
+autoar_compressor_get_output_stream (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), NULL);
+  return self->output_stream;
+}
+
 /**
  * autoar_compressor_get_format:
  * @self: an #AutoarCompressor
@@ -321,8 +577,10 @@ autoar_compressor_get_create_top_level_directory (AutoarCompressor *self)
  * autoar_compressor_get_size:
  * @self: an #AutoarCompressor
  *
- * Gets the size in bytes will be read when the operation is completed. This
- * value is currently unset, so calling this function is useless.
+ * Gets the size in bytes will be read when the operation is completed. The
+ * directories are scanned while the archive is being created, so the value
+ * grows until the scan is finished, which is usually long before the
+ * operation is completed.
  *
  * Returns: total file size in bytes
  **/
@@ -352,8 +610,9 @@ autoar_compressor_get_completed_size (AutoarCompressor *self)
  * autoar_compressor_get_files:
  * @self: an #AutoarCompressor
  *
- * Gets the number of files will be read when the operation is completed. This
- * value is currently unset, so calling this function is useless.
+ * Gets the number of files will be read when the operation is completed. Like
+ * autoar_compressor_get_size(), the value grows until the directories have
+ * been scanned.
  *
  * Returns: total number of files
  **/
@@ -411,6 +670,288 @@ autoar_compressor_get_notify_interval (AutoarCompressor *self)
   return self->notify_interval;
 }
 
+/**
+ * autoar_compressor_get_compression_level:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_compression_level().
+ *
+ * Returns: the compression level
+ **/
+AutoarCompressionLevel
+autoar_compressor_get_compression_level (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), AUTOAR_COMPRESSION_LEVEL_DEFAULT);
+  return self->compression_level;
+}
+
+/**
+ * autoar_compressor_get_threads:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_threads().
+ *
+ * Returns: the number of compression threads, or 0 for the number of
+ * online CPUs
+ **/
+guint
+autoar_compressor_get_threads (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->threads;
+}
+
+/**
+ * autoar_compressor_get_in_flight_budget:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_in_flight_budget().
+ *
+ * Returns: the in-flight budget in bytes
+ **/
+guint64
+autoar_compressor_get_in_flight_budget (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->in_flight_budget;
+}
+
+/**
+ * autoar_compressor_get_store_detection:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_store_detection().
+ *
+ * Returns: the checks for the files which are stored
+ **/
+AutoarStoreDetection
+autoar_compressor_get_store_detection (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), AUTOAR_STORE_DETECTION_NONE);
+  return self->store_detection;
+}
+
+/**
+ * autoar_compressor_get_read_order:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_read_order().
+ *
+ * Returns: the order in which the files are read ahead
+ **/
+AutoarReadOrder
+autoar_compressor_get_read_order (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), AUTOAR_READ_ORDER_TRAVERSAL);
+  return self->read_order;
+}
+
+/**
+ * autoar_compressor_get_write_mode:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_write_mode().
+ *
+ * Returns: how an existing archive is written to
+ **/
+AutoarWriteMode
+autoar_compressor_get_write_mode (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), AUTOAR_WRITE_MODE_CREATE);
+  return self->write_mode;
+}
+
+/**
+ * autoar_compressor_get_snapshot_file:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_snapshot_file().
+ *
+ * Returns: (transfer none) (nullable): the snapshot of the source files, or
+ * %NULL
+ **/
+GFile*
+autoar_compressor_get_snapshot_file (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), NULL);
+  return self->snapshot_file;
+}
+
+/**
+ * autoar_compressor_get_newer_than:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_newer_than().
+ *
+ * Returns: the time before which files are not archived, in microseconds
+ **/
+gint64
+autoar_compressor_get_newer_than (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->newer_than;
+}
+
+/**
+ * autoar_compressor_get_volume_size:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_volume_size().
+ *
+ * Returns: the size of the volumes in bytes, or 0 if the archive is not split
+ **/
+guint64
+autoar_compressor_get_volume_size (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->volume_size;
+}
+
+/**
+ * autoar_compressor_get_exclude_caches:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_exclude_caches().
+ *
+ * Returns: whether the contents of cache directories are not archived
+ **/
+gboolean
+autoar_compressor_get_exclude_caches (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), FALSE);
+  return self->exclude_caches;
+}
+
+/**
+ * autoar_compressor_get_ignore_file_name:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_ignore_file_name().
+ *
+ * Returns: (transfer none) (nullable): the name of the files listing the
+ * files which are not archived, or %NULL
+ **/
+const char *
+autoar_compressor_get_ignore_file_name (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), NULL);
+  return self->ignore_file_name;
+}
+
+/**
+ * autoar_compressor_get_deduplicate:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_deduplicate().
+ *
+ * Returns: whether the files with the same data are archived as hard links
+ **/
+gboolean
+autoar_compressor_get_deduplicate (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), FALSE);
+  return self->deduplicate;
+}
+
+/**
+ * autoar_compressor_get_rsyncable:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_rsyncable().
+ *
+ * Returns: whether the compressed data is friendly to rsync
+ **/
+gboolean
+autoar_compressor_get_rsyncable (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), FALSE);
+  return self->rsyncable;
+}
+
+/**
+ * autoar_compressor_get_reproducible:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_reproducible().
+ *
+ * Returns: whether the same files always give the same archive
+ **/
+gboolean
+autoar_compressor_get_reproducible (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), FALSE);
+  return self->reproducible;
+}
+
+/**
+ * autoar_compressor_get_source_date_epoch:
+ * @self: an #AutoarCompressor
+ *
+ * See autoar_compressor_set_source_date_epoch().
+ *
+ * Returns: the newest modification time of the entries of a reproducible
+ * archive, in seconds since the Epoch, or -1
+ **/
+gint64
+autoar_compressor_get_source_date_epoch (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), -1);
+  return self->source_date_epoch;
+}
+
+/**
+ * autoar_compressor_get_stored_files:
+ * @self: an #AutoarCompressor
+ *
+ * Gets the number of files which have been stored instead of compressed.
+ * See autoar_compressor_set_store_detection().
+ *
+ * Returns: the number of stored files
+ **/
+guint
+autoar_compressor_get_stored_files (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->stored_files;
+}
+
+/**
+ * autoar_compressor_get_stored_size:
+ * @self: an #AutoarCompressor
+ *
+ * Gets the size of the files which have been stored instead of compressed.
+ *
+ * Returns: the size of the stored files in bytes
+ **/
+guint64
+autoar_compressor_get_stored_size (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+  return self->stored_size;
+}
+
+/**
+ * autoar_compressor_get_saved_time:
+ * @self: an #AutoarCompressor
+ *
+ * Estimates the time which compressing the stored files would have taken,
+ * from the time spent compressing the other files of the archive. It is
+ * more accurate once the archive has been written.
+ *
+ * Returns: the estimated time in microseconds, or 0 if no file has been
+ * compressed yet
+ **/
+gint64
+autoar_compressor_get_saved_time (AutoarCompressor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_COMPRESSOR (self), 0);
+
+  if (self->deflated_size == 0)
+    return 0;
+
+  return self->stored_size * ((double) self->deflate_time / self->deflated_size);
+}
+
 /**
  * autoar_compressor_set_output_is_dest:
  * @self: an #AutoarCompressor
@@ -458,34 +999,571 @@ autoar_compressor_set_notify_interval (AutoarCompressor *self,
 }
 
 /**
- * autoar_compressor_set_passphrase:
+ * autoar_compressor_set_compression_level:
  * @self: an #AutoarCompressor
- * @passphrase: the archive passphrase
+ * @compression_level: an #AutoarCompressionLevel
  *
- * Sets the archive passphrase. It works only with %ARCHIVE_FORMAT_ZIP.
+ * Sets the compression level of the filter and of the format. A
+ * "compression-level" set by autoar_compressor_set_filter_option() takes
+ * precedence for the filter. Filters without levels ignore it.
  **/
 void
-autoar_compressor_set_passphrase (AutoarCompressor *self,
-                                  const gchar      *passphrase)
+autoar_compressor_set_compression_level (AutoarCompressor       *self,
+                                         AutoarCompressionLevel  compression_level)
 {
   g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
-  g_return_if_fail (self->format == AUTOAR_FORMAT_ZIP);
-
-  self->passphrase = g_strdup (passphrase);
+  g_return_if_fail (compression_level <= AUTOAR_COMPRESSION_LEVEL_BEST);
+  self->compression_level = compression_level;
 }
 
-static void
-autoar_compressor_dispose (GObject *object)
+/**
+ * autoar_compressor_set_threads:
+ * @self: an #AutoarCompressor
+ * @threads: the number of threads, or 0 for the number of online CPUs
+ *
+ * Sets the number of threads used for compression. The default of 1 writes
+ * the archive on a single thread, as libarchive does, and 0 uses all the
+ * online CPUs. With more than one thread, %AUTOAR_FILTER_XZ and
+ * %AUTOAR_FILTER_ZSTD use the multithreaded encoders of liblzma and libzstd.
+ * %AUTOAR_FILTER_GZIP compresses chunks of the archive in parallel, which are
+ * concatenated into a single gzip member, unless a filter option other than
+ * "compression-level" is set. Other filters are always single-threaded.
+ *
+ * Unencrypted %AUTOAR_FORMAT_ZIP archives without a filter are compressed
+ * in parallel too: the entries, and chunks of the large ones, are read and
+ * deflated by the threads, and they are written in the same order as they
+ * would be by a single thread. For other archives, the threads read the
+ * files ahead of the one being written. See
+ * autoar_compressor_set_in_flight_budget(). A "threads" option set by
+ * autoar_compressor_set_filter_option() takes precedence. This function
+ * should only be called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_threads (AutoarCompressor *self,
+                               guint             threads)
 {
-  AutoarCompressor *self;
-
-  self = AUTOAR_COMPRESSOR (object);
-
-  g_debug ("AutoarCompressor: dispose");
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->threads = threads;
+}
 
-  if (self->ostream != NULL) {
-    if (!g_output_stream_is_closed (self->ostream)) {
-      g_output_stream_close (self->ostream,
+/**
+ * autoar_compressor_set_in_flight_budget:
+ * @self: an #AutoarCompressor
+ * @in_flight_budget: the budget in bytes
+ *
+ * Sets how much file data may be read, but not written to the archive yet,
+ * when %AUTOAR_FORMAT_ZIP archives are compressed by more threads. The
+ * memory usage is roughly twice as much. A single entry larger than the
+ * budget is still compressed, but alone. The same budget limits the small
+ * files which are read ahead for other archives. The default is 64 MiB. This
+ * function should only be called before calling autoar_compressor_start()
+ * or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_in_flight_budget (AutoarCompressor *self,
+                                        guint64           in_flight_budget)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (in_flight_budget > 0);
+  self->in_flight_budget = in_flight_budget;
+}
+
+/**
+ * autoar_compressor_set_store_detection:
+ * @self: an #AutoarCompressor
+ * @store_detection: the checks for the files to store
+ *
+ * Sets how the files which are compressed already, like photos, videos or
+ * other archives, are detected. Such files are stored in unencrypted
+ * %AUTOAR_FORMAT_ZIP archives without a filter instead of being deflated
+ * again for almost no gain, all the other files are deflated. Other
+ * archives use the same method for all the entries, so they ignore it. See
+ * autoar_compressor_get_saved_time(). All the checks are done by default.
+ * This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_store_detection (AutoarCompressor     *self,
+                                       AutoarStoreDetection  store_detection)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->store_detection = store_detection;
+}
+
+/**
+ * autoar_compressor_set_read_order:
+ * @self: an #AutoarCompressor
+ * @read_order: the order in which the files are read ahead
+ *
+ * Sets the order in which the files of the archives other than
+ * %AUTOAR_FORMAT_ZIP are read ahead of the entries being written, see
+ * autoar_compressor_set_threads(). Sorting the reads by the location of the
+ * files saves most of the seeks of rotational disks, but delays the first
+ * entries of each batch. The entries are written in the same order in any
+ * case. %AUTOAR_READ_ORDER_AUTO is the default. This function should only
+ * be called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_read_order (AutoarCompressor *self,
+                                  AutoarReadOrder   read_order)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->read_order = read_order;
+}
+
+/**
+ * autoar_compressor_set_write_mode:
+ * @self: an #AutoarCompressor
+ * @write_mode: how an existing archive is written to
+ *
+ * Sets whether the entries are appended to the archive set by
+ * #AutoarCompressor:output-file, which requires
+ * #AutoarCompressor:output-is-dest, instead of creating a new one. Only the
+ * new entries are written: tar and cpio archives are cut at their end and
+ * the entries are written there, and the central directory of
+ * %AUTOAR_FORMAT_ZIP archives is written again after them. The existing
+ * archive must be in the same format, with %AUTOAR_FILTER_NONE and without
+ * a passphrase. It is created if it doesn't exist yet. The entries of zip
+ * archives which are written again replace the existing ones, while the last
+ * of the entries with the same name is the one which is extracted from tar
+ * archives. The existing archive is only cut once the new entries have been
+ * written, and its end is written back if the compression fails or is
+ * cancelled, so that it can still be read.
+ * %AUTOAR_WRITE_MODE_CREATE is the default. This function should only be
+ * called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_write_mode (AutoarCompressor *self,
+                                  AutoarWriteMode   write_mode)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->write_mode = write_mode;
+}
+
+/**
+ * autoar_compressor_set_snapshot_file:
+ * @self: an #AutoarCompressor
+ * @snapshot_file: (nullable): the snapshot of the source files, or %NULL
+ *
+ * Makes an incremental archive, like the listed incremental archives of GNU
+ * tar. The type, inode, size, modification and status change times of the
+ * source files are saved to @snapshot_file once the archive has been
+ * written, and the files which haven't changed since the snapshot which was
+ * saved by the previous archive are not archived. The directories are always
+ * archived. The paths of the files which were in the previous snapshot and
+ * have been removed since are listed, separated by NUL characters, by an
+ * entry named `.autoar-deleted` at the end of the archive. Every file is
+ * archived if @snapshot_file doesn't exist yet. The snapshot is not saved
+ * if the compression fails or is cancelled. This function should only be
+ * called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_snapshot_file (AutoarCompressor *self,
+                                     GFile            *snapshot_file)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (snapshot_file == NULL || G_IS_FILE (snapshot_file));
+
+  g_set_object (&self->snapshot_file, snapshot_file);
+}
+
+/**
+ * autoar_compressor_set_newer_than:
+ * @self: an #AutoarCompressor
+ * @newer_than: the time before which files are not archived, as returned by
+ * g_get_real_time(), or 0
+ *
+ * Sets the time since which the data or the status of the files which are
+ * archived changed, like the --newer option of GNU tar. The older files are
+ * not archived, except for directories. Unlike with
+ * autoar_compressor_set_snapshot_file(), the removed files are not recorded.
+ * If both are set, the files which are older or haven't changed since the
+ * snapshot are not archived. The default is 0, which archives every file.
+ * This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_newer_than (AutoarCompressor *self,
+                                  gint64            newer_than)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->newer_than = newer_than;
+}
+
+/**
+ * autoar_compressor_set_volume_size:
+ * @self: an #AutoarCompressor
+ * @volume_size: the size of the volumes in bytes, or 0
+ *
+ * Splits the new archive into volumes of @volume_size bytes, except for the
+ * last one, which are written as soon as they are full. The volumes are
+ * named after the archive followed by their number, like "archive.zip.001",
+ * "archive.zip.002" and so on, and the archive is their concatenation, so
+ * they can be uploaded as separate objects and joined by
+ * autoar_extractor_new() or 7-Zip without copying them. The name of the
+ * archive is still the one which is notified by
+ * #AutoarCompressor::decide-dest. The archives which are written to a
+ * #GOutputStream or appended to can't be split. The default is 0, which
+ * writes a single file. This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_volume_size (AutoarCompressor *self,
+                                   guint64           volume_size)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->volume_size = volume_size;
+}
+
+/**
+ * autoar_compressor_set_exclude_caches:
+ * @self: an #AutoarCompressor
+ * @exclude_caches: whether not to archive the contents of cache directories
+ *
+ * Skips the contents of the directories which are tagged as caches by a
+ * `CACHEDIR.TAG` file, like the --exclude-caches option of GNU tar. The
+ * directory and the tag are still archived. The default is %FALSE. This
+ * function should only be called before calling autoar_compressor_start()
+ * or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_exclude_caches (AutoarCompressor *self,
+                                      gboolean          exclude_caches)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->exclude_caches = exclude_caches;
+}
+
+/**
+ * autoar_compressor_set_ignore_file_name:
+ * @self: an #AutoarCompressor
+ * @ignore_file_name: (nullable): the name of the ignore files, like
+ * ".gitignore", or %NULL
+ *
+ * Reads the files named @ignore_file_name in the source directories and
+ * their subdirectories, and doesn't archive the files which they list in
+ * the syntax of .gitignore files. The patterns of an ignore file apply to
+ * the directory it is in and its subdirectories, and take precedence over
+ * the ones of the directories above. The ignore files themselves are
+ * archived. The default is %NULL, which doesn't read any. This function
+ * should only be called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_ignore_file_name (AutoarCompressor *self,
+                                        const char       *ignore_file_name)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+
+  g_free (self->ignore_file_name);
+  self->ignore_file_name = g_strdup (ignore_file_name);
+}
+
+/**
+ * autoar_compressor_set_deduplicate:
+ * @self: an #AutoarCompressor
+ * @deduplicate: whether to archive the files with the same data as hard
+ * links
+ *
+ * Archives the regular files whose data is the same as the one of a file
+ * which has been archived before as hard links to it, even if they are not
+ * hard links on the disk, so their data is neither compressed nor stored
+ * again. The files are only compared with the ones of the same size, by
+ * their SHA-256 digests. It only applies to the tar formats, where the
+ * data of hard links is the one of the entry they refer to. The default is
+ * %FALSE. This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_deduplicate (AutoarCompressor *self,
+                                   gboolean          deduplicate)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->deduplicate = deduplicate;
+}
+
+/**
+ * autoar_compressor_set_rsyncable:
+ * @self: an #AutoarCompressor
+ * @rsyncable: whether to make the compressed data friendly to rsync
+ *
+ * Compresses %AUTOAR_FILTER_GZIP and %AUTOAR_FILTER_ZSTD archives in chunks
+ * which end where the content says so, like the --rsyncable option of gzip
+ * and zstd, so a change of the archive only changes the compressed data
+ * around it, and rsync or a deduplicating storage only transfer or store
+ * that part again. The ratio is almost the same for gzip, and a bit worse
+ * for zstd, whose chunks are separate frames. The archives are still
+ * readable by any decompressor. The other filters are not affected. The
+ * archive is not written if a filter option which only libarchive knows is
+ * set, see autoar_compressor_set_filter_option(). The default is %FALSE.
+ * This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_rsyncable (AutoarCompressor *self,
+                                 gboolean          rsyncable)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->rsyncable = rsyncable;
+}
+
+/**
+ * autoar_compressor_set_reproducible:
+ * @self: an #AutoarCompressor
+ * @reproducible: whether the same files always give the same archive
+ *
+ * Makes the archive only depend on the names, the contents, the modes and
+ * the modification times of the files, so archiving the same files twice
+ * gives the same bytes. The entries of each directory are sorted by name,
+ * the access, change and creation times are not stored, the owner is root,
+ * and the modification times are clamped, see
+ * autoar_compressor_set_source_date_epoch(). The header of gzip doesn't
+ * have the time of compression, and its data is the same for any number of
+ * threads, see autoar_compressor_set_threads(). Zip archives have their
+ * times in UTC. The default is %FALSE. This function should only be called
+ * before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_reproducible (AutoarCompressor *self,
+                                    gboolean          reproducible)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  self->reproducible = reproducible;
+}
+
+/**
+ * autoar_compressor_set_source_date_epoch:
+ * @self: an #AutoarCompressor
+ * @source_date_epoch: a time in seconds since the Epoch, or -1
+ *
+ * Sets the newest modification time of the entries of a reproducible
+ * archive, see autoar_compressor_set_reproducible(). Newer files, and the
+ * entries added by autoar_compressor_add_stream(), get this time instead.
+ * If it is -1, the SOURCE_DATE_EPOCH environment variable is used when it
+ * is set, like by the tools of https://reproducible-builds.org/, otherwise
+ * the times of the files are kept and the added entries get 0. The default
+ * is -1. This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_set_source_date_epoch (AutoarCompressor *self,
+                                         gint64            source_date_epoch)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (source_date_epoch >= -1);
+  self->source_date_epoch = source_date_epoch;
+}
+
+/**
+ * autoar_compressor_add_exclude_pattern:
+ * @self: an #AutoarCompressor
+ * @pattern: a pattern in the syntax of .gitignore files
+ *
+ * Doesn't archive the files and directories which match @pattern. The
+ * excluded directories are not read at all. A pattern without a slash, like
+ * "*.o", matches the names of the files at any depth, while the other ones,
+ * like "/build" or "doc/api", match the paths relative to the source
+ * directories, and a trailing slash only matches directories. A pattern
+ * starting with an exclamation mark archives the files which an earlier
+ * pattern excluded, and the patterns take precedence over the ignore files,
+ * see autoar_compressor_set_ignore_file_name(). The source files themselves
+ * are always archived. This function should only be called before calling
+ * autoar_compressor_start() or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_add_exclude_pattern (AutoarCompressor *self,
+                                       const char       *pattern)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (pattern != NULL);
+
+  if (self->excludes == NULL)
+    self->excludes = autoar_ignore_new (NULL, "");
+  autoar_ignore_add_pattern (self->excludes, pattern);
+}
+
+/**
+ * autoar_compressor_add_include_pattern:
+ * @self: an #AutoarCompressor
+ * @pattern: a pattern in the syntax of .gitignore files
+ *
+ * Only archives the files which match one of the include patterns, in the
+ * source directories. The directories are still archived and read, unless
+ * they are excluded, see autoar_compressor_add_exclude_pattern(). This
+ * function should only be called before calling autoar_compressor_start()
+ * or autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_add_include_pattern (AutoarCompressor *self,
+                                       const char       *pattern)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (pattern != NULL);
+
+  if (self->includes == NULL)
+    self->includes = autoar_ignore_new (NULL, "");
+  autoar_ignore_add_pattern (self->includes, pattern);
+}
+
+/* Whether @pathname is relative and made of names, so that its entry can't
+ * be extracted outside of the destination */
+static gboolean
+autoar_compressor_is_entry_pathname (const char *pathname)
+{
+  g_auto (GStrv) components = NULL;
+  guint i;
+
+  if (*pathname == '\0' || g_path_is_absolute (pathname))
+    return FALSE;
+
+  components = g_strsplit (pathname, "/", -1);
+  for (i = 0; components[i] != NULL; i++) {
+    if (*components[i] == '\0' ||
+        strcmp (components[i], ".") == 0 ||
+        strcmp (components[i], "..") == 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * autoar_compressor_add_stream:
+ * @self: an #AutoarCompressor
+ * @pathname: the path of the new entry in the archive
+ * @stream: the data of the new entry
+ * @size: the size of the data in @stream
+ * @info: (nullable): the metadata of the new entry, or %NULL
+ *
+ * Adds a regular file, like a generated report or manifest, to the archive
+ * without writing it to the disk first. The entries which are added this way
+ * follow the entries of the source files in the order they were added.
+ * @pathname is relative to the root of the archive, or to the top level
+ * directory if #AutoarCompressor:create-top-level-directory is set, and its
+ * components are separated by "/" and can't be empty, "." or "..". At most
+ * @size bytes are read from @stream, and the entry should have exactly as
+ * many since most formats store the size first. The modification time,
+ * owner and permissions are taken from the "time::", "unix::" and "owner::"
+ * attributes of @info, the entry is otherwise writable by its owner and
+ * readable by everyone and was modified when it was added. This function
+ * should only be called before calling autoar_compressor_start() or
+ * autoar_compressor_start_async().
+ **/
+void
+autoar_compressor_add_stream (AutoarCompressor *self,
+                              const char       *pathname,
+                              GInputStream     *stream,
+                              guint64           size,
+                              GFileInfo        *info)
+{
+  AutoarCompressorStream *entry;
+
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (pathname != NULL &&
+                    autoar_compressor_is_entry_pathname (pathname));
+  g_return_if_fail (G_IS_INPUT_STREAM (stream));
+  g_return_if_fail (info == NULL || G_IS_FILE_INFO (info));
+
+  entry = g_new0 (AutoarCompressorStream, 1);
+  entry->pathname = g_strdup (pathname);
+  entry->istream = g_object_ref (stream);
+  entry->size = size;
+  entry->info = info != NULL ? g_object_ref (info) : NULL;
+  entry->added_time = g_get_real_time ();
+
+  g_ptr_array_add (self->streams, entry);
+}
+
+/**
+ * autoar_compressor_add_bytes:
+ * @self: an #AutoarCompressor
+ * @pathname: the path of the new entry in the archive
+ * @bytes: the data of the new entry
+ * @info: (nullable): the metadata of the new entry, or %NULL
+ *
+ * Adds a regular file whose data is in memory to the archive. See
+ * autoar_compressor_add_stream().
+ **/
+void
+autoar_compressor_add_bytes (AutoarCompressor *self,
+                             const char       *pathname,
+                             GBytes           *bytes,
+                             GFileInfo        *info)
+{
+  g_autoptr (GInputStream) stream = NULL;
+
+  g_return_if_fail (bytes != NULL);
+
+  stream = g_memory_input_stream_new_from_bytes (bytes);
+  autoar_compressor_add_stream (self, pathname, stream,
+                                g_bytes_get_size (bytes), info);
+}
+
+/**
+ * autoar_compressor_set_passphrase:
+ * @self: an #AutoarCompressor
+ * @passphrase: the archive passphrase
+ *
+ * Sets the archive passphrase. It works only with %ARCHIVE_FORMAT_ZIP.
+ **/
+void
+autoar_compressor_set_passphrase (AutoarCompressor *self,
+                                  const gchar      *passphrase)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (self->format == AUTOAR_FORMAT_ZIP);
+
+  self->passphrase = g_strdup (passphrase);
+}
+
+/**
+ * autoar_compressor_set_filter_option:
+ * @self: an #AutoarCompressor
+ * @option: the name of a libarchive option of the filter
+ * @value: (nullable): the value of the option, or %NULL to unset it
+ *
+ * Sets an option of the compression filter, which is passed to
+ * archive_write_set_filter_option(). For example, "compression-level" sets
+ * the level of all filters which have levels and "threads" sets the number
+ * of worker threads of %AUTOAR_FILTER_XZ and %AUTOAR_FILTER_ZSTD. See the
+ * archive_write_set_options(3) manual page for the options of each filter.
+ * The #AutoarCompressor::error signal is emitted if the filter does not know
+ * the option or its value.
+ **/
+void
+autoar_compressor_set_filter_option (AutoarCompressor *self,
+                                     const gchar      *option,
+                                     const gchar      *value)
+{
+  g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
+  g_return_if_fail (option != NULL);
+
+  if (value != NULL)
+    g_hash_table_insert (self->filter_options,
+                         g_strdup (option), g_strdup (value));
+  else
+    g_hash_table_remove (self->filter_options, option);
+}
+
+static void
+autoar_compressor_dispose (GObject *object)
+{
+  AutoarCompressor *self;
+
+  self = AUTOAR_COMPRESSOR (object);
+
+  g_debug ("AutoarCompressor: dispose");
+
+  /* The output stream is closed by its owner */
+  if (self->ostream != NULL) {
+    if (self->output_stream == NULL &&
+        !g_output_stream_is_closed (self->ostream)) {
+      g_output_stream_close (self->ostream,
                              self->cancellable,
                              NULL);
     }
@@ -496,12 +1574,22 @@ autoar_compressor_dispose (GObject *object)
   g_clear_object (&(self->dest));
   g_clear_object (&(self->cancellable));
   g_clear_object (&(self->output_file));
+  g_clear_object (&(self->output_stream));
 
-  if (self->pathname_to_g_file != NULL) {
-    g_hash_table_unref (self->pathname_to_g_file);
-    self->pathname_to_g_file = NULL;
+  if (self->deferred_files != NULL) {
+    g_hash_table_unref (self->deferred_files);
+    self->deferred_files = NULL;
   }
 
+  g_clear_pointer (&self->streams, g_ptr_array_unref);
+  g_clear_pointer (&self->archived, g_hash_table_unref);
+  g_clear_object (&(self->iostream));
+  g_clear_pointer (&self->existing_tail, g_bytes_unref);
+  g_clear_object (&(self->snapshot_file));
+  g_clear_pointer (&self->snapshot, g_hash_table_unref);
+  g_clear_pointer (&self->snapshot_next, g_hash_table_unref);
+  g_clear_pointer (&self->contents, g_hash_table_unref);
+
   if (self->source_files != NULL) {
     g_list_free_full (self->source_files, g_object_unref);
     self->source_files = NULL;
@@ -521,6 +1609,7 @@ autoar_compressor_finalize (GObject *object)
 
   g_free (self->buffer);
   self->buffer = NULL;
+  g_clear_pointer (&self->zeros, g_free);
 
   /* If self->error == NULL, no errors occurs. Therefore, we can safely
    * free libarchive objects because it will not call the callbacks during the
@@ -556,10 +1645,183 @@ autoar_compressor_finalize (GObject *object)
   self->extension = NULL;
 
   g_clear_pointer (&self->passphrase, g_free);
+  g_clear_pointer (&self->filter_options, g_hash_table_unref);
+  g_clear_pointer (&self->encoder, autoar_encoder_free);
+  g_clear_pointer (&self->zip_writer, autoar_zip_writer_free);
+  g_clear_pointer (&self->prefetcher, autoar_prefetcher_free);
+  g_clear_pointer (&self->excludes, autoar_ignore_unref);
+  g_clear_pointer (&self->includes, autoar_ignore_unref);
+  g_clear_pointer (&self->ignore_file_name, g_free);
 
   G_OBJECT_CLASS (autoar_compressor_parent_class)->finalize (object);
 }
 
+/* Reads the entries of the existing archive for AUTOAR_WRITE_MODE_UPDATE,
+ * and finds the end of the entries of tar and cpio archives */
+static gboolean
+autoar_compressor_do_read_existing (AutoarCompressor *self,
+                                    guint64          *end)
+{
+  g_autofree char *path = NULL;
+  struct archive *a;
+  struct archive_entry *entry;
+  int family;
+  int r;
+
+  family = archive_format (self->a) & ARCHIVE_FORMAT_BASE_MASK;
+  if (family == ARCHIVE_FORMAT_ZIP &&
+      self->write_mode != AUTOAR_WRITE_MODE_UPDATE)
+    return TRUE;
+
+  path = g_file_get_path (self->dest);
+  if (path == NULL) {
+    self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                               "Entries can only be appended to local archives");
+    return FALSE;
+  }
+
+  a = archive_read_new ();
+  if (family == ARCHIVE_FORMAT_ZIP)
+    archive_read_support_format_zip_seekable (a);
+  else if (family == ARCHIVE_FORMAT_CPIO)
+    archive_read_support_format_cpio (a);
+  else
+    archive_read_support_format_tar (a);
+
+  if (self->write_mode == AUTOAR_WRITE_MODE_UPDATE)
+    self->archived = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, g_free);
+
+  r = archive_read_open_filename (a, path, BUFFER_SIZE);
+  while (r == ARCHIVE_OK &&
+         (r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
+    AutoarArchivedEntry *archived;
+    char *pathname;
+
+    if (self->archived == NULL)
+      continue;
+
+    if (g_cancellable_set_error_if_cancelled (self->cancellable,
+                                              &(self->error))) {
+      archive_read_free (a);
+      return FALSE;
+    }
+
+    /* The names of directories end with a slash in most formats */
+    pathname = g_strdup (archive_entry_pathname (entry));
+    if (pathname == NULL)
+      continue;
+    if (g_str_has_suffix (pathname, "/") && pathname[1] != '\0')
+      pathname[strlen (pathname) - 1] = '\0';
+
+    archived = g_new (AutoarArchivedEntry, 1);
+    archived->filetype = archive_entry_filetype (entry);
+    archived->size = archive_entry_size (entry);
+    archived->mtime = archive_entry_mtime (entry);
+    g_hash_table_replace (self->archived, pathname, archived);
+  }
+
+  if (r != ARCHIVE_EOF) {
+    self->error = autoar_common_g_error_new_a (a, path);
+    archive_read_free (a);
+    return FALSE;
+  }
+
+  /* The end-of-archive marker of tar, or the trailer of cpio */
+  *end = archive_read_header_position (a);
+  archive_read_free (a);
+
+  g_debug ("autoar_compressor_do_read_existing: end at %" G_GUINT64_FORMAT, *end);
+
+  return TRUE;
+}
+
+/* Opens the archive to append the entries after the existing ones */
+static void
+autoar_compressor_open_existing (AutoarCompressor *self)
+{
+  g_autoptr (GFileInfo) info = NULL;
+  GFileIOStream *iostream;
+  guint64 offset = 0;
+  guint64 size;
+  guint8 *tail;
+  gsize bytes_read;
+
+  info = g_file_query_info (self->dest, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, self->cancellable,
+                            &(self->error));
+  if (info == NULL)
+    return;
+
+  size = g_file_info_get_size (info);
+  if (size > 0) {
+    if (!autoar_compressor_do_read_existing (self, &offset))
+      return;
+
+    if (self->zip_writer != NULL &&
+        !autoar_zip_writer_load (self->zip_writer, self->dest, &offset,
+                                 self->cancellable, &(self->error)))
+      return;
+  }
+
+  iostream = g_file_open_readwrite (self->dest, self->cancellable,
+                                    &(self->error));
+  if (iostream == NULL)
+    return;
+
+  self->iostream = G_IO_STREAM (iostream);
+  if (!g_seekable_seek (G_SEEKABLE (iostream), offset, G_SEEK_SET,
+                        self->cancellable, &(self->error)))
+    return;
+
+  /* The archive is only cut once the new entries are complete, until then
+   * its end is kept to write it back */
+  tail = g_malloc (size - MIN (offset, size));
+  if (!g_input_stream_read_all (g_io_stream_get_input_stream (self->iostream),
+                                tail, size - MIN (offset, size), &bytes_read,
+                                self->cancellable, &(self->error))) {
+    g_free (tail);
+    return;
+  }
+  self->existing_tail = g_bytes_new_take (tail, bytes_read);
+  self->existing_offset = offset;
+
+  if (!g_seekable_seek (G_SEEKABLE (iostream), offset, G_SEEK_SET,
+                        self->cancellable, &(self->error)))
+    return;
+
+  self->ostream = g_object_ref (g_io_stream_get_output_stream (self->iostream));
+}
+
+/* Writes the end of the existing archive back over the entries which were
+ * appended, after they failed or were cancelled */
+static void
+autoar_compressor_restore_existing (AutoarCompressor *self)
+{
+  g_autoptr (GError) error = NULL;
+  gconstpointer data;
+  gsize size;
+
+  if (self->iostream == NULL || self->existing_tail == NULL)
+    return;
+
+  g_debug ("autoar_compressor_restore_existing: at %" G_GUINT64_FORMAT,
+           self->existing_offset);
+
+  data = g_bytes_get_data (self->existing_tail, &size);
+  if (!g_seekable_seek (G_SEEKABLE (self->iostream), self->existing_offset,
+                        G_SEEK_SET, NULL, &error) ||
+      !g_output_stream_write_all (g_io_stream_get_output_stream (self->iostream),
+                                  data, size, NULL, NULL, &error) ||
+      !g_seekable_truncate (G_SEEKABLE (self->iostream),
+                            self->existing_offset + size, NULL, &error) ||
+      !g_io_stream_close (self->iostream, NULL, &error))
+    g_debug ("autoar_compressor_restore_existing: %s", error->message);
+
+  g_clear_object (&(self->ostream));
+  g_clear_object (&(self->iostream));
+}
+
 static int
 libarchive_write_open_cb (struct archive *ar_write,
                           void           *client_data)
@@ -573,10 +1835,21 @@ libarchive_write_open_cb (struct archive *ar_write,
     return ARCHIVE_FATAL;
   }
 
-  self->ostream = (GOutputStream*)g_file_create (self->dest,
-                                                 G_FILE_CREATE_NONE,
-                                                 self->cancellable,
-                                                 &(self->error));
+  if (self->output_stream != NULL)
+    self->ostream = g_object_ref (self->output_stream);
+  else if (self->write_mode != AUTOAR_WRITE_MODE_CREATE &&
+           g_file_query_exists (self->dest, self->cancellable))
+    autoar_compressor_open_existing (self);
+  else if (self->volume_size > 0)
+    self->ostream = autoar_volume_output_stream_new (self->dest,
+                                                     self->volume_size,
+                                                     self->cancellable,
+                                                     &(self->error));
+  else
+    self->ostream = (GOutputStream*)g_file_create (self->dest,
+                                                   G_FILE_CREATE_NONE,
+                                                   self->cancellable,
+                                                   &(self->error));
   if (self->error != NULL) {
     g_debug ("libarchive_write_open_cb: ARCHIVE_FATAL");
     return ARCHIVE_FATAL;
@@ -600,10 +1873,29 @@ libarchive_write_close_cb (struct archive *ar_write,
   }
 
   if (self->ostream != NULL) {
-    g_output_stream_close (self->ostream,
+    if (self->encoder != NULL)
+      autoar_encoder_finish (self->encoder, self->ostream,
+                             self->cancellable, &(self->error));
+    /* Streams passed by the caller are left open for more data */
+    if (self->error == NULL && self->output_stream != NULL)
+      g_output_stream_flush (self->ostream,
+                             self->cancellable, &(self->error));
+    else if (self->error == NULL && self->iostream != NULL) {
+      /* The existing archive may have been longer */
+      if (g_seekable_truncate (G_SEEKABLE (self->iostream),
+                               g_seekable_tell (G_SEEKABLE (self->iostream)),
+                               self->cancellable, &(self->error)))
+        g_io_stream_close (self->iostream,
                            self->cancellable, &(self->error));
+    }
+    else if (self->error == NULL)
+      g_output_stream_close (self->ostream,
+                             self->cancellable, &(self->error));
     g_object_unref (self->ostream);
     self->ostream = NULL;
+    /* Otherwise the existing archive is restored */
+    if (self->error == NULL)
+      g_clear_object (&(self->iostream));
   }
 
   if (self->error != NULL) {
@@ -631,13 +1923,22 @@ libarchive_write_write_cb (struct archive *ar_write,
     return -1;
   }
 
-  write_size = g_output_stream_write (self->ostream,
-                                      buffer,
-                                      length,
-                                      self->cancellable,
-                                      &(self->error));
-  if (self->error != NULL)
-    return -1;
+  if (self->encoder != NULL) {
+    if (!autoar_encoder_write (self->encoder, self->ostream,
+                               buffer, length,
+                               self->cancellable, &(self->error)))
+      return -1;
+
+    write_size = length;
+  } else {
+    write_size = g_output_stream_write (self->ostream,
+                                        buffer,
+                                        length,
+                                        self->cancellable,
+                                        &(self->error));
+    if (self->error != NULL)
+      return -1;
+  }
 
   g_debug ("libarchive_write_write_cb: %" G_GSSIZE_FORMAT, write_size);
   return write_size;
@@ -665,132 +1966,825 @@ autoar_compressor_signal_progress (AutoarCompressor *self)
   }
 }
 
-static inline void
-autoar_compressor_signal_cancelled (AutoarCompressor *self)
+static inline void
+autoar_compressor_signal_cancelled (AutoarCompressor *self)
+{
+  autoar_common_g_signal_emit (self, self->in_thread,
+                               autoar_compressor_signals[CANCELLED], 0);
+
+}
+
+static inline void
+autoar_compressor_signal_completed (AutoarCompressor *self)
+{
+  autoar_common_g_signal_emit (self, self->in_thread,
+                               autoar_compressor_signals[COMPLETED], 0);
+
+}
+
+static inline void
+autoar_compressor_signal_error (AutoarCompressor *self)
+{
+  if (self->error != NULL) {
+    if (self->error->domain == G_IO_ERROR &&
+        self->error->code == G_IO_ERROR_CANCELLED) {
+      g_error_free (self->error);
+      self->error = NULL;
+      autoar_compressor_signal_cancelled (self);
+    } else {
+      autoar_common_g_signal_emit (self, self->in_thread,
+                                   autoar_compressor_signals[AR_ERROR], 0,
+                                   self->error);
+    }
+  }
+}
+
+static void
+autoar_compressor_zip_writer_progress_cb (guint64  size,
+                                          guint    files,
+                                          gpointer user_data)
+{
+  AutoarCompressor *self = user_data;
+
+  self->completed_size += size;
+  self->completed_files += files;
+  autoar_zip_writer_get_stats (self->zip_writer,
+                               &self->stored_files, &self->stored_size,
+                               &self->deflated_size, &self->deflate_time);
+  autoar_compressor_signal_progress (self);
+}
+
+/* Writes the whole @buffer to the data of @entry */
+static gboolean
+autoar_compressor_do_write_buffer (AutoarCompressor     *self,
+                                   struct archive_entry *entry,
+                                   const void           *buffer,
+                                   gsize                 size)
+{
+  ssize_t written_actual;
+  gsize written_acc = 0;
+  int written_try = 0;
+
+  while (written_acc < size) {
+    written_actual = archive_write_data (self->a,
+                                         (const char*)buffer + written_acc,
+                                         size - written_acc);
+    if (written_actual < 0)
+      break;
+
+    written_acc += written_actual;
+    /* archive_write_data may return zero, so we have to limit the
+     * retry times to prevent infinite loop */
+    written_try = written_actual ? 0 : written_try + 1;
+    if (written_try >= ARCHIVE_WRITE_RETRY_TIMES)
+      break;
+  }
+
+  if (written_acc < size) {
+    if (self->error == NULL)
+      self->error =
+        autoar_common_g_error_new_a_entry (self->a, entry);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Copies @length bytes of @istream to the data of @entry, or the rest of
+ * @istream if @length is negative */
+static gboolean
+autoar_compressor_do_copy (AutoarCompressor     *self,
+                           struct archive_entry *entry,
+                           GInputStream         *istream,
+                           gint64                length)
+{
+  while (length != 0) {
+    ssize_t read_actual;
+    gsize size;
+
+    size = length < 0 ? self->buffer_size : MIN (length, self->buffer_size);
+    read_actual = g_input_stream_read (istream,
+                                       self->buffer,
+                                       size,
+                                       self->cancellable,
+                                       &(self->error));
+    if (read_actual < 0)
+      return FALSE;
+
+    /* The file may have been truncated, libarchive pads the entry */
+    if (read_actual == 0)
+      break;
+
+    self->completed_size += read_actual;
+    autoar_compressor_signal_progress (self);
+
+    if (!autoar_compressor_do_write_buffer (self, entry,
+                                            self->buffer, read_actual))
+      return FALSE;
+
+    if (length > 0)
+      length -= read_actual;
+  }
+
+  return TRUE;
+}
+
+/* Writes @length zeros to the data of @entry, which libarchive skips in
+ * the holes of sparse entries */
+static gboolean
+autoar_compressor_do_write_hole (AutoarCompressor     *self,
+                                 struct archive_entry *entry,
+                                 gint64                length)
+{
+  if (self->zeros == NULL && length > 0)
+    self->zeros = g_malloc0 (HOLE_BUFFER_SIZE);
+
+  while (length > 0) {
+    gsize size;
+
+    if (g_cancellable_set_error_if_cancelled (self->cancellable,
+                                              &(self->error)))
+      return FALSE;
+
+    size = MIN (length, HOLE_BUFFER_SIZE);
+    if (!autoar_compressor_do_write_buffer (self, entry, self->zeros, size))
+      return FALSE;
+
+    self->completed_size += size;
+    autoar_compressor_signal_progress (self);
+    length -= size;
+  }
+
+  return TRUE;
+}
+
+/* Reads only the data regions of a sparse entry, see
+ * autoar_compressor_do_add_sparse_map() */
+static gboolean
+autoar_compressor_do_write_sparse (AutoarCompressor     *self,
+                                   struct archive_entry *entry,
+                                   GInputStream         *istream)
+{
+  la_int64_t offset, length;
+  gint64 position = 0;
+
+  while (archive_entry_sparse_next (entry, &offset, &length) == ARCHIVE_OK) {
+    if (!autoar_compressor_do_write_hole (self, entry, offset - position))
+      return FALSE;
+
+    if (length > 0) {
+      if (!g_seekable_seek (G_SEEKABLE (istream), offset, G_SEEK_SET,
+                            self->cancellable, &(self->error)))
+        return FALSE;
+
+      if (!autoar_compressor_do_copy (self, entry, istream, length))
+        return FALSE;
+    }
+
+    position = offset + length;
+  }
+
+  return autoar_compressor_do_write_hole (self, entry,
+                                          archive_entry_size (entry) - position);
+}
+
+static void
+autoar_compressor_do_write_data (AutoarCompressor     *self,
+                                 struct archive_entry *entry,
+                                 GFile                *file,
+                                 GInputStream         *source)
+{
+  int r;
+
+  g_debug ("autoar_compressor_do_write_data: called");
+
+  if (self->error != NULL)
+    return;
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  /* The progress is reported when the entry is written */
+  if (self->zip_writer != NULL) {
+    autoar_zip_writer_add (self->zip_writer, self->ostream, entry, file,
+                           source, self->cancellable, &(self->error));
+    return;
+  }
+
+  while ((r = archive_write_header (self->a, entry)) == ARCHIVE_RETRY);
+  if (r == ARCHIVE_FATAL) {
+    if (self->error == NULL)
+      self->error =
+        autoar_common_g_error_new_a_entry (self->a, entry);
+    return;
+  }
+
+  g_debug ("autoar_compressor_do_write_data: write header OK");
+
+  /* Non-regular files have no content to write */
+  if (archive_entry_size (entry) > 0 && archive_entry_filetype (entry) == AE_IFREG) {
+    GInputStream *istream;
+    gboolean ok;
+
+    g_debug ("autoar_compressor_do_write_data: entry size is %"G_GUINT64_FORMAT,
+             archive_entry_size (entry));
+
+    if (source != NULL)
+      istream = g_object_ref (source);
+    else
+      istream = autoar_prefetcher_read (self->prefetcher,
+                                        file,
+                                        NULL,
+                                        self->cancellable,
+                                        &(self->error));
+    if (istream == NULL)
+      return;
+
+    /* Streams may have more data than they were added with */
+    if (source != NULL)
+      ok = autoar_compressor_do_copy (self, entry, istream,
+                                      archive_entry_size (entry));
+    else if (archive_entry_sparse_reset (entry) > 0)
+      ok = autoar_compressor_do_write_sparse (self, entry, istream);
+    else
+      ok = autoar_compressor_do_copy (self, entry, istream, -1);
+
+    self->completed_files++;
+
+    g_input_stream_close (istream, self->cancellable, NULL);
+    g_object_unref (istream);
+
+    if (!ok)
+      return;
+
+    g_debug ("autoar_compressor_do_write_data: write data OK");
+  } else {
+    g_debug ("autoar_compressor_do_write_data: no data, return now!");
+    self->completed_files++;
+    autoar_compressor_signal_progress (self);
+  }
+}
+
+/* Records the data regions of sparse files in pax archives, which store
+ * neither the holes nor their zeros. Files whose allocated blocks cover
+ * their size have no holes, so most files are not opened here. */
+static void
+autoar_compressor_do_add_sparse_map (AutoarCompressor *self,
+                                     GFile            *file,
+                                     GFileInfo        *info)
+{
+#if defined SEEK_DATA && defined SEEK_HOLE
+  const char *path;
+  gint64 size, blocks;
+  off_t data = 0, hole = 0;
+  guint regions = 0;
+  gboolean ok = TRUE;
+  int fd;
+
+  if (archive_format (self->a) != ARCHIVE_FORMAT_TAR_PAX_INTERCHANGE &&
+      archive_format (self->a) != ARCHIVE_FORMAT_TAR_PAX_RESTRICTED)
+    return;
+
+  /* Hard links are written without data */
+  if (archive_entry_filetype (self->entry) != AE_IFREG ||
+      archive_entry_nlink (self->entry) > 1 ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS))
+    return;
+
+  size = archive_entry_size (self->entry);
+  blocks = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS);
+  if (size <= 0 || blocks * 512 >= size)
+    return;
+
+  path = g_file_peek_path (file);
+  if (path == NULL)
+    return;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0)
+    return;
+
+  for (hole = 0; ok && hole < size; regions++) {
+    data = lseek (fd, hole, SEEK_DATA);
+    if (data < 0 || data >= size) {
+      /* Only a hole is left */
+      ok = data >= 0 || errno == ENXIO;
+      break;
+    }
+
+    hole = lseek (fd, data, SEEK_HOLE);
+    if (hole < 0) {
+      ok = FALSE;
+      break;
+    }
+
+    hole = MIN (hole, size);
+    archive_entry_sparse_add_entry (self->entry, data, hole - data);
+  }
+
+  close (fd);
+
+  /* The file has no holes after all, or the map is not known */
+  if (!ok || (regions == 1 && hole - data == size)) {
+    archive_entry_sparse_clear (self->entry);
+    return;
+  }
+
+  /* A file with no data still needs a map */
+  if (regions == 0)
+    archive_entry_sparse_add_entry (self->entry, size, 0);
+
+  g_debug ("autoar_compressor_do_add_sparse_map: %u data regions", regions);
+#endif
+}
+
+/* Drops what differs between two copies of the same files, see
+ * autoar_compressor_set_reproducible() */
+static void
+autoar_compressor_do_normalize_metadata (AutoarCompressor *self)
+{
+  archive_entry_unset_atime (self->entry);
+  archive_entry_unset_birthtime (self->entry);
+  archive_entry_unset_ctime (self->entry);
+
+  if (self->clamp_mtime >= 0 &&
+      (!archive_entry_mtime_is_set (self->entry) ||
+       archive_entry_mtime (self->entry) >= self->clamp_mtime))
+    archive_entry_set_mtime (self->entry, self->clamp_mtime, 0);
+
+  archive_entry_set_uid (self->entry, 0);
+  archive_entry_set_gid (self->entry, 0);
+  archive_entry_set_uname (self->entry, "root");
+  archive_entry_set_gname (self->entry, "root");
+}
+
+/* Sets the times, the owner and the mode of the current entry */
+static void
+autoar_compressor_do_set_metadata (AutoarCompressor *self,
+                                   GFileInfo        *info)
+{
+  time_t atime, btime, ctime, mtime;
+  long atimeu, btimeu, ctimeu, mtimeu;
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_ACCESS)) {
+    atime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS);
+    atimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_ACCESS_USEC);
+    archive_entry_set_atime (self->entry, atime, atimeu * 1000);
+  }
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_CREATED)) {
+    btime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED);
+    btimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CREATED_USEC);
+    archive_entry_set_birthtime (self->entry, btime, btimeu * 1000);
+  }
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_CHANGED)) {
+    ctime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED);
+    ctimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
+    archive_entry_set_ctime (self->entry, ctime, ctimeu * 1000);
+  }
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)) {
+    mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    mtimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    archive_entry_set_mtime (self->entry, mtime, mtimeu * 1000);
+  }
+
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_UID))
+    archive_entry_set_uid (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID));
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_GID))
+    archive_entry_set_gid (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID));
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_OWNER_USER))
+    archive_entry_set_uname (self->entry, g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER));
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_OWNER_GROUP))
+    archive_entry_set_gname (self->entry, g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP));
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_MODE))
+    archive_entry_set_mode (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE));
+
+  if (self->reproducible)
+    autoar_compressor_do_normalize_metadata (self);
+}
+
+/* The path of @file in the archive, relative to the top level directory */
+static char *
+autoar_compressor_get_source_pathname (GFile *root,
+                                       GFile *file)
+{
+  g_autofree char *root_basename = NULL;
+  g_autofree char *pathname_relative = NULL;
+
+  root_basename = g_file_get_basename (root);
+  pathname_relative = g_file_get_relative_path (root, file);
+
+  return g_strconcat (root_basename,
+                      pathname_relative != NULL ? "/" : "",
+                      pathname_relative != NULL ? pathname_relative : "",
+                      NULL);
+}
+
+static inline gint64
+autoar_compressor_get_time (GFileInfo  *info,
+                            const char *attribute,
+                            const char *attribute_usec)
+{
+  return g_file_info_get_attribute_uint64 (info, attribute) * G_USEC_PER_SEC +
+         g_file_info_get_attribute_uint32 (info, attribute_usec);
+}
+
+/* Counts a file which is not archived as completed */
+static void
+autoar_compressor_do_skip (AutoarCompressor *self,
+                           GFileInfo        *info)
+{
+  self->completed_files++;
+  self->completed_size += g_file_info_get_size (info);
+  autoar_compressor_signal_progress (self);
+}
+
+/* Reads the snapshot saved by the previous incremental archive, if any */
+static void
+autoar_compressor_do_load_snapshot (AutoarCompressor *self)
+{
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GVariantIter) iter = NULL;
+  g_autoptr (GError) error = NULL;
+  AutoarSnapshotEntry entry;
+  const char *pathname;
+  guint32 version;
+  guint32 byte_order;
+
+  self->snapshot_next = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+
+  bytes = g_file_load_bytes (self->snapshot_file, self->cancellable,
+                             NULL, &error);
+  if (bytes == NULL) {
+    /* Every file is archived by the first incremental archive */
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      self->error = g_steal_pointer (&error);
+    return;
+  }
+
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_VARIANT_TYPE),
+                                      bytes, FALSE);
+  g_variant_ref_sink (variant);
+
+  /* Snapshots may be moved between machines of different byte order */
+  g_variant_get_child (variant, 1, "u", &byte_order);
+  if (byte_order == GUINT32_SWAP_LE_BE (SNAPSHOT_BYTE_ORDER)) {
+    GVariant *swapped;
+
+    swapped = g_variant_byteswap (variant);
+    g_variant_unref (variant);
+    variant = swapped;
+  }
+
+  g_variant_get (variant, SNAPSHOT_VARIANT_TYPE,
+                 &version, &byte_order, &iter);
+
+  if (version != SNAPSHOT_VERSION || byte_order != SNAPSHOT_BYTE_ORDER) {
+    g_autofree char *name = NULL;
+
+    name = autoar_common_g_file_get_name (self->snapshot_file);
+    self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                               "“%s” is not a snapshot of an incremental archive",
+                               name);
+    return;
+  }
+
+  self->snapshot = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, g_free);
+  while (g_variant_iter_next (iter, "(&sutxxx)",
+                              &pathname, &entry.filetype, &entry.ino,
+                              &entry.size, &entry.mtime, &entry.ctime)) {
+    AutoarSnapshotEntry *copy;
+
+    copy = g_new (AutoarSnapshotEntry, 1);
+    *copy = entry;
+    g_hash_table_replace (self->snapshot, g_strdup (pathname), copy);
+  }
+
+  g_debug ("autoar_compressor_do_load_snapshot: %u files",
+           g_hash_table_size (self->snapshot));
+}
+
+/* Records @file in the snapshot being taken, and returns whether it has
+ * changed since the previous snapshot or #AutoarCompressor:newer-than. The
+ * directories are always archived, so that they are restored with their
+ * metadata even if none of their files changed. */
+static gboolean
+autoar_compressor_do_snapshot (AutoarCompressor *self,
+                               GFile            *root,
+                               GFile            *file,
+                               GFileInfo        *info)
+{
+  AutoarSnapshotEntry entry;
+  AutoarSnapshotEntry *previous = NULL;
+
+  if (self->snapshot_next == NULL && self->newer_than == 0)
+    return TRUE;
+
+  entry.filetype = g_file_info_get_file_type (info);
+  entry.ino = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+  entry.size = g_file_info_get_size (info);
+  entry.mtime = autoar_compressor_get_time (info,
+                                            G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  entry.ctime = autoar_compressor_get_time (info,
+                                            G_FILE_ATTRIBUTE_TIME_CHANGED,
+                                            G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
+
+  if (self->snapshot_next != NULL) {
+    AutoarSnapshotEntry *copy;
+    char *pathname;
+
+    pathname = autoar_compressor_get_source_pathname (root, file);
+    if (self->snapshot != NULL)
+      previous = g_hash_table_lookup (self->snapshot, pathname);
+    copy = g_new (AutoarSnapshotEntry, 1);
+    *copy = entry;
+    g_hash_table_replace (self->snapshot_next, pathname, copy);
+  }
+
+  if (entry.filetype == G_FILE_TYPE_DIRECTORY)
+    return TRUE;
+
+  /* The status change time covers renames and changes of the metadata */
+  if (previous != NULL &&
+      previous->filetype == entry.filetype &&
+      previous->ino == entry.ino &&
+      previous->size == entry.size &&
+      previous->mtime == entry.mtime &&
+      previous->ctime == entry.ctime)
+    return FALSE;
+
+  if (MAX (entry.mtime, entry.ctime) < self->newer_than)
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Saves the snapshot of the source files for the next incremental archive */
+static void
+autoar_compressor_do_save_snapshot (AutoarCompressor *self)
+{
+  g_autoptr (GVariant) variant = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (self->snapshot_next == NULL)
+    return;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sutxxx)"));
+  g_hash_table_iter_init (&iter, self->snapshot_next);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    AutoarSnapshotEntry *entry = value;
+
+    g_variant_builder_add (&builder, "(sutxxx)",
+                           key, entry->filetype, entry->ino,
+                           entry->size, entry->mtime, entry->ctime);
+  }
+
+  variant = g_variant_new (SNAPSHOT_VARIANT_TYPE,
+                           (guint32) SNAPSHOT_VERSION,
+                           (guint32) SNAPSHOT_BYTE_ORDER, &builder);
+  g_variant_ref_sink (variant);
+
+  g_file_replace_contents (self->snapshot_file,
+                           g_variant_get_data (variant),
+                           g_variant_get_size (variant),
+                           NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+                           self->cancellable, &(self->error));
+
+  g_debug ("autoar_compressor_do_save_snapshot: %u files",
+           g_hash_table_size (self->snapshot_next));
+}
+
+static void
+autoar_compressor_content_free (AutoarCompressorContent *content)
 {
-  autoar_common_g_signal_emit (self, self->in_thread,
-                               autoar_compressor_signals[CANCELLED], 0);
-
+  g_object_unref (content->file);
+  g_free (content->pathname);
+  g_free (content->digest);
+  g_free (content);
 }
 
-static inline void
-autoar_compressor_signal_completed (AutoarCompressor *self)
+/* Hashes the rest of @istream */
+static char *
+autoar_compressor_get_digest (AutoarCompressor  *self,
+                              GInputStream      *istream,
+                              GError           **error)
 {
-  autoar_common_g_signal_emit (self, self->in_thread,
-                               autoar_compressor_signals[COMPLETED], 0);
+  g_autoptr (GChecksum) checksum = NULL;
+  gssize read_actual;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  while ((read_actual = g_input_stream_read (istream,
+                                             self->buffer,
+                                             self->buffer_size,
+                                             self->cancellable,
+                                             error)) > 0)
+    g_checksum_update (checksum, self->buffer, read_actual);
 
+  if (read_actual < 0)
+    return NULL;
+
+  return g_strdup (g_checksum_get_string (checksum));
 }
 
-static inline void
-autoar_compressor_signal_error (AutoarCompressor *self)
+/* Hashes a file which has been archived before, unless it has changed
+ * since, since its digest wouldn't match its entry anymore */
+static gboolean
+autoar_compressor_get_content_digest (AutoarCompressor        *self,
+                                      AutoarCompressorContent *content)
 {
-  if (self->error != NULL) {
-    if (self->error->domain == G_IO_ERROR &&
-        self->error->code == G_IO_ERROR_CANCELLED) {
-      g_error_free (self->error);
-      self->error = NULL;
-      autoar_compressor_signal_cancelled (self);
-    } else {
-      autoar_common_g_signal_emit (self, self->in_thread,
-                                   autoar_compressor_signals[AR_ERROR], 0,
-                                   self->error);
-    }
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GInputStream) istream = NULL;
+  g_autoptr (GError) error = NULL;
+
+  if (content->digest != NULL)
+    return TRUE;
+
+  info = g_file_query_info (content->file, "time::*",
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            self->cancellable, &error);
+  if (info == NULL)
+    return FALSE;
+
+  if (autoar_compressor_get_time (info, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC) != content->mtime ||
+      autoar_compressor_get_time (info, G_FILE_ATTRIBUTE_TIME_CHANGED,
+                                  G_FILE_ATTRIBUTE_TIME_CHANGED_USEC) != content->ctime)
+    return FALSE;
+
+  istream = G_INPUT_STREAM (g_file_read (content->file,
+                                         self->cancellable,
+                                         &error));
+  if (istream != NULL)
+    content->digest = autoar_compressor_get_digest (self, istream, &error);
+
+  if (content->digest == NULL) {
+    g_debug ("autoar_compressor_get_content_digest: %s: %s",
+             content->pathname, error->message);
+    return FALSE;
   }
+
+  return TRUE;
 }
 
-static void
-autoar_compressor_do_write_data (AutoarCompressor     *self,
-                                 struct archive_entry *entry,
-                                 GFile                *file)
+/* Reads @istream again from the start */
+static gboolean
+autoar_compressor_do_rewind (AutoarCompressor  *self,
+                             GFile             *file,
+                             GInputStream     **istream)
 {
-  int r;
+  if (G_IS_SEEKABLE (*istream) && g_seekable_can_seek (G_SEEKABLE (*istream)))
+    return g_seekable_seek (G_SEEKABLE (*istream), 0, G_SEEK_SET,
+                            self->cancellable, &(self->error));
 
-  g_debug ("autoar_compressor_do_write_data: called");
+  g_input_stream_close (*istream, NULL, NULL);
+  g_object_unref (*istream);
+  *istream = G_INPUT_STREAM (g_file_read (file,
+                                          self->cancellable,
+                                          &(self->error)));
 
-  if (self->error != NULL)
-    return;
+  return *istream != NULL;
+}
 
-  if (g_cancellable_is_cancelled (self->cancellable))
-    return;
+/* Writes self->entry as a hard link to an archived file with the same
+ * data, or with its data while remembering it. The files are hashed only
+ * once another file of the same size is found, and the small ones have
+ * been hashed by the prefetcher already. Returns %FALSE if the entry has to
+ * be written as usual. */
+static gboolean
+autoar_compressor_do_deduplicate (AutoarCompressor *self,
+                                  GFile            *file,
+                                  GFileInfo        *info)
+{
+  g_autoptr (GInputStream) istream = NULL;
+  g_autofree char *digest = NULL;
+  AutoarCompressorContent *content;
+  GPtrArray *contents;
+  gint64 size;
+  guint i;
+
+  /* Real hard links are left to the link resolver */
+  size = archive_entry_size (self->entry);
+  if (self->contents == NULL ||
+      archive_entry_filetype (self->entry) != AE_IFREG || size <= 0 ||
+      archive_entry_nlink (self->entry) > 1 ||
+      archive_entry_sparse_count (self->entry) > 0)
+    return FALSE;
+
+  content = g_new0 (AutoarCompressorContent, 1);
+  content->file = g_object_ref (file);
+  content->pathname = g_strdup (archive_entry_pathname (self->entry));
+  content->mtime = autoar_compressor_get_time (info,
+                                               G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                               G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  content->ctime = autoar_compressor_get_time (info,
+                                               G_FILE_ATTRIBUTE_TIME_CHANGED,
+                                               G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
+
+  contents = g_hash_table_lookup (self->contents, &size);
+  if (contents == NULL) {
+    gint64 *key;
+
+    contents =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) autoar_compressor_content_free);
+    g_ptr_array_add (contents, content);
+    key = g_new (gint64, 1);
+    *key = size;
+    g_hash_table_insert (self->contents, key, contents);
+    return FALSE;
+  }
 
-  while ((r = archive_write_header (self->a, entry)) == ARCHIVE_RETRY);
-  if (r == ARCHIVE_FATAL) {
-    if (self->error == NULL)
-      self->error =
-        autoar_common_g_error_new_a_entry (self->a, entry);
-    return;
+  istream = autoar_prefetcher_read (self->prefetcher, file, &digest,
+                                    self->cancellable, &(self->error));
+  if (istream == NULL) {
+    autoar_compressor_content_free (content);
+    return TRUE;
   }
 
-  g_debug ("autoar_compressor_do_write_data: write header OK");
+  if (digest == NULL) {
+    digest = autoar_compressor_get_digest (self, istream, &(self->error));
+    if (digest == NULL || !autoar_compressor_do_rewind (self, file, &istream)) {
+      autoar_compressor_content_free (content);
+      return TRUE;
+    }
+  }
 
-  /* Non-regular files have no content to write */
-  if (archive_entry_size (entry) > 0 && archive_entry_filetype (entry) == AE_IFREG) {
-    GInputStream *istream;
-    ssize_t read_actual, written_actual, written_acc;
-    int written_try;
+  for (i = 0; i < contents->len; i++) {
+    AutoarCompressorContent *other;
 
-    g_debug ("autoar_compressor_do_write_data: entry size is %"G_GUINT64_FORMAT,
-             archive_entry_size (entry));
+    other = g_ptr_array_index (contents, i);
+    if (!autoar_compressor_get_content_digest (self, other) ||
+        strcmp (other->digest, digest) != 0)
+      continue;
 
-    written_actual = 0;
-    written_try = 0;
+    g_debug ("autoar_compressor_do_deduplicate: %s is a copy of %s",
+             content->pathname, other->pathname);
 
-    istream = (GInputStream*)g_file_read (file,
-                                          self->cancellable,
-                                          &(self->error));
-    if (istream == NULL)
-      return;
+    archive_entry_set_hardlink (self->entry, other->pathname);
+    archive_entry_set_size (self->entry, 0);
+    autoar_compressor_do_write_data (self, self->entry, file, NULL);
+    self->completed_size += size;
+    autoar_compressor_signal_progress (self);
 
-    do {
-      read_actual = g_input_stream_read (istream,
-                                         self->buffer,
-                                         self->buffer_size,
-                                         self->cancellable,
-                                         &(self->error));
-      self->completed_size += read_actual > 0 ? read_actual : 0;
-      autoar_compressor_signal_progress (self);
-      if (read_actual > 0) {
-        written_acc = 0;
-        written_try = 0;
-        do {
-          written_actual =
-            archive_write_data (self->a,
-                                (const char*)(self->buffer) + written_acc,
-                                read_actual);
-          written_acc += written_actual > 0 ? written_actual : 0;
-          written_try = written_actual ? 0 : written_try + 1;
-          /* archive_write_data may return zero, so we have to limit the
-           * retry times to prevent infinite loop */
-        } while (written_acc < read_actual && written_actual >= 0 && written_try < ARCHIVE_WRITE_RETRY_TIMES);
-      }
-    } while (read_actual > 0 && written_actual >= 0);
+    g_input_stream_close (istream, NULL, NULL);
+    autoar_compressor_content_free (content);
+    return TRUE;
+  }
 
-    self->completed_files++;
+  content->digest = g_steal_pointer (&digest);
+  g_ptr_array_add (contents, content);
+  autoar_compressor_do_write_data (self, self->entry, file, istream);
 
-    g_input_stream_close (istream, self->cancellable, NULL);
-    g_object_unref (istream);
+  return TRUE;
+}
 
-    if (read_actual < 0)
-      return;
+/* Whether the current entry is in the existing archive already */
+static gboolean
+autoar_compressor_is_archived (AutoarCompressor *self)
+{
+  AutoarArchivedEntry *archived;
 
-    if (written_actual < 0 || written_try >= ARCHIVE_WRITE_RETRY_TIMES) {
-      if (self->error == NULL)
-        self->error =
-          autoar_common_g_error_new_a_entry (self->a, entry);
-      return;
-    }
-    g_debug ("autoar_compressor_do_write_data: write data OK");
-  } else {
-    g_debug ("autoar_compressor_do_write_data: no data, return now!");
-    self->completed_files++;
-    autoar_compressor_signal_progress (self);
-  }
+  archived = g_hash_table_lookup (self->archived,
+                                  archive_entry_pathname (self->entry));
+  if (archived == NULL)
+    return FALSE;
+
+  return archived->filetype == archive_entry_filetype (self->entry) &&
+         archived->mtime == archive_entry_mtime (self->entry) &&
+         (archived->filetype != AE_IFREG ||
+          archived->size == archive_entry_size (self->entry));
+}
+
+/* Remembers the file of the first entry of @inode which is deferred by the
+ * link resolver, whose data is read if the entry is still deferred at the
+ * end */
+static void
+autoar_compressor_defer_file (AutoarCompressor  *self,
+                              const AutoarInode *inode,
+                              GFile             *file)
+{
+  AutoarInode *key;
+
+  if (g_hash_table_contains (self->deferred_files, inode))
+    return;
+
+  key = g_new (AutoarInode, 1);
+  *key = *inode;
+  g_hash_table_insert (self->deferred_files, key, g_object_ref (file));
 }
 
 static void
 autoar_compressor_do_add_to_archive (AutoarCompressor *self,
                                      GFile            *root,
-                                     GFile            *file)
+                                     GFile            *file,
+                                     GFileInfo        *file_info)
 {
   GFileInfo *info;
   GFileType  filetype;
@@ -802,8 +2796,12 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
     return;
 
   archive_entry_clear (self->entry);
-  info = g_file_query_info (file, "*", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                            self->cancellable, &(self->error));
+  if (file_info != NULL)
+    info = g_object_ref (file_info);
+  else
+    info = g_file_query_info (file, AUTOAR_SCANNER_ATTRIBUTES,
+                              G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                              self->cancellable, &(self->error));
   if (info == NULL)
     return;
 
@@ -833,7 +2831,6 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
   }
 
   {
-    char *root_basename;
     char *pathname_relative;
     char *pathname;
 
@@ -848,18 +2845,14 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
         break;
 
       default:
-        root_basename = g_file_get_basename (root);
-        pathname_relative = g_file_get_relative_path (root, file);
+        pathname_relative = autoar_compressor_get_source_pathname (root, file);
         pathname =
           g_strconcat (self->create_top_level_directory ?
                        self->source_basename_noext : "",
                        self->create_top_level_directory ? "/" : "",
-                       root_basename,
-                       pathname_relative != NULL ? "/" : "",
-                       pathname_relative != NULL ? pathname_relative : "",
+                       pathname_relative,
                        NULL);
         archive_entry_set_pathname (self->entry, pathname);
-        g_free (root_basename);
         g_free (pathname_relative);
         g_free (pathname);
     }
@@ -868,45 +2861,7 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
   g_debug ("autoar_compressor_do_add_to_archive: %s",
            archive_entry_pathname (self->entry));
 
-  {
-    time_t atime, btime, ctime, mtime;
-    long atimeu, btimeu, ctimeu, mtimeu;
-
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_ACCESS)) {
-      atime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS);
-      atimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_ACCESS_USEC);
-      archive_entry_set_atime (self->entry, atime, atimeu * 1000);
-    }
-
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_CREATED)) {
-      btime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED);
-      btimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CREATED_USEC);
-      archive_entry_set_birthtime (self->entry, btime, btimeu * 1000);
-    }
-
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_CHANGED)) {
-      ctime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED);
-      ctimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_USEC);
-      archive_entry_set_ctime (self->entry, ctime, ctimeu * 1000);
-    }
-
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)) {
-      mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-      mtimeu = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
-      archive_entry_set_mtime (self->entry, mtime, mtimeu * 1000);
-    }
-
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_UID))
-      archive_entry_set_uid (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID));
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_GID))
-      archive_entry_set_gid (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID));
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_OWNER_USER))
-      archive_entry_set_uname (self->entry, g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER));
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_OWNER_GROUP))
-      archive_entry_set_gname (self->entry, g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP));
-    if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_MODE))
-      archive_entry_set_mode (self->entry, g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE));
-  }
+  autoar_compressor_do_set_metadata (self, info);
 
   if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_SIZE))
     archive_entry_set_size (self->entry, g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE));
@@ -979,12 +2934,32 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
       break;
   }
 
-  g_hash_table_insert (self->pathname_to_g_file,
-                       g_strdup (archive_entry_pathname (self->entry)),
-                       g_object_ref (file));
+  if (self->archived != NULL && autoar_compressor_is_archived (self)) {
+    g_debug ("autoar_compressor_do_add_to_archive: %s is archived already",
+             archive_entry_pathname (self->entry));
+
+    if (archive_entry_filetype (self->entry) == AE_IFREG &&
+        archive_entry_size (self->entry) > 0)
+      autoar_prefetcher_skip (self->prefetcher, file);
+    autoar_compressor_do_skip (self, info);
+
+    g_object_unref (info);
+    return;
+  }
+
+  autoar_compressor_do_add_sparse_map (self, file, info);
+
+  if (autoar_compressor_do_deduplicate (self, file, info)) {
+    g_object_unref (info);
+    return;
+  }
 
   {
     struct archive_entry *sparse = NULL;
+    AutoarInode inode;
+
+    inode.dev = archive_entry_dev (self->entry);
+    inode.ino = archive_entry_ino64 (self->entry);
 
      /* Hardlinks are handled in different ways by the archive formats. The
      * archive_entry_linkify function is a unified interface, which handling
@@ -998,13 +2973,11 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
         g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_NLINK))
       archive_entry_linkify (self->resolver, &self->entry, &sparse);
 
+    /* The resolver only returns entries of the same inode as the current
+     * one, so their data is read from the current file. Only the entries
+     * which are still deferred at the end need to know their files. */
     if (self->entry != NULL) {
-      GFile *file_to_read;
-      const char *pathname_in_entry;
-      pathname_in_entry = archive_entry_pathname (self->entry);
-      file_to_read = g_hash_table_lookup (self->pathname_to_g_file,
-                                          pathname_in_entry);
-      autoar_compressor_do_write_data (self, self->entry, file_to_read);
+      autoar_compressor_do_write_data (self, self->entry, file, NULL);
       /* Entries for non-regular files might have their size attribute
        * different to their actual size on the disk
        */
@@ -1013,24 +2986,17 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
         self->completed_size += g_file_info_get_size (info);
         autoar_compressor_signal_progress (self);
       }
-
-      g_hash_table_remove (self->pathname_to_g_file, pathname_in_entry);
-      /* We have registered g_object_unref function to free the GFile object,
-       * so we do not have to unref it here. */
     } else {
       /* The archive_entry_linkify function stole our entry, so new one has to
        * be allocated here to not crash on the next file. */
       self->entry = archive_entry_new ();
+      autoar_compressor_defer_file (self, &inode, file);
     }
 
+    /* All the links of the inode have been found */
     if (sparse != NULL) {
-      GFile *file_to_read;
-      const char *pathname_in_entry;
-      pathname_in_entry = archive_entry_pathname (self->entry);
-      file_to_read = g_hash_table_lookup (self->pathname_to_g_file,
-                                          pathname_in_entry);
-      autoar_compressor_do_write_data (self, sparse, file_to_read);
-      g_hash_table_remove (self->pathname_to_g_file, pathname_in_entry);
+      autoar_compressor_do_write_data (self, sparse, file, NULL);
+      g_hash_table_remove (self->deferred_files, &inode);
     }
   }
 
@@ -1038,47 +3004,136 @@ autoar_compressor_do_add_to_archive (AutoarCompressor *self,
 };
 
 static void
-autoar_compressor_do_recursive_read (AutoarCompressor *self,
-                                     GFile            *root,
-                                     GFile            *file)
+autoar_compressor_do_add_stream (AutoarCompressor       *self,
+                                 AutoarCompressorStream *stream)
 {
-  GFileEnumerator *enumerator;
-  GFileInfo *info;
-  GFile *thisfile;
-  const char *thisname;
+  g_autofree char *pathname = NULL;
 
-  enumerator = g_file_enumerate_children (file,
-                                          "standard::*",
-                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                          self->cancellable,
-                                          &(self->error));
-  if (enumerator == NULL)
+  if (self->error != NULL)
     return;
 
-  while ((info = g_file_enumerator_next_file (enumerator,
-                                              self->cancellable,
-                                              &(self->error))) != NULL) {
-    thisname = g_file_info_get_name (info);
-    thisfile = g_file_get_child (file, thisname);
-    autoar_compressor_do_add_to_archive (self, root, thisfile);
-    if (self->error != NULL) {
-      g_object_unref (thisfile);
-      g_object_unref (info);
-      break;
-    }
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
 
-    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
-      autoar_compressor_do_recursive_read (self, root, thisfile);
-    g_object_unref (thisfile);
-    g_object_unref (info);
+  archive_entry_clear (self->entry);
 
-    if (self->error != NULL)
-      break;
-    if (g_cancellable_is_cancelled (self->cancellable))
+  switch (archive_format (self->a)) {
+    /* ar format does not support directories */
+    case ARCHIVE_FORMAT_AR:
+    case ARCHIVE_FORMAT_AR_GNU:
+    case ARCHIVE_FORMAT_AR_BSD:
+      pathname = g_path_get_basename (stream->pathname);
       break;
+
+    default:
+      pathname = g_strconcat (self->create_top_level_directory ?
+                              self->source_basename_noext : "",
+                              self->create_top_level_directory ? "/" : "",
+                              stream->pathname,
+                              NULL);
+  }
+  archive_entry_set_pathname (self->entry, pathname);
+
+  g_debug ("autoar_compressor_do_add_stream: %s", pathname);
+
+  /* Generated files are as recent as the time they were added, unless the
+   * archive has to be reproducible */
+  if (self->reproducible)
+    archive_entry_set_mtime (self->entry, MAX (self->clamp_mtime, 0), 0);
+  else
+    archive_entry_set_mtime (self->entry, stream->added_time / G_USEC_PER_SEC,
+                             (stream->added_time % G_USEC_PER_SEC) * 1000);
+  archive_entry_set_mode (self->entry, AE_IFREG | 0644);
+  if (stream->info != NULL)
+    autoar_compressor_do_set_metadata (self, stream->info);
+  else if (self->reproducible)
+    autoar_compressor_do_normalize_metadata (self);
+
+  archive_entry_set_filetype (self->entry, AE_IFREG);
+  archive_entry_set_size (self->entry, stream->size);
+
+  autoar_compressor_do_write_data (self, self->entry, NULL, stream->istream);
+}
+
+static int
+autoar_compressor_compare_pathnames (gconstpointer a,
+                                     gconstpointer b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Lists the files of the previous snapshot which have been removed */
+static void
+autoar_compressor_do_add_deleted (AutoarCompressor *self)
+{
+  g_autoptr (GPtrArray) deleted = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  AutoarCompressorStream stream = { 0 };
+  GHashTableIter iter;
+  GString *list;
+  gpointer pathname;
+  guint i;
+
+  if (self->snapshot == NULL)
+    return;
+
+  deleted = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, self->snapshot);
+  while (g_hash_table_iter_next (&iter, &pathname, NULL)) {
+    if (!g_hash_table_contains (self->snapshot_next, pathname))
+      g_ptr_array_add (deleted, pathname);
   }
 
-  g_object_unref (enumerator);
+  if (deleted->len == 0)
+    return;
+
+  g_debug ("autoar_compressor_do_add_deleted: %u files", deleted->len);
+
+  g_ptr_array_sort (deleted, autoar_compressor_compare_pathnames);
+
+  list = g_string_new (NULL);
+  for (i = 0; i < deleted->len; i++)
+    g_string_append_len (list, deleted->pdata[i],
+                         strlen (deleted->pdata[i]) + 1);
+  bytes = g_string_free_to_bytes (list);
+
+  stream.pathname = (char *) DELETED_ENTRY_NAME;
+  stream.istream = g_memory_input_stream_new_from_bytes (bytes);
+  stream.size = g_bytes_get_size (bytes);
+  stream.added_time = g_get_real_time ();
+
+  self->size += stream.size;
+  self->files++;
+
+  autoar_compressor_do_add_stream (self, &stream);
+  g_object_unref (stream.istream);
+}
+
+static void
+autoar_compressor_stream_free (AutoarCompressorStream *stream)
+{
+  g_free (stream->pathname);
+  g_object_unref (stream->istream);
+  g_clear_object (&stream->info);
+  g_free (stream);
+}
+
+static guint
+autoar_compressor_inode_hash (gconstpointer key)
+{
+  const AutoarInode *inode = key;
+
+  return g_int64_hash (&inode->ino) ^ (guint) inode->dev;
+}
+
+static gboolean
+autoar_compressor_inode_equal (gconstpointer a,
+                               gconstpointer b)
+{
+  const AutoarInode *inode_a = a;
+  const AutoarInode *inode_b = b;
+
+  return inode_a->dev == inode_b->dev && inode_a->ino == inode_b->ino;
 }
 
 static void
@@ -1112,6 +3167,15 @@ autoar_compressor_class_init (AutoarCompressorClass *klass)
                                                         G_PARAM_CONSTRUCT_ONLY |
                                                         G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_OUTPUT_STREAM,
+                                   g_param_spec_object ("output-stream",
+                                                        "Output stream",
+                                                        "Stream (GOutputStream) which the archive is written to instead of a file",
+                                                        G_TYPE_OUTPUT_STREAM,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT_ONLY |
+                                                        G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (object_class, PROP_FORMAT,
                                    g_param_spec_enum ("format",
                                                       "Compression format",
@@ -1132,66 +3196,230 @@ autoar_compressor_class_init (AutoarCompressorClass *klass)
                                                       G_PARAM_CONSTRUCT_ONLY |
                                                       G_PARAM_STATIC_STRINGS));
 
-  g_object_class_install_property (object_class, PROP_CREATE_TOP_LEVEL_DIRECTORY,
-                                   g_param_spec_boolean ("create-top-level-directory",
-                                                         "Create top level directory",
-                                                         "Whether to create a top level directory",
+  g_object_class_install_property (object_class, PROP_CREATE_TOP_LEVEL_DIRECTORY,
+                                   g_param_spec_boolean ("create-top-level-directory",
+                                                         "Create top level directory",
+                                                         "Whether to create a top level directory",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+
+
+  g_object_class_install_property (object_class, PROP_SIZE,
+                                   g_param_spec_uint64 ("size",
+                                                        "Size",
+                                                        "Total bytes will be read from disk",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_COMPLETED_SIZE,
+                                   g_param_spec_uint64 ("completed-size",
+                                                        "Read file size",
+                                                        "Bytes has read from disk",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_FILES,
+                                   g_param_spec_uint ("files",
+                                                      "Files",
+                                                      "Number of files will be compressed",
+                                                      0, G_MAXUINT32, 0,
+                                                      G_PARAM_READABLE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_COMPLETED_FILES,
+                                   g_param_spec_uint ("completed-files",
+                                                      "Read files",
+                                                      "Number of files has been read",
+                                                      0, G_MAXUINT32, 0,
+                                                      G_PARAM_READABLE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_OUTPUT_IS_DEST,
+                                   g_param_spec_boolean ("output-is-dest",
+                                                         "Output is destination",
+                                                         "Whether output file is used as destination",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_NOTIFY_INTERVAL,
+                                   g_param_spec_int64 ("notify-interval",
+                                                       "Notify interval",
+                                                       "Minimal time interval between progress signal",
+                                                       0, G_MAXINT64, 100000,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT |
+                                                       G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_COMPRESSION_LEVEL,
+                                   g_param_spec_enum ("compression-level",
+                                                      "Compression level",
+                                                      "The compression level of the filter and the format",
+                                                      AUTOAR_TYPE_COMPRESSION_LEVEL,
+                                                      AUTOAR_COMPRESSION_LEVEL_DEFAULT,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_THREADS,
+                                   g_param_spec_uint ("threads",
+                                                      "Threads",
+                                                      "Number of compression threads, 0 for the number of online CPUs",
+                                                      0, G_MAXUINT, 1,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_IN_FLIGHT_BUDGET,
+                                   g_param_spec_uint64 ("in-flight-budget",
+                                                        "In-flight budget",
+                                                        "Maximal size of the data being compressed by the threads",
+                                                        1, G_MAXUINT64, IN_FLIGHT_BUDGET,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_STORE_DETECTION,
+                                   g_param_spec_flags ("store-detection",
+                                                       "Store detection",
+                                                       "How the files which are compressed already are detected",
+                                                       AUTOAR_TYPE_STORE_DETECTION,
+                                                       AUTOAR_STORE_DETECTION_EXTENSION |
+                                                       AUTOAR_STORE_DETECTION_MAGIC |
+                                                       AUTOAR_STORE_DETECTION_ENTROPY,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT |
+                                                       G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_READ_ORDER,
+                                   g_param_spec_enum ("read-order",
+                                                      "Read order",
+                                                      "The order in which the files are read ahead",
+                                                      AUTOAR_TYPE_READ_ORDER,
+                                                      AUTOAR_READ_ORDER_AUTO,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_WRITE_MODE,
+                                   g_param_spec_enum ("write-mode",
+                                                      "Write mode",
+                                                      "Whether the entries are appended to an existing archive",
+                                                      AUTOAR_TYPE_WRITE_MODE,
+                                                      AUTOAR_WRITE_MODE_CREATE,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_SNAPSHOT_FILE,
+                                   g_param_spec_object ("snapshot-file",
+                                                        "Snapshot file",
+                                                        "The snapshot of the source files of an incremental archive",
+                                                        G_TYPE_FILE,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_NEWER_THAN,
+                                   g_param_spec_int64 ("newer-than",
+                                                       "Newer than",
+                                                       "The time before which files are not archived",
+                                                       0, G_MAXINT64, 0,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_CONSTRUCT |
+                                                       G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_VOLUME_SIZE,
+                                   g_param_spec_uint64 ("volume-size",
+                                                        "Volume size",
+                                                        "The size of the volumes the archive is split into",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_EXCLUDE_CACHES,
+                                   g_param_spec_boolean ("exclude-caches",
+                                                         "Exclude caches",
+                                                         "Whether the contents of cache directories are not archived",
                                                          FALSE,
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_CONSTRUCT |
                                                          G_PARAM_STATIC_STRINGS));
 
-
-  g_object_class_install_property (object_class, PROP_SIZE, /* This propery is unused! */
-                                   g_param_spec_uint64 ("size",
-                                                        "Size",
-                                                        "Total bytes will be read from disk",
-                                                        0, G_MAXUINT64, 0,
-                                                        G_PARAM_READABLE |
-                                                        G_PARAM_STATIC_STRINGS));
-
-  g_object_class_install_property (object_class, PROP_COMPLETED_SIZE,
-                                   g_param_spec_uint64 ("completed-size",
-                                                        "Read file size",
-                                                        "Bytes has read from disk",
-                                                        0, G_MAXUINT64, 0,
-                                                        G_PARAM_READABLE |
+  g_object_class_install_property (object_class, PROP_IGNORE_FILE_NAME,
+                                   g_param_spec_string ("ignore-file-name",
+                                                        "Ignore file name",
+                                                        "The name of the files listing the files which are not archived",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT |
                                                         G_PARAM_STATIC_STRINGS));
 
-  g_object_class_install_property (object_class, PROP_FILES,
-                                   g_param_spec_uint ("files",
-                                                      "Files",
-                                                      "Number of files will be compressed",
-                                                      0, G_MAXUINT32, 0,
-                                                      G_PARAM_READABLE |
-                                                      G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_DEDUPLICATE,
+                                   g_param_spec_boolean ("deduplicate",
+                                                         "Deduplicate",
+                                                         "Whether the files with the same data are archived as hard links",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
 
-  g_object_class_install_property (object_class, PROP_COMPLETED_FILES,
-                                   g_param_spec_uint ("completed-files",
-                                                      "Read files",
-                                                      "Number of files has been read",
-                                                      0, G_MAXUINT32, 0,
-                                                      G_PARAM_READABLE |
-                                                      G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (object_class, PROP_RSYNCABLE,
+                                   g_param_spec_boolean ("rsyncable",
+                                                         "Rsyncable",
+                                                         "Whether the compressed data is friendly to rsync",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
 
-  g_object_class_install_property (object_class, PROP_OUTPUT_IS_DEST,
-                                   g_param_spec_boolean ("output-is-dest",
-                                                         "Output is destination",
-                                                         "Whether output file is used as destination",
+  g_object_class_install_property (object_class, PROP_REPRODUCIBLE,
+                                   g_param_spec_boolean ("reproducible",
+                                                         "Reproducible",
+                                                         "Whether the same files always give the same archive",
                                                          FALSE,
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_CONSTRUCT |
                                                          G_PARAM_STATIC_STRINGS));
 
-  g_object_class_install_property (object_class, PROP_NOTIFY_INTERVAL,
-                                   g_param_spec_int64 ("notify-interval",
-                                                       "Notify interval",
-                                                       "Minimal time interval between progress signal",
-                                                       0, G_MAXINT64, 100000,
+  g_object_class_install_property (object_class, PROP_SOURCE_DATE_EPOCH,
+                                   g_param_spec_int64 ("source-date-epoch",
+                                                       "Source date epoch",
+                                                       "The newest modification time of the entries of a reproducible archive",
+                                                       -1, G_MAXINT64, -1,
                                                        G_PARAM_READWRITE |
                                                        G_PARAM_CONSTRUCT |
                                                        G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_STORED_FILES,
+                                   g_param_spec_uint ("stored-files",
+                                                      "Stored files",
+                                                      "Number of files stored instead of compressed",
+                                                      0, G_MAXUINT32, 0,
+                                                      G_PARAM_READABLE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_STORED_SIZE,
+                                   g_param_spec_uint64 ("stored-size",
+                                                        "Stored size",
+                                                        "Bytes stored instead of compressed",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_SAVED_TIME,
+                                   g_param_spec_int64 ("saved-time",
+                                                       "Saved time",
+                                                       "Estimated microseconds saved by storing files",
+                                                       0, G_MAXINT64, 0,
+                                                       G_PARAM_READABLE |
+                                                       G_PARAM_STATIC_STRINGS));
+
 /**
  * AutoarCompressor::decide-dest:
  * @self: the #AutoarCompressor
@@ -1305,15 +3533,20 @@ autoar_compressor_init (AutoarCompressor *self)
   self->a = archive_write_new ();
   self->entry = archive_entry_new ();
   self->resolver = archive_entry_linkresolver_new ();
-  self->pathname_to_g_file = g_hash_table_new_full (g_str_hash,
-                                                    g_str_equal,
-                                                    g_free,
-                                                    g_object_unref);
+  self->deferred_files = g_hash_table_new_full (autoar_compressor_inode_hash,
+                                                autoar_compressor_inode_equal,
+                                                g_free,
+                                                g_object_unref);
+  self->streams =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) autoar_compressor_stream_free);
   self->source_basename_noext = NULL;
   self->extension = NULL;
 
   self->in_thread = FALSE;
   self->passphrase = NULL;
+  self->filter_options = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, g_free);
+  self->clamp_mtime = -1;
 }
 
 /**
@@ -1349,6 +3582,193 @@ autoar_compressor_new (GList        *source_files,
   return self;
 }
 
+/**
+ * autoar_compressor_new_to_stream:
+ * @source_files: (element-type GFile): a #GList of source #GFiles to be archived
+ * @output_stream: the stream which the new archive is written to
+ * @format: the compression format
+ * @filter: the compression filter
+ *
+ * Create a new #AutoarCompressor object which writes the archive to
+ * @output_stream, like a socket or the body of a response, without a
+ * temporary file. The archive is written sequentially, so the stream doesn't
+ * need to be seekable, and the entries of %AUTOAR_FORMAT_ZIP archives which
+ * are compressed on the fly have their sizes in data descriptors. The writes
+ * block until @output_stream accepts the data, so a slow reader slows down
+ * the compression instead of making the data pile up in memory; use
+ * autoar_compressor_start_async() to keep the main loop running meanwhile.
+ * #AutoarCompressor::decide-dest is not emitted. @output_stream is flushed
+ * once the archive is complete, but it isn't closed.
+ *
+ * Returns: (transfer full): a new #AutoarCompressor object
+ **/
+AutoarCompressor*
+autoar_compressor_new_to_stream (GList         *source_files,
+                                 GOutputStream *output_stream,
+                                 AutoarFormat   format,
+                                 AutoarFilter   filter,
+                                 gboolean       create_top_level_directory)
+{
+  AutoarCompressor *self;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (output_stream), NULL);
+
+  self =
+    g_object_new (AUTOAR_TYPE_COMPRESSOR,
+                  "source-files", source_files,
+                  "output-stream", output_stream,
+                  "format", format,
+                  "filter", filter,
+                  "create-top-level-directory", create_top_level_directory,
+                  NULL);
+
+  return self;
+}
+
+/* Native levels for AUTOAR_COMPRESSION_LEVEL_FASTEST to _BEST of the filters
+ * and formats which have levels */
+typedef struct
+{
+  gboolean valid;
+  int levels[4];
+} AutoarNativeLevels;
+
+static const AutoarNativeLevels filter_levels[AUTOAR_FILTER_LAST] = {
+  [AUTOAR_FILTER_GZIP]  = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FILTER_BZIP2] = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FILTER_XZ]    = { TRUE, { 0, 2, 7, 9 } },
+  [AUTOAR_FILTER_LZMA]  = { TRUE, { 0, 2, 7, 9 } },
+  [AUTOAR_FILTER_LZIP]  = { TRUE, { 0, 2, 7, 9 } },
+  [AUTOAR_FILTER_LZOP]  = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FILTER_LRZIP] = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FILTER_ZSTD]  = { TRUE, { 1, 3, 12, 22 } },
+  [AUTOAR_FILTER_LZ4]   = { TRUE, { 1, 3, 7, 9 } },
+};
+
+static const AutoarNativeLevels format_levels[AUTOAR_FORMAT_LAST] = {
+  [AUTOAR_FORMAT_ZIP]   = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FORMAT_7ZIP]  = { TRUE, { 1, 3, 7, 9 } },
+  [AUTOAR_FORMAT_XAR]   = { TRUE, { 1, 3, 7, 9 } },
+};
+
+static int
+autoar_compressor_get_native_level (const AutoarNativeLevels *levels,
+                                    int                       i,
+                                    AutoarCompressionLevel    compression_level)
+{
+  if (!levels[i].valid)
+    return -1;
+
+  return levels[i].levels[compression_level - AUTOAR_COMPRESSION_LEVEL_FASTEST];
+}
+
+static AutoarReadOrder
+autoar_compressor_get_effective_read_order (AutoarCompressor *self)
+{
+  g_autoptr (GFileInfo) info = NULL;
+  guint32 device;
+
+  if (self->read_order != AUTOAR_READ_ORDER_AUTO)
+    return self->read_order;
+
+  if (self->source_files == NULL)
+    return AUTOAR_READ_ORDER_TRAVERSAL;
+
+  /* The first source file is expected to be on the same disk as the others */
+  info = g_file_query_info (self->source_files->data,
+                            G_FILE_ATTRIBUTE_UNIX_DEVICE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            self->cancellable, NULL);
+  if (info == NULL ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_DEVICE))
+    return AUTOAR_READ_ORDER_TRAVERSAL;
+
+  device = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+  if (!autoar_prefetcher_is_rotational (device))
+    return AUTOAR_READ_ORDER_TRAVERSAL;
+
+  g_debug ("autoar_compressor_get_effective_read_order: rotational device %u", device);
+
+#ifdef HAVE_LINUX_FIEMAP_H
+  return AUTOAR_READ_ORDER_EXTENT;
+#else
+  return AUTOAR_READ_ORDER_INODE;
+#endif
+}
+
+static guint
+autoar_compressor_get_n_threads (AutoarCompressor *self)
+{
+  return self->threads > 0 ? self->threads : g_get_num_processors ();
+}
+
+/* libarchive compresses gzip on a single thread, and can't make gzip or
+ * zstd rsyncable, so AutoarEncoder is used instead, unless there are
+ * options which only libarchive knows. */
+static AutoarEncoder *
+autoar_compressor_new_encoder (AutoarCompressor *self,
+                               guint             threads)
+{
+  AutoarEncoder *encoder;
+  const char *value;
+  guint64 n;
+  gint64 zstd_level;
+  guint known = 0;
+  int level = -1;
+
+  if (self->filter != AUTOAR_FILTER_GZIP &&
+      (self->filter != AUTOAR_FILTER_ZSTD || !self->rsyncable))
+    return NULL;
+
+  value = g_hash_table_lookup (self->filter_options, "threads");
+  if (value != NULL) {
+    if (!g_ascii_string_to_unsigned (value, 10, 0, G_MAXUINT, &n, NULL))
+      return NULL;
+
+    threads = n > 0 ? n : g_get_num_processors ();
+    known++;
+  }
+
+  /* The output of libarchive and of the encoder differ, so reproducible
+   * gzip archives are always compressed in chunks, whose output doesn't
+   * depend on the number of threads */
+  if (threads <= 1 && !self->rsyncable &&
+      !(self->reproducible && self->filter == AUTOAR_FILTER_GZIP))
+    return NULL;
+
+  value = g_hash_table_lookup (self->filter_options, "compression-level");
+  if (value != NULL)
+    known++;
+
+  if (g_hash_table_size (self->filter_options) > known)
+    return NULL;
+
+  if (value != NULL && self->filter == AUTOAR_FILTER_ZSTD) {
+    if (!g_ascii_string_to_signed (value, 10, 1, 22, &zstd_level, NULL))
+      return NULL;
+
+    level = zstd_level;
+  } else if (value != NULL) {
+    if (value[0] < '0' || value[0] > '9' || value[1] != '\0')
+      return NULL;
+
+    level = value[0] - '0';
+  } else if (self->compression_level != AUTOAR_COMPRESSION_LEVEL_DEFAULT) {
+    level = autoar_compressor_get_native_level (filter_levels, self->filter,
+                                                self->compression_level);
+  }
+
+  if (self->filter == AUTOAR_FILTER_ZSTD)
+    encoder = autoar_encoder_new_zstd (level, threads);
+  else
+    encoder = autoar_encoder_new (level, threads);
+
+  if (encoder != NULL)
+    autoar_encoder_set_rsyncable (encoder, self->rsyncable);
+
+  return encoder;
+}
+
 static void
 autoar_compressor_step_initialize_object (AutoarCompressor *self)
 {
@@ -1356,6 +3776,10 @@ autoar_compressor_step_initialize_object (AutoarCompressor *self)
 
   AutoarFormatFunc format_func;
   AutoarFilterFunc filter_func;
+  AutoarReadOrder read_order;
+  GHashTableIter iter;
+  gpointer option, value;
+  guint threads;
 
   int r;
 
@@ -1387,13 +3811,207 @@ autoar_compressor_step_initialize_object (AutoarCompressor *self)
     return;
   }
 
-  filter_func = autoar_filter_get_libarchive_write (self->filter);
-  r = (*filter_func)(self->a);
+  if (self->write_mode != AUTOAR_WRITE_MODE_CREATE) {
+    int family = archive_format (self->a) & ARCHIVE_FORMAT_BASE_MASK;
+
+    if (family != ARCHIVE_FORMAT_TAR && family != ARCHIVE_FORMAT_CPIO &&
+        family != ARCHIVE_FORMAT_ZIP) {
+      self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 "Entries can't be appended to %s archives",
+                                 autoar_format_get_description (self->format));
+      return;
+    }
+
+    if (!self->output_is_dest || self->output_stream != NULL ||
+        self->filter != AUTOAR_FILTER_NONE || self->passphrase != NULL) {
+      self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 "Entries can only be appended to the destination archive without filter and passphrase");
+      return;
+    }
+  }
+
+  if (self->volume_size > 0 &&
+      (self->output_stream != NULL ||
+       self->write_mode != AUTOAR_WRITE_MODE_CREATE)) {
+    self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                               "Only new archive files can be split into volumes");
+    return;
+  }
+
+  if (self->reproducible) {
+    const char *epoch;
+
+    epoch = g_getenv ("SOURCE_DATE_EPOCH");
+    if (self->source_date_epoch >= 0) {
+      self->clamp_mtime = self->source_date_epoch;
+    } else if (epoch != NULL &&
+               !g_ascii_string_to_signed (epoch, 10, 0, G_MAXINT64,
+                                          &self->clamp_mtime, NULL)) {
+      self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                 "SOURCE_DATE_EPOCH is not a number of seconds: %s",
+                                 epoch);
+      return;
+    }
+
+    g_debug ("autoar_compressor_step_initialize_object: mtimes clamped to %" G_GINT64_FORMAT,
+             self->clamp_mtime);
+  }
+
+  threads = autoar_compressor_get_n_threads (self);
+  self->encoder = autoar_compressor_new_encoder (self, threads);
+  if (self->rsyncable && self->encoder == NULL &&
+      (self->filter == AUTOAR_FILTER_GZIP || self->filter == AUTOAR_FILTER_ZSTD)) {
+    self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                               "%s can't be made rsyncable with these filter options",
+                               autoar_filter_get_description (self->filter));
+    return;
+  }
+
+  /* libarchive writes zip archives unless there is more than one thread, or
+   * it can't do what is asked: change the method between the entries, append
+   * to an existing archive or write the MS-DOS times in UTC */
+  if (self->format == AUTOAR_FORMAT_ZIP && self->filter == AUTOAR_FILTER_NONE &&
+      self->passphrase == NULL &&
+      (threads > 1 || self->store_detection != AUTOAR_STORE_DETECTION_NONE ||
+       self->write_mode != AUTOAR_WRITE_MODE_CREATE || self->reproducible)) {
+    int level = -1;
+
+    if (self->compression_level != AUTOAR_COMPRESSION_LEVEL_DEFAULT)
+      level = autoar_compressor_get_native_level (format_levels, self->format,
+                                                  self->compression_level);
+
+    self->zip_writer =
+      autoar_zip_writer_new (level, threads, self->in_flight_budget,
+                             autoar_compressor_zip_writer_progress_cb, self);
+    if (self->zip_writer != NULL) {
+      autoar_zip_writer_set_store_detection (self->zip_writer,
+                                             self->store_detection);
+      autoar_zip_writer_set_utc (self->zip_writer, self->reproducible);
+    }
+
+    /* libarchive can't append to zip archives */
+    if (self->zip_writer == NULL &&
+        self->write_mode != AUTOAR_WRITE_MODE_CREATE) {
+      self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                 "gnome-autoar is built without zlib, so entries can't be appended to zip archives");
+      return;
+    }
+  }
+
+  /* AutoarZipWriter reads the files on its own threads, in order. A single
+   * thread is enough to read the files of a rotational disk in order. */
+  read_order = autoar_compressor_get_effective_read_order (self);
+  self->prefetcher =
+    autoar_prefetcher_new (self->zip_writer == NULL &&
+                           (threads > 1 ||
+                            read_order != AUTOAR_READ_ORDER_TRAVERSAL) ?
+                           threads : 0,
+                           self->in_flight_budget, read_order,
+                           self->cancellable);
+
+  /* Hard links only refer to earlier entries in tar archives */
+  if (self->deduplicate &&
+      (archive_format (self->a) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_TAR) {
+    self->contents = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                            g_free,
+                                            (GDestroyNotify) g_ptr_array_unref);
+    autoar_prefetcher_set_digests (self->prefetcher, TRUE);
+  }
+
+  if (self->encoder != NULL) {
+    r = archive_write_add_filter_none (self->a);
+  } else {
+    filter_func = autoar_filter_get_libarchive_write (self->filter);
+    r = (*filter_func)(self->a);
+  }
   if (r != ARCHIVE_OK) {
     self->error = autoar_common_g_error_new_a (self->a, NULL);
     return;
   }
 
+  if (self->compression_level != AUTOAR_COMPRESSION_LEVEL_DEFAULT) {
+    int level;
+
+    level = autoar_compressor_get_native_level (filter_levels, self->filter,
+                                                self->compression_level);
+    if (level >= 0 && self->encoder == NULL &&
+        !g_hash_table_contains (self->filter_options, "compression-level")) {
+      g_autofree char *value = g_strdup_printf ("%d", level);
+
+      r = archive_write_set_filter_option (self->a, NULL,
+                                           "compression-level", value);
+      if (r != ARCHIVE_OK) {
+        self->error = autoar_common_g_error_new_a (self->a, NULL);
+        return;
+      }
+    }
+
+    /* Older libarchive doesn't have levels for all of these formats, so
+     * ARCHIVE_WARN is ignored. */
+    level = autoar_compressor_get_native_level (format_levels, self->format,
+                                                self->compression_level);
+    if (level >= 0) {
+      g_autofree char *value = g_strdup_printf ("%d", level);
+
+      r = archive_write_set_format_option (self->a, NULL,
+                                           "compression-level", value);
+      if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+        self->error = autoar_common_g_error_new_a (self->a, NULL);
+        return;
+      }
+    }
+  }
+
+  /* liblzma or libarchive may be too old for threads, so ARCHIVE_WARN is
+   * ignored. The multithreaded encoders write the same data with any number
+   * of threads, but not the same as the single threaded ones. */
+  if ((self->filter == AUTOAR_FILTER_XZ || self->filter == AUTOAR_FILTER_ZSTD) &&
+      (threads > 1 || self->reproducible) &&
+      !g_hash_table_contains (self->filter_options, "threads")) {
+    g_autofree char *value = NULL;
+
+    value = g_strdup_printf ("%u", self->reproducible ? MAX (threads, 2) : threads);
+
+    r = archive_write_set_filter_option (self->a, NULL, "threads", value);
+    if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+      self->error = autoar_common_g_error_new_a (self->a, NULL);
+      return;
+    }
+  }
+
+  /* The gzip header of libarchive has the time of compression by default,
+   * while the one of AutoarEncoder never has it */
+  if (self->reproducible && self->filter == AUTOAR_FILTER_GZIP &&
+      self->encoder == NULL &&
+      !g_hash_table_contains (self->filter_options, "timestamp")) {
+    r = archive_write_set_filter_option (self->a, NULL, "timestamp", NULL);
+    if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+      self->error = autoar_common_g_error_new_a (self->a, NULL);
+      return;
+    }
+  }
+
+  /* The options of the encoder have been consumed already */
+  g_hash_table_iter_init (&iter, self->filter_options);
+  while (self->encoder == NULL &&
+         g_hash_table_iter_next (&iter, &option, &value)) {
+    g_debug ("autoar_compressor_step_initialize_object: %s=%s",
+             (char *) option, (char *) value);
+
+    /* ARCHIVE_WARN means that no filter knows the option */
+    r = archive_write_set_filter_option (self->a, NULL, option, value);
+    if (r == ARCHIVE_WARN) {
+      self->error = g_error_new (AUTOAR_COMPRESSOR_ERROR, INVALID_FILTER,
+                                 "Filter %s does not support option %s",
+                                 autoar_filter_get_description (self->filter),
+                                 (char *) option);
+      return;
+    } else if (r != ARCHIVE_OK) {
+      self->error = autoar_common_g_error_new_a (self->a, NULL);
+      return;
+    }
+  }
+
   if (self->passphrase != NULL && self->format == AUTOAR_FORMAT_ZIP) {
     r = archive_write_set_options (self->a, "zip:encryption=aes256");
     if (r != ARCHIVE_OK) {
@@ -1409,6 +4027,50 @@ autoar_compressor_step_initialize_object (AutoarCompressor *self)
   }
 }
 
+static void
+autoar_compressor_set_source_basename (AutoarCompressor *self)
+{
+  GFile *file_source; /* Do not unref */
+  GFileInfo *source_info;
+  char *source_basename;
+
+  file_source = self->source_files->data;
+  source_info = g_file_query_info (file_source,
+                                   G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                   G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                   self->cancellable,
+                                   &(self->error));
+  if (source_info == NULL)
+    return;
+
+  source_basename = g_file_get_basename (file_source);
+  if (g_file_info_get_file_type (source_info) == G_FILE_TYPE_REGULAR)
+    self->source_basename_noext =
+      autoar_common_get_basename_remove_extension (source_basename);
+  else
+    self->source_basename_noext = g_strdup (source_basename);
+
+  g_object_unref (source_info);
+  g_free (source_basename);
+}
+
+/* Whether the destination, or its first volume, exists already */
+static gboolean
+autoar_compressor_dest_exists (AutoarCompressor *self)
+{
+  g_autoptr (GFile) volume = NULL;
+
+  if (g_file_query_exists (self->dest, self->cancellable))
+    return TRUE;
+
+  if (self->volume_size == 0)
+    return FALSE;
+
+  volume = autoar_volume_get_file (self->dest, 1);
+
+  return g_file_query_exists (volume, self->cancellable);
+}
+
 static void
 autoar_compressor_step_decide_dest (AutoarCompressor *self)
 {
@@ -1417,30 +4079,9 @@ autoar_compressor_step_decide_dest (AutoarCompressor *self)
 
   g_debug ("autoar_compressor_step_decide_dest: called");
 
-  {
-    GFile *file_source; /* Do not unref */
-    GFileInfo *source_info;
-    char *source_basename;
-
-    file_source = self->source_files->data;
-    source_info = g_file_query_info (file_source,
-                                     G_FILE_ATTRIBUTE_STANDARD_TYPE,
-                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                     self->cancellable,
-                                     &(self->error));
-    if (source_info == NULL)
-      return;
-
-    source_basename = g_file_get_basename (file_source);
-    if (g_file_info_get_file_type (source_info) == G_FILE_TYPE_REGULAR)
-      self->source_basename_noext =
-        autoar_common_get_basename_remove_extension (source_basename);
-    else
-      self->source_basename_noext = g_strdup (source_basename);
-
-    g_object_unref (source_info);
-    g_free (source_basename);
-  }
+  autoar_compressor_set_source_basename (self);
+  if (self->error != NULL)
+    return;
 
   {
     char *dest_basename;
@@ -1451,7 +4092,7 @@ autoar_compressor_step_decide_dest (AutoarCompressor *self)
     self->dest = g_file_get_child (self->output_file, dest_basename);
 
     for (i = 1;
-         g_file_query_exists (self->dest, self->cancellable);
+         autoar_compressor_dest_exists (self);
          i++) {
       g_free (dest_basename);
       g_object_unref (self->dest);
@@ -1495,19 +4136,45 @@ autoar_compressor_step_decide_dest_already (AutoarCompressor *self)
   autoar_compressor_signal_decide_dest (self);
 }
 
+static void
+autoar_compressor_step_decide_dest_stream (AutoarCompressor *self)
+{
+  /* Alternative step 1: Output is a stream, only the name of the top level
+   * directory is needed */
+
+  g_debug ("autoar_compressor_step_decide_dest_stream: called");
+
+  autoar_compressor_set_source_basename (self);
+}
+
 static void
 autoar_compressor_step_create (AutoarCompressor *self)
 {
   /* Step 2: Create and open the new archive file */
+  g_autoptr (AutoarScanner) scanner = NULL;
+  g_autoptr (GPtrArray) infos = NULL;
+  guint64 sources_size = 0;
+  guint sources_files = 0;
   GList *l;
+  guint i;
   int r;
 
   g_debug ("autoar_compressor_step_create: called");
 
-  r = archive_write_open (self->a, self,
-                          libarchive_write_open_cb,
-                          libarchive_write_write_cb,
-                          libarchive_write_close_cb);
+  if (self->snapshot_file != NULL) {
+    autoar_compressor_do_load_snapshot (self);
+    if (self->error != NULL)
+      return;
+  }
+
+  /* AutoarZipWriter writes the archive on its own */
+  if (self->zip_writer != NULL)
+    r = libarchive_write_open_cb (self->a, self);
+  else
+    r = archive_write_open (self->a, self,
+                            libarchive_write_open_cb,
+                            libarchive_write_write_cb,
+                            libarchive_write_close_cb);
   if (r != ARCHIVE_OK) {
     if (self->error == NULL)
       self->error = autoar_common_g_error_new_a (self->a, NULL);
@@ -1517,9 +4184,17 @@ autoar_compressor_step_create (AutoarCompressor *self)
   archive_entry_linkresolver_set_strategy (self->resolver,
                                            archive_format (self->a));
 
+  /* All the directories are scanned in parallel from the start, while their
+   * entries are added in the order of a sequential traversal */
+  scanner = autoar_scanner_new (autoar_compressor_get_n_threads (self),
+                                self->cancellable);
+  autoar_scanner_set_filters (scanner, self->excludes, self->includes,
+                              self->exclude_caches, self->ignore_file_name);
+  autoar_scanner_set_sorted (scanner, self->reproducible);
+  infos = g_ptr_array_new_with_free_func (g_object_unref);
+
   for (l = self->source_files; l != NULL; l = l->next) {
     GFile *file; /* Do not unref */
-    GFileType filetype;
     GFileInfo *fileinfo;
     g_autofree gchar *pathname = NULL;
 
@@ -1529,20 +4204,102 @@ autoar_compressor_step_create (AutoarCompressor *self)
     g_debug ("autoar_compressor_step_create: %s", pathname);
 
     fileinfo = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                  AUTOAR_SCANNER_ATTRIBUTES,
                                   G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
                                   self->cancellable,
                                   &(self->error));
     if (self->error != NULL)
       return;
 
-    filetype = g_file_info_get_file_type (fileinfo);
-    g_object_unref (fileinfo);
+    if (g_file_info_get_file_type (fileinfo) == G_FILE_TYPE_DIRECTORY)
+      autoar_scanner_add (scanner, file);
+
+    sources_size += g_file_info_get_size (fileinfo);
+    sources_files++;
+    g_ptr_array_add (infos, fileinfo);
+  }
+
+  for (i = 0; i < self->streams->len; i++) {
+    AutoarCompressorStream *stream = self->streams->pdata[i];
+
+    sources_size += stream->size;
+    sources_files++;
+  }
+
+  self->size = sources_size;
+  self->files = sources_files;
+
+  for (l = self->source_files, i = 0; l != NULL; l = l->next, i++) {
+    GFile *file; /* Do not unref */
+    GFileInfo *fileinfo; /* Do not unref */
+
+    file = l->data;
+    fileinfo = infos->pdata[i];
+
+    if (autoar_compressor_do_snapshot (self, file, file, fileinfo))
+      autoar_compressor_do_add_to_archive (self, file, file, fileinfo);
+    else
+      autoar_compressor_do_skip (self, fileinfo);
+
+    if (g_file_info_get_file_type (fileinfo) == G_FILE_TYPE_DIRECTORY) {
+      gboolean scanning = TRUE;
+      GFile *thisfile;
+      GFileInfo *thisinfo;
+
+      while (self->error == NULL &&
+             !g_cancellable_is_cancelled (self->cancellable)) {
+        guint64 size;
+        guint files;
+
+        /* Keep the files ahead of the archive being read in the meantime */
+        while (scanning && !autoar_prefetcher_is_full (self->prefetcher)) {
+          scanning = autoar_scanner_next (scanner, &thisfile, &thisinfo,
+                                          &(self->error));
+          if (scanning) {
+            /* The unchanged files of incremental archives are not read */
+            if (autoar_compressor_do_snapshot (self, file, thisfile, thisinfo))
+              autoar_prefetcher_push (self->prefetcher, thisfile, thisinfo);
+            else
+              autoar_compressor_do_skip (self, thisinfo);
+            g_object_unref (thisfile);
+            g_object_unref (thisinfo);
+          }
+        }
+
+        if (self->error != NULL ||
+            !autoar_prefetcher_pop (self->prefetcher, &thisfile, &thisinfo))
+          break;
+
+        autoar_scanner_get_totals (scanner, &size, &files);
+        self->size = sources_size + size;
+        self->files = sources_files + files;
+
+        autoar_compressor_do_add_to_archive (self, file, thisfile, thisinfo);
+        g_object_unref (thisfile);
+        g_object_unref (thisinfo);
+      }
+
+      /* The totals are final once the scanner has returned all the entries */
+      if (!scanning) {
+        guint64 size;
+        guint files;
 
-    autoar_compressor_do_add_to_archive (self, file, file);
+        autoar_scanner_get_totals (scanner, &size, &files);
+        self->size = sources_size + size;
+        self->files = sources_files + files;
+      }
+    }
+
+    if (self->error != NULL)
+      return;
+
+    if (g_cancellable_is_cancelled (self->cancellable))
+      return;
+  }
 
-    if (filetype == G_FILE_TYPE_DIRECTORY)
-      autoar_compressor_do_recursive_read (self, file, file);
+  /* The streams are added after the files */
+  for (i = 0; i < self->streams->len; i++) {
+    autoar_compressor_do_add_stream (self, self->streams->pdata[i]);
 
     if (self->error != NULL)
       return;
@@ -1551,11 +4308,15 @@ autoar_compressor_step_create (AutoarCompressor *self)
       return;
   }
 
+  autoar_compressor_do_add_deleted (self);
+  if (self->error != NULL)
+    return;
+
   /* Flush deferred entries, if any, by calling linkify with entry unset. */
   {
     struct archive_entry *entry, *sparse;
     GFile *file_to_read;
-    const char *pathname_in_entry;
+    AutoarInode inode;
 
     while (TRUE) {
       /* The archive_entry is freed by the archive_entry_linkify function. */
@@ -1564,10 +4325,10 @@ autoar_compressor_step_create (AutoarCompressor *self)
       if (entry == NULL)
         break;
 
-      pathname_in_entry = archive_entry_pathname (entry);
-      file_to_read = g_hash_table_lookup (self->pathname_to_g_file,
-                                          pathname_in_entry);
-      autoar_compressor_do_write_data (self, entry, file_to_read);
+      inode.dev = archive_entry_dev (entry);
+      inode.ino = archive_entry_ino64 (entry);
+      file_to_read = g_hash_table_lookup (self->deferred_files, &inode);
+      autoar_compressor_do_write_data (self, entry, file_to_read, NULL);
       /* I think we do not have to remove the entry in the hash table now
        * because we are going to free the entire hash table. */
     }
@@ -1581,17 +4342,29 @@ autoar_compressor_step_cleanup (AutoarCompressor *self)
    * We do not have to do other cleanup because they are handled in dispose
    * and finalize functions. */
   self->notify_last = 0;
-  autoar_compressor_signal_progress (self);
-  if (archive_write_close (self->a) != ARCHIVE_OK) {
-    g_autofree gchar *output_name = NULL;
+  if (self->zip_writer != NULL) {
+    if (autoar_zip_writer_finish (self->zip_writer, self->ostream,
+                                  self->cancellable, &(self->error)))
+      libarchive_write_close_cb (self->a, self);
+    autoar_compressor_signal_progress (self);
+  } else {
+    autoar_compressor_signal_progress (self);
+    if (archive_write_close (self->a) != ARCHIVE_OK) {
+      g_autofree gchar *output_name = NULL;
 
-    output_name = autoar_common_g_file_get_name (self->output_file);
+      if (self->output_file != NULL)
+        output_name = autoar_common_g_file_get_name (self->output_file);
 
-    if (self->error == NULL)
-      self->error =
-        autoar_common_g_error_new_a (self->a, output_name);
-    return;
+      if (self->error == NULL)
+        self->error =
+          autoar_common_g_error_new_a (self->a, output_name);
+      return;
+    }
   }
+
+  /* The snapshot is only saved along with a complete archive */
+  if (self->error == NULL)
+    autoar_compressor_do_save_snapshot (self);
 }
 
 static void
@@ -1606,7 +4379,7 @@ autoar_compressor_run (AutoarCompressor *self)
   g_return_if_fail (AUTOAR_IS_COMPRESSOR (self));
 
   g_return_if_fail (self->source_files != NULL);
-  g_return_if_fail (self->output_file != NULL);
+  g_return_if_fail (self->output_file != NULL || self->output_stream != NULL);
 
   /* A GFile* list without a GFile* is not allowed */
   g_return_if_fail (self->source_files->data != NULL);
@@ -1618,9 +4391,12 @@ autoar_compressor_run (AutoarCompressor *self)
 
   i = 0;
   steps[i++] = autoar_compressor_step_initialize_object;
-  steps[i++] = self->output_is_dest ?
-               autoar_compressor_step_decide_dest_already :
-               autoar_compressor_step_decide_dest;
+  if (self->output_stream != NULL)
+    steps[i++] = autoar_compressor_step_decide_dest_stream;
+  else
+    steps[i++] = self->output_is_dest ?
+                 autoar_compressor_step_decide_dest_already :
+                 autoar_compressor_step_decide_dest;
   steps[i++] = autoar_compressor_step_create;
   steps[i++] = autoar_compressor_step_cleanup;
   steps[i++] = NULL;
@@ -1630,10 +4406,12 @@ autoar_compressor_run (AutoarCompressor *self)
     (*steps[i])(self);
     g_debug ("autoar_compressor_run: Step %d End", i);
     if (self->error != NULL) {
+      autoar_compressor_restore_existing (self);
       autoar_compressor_signal_error (self);
       return;
     }
     if (g_cancellable_is_cancelled (self->cancellable)) {
+      autoar_compressor_restore_existing (self);
       autoar_compressor_signal_cancelled (self);
       return;
     }
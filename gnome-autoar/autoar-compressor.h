@@ -35,6 +35,84 @@ G_BEGIN_DECLS
 
 #define AUTOAR_TYPE_COMPRESSOR autoar_compressor_get_type ()
 
+/**
+ * AutoarCompressionLevel:
+ * @AUTOAR_COMPRESSION_LEVEL_DEFAULT: the default level of libarchive
+ * @AUTOAR_COMPRESSION_LEVEL_FASTEST: the fastest level, e.g. gzip -1
+ * @AUTOAR_COMPRESSION_LEVEL_FAST: a fast level, e.g. gzip -3
+ * @AUTOAR_COMPRESSION_LEVEL_HIGH: a level favouring the size, e.g. gzip -7
+ * @AUTOAR_COMPRESSION_LEVEL_BEST: the best compression, e.g. gzip -9
+ *
+ * The compression level used by #AutoarCompressor. It is translated to the
+ * native levels of the filter and of the formats with their own compression,
+ * which are %AUTOAR_FORMAT_ZIP, %AUTOAR_FORMAT_7ZIP and %AUTOAR_FORMAT_XAR.
+ **/
+typedef enum {
+  AUTOAR_COMPRESSION_LEVEL_DEFAULT = 0,
+  AUTOAR_COMPRESSION_LEVEL_FASTEST,
+  AUTOAR_COMPRESSION_LEVEL_FAST,
+  AUTOAR_COMPRESSION_LEVEL_HIGH,
+  AUTOAR_COMPRESSION_LEVEL_BEST
+} AutoarCompressionLevel;
+
+/**
+ * AutoarStoreDetection:
+ * @AUTOAR_STORE_DETECTION_NONE: every file is compressed
+ * @AUTOAR_STORE_DETECTION_EXTENSION: files with the extension of a compressed
+ * format, e.g. .jpg, .mp4 or .zip, are stored
+ * @AUTOAR_STORE_DETECTION_MAGIC: files starting with the signature of a
+ * compressed format are stored
+ * @AUTOAR_STORE_DETECTION_ENTROPY: files whose first block looks random are
+ * stored
+ *
+ * How #AutoarCompressor detects the files which are compressed already, and
+ * stores them in %AUTOAR_FORMAT_ZIP archives instead of deflating them again.
+ **/
+typedef enum {
+  AUTOAR_STORE_DETECTION_NONE = 0,
+  AUTOAR_STORE_DETECTION_EXTENSION = 1 << 0,
+  AUTOAR_STORE_DETECTION_MAGIC = 1 << 1,
+  AUTOAR_STORE_DETECTION_ENTROPY = 1 << 2
+} AutoarStoreDetection;
+
+/**
+ * AutoarReadOrder:
+ * @AUTOAR_READ_ORDER_TRAVERSAL: the files are read in the order of the
+ * traversal of the directories
+ * @AUTOAR_READ_ORDER_AUTO: %AUTOAR_READ_ORDER_EXTENT if the first source
+ * file is on a rotational disk, otherwise %AUTOAR_READ_ORDER_TRAVERSAL
+ * @AUTOAR_READ_ORDER_INODE: the files are read in the order of their inode
+ * numbers
+ * @AUTOAR_READ_ORDER_EXTENT: the files are read in the order of their
+ * first extent on the disk, or of their inode numbers if the file system
+ * doesn't tell
+ *
+ * The order in which #AutoarCompressor reads the files ahead of the entry
+ * being written. The order of the entries in the archive doesn't change.
+ **/
+typedef enum {
+  AUTOAR_READ_ORDER_TRAVERSAL = 0,
+  AUTOAR_READ_ORDER_AUTO,
+  AUTOAR_READ_ORDER_INODE,
+  AUTOAR_READ_ORDER_EXTENT
+} AutoarReadOrder;
+
+/**
+ * AutoarWriteMode:
+ * @AUTOAR_WRITE_MODE_CREATE: a new archive is created
+ * @AUTOAR_WRITE_MODE_APPEND: the entries are appended to an existing archive
+ * @AUTOAR_WRITE_MODE_UPDATE: like %AUTOAR_WRITE_MODE_APPEND, but only the
+ * files which aren't in the existing archive with the same size and
+ * modification time are appended
+ *
+ * How #AutoarCompressor writes to an archive which exists already.
+ **/
+typedef enum {
+  AUTOAR_WRITE_MODE_CREATE = 0,
+  AUTOAR_WRITE_MODE_APPEND,
+  AUTOAR_WRITE_MODE_UPDATE
+} AutoarWriteMode;
+
 G_DECLARE_FINAL_TYPE (AutoarCompressor, autoar_compressor, AUTOAR, COMPRESSOR, GObject)
 
 /**
@@ -53,6 +131,11 @@ AutoarCompressor * autoar_compressor_new                            (GList
                                                                      AutoarFormat  format,
                                                                      AutoarFilter  filter,
                                                                      gboolean      create_top_level_directory);
+AutoarCompressor * autoar_compressor_new_to_stream                  (GList         *source_files,
+                                                                     GOutputStream *output_stream,
+                                                                     AutoarFormat   format,
+                                                                     AutoarFilter   filter,
+                                                                     gboolean       create_top_level_directory);
 
 void               autoar_compressor_start                          (AutoarCompressor *self,
                                                                      GCancellable     *cancellable);
@@ -61,6 +144,7 @@ void               autoar_compressor_start_async                    (AutoarCompr
 
 GList *            autoar_compressor_get_source_files               (AutoarCompressor *self);
 GFile *            autoar_compressor_get_output_file                (AutoarCompressor *self);
+GOutputStream *    autoar_compressor_get_output_stream              (AutoarCompressor *self);
 AutoarFormat       autoar_compressor_get_format                     (AutoarCompressor *self);
 AutoarFilter       autoar_compressor_get_filter                     (AutoarCompressor *self);
 gboolean           autoar_compressor_get_create_top_level_directory (AutoarCompressor *self);
@@ -70,13 +154,77 @@ guint              autoar_compressor_get_files                      (AutoarCompr
 guint              autoar_compressor_get_completed_files            (AutoarCompressor *self);
 gboolean           autoar_compressor_get_output_is_dest             (AutoarCompressor *self);
 gint64             autoar_compressor_get_notify_interval            (AutoarCompressor *self);
+AutoarCompressionLevel autoar_compressor_get_compression_level      (AutoarCompressor *self);
+guint              autoar_compressor_get_threads                    (AutoarCompressor *self);
+guint64            autoar_compressor_get_in_flight_budget           (AutoarCompressor *self);
+AutoarStoreDetection autoar_compressor_get_store_detection          (AutoarCompressor *self);
+AutoarReadOrder    autoar_compressor_get_read_order                 (AutoarCompressor *self);
+AutoarWriteMode    autoar_compressor_get_write_mode                 (AutoarCompressor *self);
+GFile *            autoar_compressor_get_snapshot_file              (AutoarCompressor *self);
+gint64             autoar_compressor_get_newer_than                 (AutoarCompressor *self);
+guint64            autoar_compressor_get_volume_size                (AutoarCompressor *self);
+gboolean           autoar_compressor_get_exclude_caches             (AutoarCompressor *self);
+const char *       autoar_compressor_get_ignore_file_name           (AutoarCompressor *self);
+gboolean           autoar_compressor_get_deduplicate                (AutoarCompressor *self);
+gboolean           autoar_compressor_get_rsyncable                  (AutoarCompressor *self);
+gboolean           autoar_compressor_get_reproducible               (AutoarCompressor *self);
+gint64             autoar_compressor_get_source_date_epoch          (AutoarCompressor *self);
+guint              autoar_compressor_get_stored_files               (AutoarCompressor *self);
+guint64            autoar_compressor_get_stored_size                (AutoarCompressor *self);
+gint64             autoar_compressor_get_saved_time                 (AutoarCompressor *self);
 
 void               autoar_compressor_set_output_is_dest             (AutoarCompressor *self,
                                                                      gboolean          output_is_dest);
 void               autoar_compressor_set_notify_interval            (AutoarCompressor *self,
                                                                      gint64            notify_interval);
+void               autoar_compressor_set_compression_level          (AutoarCompressor      *self,
+                                                                     AutoarCompressionLevel compression_level);
+void               autoar_compressor_set_threads                    (AutoarCompressor *self,
+                                                                     guint             threads);
+void               autoar_compressor_set_in_flight_budget           (AutoarCompressor *self,
+                                                                     guint64           in_flight_budget);
+void               autoar_compressor_set_store_detection            (AutoarCompressor     *self,
+                                                                     AutoarStoreDetection  store_detection);
+void               autoar_compressor_set_read_order                 (AutoarCompressor *self,
+                                                                     AutoarReadOrder   read_order);
+void               autoar_compressor_set_write_mode                 (AutoarCompressor *self,
+                                                                     AutoarWriteMode   write_mode);
+void               autoar_compressor_set_snapshot_file              (AutoarCompressor *self,
+                                                                     GFile            *snapshot_file);
+void               autoar_compressor_set_newer_than                 (AutoarCompressor *self,
+                                                                     gint64            newer_than);
+void               autoar_compressor_set_volume_size                (AutoarCompressor *self,
+                                                                     guint64           volume_size);
+void               autoar_compressor_set_exclude_caches             (AutoarCompressor *self,
+                                                                     gboolean          exclude_caches);
+void               autoar_compressor_set_ignore_file_name           (AutoarCompressor *self,
+                                                                     const char       *ignore_file_name);
+void               autoar_compressor_set_deduplicate                (AutoarCompressor *self,
+                                                                     gboolean          deduplicate);
+void               autoar_compressor_set_rsyncable                  (AutoarCompressor *self,
+                                                                     gboolean          rsyncable);
+void               autoar_compressor_set_reproducible               (AutoarCompressor *self,
+                                                                     gboolean          reproducible);
+void               autoar_compressor_set_source_date_epoch          (AutoarCompressor *self,
+                                                                     gint64            source_date_epoch);
+void               autoar_compressor_add_exclude_pattern            (AutoarCompressor *self,
+                                                                     const char       *pattern);
+void               autoar_compressor_add_include_pattern            (AutoarCompressor *self,
+                                                                     const char       *pattern);
+void               autoar_compressor_add_stream                     (AutoarCompressor *self,
+                                                                     const char       *pathname,
+                                                                     GInputStream     *stream,
+                                                                     guint64           size,
+                                                                     GFileInfo        *info);
+void               autoar_compressor_add_bytes                      (AutoarCompressor *self,
+                                                                     const char       *pathname,
+                                                                     GBytes           *bytes,
+                                                                     GFileInfo        *info);
 void               autoar_compressor_set_passphrase                 (AutoarCompressor *self,
                                                                      const gchar      *passphrase);
+void               autoar_compressor_set_filter_option              (AutoarCompressor *self,
+                                                                     const gchar      *option,
+                                                                     const gchar      *value);
 G_END_DECLS
 
 #endif /* AUTOAR_COMPRESSOR_H */
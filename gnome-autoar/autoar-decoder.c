@@ -0,0 +1,1880 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-decoder.c
+ * Seekable decompression of gzip, xz and zstd archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-decoder.h"
+
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#ifdef HAVE_LZMA
+# include <lzma.h>
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+/* AutoarDecoder decompresses the source archive itself instead of letting
+ * libarchive do it, so it can remember restart points while the archive is
+ * read from the beginning and later continue decompression near any offset
+ * of the uncompressed stream:
+ *
+ *  - gzip: the state of inflate at a deflate block boundary, that is the
+ *    compressed offset, the unused bits of the last byte and the last 32 KiB
+ *    of output (the approach of zran.c from the zlib distribution)
+ *  - xz: the block boundaries, which are read from the index at the end of
+ *    the file instead of being remembered
+ *  - zstd: the frame boundaries
+ *
+ * The restart points of gzip and zstd are returned by
+ * autoar_decoder_get_seek_points() and stored by AutoarArchiveIndex.
+ *
+ * Blocks of xz files written by "xz -T" and frames of zstd files are
+ * independent of each other, so they are decoded by a pool of threads while
+ * the calling thread reads the compressed data and returns the decoded units
+ * in order. Units larger than MAX_UNIT_SIZE, and zstd frames which don't
+ * store the size of their content, are decoded in the calling thread as they
+ * would be without the pool. */
+
+#define INPUT_SIZE (128 * 1024)
+#define DISCARD_SIZE (64 * 1024)
+#define WINDOW_SIZE (32 * 1024)
+
+/* Distance between two restart points. It grows with the size of the source
+ * to limit the memory used by the windows of gzip restart points. */
+#define MIN_SPAN (1024 * 1024)
+#define MAX_SEEK_POINTS 1024
+
+#define SEEK_POINTS_TYPE "(ya(xxyay))"
+
+/* Limits of the parallel decoding */
+#define MAX_UNIT_SIZE (64 * 1024 * 1024)
+#define MAX_QUEUED_SIZE (512 * 1024 * 1024)
+
+/* Memory the decoded xz indexes of a file may use. The size of an index is
+ * read from the file, so it is not trusted. Files with larger indexes are
+ * left to libarchive, which decodes them without seeking. */
+#define MAX_INDEX_MEMORY (256 * 1024 * 1024)
+
+typedef enum {
+  AUTOAR_DECODER_NONE = 0,
+  AUTOAR_DECODER_GZIP,
+  AUTOAR_DECODER_XZ,
+  AUTOAR_DECODER_ZSTD
+} AutoarDecoderType;
+
+typedef struct _AutoarDecoderPoint AutoarDecoderPoint;
+typedef struct _AutoarDecoderJob AutoarDecoderJob;
+
+struct _AutoarDecoderPoint
+{
+  gint64 in_offset;
+  gint64 out_offset;
+  guint8 bits;
+  GBytes *window;
+
+  /* xz only */
+  guint64 unpadded_size;
+  guint64 uncompressed_size;
+  guint check;
+};
+
+/* One block or frame decoded by the thread pool */
+struct _AutoarDecoderJob
+{
+  AutoarDecoderType type;
+
+  guint8 *in;
+  gsize in_size;
+  gint64 in_offset;
+
+  guint8 *out;
+  gsize out_size;
+  gsize out_pos;
+
+  /* Counted in AutoarDecoder.queued_size */
+  gsize queued_size;
+
+  /* xz only */
+  guint64 unpadded_size;
+  guint check;
+
+  gboolean started;
+  gint cancelled;
+  gboolean done;
+  GError *error;
+};
+
+struct _AutoarDecoder
+{
+  AutoarDecoderType type;
+
+  GInputStream *istream;
+  gint64 source_size;
+
+  /* Compressed input, in_buf[0] is at in_offset in the source */
+  guint8 *in_buf;
+  gsize in_len;
+  gsize in_pos;
+  gint64 in_offset;
+
+  /* Offset of the next byte returned by autoar_decoder_read() */
+  gint64 out_pos;
+  gboolean eof;
+
+  GArray *points;
+  gint64 span;
+
+  guint8 *discard;
+
+  /* Parallel decoding, pool is NULL if it is not possible */
+  GThreadPool *pool;
+  guint n_threads;
+  GMutex lock;
+  GCond cond;
+  GQueue jobs;
+  gsize queued_size;
+  guint queue_depth;
+  gboolean parallel;
+  gboolean input_done;
+  gboolean input_blocked;
+
+#ifdef HAVE_ZLIB
+  z_stream zs;
+  gboolean zs_raw;
+  gboolean member_end;
+  gsize trailer_left;
+  guint8 *window;
+  gsize window_pos;
+  gsize window_fill;
+#endif
+
+#ifdef HAVE_LZMA
+  lzma_stream ls;
+  lzma_block block;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  guint current_block;
+  gboolean in_block;
+#endif
+
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zds;
+  gboolean frame_done;
+#endif
+};
+
+static void
+autoar_decoder_point_clear (void *data)
+{
+  AutoarDecoderPoint *point = data;
+
+  g_clear_pointer (&point->window, g_bytes_unref);
+}
+
+static gboolean
+autoar_decoder_reset_input (AutoarDecoder *self,
+                            gint64         offset,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  if (!g_seekable_seek (G_SEEKABLE (self->istream), offset, G_SEEK_SET,
+                        cancellable, error))
+    return FALSE;
+
+  self->in_offset = offset;
+  self->in_len = 0;
+  self->in_pos = 0;
+
+  return TRUE;
+}
+
+/* Makes at least @size bytes of input available if the source is long enough
+ * and returns the number of available bytes, or -1 on error. */
+static gssize
+autoar_decoder_ensure_input (AutoarDecoder *self,
+                             gsize          size,
+                             GCancellable  *cancellable,
+                             GError       **error)
+{
+  gsize avail;
+
+  avail = self->in_len - self->in_pos;
+  if (avail >= size)
+    return avail;
+
+  memmove (self->in_buf, self->in_buf + self->in_pos, avail);
+  self->in_offset += self->in_pos;
+  self->in_pos = 0;
+  self->in_len = avail;
+
+  while (self->in_len < size) {
+    gssize read_size;
+
+    read_size = g_input_stream_read (self->istream,
+                                     self->in_buf + self->in_len,
+                                     INPUT_SIZE - self->in_len,
+                                     cancellable, error);
+    if (read_size < 0)
+      return -1;
+    if (read_size == 0)
+      break;
+
+    self->in_len += read_size;
+  }
+
+  return self->in_len;
+}
+
+static gboolean
+autoar_decoder_pread (AutoarDecoder *self,
+                      gint64         offset,
+                      void          *buffer,
+                      gsize          size,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+  gsize bytes_read;
+
+  if (!g_seekable_seek (G_SEEKABLE (self->istream), offset, G_SEEK_SET,
+                        cancellable, error))
+    return FALSE;
+
+  if (!g_input_stream_read_all (self->istream, buffer, size, &bytes_read,
+                                cancellable, error))
+    return FALSE;
+
+  if (bytes_read != size) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                         "Unexpected end of compressed data");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+autoar_decoder_set_truncated_error (GError **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                       "Unexpected end of compressed data");
+}
+
+static AutoarDecoderPoint *
+autoar_decoder_find_point (AutoarDecoder *self,
+                           gint64         offset,
+                           guint         *index)
+{
+  guint low, high;
+
+  /* Binary search for the last point at or before offset */
+  low = 0;
+  high = self->points->len;
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (g_array_index (self->points, AutoarDecoderPoint, mid).out_offset <= offset)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if (low == 0)
+    return NULL;
+
+  if (index != NULL)
+    *index = low - 1;
+
+  return &g_array_index (self->points, AutoarDecoderPoint, low - 1);
+}
+
+static gboolean
+autoar_decoder_should_add_point (AutoarDecoder *self)
+{
+  AutoarDecoderPoint *last;
+
+  if (self->points->len >= MAX_SEEK_POINTS)
+    return FALSE;
+
+  if (self->points->len == 0)
+    return self->out_pos >= self->span;
+
+  last = &g_array_index (self->points, AutoarDecoderPoint, self->points->len - 1);
+  return self->out_pos >= last->out_offset + self->span;
+}
+
+#ifdef HAVE_ZLIB
+static void
+autoar_decoder_gzip_update_window (AutoarDecoder *self,
+                                   const guint8  *data,
+                                   gsize          size)
+{
+  gsize chunk;
+
+  if (size >= WINDOW_SIZE) {
+    memcpy (self->window, data + size - WINDOW_SIZE, WINDOW_SIZE);
+    self->window_pos = 0;
+    self->window_fill = WINDOW_SIZE;
+    return;
+  }
+
+  chunk = MIN (size, WINDOW_SIZE - self->window_pos);
+  memcpy (self->window + self->window_pos, data, chunk);
+  memcpy (self->window, data + chunk, size - chunk);
+  self->window_pos = (self->window_pos + size) % WINDOW_SIZE;
+  self->window_fill = MIN (self->window_fill + size, WINDOW_SIZE);
+}
+
+static GBytes *
+autoar_decoder_gzip_copy_window (AutoarDecoder *self)
+{
+  guint8 *window;
+
+  window = g_malloc (self->window_fill);
+  if (self->window_fill < WINDOW_SIZE) {
+    memcpy (window, self->window, self->window_fill);
+  } else {
+    memcpy (window, self->window + self->window_pos,
+            WINDOW_SIZE - self->window_pos);
+    memcpy (window + WINDOW_SIZE - self->window_pos, self->window,
+            self->window_pos);
+  }
+
+  return g_bytes_new_take (window, self->window_fill);
+}
+
+static void
+autoar_decoder_gzip_add_point (AutoarDecoder *self)
+{
+  AutoarDecoderPoint point = { 0 };
+
+  point.in_offset = self->in_offset + self->in_pos;
+  point.out_offset = self->out_pos;
+  point.bits = self->zs.data_type & 7;
+  point.window = autoar_decoder_gzip_copy_window (self);
+
+  g_array_append_val (self->points, point);
+
+  g_debug ("autoar_decoder_gzip_add_point: %" G_GINT64_FORMAT
+           " -> %" G_GINT64_FORMAT,
+           point.in_offset, point.out_offset);
+}
+
+static gboolean
+autoar_decoder_gzip_init (AutoarDecoder *self)
+{
+  memset (&self->zs, 0, sizeof (self->zs));
+  if (inflateInit2 (&self->zs, 15 + 16) != Z_OK)
+    return FALSE;
+
+  self->window = g_malloc (WINDOW_SIZE);
+
+  return TRUE;
+}
+
+static gboolean
+autoar_decoder_gzip_restart (AutoarDecoder       *self,
+                             AutoarDecoderPoint  *point,
+                             GCancellable        *cancellable,
+                             GError             **error)
+{
+  self->member_end = FALSE;
+  self->trailer_left = 0;
+  self->eof = FALSE;
+
+  if (point == NULL) {
+    if (!autoar_decoder_reset_input (self, 0, cancellable, error))
+      return FALSE;
+
+    inflateReset2 (&self->zs, 15 + 16);
+    self->zs_raw = FALSE;
+    self->out_pos = 0;
+    self->window_pos = 0;
+    self->window_fill = 0;
+
+    return TRUE;
+  }
+
+  /* If the point is inside a byte, that byte is read again and its unused
+   * bits are fed to inflate. */
+  if (!autoar_decoder_reset_input (self, point->in_offset - (point->bits ? 1 : 0),
+                                   cancellable, error))
+    return FALSE;
+
+  inflateReset2 (&self->zs, -15);
+  self->zs_raw = TRUE;
+
+  if (point->bits) {
+    gssize avail;
+
+    avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+    if (avail < 0)
+      return FALSE;
+    if (avail == 0) {
+      autoar_decoder_set_truncated_error (error);
+      return FALSE;
+    }
+
+    inflatePrime (&self->zs, point->bits,
+                  self->in_buf[self->in_pos] >> (8 - point->bits));
+    self->in_pos++;
+  }
+
+  self->window_pos = 0;
+  self->window_fill = 0;
+  if (point->window != NULL) {
+    gconstpointer window;
+    gsize window_size;
+
+    window = g_bytes_get_data (point->window, &window_size);
+    inflateSetDictionary (&self->zs, window, window_size);
+    autoar_decoder_gzip_update_window (self, window, window_size);
+  }
+
+  self->out_pos = point->out_offset;
+
+  return TRUE;
+}
+
+static gssize
+autoar_decoder_gzip_read (AutoarDecoder  *self,
+                          guint8         *buffer,
+                          gsize           count,
+                          GCancellable   *cancellable,
+                          GError        **error)
+{
+  gsize produced = 0;
+
+  while (produced < count && !self->eof) {
+    gssize avail;
+    gsize out_size;
+    int ret;
+
+    /* Members inflated in the raw mode leave their trailer in the input */
+    if (self->trailer_left > 0) {
+      gsize skip;
+
+      avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+      if (avail < 0)
+        return -1;
+      if (avail == 0) {
+        autoar_decoder_set_truncated_error (error);
+        return -1;
+      }
+
+      skip = MIN (self->trailer_left, (gsize) avail);
+      self->in_pos += skip;
+      self->trailer_left -= skip;
+      continue;
+    }
+
+    /* Concatenated members are allowed, anything else after the end of a
+     * member is ignored like libarchive does. */
+    if (self->member_end) {
+      avail = autoar_decoder_ensure_input (self, 2, cancellable, error);
+      if (avail < 0)
+        return -1;
+      if (avail < 2 ||
+          self->in_buf[self->in_pos] != 0x1f ||
+          self->in_buf[self->in_pos + 1] != 0x8b) {
+        self->eof = TRUE;
+        break;
+      }
+
+      inflateReset2 (&self->zs, 15 + 16);
+      self->zs_raw = FALSE;
+      self->member_end = FALSE;
+    }
+
+    avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+    if (avail < 0)
+      return -1;
+
+    out_size = MIN (count - produced, G_MAXUINT32);
+    self->zs.next_in = self->in_buf + self->in_pos;
+    self->zs.avail_in = avail;
+    self->zs.next_out = buffer + produced;
+    self->zs.avail_out = out_size;
+
+    /* Z_BLOCK stops at the end of every deflate block, where the restart
+     * points can be taken. */
+    ret = inflate (&self->zs, Z_BLOCK);
+
+    out_size -= self->zs.avail_out;
+    autoar_decoder_gzip_update_window (self, buffer + produced, out_size);
+    produced += out_size;
+    self->out_pos += out_size;
+    self->in_pos = self->zs.next_in - self->in_buf;
+
+    if (ret == Z_STREAM_END) {
+      self->member_end = TRUE;
+      if (self->zs_raw)
+        self->trailer_left = 8;
+      continue;
+    }
+
+    if (ret == Z_BUF_ERROR && avail == 0) {
+      autoar_decoder_set_truncated_error (error);
+      return -1;
+    }
+
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid gzip data: %s",
+                   self->zs.msg ? self->zs.msg : "unknown error");
+      return -1;
+    }
+
+    if ((self->zs.data_type & 128) && !(self->zs.data_type & 64) &&
+        autoar_decoder_should_add_point (self))
+      autoar_decoder_gzip_add_point (self);
+  }
+
+  return produced;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static void
+autoar_decoder_xz_free_filters (AutoarDecoder *self)
+{
+  int i;
+
+  for (i = 0; i < LZMA_FILTERS_MAX; i++) {
+    if (self->filters[i].id == LZMA_VLI_UNKNOWN)
+      break;
+    free (self->filters[i].options);
+    self->filters[i].options = NULL;
+  }
+}
+
+static gboolean
+autoar_decoder_xz_decode_index (AutoarDecoder  *self,
+                                gint64          offset,
+                                guint64         size,
+                                guint64         memlimit,
+                                lzma_index    **index,
+                                GCancellable   *cancellable,
+                                GError        **error)
+{
+  lzma_stream strm = LZMA_STREAM_INIT;
+  lzma_ret ret;
+
+  if (lzma_index_decoder (&strm, index, memlimit) != LZMA_OK) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                         "Unable to initialize the xz index decoder");
+    return FALSE;
+  }
+
+  do {
+    gsize chunk = MIN (size, INPUT_SIZE);
+
+    if (chunk == 0 ||
+        !autoar_decoder_pread (self, offset, self->in_buf, chunk,
+                               cancellable, error)) {
+      if (chunk == 0)
+        autoar_decoder_set_truncated_error (error);
+      lzma_end (&strm);
+      return FALSE;
+    }
+
+    offset += chunk;
+    size -= chunk;
+
+    strm.next_in = self->in_buf;
+    strm.avail_in = chunk;
+    ret = lzma_code (&strm, LZMA_RUN);
+  } while (ret == LZMA_OK);
+
+  lzma_end (&strm);
+
+  if (ret == LZMA_MEMLIMIT_ERROR) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "The xz index needs more than %" G_GUINT64_FORMAT " bytes",
+                 memlimit);
+    return FALSE;
+  }
+
+  if (ret != LZMA_STREAM_END || size != 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Invalid xz index");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Reads the indexes of all streams from the end of the file, the same way
+ * as "xz --list" does. */
+static gboolean
+autoar_decoder_xz_init (AutoarDecoder  *self,
+                        GCancellable   *cancellable,
+                        GError        **error)
+{
+  lzma_index *combined = NULL;
+  lzma_index_iter iter;
+  gint64 pos;
+  guint8 buf[LZMA_STREAM_HEADER_SIZE];
+
+  pos = self->source_size;
+  while (pos > 0) {
+    lzma_stream_flags header_flags, footer_flags;
+    lzma_index *index = NULL;
+    guint64 padding = 0;
+    guint64 memused = 0;
+    gint64 index_offset, stream_offset;
+
+    /* Stream padding is a multiple of four null bytes */
+    while (TRUE) {
+      if (pos < 2 * LZMA_STREAM_HEADER_SIZE)
+        goto invalid;
+      if (!autoar_decoder_pread (self, pos - LZMA_STREAM_HEADER_SIZE, buf,
+                                 LZMA_STREAM_HEADER_SIZE, cancellable, error))
+        goto error;
+      if (buf[8] != 0 || buf[9] != 0 || buf[10] != 0 || buf[11] != 0)
+        break;
+      pos -= 4;
+      padding += 4;
+    }
+
+    if (lzma_stream_footer_decode (&footer_flags, buf) != LZMA_OK)
+      goto invalid;
+
+    index_offset = pos - LZMA_STREAM_HEADER_SIZE - footer_flags.backward_size;
+    if (index_offset < LZMA_STREAM_HEADER_SIZE)
+      goto invalid;
+
+    /* The limit holds for the indexes of all the streams together */
+    if (combined != NULL)
+      memused = MIN (lzma_index_memused (combined), MAX_INDEX_MEMORY);
+    if (!autoar_decoder_xz_decode_index (self, index_offset,
+                                         footer_flags.backward_size,
+                                         MAX_INDEX_MEMORY - memused, &index,
+                                         cancellable, error))
+      goto error;
+
+    stream_offset = index_offset - lzma_index_total_size (index) -
+                    LZMA_STREAM_HEADER_SIZE;
+    if (stream_offset < 0 ||
+        !autoar_decoder_pread (self, stream_offset, buf,
+                               LZMA_STREAM_HEADER_SIZE, cancellable, error) ||
+        lzma_stream_header_decode (&header_flags, buf) != LZMA_OK ||
+        lzma_stream_flags_compare (&header_flags, &footer_flags) != LZMA_OK ||
+        lzma_index_stream_flags (index, &footer_flags) != LZMA_OK ||
+        lzma_index_stream_padding (index, padding) != LZMA_OK) {
+      lzma_index_end (index, NULL);
+      if (error != NULL && *error != NULL)
+        goto error;
+      goto invalid;
+    }
+
+    if (combined != NULL && lzma_index_cat (index, combined, NULL) != LZMA_OK) {
+      lzma_index_end (index, NULL);
+      goto invalid;
+    }
+
+    combined = index;
+    pos = stream_offset;
+  }
+
+  if (combined == NULL)
+    goto invalid;
+
+  lzma_index_iter_init (&iter, combined);
+  while (!lzma_index_iter_next (&iter, LZMA_INDEX_ITER_BLOCK)) {
+    AutoarDecoderPoint point = { 0 };
+
+    point.in_offset = iter.block.compressed_file_offset;
+    point.out_offset = iter.block.uncompressed_file_offset;
+    point.unpadded_size = iter.block.unpadded_size;
+    point.uncompressed_size = iter.block.uncompressed_size;
+    point.check = iter.stream.flags->check;
+
+    g_array_append_val (self->points, point);
+  }
+
+  g_debug ("autoar_decoder_xz_init: %u blocks", self->points->len);
+
+  lzma_index_end (combined, NULL);
+
+  self->filters[0].id = LZMA_VLI_UNKNOWN;
+
+  return autoar_decoder_reset_input (self, 0, cancellable, error);
+
+invalid:
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid xz data");
+error:
+  if (combined != NULL)
+    lzma_index_end (combined, NULL);
+  return FALSE;
+}
+
+static gboolean
+autoar_decoder_xz_start_block (AutoarDecoder  *self,
+                               GCancellable   *cancellable,
+                               GError        **error)
+{
+  AutoarDecoderPoint *point;
+  gssize avail;
+  guint32 header_size;
+
+  point = &g_array_index (self->points, AutoarDecoderPoint, self->current_block);
+
+  /* Blocks of one stream follow each other, the streams are separated by
+   * their index, footer and header. */
+  if (self->in_offset + self->in_pos != point->in_offset &&
+      !autoar_decoder_reset_input (self, point->in_offset, cancellable, error))
+    return FALSE;
+
+  avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+  if (avail < 0)
+    return FALSE;
+  if (avail == 0) {
+    autoar_decoder_set_truncated_error (error);
+    return FALSE;
+  }
+
+  header_size = lzma_block_header_size_decode (self->in_buf[self->in_pos]);
+  avail = autoar_decoder_ensure_input (self, header_size, cancellable, error);
+  if (avail < 0)
+    return FALSE;
+  if (avail < header_size) {
+    autoar_decoder_set_truncated_error (error);
+    return FALSE;
+  }
+
+  /* The block decoder keeps a pointer to self->block */
+  memset (&self->block, 0, sizeof (self->block));
+  self->block.version = 1;
+  self->block.check = point->check;
+  self->block.filters = self->filters;
+  self->block.header_size = header_size;
+
+  if (lzma_block_header_decode (&self->block, NULL,
+                                self->in_buf + self->in_pos) != LZMA_OK ||
+      lzma_block_compressed_size (&self->block, point->unpadded_size) != LZMA_OK ||
+      lzma_block_decoder (&self->ls, &self->block) != LZMA_OK) {
+    autoar_decoder_xz_free_filters (self);
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Invalid xz block header");
+    return FALSE;
+  }
+
+  /* The options are copied by the block decoder */
+  autoar_decoder_xz_free_filters (self);
+
+  self->in_pos += header_size;
+  self->in_block = TRUE;
+
+  return TRUE;
+}
+
+static gssize
+autoar_decoder_xz_read (AutoarDecoder  *self,
+                        guint8         *buffer,
+                        gsize           count,
+                        GCancellable   *cancellable,
+                        GError        **error)
+{
+  gsize produced = 0;
+
+  while (produced < count && !self->eof) {
+    gssize avail;
+    gsize out_size;
+    lzma_ret ret;
+
+    if (!self->in_block) {
+      if (self->current_block >= self->points->len) {
+        self->eof = TRUE;
+        break;
+      }
+
+      if (!autoar_decoder_xz_start_block (self, cancellable, error))
+        return -1;
+    }
+
+    avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+    if (avail < 0)
+      return -1;
+
+    out_size = count - produced;
+    self->ls.next_in = self->in_buf + self->in_pos;
+    self->ls.avail_in = avail;
+    self->ls.next_out = buffer + produced;
+    self->ls.avail_out = out_size;
+
+    ret = lzma_code (&self->ls, LZMA_RUN);
+
+    out_size -= self->ls.avail_out;
+    produced += out_size;
+    self->out_pos += out_size;
+    self->in_pos = self->ls.next_in - self->in_buf;
+
+    if (ret == LZMA_STREAM_END) {
+      self->in_block = FALSE;
+      self->current_block++;
+
+      /* Let the thread pool decode the next blocks */
+      if (self->pool != NULL)
+        break;
+      continue;
+    }
+
+    if (ret == LZMA_BUF_ERROR || (ret == LZMA_OK && avail == 0 && out_size == 0)) {
+      autoar_decoder_set_truncated_error (error);
+      return -1;
+    }
+
+    if (ret != LZMA_OK) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid xz data: error %d", ret);
+      return -1;
+    }
+  }
+
+  return produced;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void
+autoar_decoder_zstd_add_point (AutoarDecoder *self,
+                               gint64         in_offset)
+{
+  AutoarDecoderPoint point = { 0 };
+
+  point.in_offset = in_offset;
+  point.out_offset = self->out_pos;
+
+  g_array_append_val (self->points, point);
+
+  g_debug ("autoar_decoder_zstd_add_point: %" G_GINT64_FORMAT
+           " -> %" G_GINT64_FORMAT,
+           point.in_offset, point.out_offset);
+}
+
+static gssize
+autoar_decoder_zstd_read (AutoarDecoder  *self,
+                          guint8         *buffer,
+                          gsize           count,
+                          GCancellable   *cancellable,
+                          GError        **error)
+{
+  gsize produced = 0;
+
+  while (produced < count && !self->eof) {
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    gssize avail;
+    gsize out_size;
+    size_t ret;
+
+    avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+    if (avail < 0)
+      return -1;
+    if (avail == 0 && self->frame_done) {
+      self->eof = TRUE;
+      break;
+    }
+
+    in.src = self->in_buf;
+    in.size = self->in_len;
+    in.pos = self->in_pos;
+    out.dst = buffer;
+    out.size = count;
+    out.pos = produced;
+
+    ret = ZSTD_decompressStream (self->zds, &out, &in);
+    if (ZSTD_isError (ret)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid zstd data: %s", ZSTD_getErrorName (ret));
+      return -1;
+    }
+
+    out_size = out.pos - produced;
+    produced = out.pos;
+    self->out_pos += out_size;
+    self->in_pos = in.pos;
+
+    if (avail == 0 && out_size == 0) {
+      autoar_decoder_set_truncated_error (error);
+      return -1;
+    }
+
+    /* Zero is returned when a frame is completely decoded and flushed */
+    self->frame_done = (ret == 0);
+    if (self->frame_done && autoar_decoder_should_add_point (self))
+      autoar_decoder_zstd_add_point (self, self->in_offset + self->in_pos);
+
+    /* Let the thread pool decode the next frames */
+    if (self->frame_done && self->pool != NULL)
+      break;
+  }
+
+  return produced;
+}
+#endif
+
+static void
+autoar_decoder_job_free (AutoarDecoderJob *job)
+{
+  g_free (job->in);
+  g_free (job->out);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+#ifdef HAVE_LZMA
+static void
+autoar_decoder_job_run_xz (AutoarDecoderJob *job)
+{
+  lzma_block block = { 0 };
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  size_t in_pos, out_pos = 0;
+  lzma_ret ret;
+  int i;
+
+  block.version = 1;
+  block.check = job->check;
+  block.filters = filters;
+  block.header_size = lzma_block_header_size_decode (job->in[0]);
+
+  if (block.header_size > job->in_size ||
+      lzma_block_header_decode (&block, NULL, job->in) != LZMA_OK) {
+    g_set_error_literal (&job->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Invalid xz block header");
+    return;
+  }
+
+  ret = lzma_block_compressed_size (&block, job->unpadded_size);
+  if (ret == LZMA_OK) {
+    in_pos = block.header_size;
+    ret = lzma_block_buffer_decode (&block, NULL, job->in, &in_pos,
+                                    job->in_size, job->out, &out_pos,
+                                    job->out_size);
+  }
+
+  for (i = 0; i < LZMA_FILTERS_MAX && filters[i].id != LZMA_VLI_UNKNOWN; i++)
+    free (filters[i].options);
+
+  if (ret != LZMA_OK || out_pos != job->out_size)
+    g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "Invalid xz data: error %d", ret);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void
+autoar_decoder_job_run_zstd (AutoarDecoderJob *job)
+{
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in = { job->in, job->in_size, 0 };
+  ZSTD_outBuffer out;
+  size_t ret;
+
+  /* Only frames with a content size up to MAX_UNIT_SIZE are queued, see
+   * autoar_decoder_zstd_cut, so the output never grows beyond it */
+  out.dst = job->out;
+  out.size = job->out_size;
+  out.pos = 0;
+
+  dctx = ZSTD_createDCtx ();
+  do {
+    gsize in_pos = in.pos;
+    gsize out_pos = out.pos;
+
+    ret = ZSTD_decompressStream (dctx, &out, &in);
+
+    if (ZSTD_isError (ret)) {
+      g_set_error (&job->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid zstd data: %s", ZSTD_getErrorName (ret));
+      break;
+    }
+
+    if (ret != 0 && in.pos == in_pos && out.pos == out_pos) {
+      if (in.pos == in.size)
+        autoar_decoder_set_truncated_error (&job->error);
+      else
+        g_set_error_literal (&job->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Invalid zstd data: content size exceeded");
+      break;
+    }
+  } while (ret != 0);
+
+  if (job->error == NULL && out.pos != out.size)
+    g_set_error_literal (&job->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Invalid zstd data: content size mismatch");
+
+  ZSTD_freeDCtx (dctx);
+}
+#endif
+
+static void
+autoar_decoder_job_run (gpointer data,
+                        gpointer user_data)
+{
+  AutoarDecoderJob *job = data;
+  AutoarDecoder *self = user_data;
+
+  if (!g_atomic_int_get (&job->cancelled)) {
+#ifdef HAVE_LZMA
+    if (job->type == AUTOAR_DECODER_XZ)
+      autoar_decoder_job_run_xz (job);
+#endif
+#ifdef HAVE_ZSTD
+    if (job->type == AUTOAR_DECODER_ZSTD)
+      autoar_decoder_job_run_zstd (job);
+#endif
+  }
+
+  g_mutex_lock (&self->lock);
+  job->done = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Waits for the queued jobs and throws them away */
+static void
+autoar_decoder_drain (AutoarDecoder *self)
+{
+  AutoarDecoderJob *job;
+  GList *l;
+
+  for (l = self->jobs.head; l != NULL; l = l->next) {
+    job = l->data;
+    g_atomic_int_set (&job->cancelled, TRUE);
+  }
+
+  while ((job = g_queue_pop_head (&self->jobs)) != NULL) {
+    g_mutex_lock (&self->lock);
+    while (!job->done)
+      g_cond_wait (&self->cond, &self->lock);
+    g_mutex_unlock (&self->lock);
+
+    autoar_decoder_job_free (job);
+  }
+
+  self->queued_size = 0;
+  self->queue_depth = 1;
+  self->input_done = FALSE;
+  self->input_blocked = FALSE;
+}
+
+/* Moves @size bytes of input to @array, or skips them if @array is NULL */
+static gboolean
+autoar_decoder_take_input (AutoarDecoder  *self,
+                           GByteArray     *array,
+                           gsize           size,
+                           GCancellable   *cancellable,
+                           GError        **error)
+{
+  while (size > 0) {
+    gssize avail;
+    gsize chunk;
+
+    avail = autoar_decoder_ensure_input (self, 1, cancellable, error);
+    if (avail < 0)
+      return FALSE;
+    if (avail == 0) {
+      autoar_decoder_set_truncated_error (error);
+      return FALSE;
+    }
+
+    chunk = MIN (size, (gsize) avail);
+    if (array != NULL)
+      g_byte_array_append (array, self->in_buf + self->in_pos, chunk);
+    self->in_pos += chunk;
+    size -= chunk;
+  }
+
+  return TRUE;
+}
+
+#ifdef HAVE_LZMA
+static AutoarDecoderJob *
+autoar_decoder_xz_cut (AutoarDecoder  *self,
+                       GCancellable   *cancellable,
+                       GError        **error)
+{
+  AutoarDecoderPoint *point;
+  AutoarDecoderJob *job;
+  GByteArray *array;
+  gsize total_size;
+
+  if (self->current_block >= self->points->len) {
+    self->input_done = TRUE;
+    return NULL;
+  }
+
+  point = &g_array_index (self->points, AutoarDecoderPoint, self->current_block);
+  total_size = (point->unpadded_size + 3) & ~(guint64) 3;
+  if (total_size > MAX_UNIT_SIZE || point->uncompressed_size > MAX_UNIT_SIZE) {
+    self->input_blocked = TRUE;
+    return NULL;
+  }
+
+  if (self->in_offset + self->in_pos != point->in_offset &&
+      !autoar_decoder_reset_input (self, point->in_offset, cancellable, error))
+    return NULL;
+
+  array = g_byte_array_sized_new (total_size);
+  if (!autoar_decoder_take_input (self, array, total_size, cancellable, error)) {
+    g_byte_array_unref (array);
+    return NULL;
+  }
+
+  job = g_new0 (AutoarDecoderJob, 1);
+  job->type = AUTOAR_DECODER_XZ;
+  job->in_offset = point->in_offset;
+  job->in_size = array->len;
+  job->in = g_byte_array_free (array, FALSE);
+  job->out_size = point->uncompressed_size;
+  job->out = g_malloc (MAX (job->out_size, 1));
+  job->unpadded_size = point->unpadded_size;
+  job->check = point->check;
+
+  self->current_block++;
+
+  return job;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/* Finds the end of the next frame by walking the block headers, see
+ * RFC 8878, and copies the frame. */
+static AutoarDecoderJob *
+autoar_decoder_zstd_cut (AutoarDecoder  *self,
+                         GCancellable   *cancellable,
+                         GError        **error)
+{
+  static const gsize dict_id_sizes[] = { 0, 1, 2, 4 };
+  static const gsize content_size_sizes[] = { 0, 2, 4, 8 };
+  AutoarDecoderJob *job;
+  GByteArray *array;
+  gint64 in_offset;
+  const guint8 *header;
+  guint32 magic;
+  guint8 descriptor;
+  gsize header_size;
+  gboolean last_block = FALSE;
+  unsigned long long content_size;
+  gssize avail;
+
+  avail = autoar_decoder_ensure_input (self, 18, cancellable, error);
+  if (avail < 0)
+    return NULL;
+  if (avail == 0) {
+    self->input_done = TRUE;
+    return NULL;
+  }
+  if (avail < 8)
+    goto invalid;
+
+  in_offset = self->in_offset + self->in_pos;
+  header = self->in_buf + self->in_pos;
+  magic = header[0] | header[1] << 8 | header[2] << 16 | (guint32) header[3] << 24;
+
+  /* Skippable frames hold their size after the magic number */
+  if ((magic & 0xfffffff0) == 0x184d2a50) {
+    guint32 size = header[4] | header[5] << 8 | header[6] << 16 | (guint32) header[7] << 24;
+
+    if (!autoar_decoder_take_input (self, NULL, (gsize) size + 8, cancellable, error))
+      return NULL;
+
+    /* No job, but no error either */
+    return autoar_decoder_zstd_cut (self, cancellable, error);
+  }
+
+  if (magic != 0xfd2fb528)
+    goto invalid;
+
+  descriptor = header[4];
+  header_size = 5 + ((descriptor & 0x20) ? 0 : 1) +
+                dict_id_sizes[descriptor & 3] +
+                content_size_sizes[descriptor >> 6] +
+                ((descriptor >> 6) == 0 && (descriptor & 0x20) ? 1 : 0);
+  if ((gsize) avail < header_size)
+    goto invalid;
+
+  /* Frames without a content size are streamed by the calling thread, as
+   * nothing bounds the memory needed to decode them at once */
+  content_size = ZSTD_getFrameContentSize (header, header_size);
+  if (content_size == ZSTD_CONTENTSIZE_ERROR)
+    goto invalid;
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size > MAX_UNIT_SIZE) {
+    self->input_blocked = TRUE;
+    return NULL;
+  }
+
+  array = g_byte_array_new ();
+  if (!autoar_decoder_take_input (self, array, header_size, cancellable, error))
+    goto error;
+
+  while (!last_block) {
+    guint32 block_header;
+    gsize block_size;
+
+    avail = autoar_decoder_ensure_input (self, 3, cancellable, error);
+    if (avail < 0)
+      goto error;
+    if (avail < 3) {
+      autoar_decoder_set_truncated_error (error);
+      goto error;
+    }
+
+    header = self->in_buf + self->in_pos;
+    block_header = header[0] | header[1] << 8 | header[2] << 16;
+    last_block = block_header & 1;
+
+    /* Raw, RLE, compressed and reserved blocks */
+    switch ((block_header >> 1) & 3) {
+      case 1:
+        block_size = 1;
+        break;
+      case 3:
+        g_byte_array_unref (array);
+        goto invalid;
+      default:
+        block_size = block_header >> 3;
+        break;
+    }
+
+    if (array->len + 3 + block_size > MAX_UNIT_SIZE) {
+      g_byte_array_unref (array);
+      if (!autoar_decoder_reset_input (self, in_offset, cancellable, error))
+        return NULL;
+      self->input_blocked = TRUE;
+      return NULL;
+    }
+
+    if (!autoar_decoder_take_input (self, array, 3 + block_size, cancellable, error))
+      goto error;
+  }
+
+  /* Content checksum */
+  if ((descriptor & 0x04) &&
+      !autoar_decoder_take_input (self, array, 4, cancellable, error))
+    goto error;
+
+  job = g_new0 (AutoarDecoderJob, 1);
+  job->type = AUTOAR_DECODER_ZSTD;
+  job->in_offset = in_offset;
+  job->in_size = array->len;
+  job->in = g_byte_array_free (array, FALSE);
+  job->out_size = content_size;
+  job->out = g_malloc (MAX (job->out_size, 1));
+
+  return job;
+
+invalid:
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid zstd data");
+  return NULL;
+
+error:
+  g_byte_array_unref (array);
+  return NULL;
+}
+#endif
+
+/* Reads units of input and queues them until enough work is queued. The
+ * queue grows while the output is read, so that a read of a few bytes after
+ * seeking does not decode many units. */
+static gboolean
+autoar_decoder_fill_queue (AutoarDecoder  *self,
+                           GCancellable   *cancellable,
+                           GError        **error)
+{
+  while (self->jobs.length < self->queue_depth &&
+         self->queued_size < MAX_QUEUED_SIZE &&
+         !self->input_done && !self->input_blocked) {
+    g_autoptr (GError) local_error = NULL;
+    AutoarDecoderJob *job = NULL;
+
+    switch (self->type) {
+#ifdef HAVE_LZMA
+      case AUTOAR_DECODER_XZ:
+        job = autoar_decoder_xz_cut (self, cancellable, &local_error);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+      case AUTOAR_DECODER_ZSTD:
+        job = autoar_decoder_zstd_cut (self, cancellable, &local_error);
+        break;
+#endif
+      default:
+        g_assert_not_reached ();
+    }
+
+    if (local_error != NULL) {
+      g_propagate_error (error, g_steal_pointer (&local_error));
+      return FALSE;
+    }
+
+    if (job == NULL)
+      break;
+
+    job->queued_size = job->in_size + job->out_size;
+    g_queue_push_tail (&self->jobs, job);
+    self->queued_size += job->queued_size;
+    g_thread_pool_push (self->pool, job, NULL);
+  }
+
+  return TRUE;
+}
+
+static gssize
+autoar_decoder_parallel_read (AutoarDecoder  *self,
+                              guint8         *buffer,
+                              gsize           count,
+                              GCancellable   *cancellable,
+                              GError        **error)
+{
+  gsize produced = 0;
+
+  while (produced < count) {
+    AutoarDecoderJob *job;
+    gsize size;
+
+    if (!autoar_decoder_fill_queue (self, cancellable, error))
+      return -1;
+
+    job = g_queue_peek_head (&self->jobs);
+    if (job == NULL) {
+      if (self->input_done) {
+        self->eof = TRUE;
+        break;
+      }
+
+      /* The next unit is too large, decode it in this thread */
+      g_debug ("autoar_decoder_parallel_read: decoding %" G_GINT64_FORMAT
+               " sequentially", self->in_offset + self->in_pos);
+#ifdef HAVE_ZSTD
+      if (self->type == AUTOAR_DECODER_ZSTD) {
+        ZSTD_DCtx_reset (self->zds, ZSTD_reset_session_only);
+        self->frame_done = TRUE;
+      }
+#endif
+      self->parallel = FALSE;
+      break;
+    }
+
+    g_mutex_lock (&self->lock);
+    while (!job->done)
+      g_cond_wait (&self->cond, &self->lock);
+    g_mutex_unlock (&self->lock);
+
+    if (job->error != NULL) {
+      g_propagate_error (error, g_steal_pointer (&job->error));
+      return -1;
+    }
+
+    if (!job->started) {
+      job->started = TRUE;
+      if (job->type == AUTOAR_DECODER_ZSTD && job->in_offset > 0 &&
+          autoar_decoder_should_add_point (self))
+        autoar_decoder_zstd_add_point (self, job->in_offset);
+    }
+
+    size = MIN (count - produced, job->out_size - job->out_pos);
+    memcpy (buffer + produced, job->out + job->out_pos, size);
+    job->out_pos += size;
+    produced += size;
+    self->out_pos += size;
+
+    if (job->out_pos == job->out_size) {
+      g_queue_pop_head (&self->jobs);
+      self->queued_size -= job->queued_size;
+      self->queue_depth = MIN (self->queue_depth * 2, 2 * self->n_threads);
+      autoar_decoder_job_free (job);
+    }
+  }
+
+  return produced;
+}
+
+static gboolean
+autoar_decoder_restart (AutoarDecoder  *self,
+                        guint           index,
+                        gboolean        from_start,
+                        GCancellable   *cancellable,
+                        GError        **error)
+{
+  AutoarDecoderPoint *point = NULL;
+
+  if (!from_start)
+    point = &g_array_index (self->points, AutoarDecoderPoint, index);
+
+  g_debug ("autoar_decoder_restart: %" G_GINT64_FORMAT,
+           point ? point->out_offset : 0);
+
+  self->eof = FALSE;
+
+  if (self->pool != NULL) {
+    autoar_decoder_drain (self);
+    self->parallel = TRUE;
+  }
+
+  switch (self->type) {
+#ifdef HAVE_ZLIB
+    case AUTOAR_DECODER_GZIP:
+      return autoar_decoder_gzip_restart (self, point, cancellable, error);
+#endif
+#ifdef HAVE_LZMA
+    case AUTOAR_DECODER_XZ:
+      self->in_block = FALSE;
+      self->current_block = from_start ? 0 : index;
+      self->out_pos = point ? point->out_offset : 0;
+      return TRUE;
+#endif
+#ifdef HAVE_ZSTD
+    case AUTOAR_DECODER_ZSTD:
+      if (!autoar_decoder_reset_input (self, point ? point->in_offset : 0,
+                                       cancellable, error))
+        return FALSE;
+      ZSTD_DCtx_reset (self->zds, ZSTD_reset_session_only);
+      self->frame_done = TRUE;
+      self->out_pos = point ? point->out_offset : 0;
+      return TRUE;
+#endif
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+  }
+}
+
+static void
+autoar_decoder_load_seek_points (AutoarDecoder *self,
+                                 GVariant      *seek_points)
+{
+  g_autoptr (GVariantIter) iter = NULL;
+  GVariant *window;
+  guint8 type;
+  gint64 in_offset, out_offset;
+  guint8 bits;
+
+  if (!autoar_decoder_check_seek_points (self, seek_points))
+    return;
+
+  g_variant_get (seek_points, SEEK_POINTS_TYPE, &type, &iter);
+  while (g_variant_iter_next (iter, "(xxy@ay)",
+                              &in_offset, &out_offset, &bits, &window)) {
+    AutoarDecoderPoint point = { 0 };
+    gconstpointer data;
+    gsize size;
+    gint64 last_out_offset;
+
+    last_out_offset = self->points->len > 0 ?
+      g_array_index (self->points, AutoarDecoderPoint, self->points->len - 1).out_offset : 0;
+
+    data = g_variant_get_fixed_array (window, &size, 1);
+    if (in_offset <= 0 || in_offset > self->source_size ||
+        out_offset <= last_out_offset || bits > 7 || size > WINDOW_SIZE) {
+      g_debug ("autoar_decoder_load_seek_points: invalid point");
+      g_variant_unref (window);
+      g_array_set_size (self->points, 0);
+      return;
+    }
+
+    point.in_offset = in_offset;
+    point.out_offset = out_offset;
+    point.bits = bits;
+    if (type == AUTOAR_DECODER_GZIP)
+      point.window = g_bytes_new (data, size);
+
+    g_array_append_val (self->points, point);
+    g_variant_unref (window);
+  }
+}
+
+/**
+ * autoar_decoder_new:
+ * @istream: a seekable #GInputStream of the source archive
+ * @seek_points: (nullable): the restart points stored by a previous decoder
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates a decoder for @istream if it is compressed by one of the supported
+ * compression methods. If not, %NULL is returned without setting @error and
+ * the position of @istream is not changed.
+ *
+ * Returns: (transfer full): a new #AutoarDecoder, or %NULL
+ **/
+AutoarDecoder *
+autoar_decoder_new (GInputStream  *istream,
+                    GVariant      *seek_points,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  AutoarDecoder *self;
+  AutoarDecoderType type = AUTOAR_DECODER_NONE;
+  guint8 magic[6] = { 0 };
+  gsize bytes_read;
+  gint64 source_size;
+  gboolean success = FALSE;
+
+  if (!G_IS_SEEKABLE (istream) || !g_seekable_can_seek (G_SEEKABLE (istream)))
+    return NULL;
+
+  if (!g_input_stream_read_all (istream, magic, sizeof (magic), &bytes_read,
+                                cancellable, error))
+    return NULL;
+
+#ifdef HAVE_ZLIB
+  if (bytes_read >= 3 && magic[0] == 0x1f && magic[1] == 0x8b && magic[2] == 0x08)
+    type = AUTOAR_DECODER_GZIP;
+#endif
+#ifdef HAVE_LZMA
+  if (bytes_read >= 6 && memcmp (magic, "\xfd" "7zXZ\0", 6) == 0)
+    type = AUTOAR_DECODER_XZ;
+#endif
+#ifdef HAVE_ZSTD
+  if (bytes_read >= 4 && memcmp (magic, "\x28\xb5\x2f\xfd", 4) == 0)
+    type = AUTOAR_DECODER_ZSTD;
+#endif
+
+  if (type == AUTOAR_DECODER_NONE) {
+    g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_SET, cancellable, error);
+    return NULL;
+  }
+
+  if (!g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_END, cancellable, error))
+    return NULL;
+  source_size = g_seekable_tell (G_SEEKABLE (istream));
+  if (!g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_SET, cancellable, error))
+    return NULL;
+
+  self = g_new0 (AutoarDecoder, 1);
+  self->type = type;
+  self->istream = g_object_ref (istream);
+  self->source_size = source_size;
+  self->in_buf = g_malloc (INPUT_SIZE);
+  self->points = g_array_new (FALSE, FALSE, sizeof (AutoarDecoderPoint));
+  g_array_set_clear_func (self->points, autoar_decoder_point_clear);
+
+  /* Assume a compression ratio of 4 when choosing the distance */
+  self->span = MAX (MIN_SPAN, source_size / MAX_SEEK_POINTS * 4);
+
+  switch (type) {
+#ifdef HAVE_ZLIB
+    case AUTOAR_DECODER_GZIP:
+      success = autoar_decoder_gzip_init (self);
+      break;
+#endif
+#ifdef HAVE_LZMA
+    case AUTOAR_DECODER_XZ:
+      self->ls = (lzma_stream) LZMA_STREAM_INIT;
+      success = autoar_decoder_xz_init (self, cancellable, error);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case AUTOAR_DECODER_ZSTD:
+      self->zds = ZSTD_createDStream ();
+      self->frame_done = TRUE;
+      success = self->zds != NULL;
+      break;
+#endif
+    default:
+      break;
+  }
+
+  if (!success) {
+    /* Let libarchive handle what the decoder is not able to */
+    g_clear_error (error);
+    autoar_decoder_free (self);
+    g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_SET, cancellable, error);
+    return NULL;
+  }
+
+  if (type != AUTOAR_DECODER_XZ && seek_points != NULL)
+    autoar_decoder_load_seek_points (self, seek_points);
+
+  /* A single xz block can't be split, but the frames of zstd are found
+   * only while reading. */
+  self->n_threads = g_get_num_processors ();
+  if (self->n_threads > 1 &&
+      ((type == AUTOAR_DECODER_XZ && self->points->len > 1) ||
+       type == AUTOAR_DECODER_ZSTD)) {
+    g_mutex_init (&self->lock);
+    g_cond_init (&self->cond);
+    g_queue_init (&self->jobs);
+    self->pool = g_thread_pool_new (autoar_decoder_job_run, self,
+                                    self->n_threads, FALSE, NULL);
+    self->queue_depth = 1;
+    self->parallel = TRUE;
+  }
+
+  g_debug ("autoar_decoder_new: type %d, %u seek points, %u threads",
+           type, self->points->len, self->pool ? self->n_threads : 1);
+
+  return self;
+}
+
+void
+autoar_decoder_free (AutoarDecoder *self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->pool != NULL) {
+    autoar_decoder_drain (self);
+    g_thread_pool_free (self->pool, FALSE, TRUE);
+    g_mutex_clear (&self->lock);
+    g_cond_clear (&self->cond);
+  }
+
+#ifdef HAVE_ZLIB
+  if (self->type == AUTOAR_DECODER_GZIP) {
+    inflateEnd (&self->zs);
+    g_free (self->window);
+  }
+#endif
+#ifdef HAVE_LZMA
+  if (self->type == AUTOAR_DECODER_XZ)
+    lzma_end (&self->ls);
+#endif
+#ifdef HAVE_ZSTD
+  if (self->type == AUTOAR_DECODER_ZSTD && self->zds != NULL)
+    ZSTD_freeDStream (self->zds);
+#endif
+
+  g_array_unref (self->points);
+  g_clear_object (&self->istream);
+  g_free (self->in_buf);
+  g_free (self->discard);
+  g_free (self);
+}
+
+static gssize
+autoar_decoder_read_sequential (AutoarDecoder  *self,
+                                guint8         *buffer,
+                                gsize           count,
+                                GCancellable   *cancellable,
+                                GError        **error)
+{
+  switch (self->type) {
+#ifdef HAVE_ZLIB
+    case AUTOAR_DECODER_GZIP:
+      return autoar_decoder_gzip_read (self, buffer, count, cancellable, error);
+#endif
+#ifdef HAVE_LZMA
+    case AUTOAR_DECODER_XZ:
+      return autoar_decoder_xz_read (self, buffer, count, cancellable, error);
+#endif
+#ifdef HAVE_ZSTD
+    case AUTOAR_DECODER_ZSTD:
+      return autoar_decoder_zstd_read (self, buffer, count, cancellable, error);
+#endif
+    default:
+      g_assert_not_reached ();
+      return -1;
+  }
+}
+
+static gboolean
+autoar_decoder_at_unit_end (AutoarDecoder *self)
+{
+  switch (self->type) {
+#ifdef HAVE_LZMA
+    case AUTOAR_DECODER_XZ:
+      return !self->in_block;
+#endif
+#ifdef HAVE_ZSTD
+    case AUTOAR_DECODER_ZSTD:
+      return self->frame_done;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+gssize
+autoar_decoder_read (AutoarDecoder  *self,
+                     void           *buffer,
+                     gsize           count,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  gsize produced = 0;
+
+  if (self->pool == NULL)
+    return autoar_decoder_read_sequential (self, buffer, count,
+                                           cancellable, error);
+
+  /* The sequential decoders stop at the end of every unit, so the thread
+   * pool takes over again after a unit that was too large for it. */
+  while (produced < count && !self->eof) {
+    gssize read_size;
+
+    if (self->parallel) {
+      read_size = autoar_decoder_parallel_read (self, (guint8 *) buffer + produced,
+                                                count - produced,
+                                                cancellable, error);
+    } else {
+      read_size = autoar_decoder_read_sequential (self, (guint8 *) buffer + produced,
+                                                  count - produced,
+                                                  cancellable, error);
+      if (read_size >= 0 && autoar_decoder_at_unit_end (self)) {
+        self->parallel = TRUE;
+        self->input_blocked = FALSE;
+      }
+    }
+
+    if (read_size < 0)
+      return -1;
+
+    produced += read_size;
+  }
+
+  return produced;
+}
+
+/* Whether the output at @offset is decoded by one of the queued jobs, in
+ * which case it is faster to read up to it than to restart */
+static gboolean
+autoar_decoder_is_queued (AutoarDecoder *self,
+                          gint64         offset)
+{
+#ifdef HAVE_LZMA
+  if (self->type == AUTOAR_DECODER_XZ && self->parallel &&
+      self->jobs.length > 0) {
+    AutoarDecoderPoint *last;
+
+    /* The blocks in front of current_block are queued */
+    last = &g_array_index (self->points, AutoarDecoderPoint,
+                           self->current_block - 1);
+    return offset < last->out_offset + (gint64) last->uncompressed_size;
+  }
+#endif
+
+  return FALSE;
+}
+
+/* Moves to the given offset of the uncompressed stream, restarting at the
+ * nearest restart point in front of it unless reading on from the current
+ * position is shorter. */
+gboolean
+autoar_decoder_seek (AutoarDecoder  *self,
+                     gint64          offset,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  AutoarDecoderPoint *point;
+  guint index = 0;
+
+  point = autoar_decoder_find_point (self, offset, &index);
+  if (offset < self->out_pos ||
+      (point != NULL && point->out_offset > self->out_pos &&
+       !autoar_decoder_is_queued (self, offset))) {
+    if (!autoar_decoder_restart (self, index, point == NULL,
+                                 cancellable, error))
+      return FALSE;
+  }
+
+  if (self->discard == NULL)
+    self->discard = g_malloc (DISCARD_SIZE);
+
+  while (self->out_pos < offset) {
+    gssize read_size;
+
+    read_size = autoar_decoder_read (self, self->discard,
+                                     MIN (DISCARD_SIZE, offset - self->out_pos),
+                                     cancellable, error);
+    if (read_size < 0)
+      return FALSE;
+    if (read_size == 0) {
+      autoar_decoder_set_truncated_error (error);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+gint64
+autoar_decoder_tell (AutoarDecoder *self)
+{
+  return self->out_pos;
+}
+
+/**
+ * autoar_decoder_get_seek_points:
+ * @self: (nullable): an #AutoarDecoder
+ *
+ * Returns: (transfer floating): the restart points to pass to the next
+ * autoar_decoder_new() for the same source
+ **/
+GVariant *
+autoar_decoder_get_seek_points (AutoarDecoder *self)
+{
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xxyay)"));
+
+  /* xz restart points are read from the file every time */
+  for (i = 0; self != NULL && self->type != AUTOAR_DECODER_XZ &&
+              i < self->points->len; i++) {
+    AutoarDecoderPoint *point;
+    gconstpointer data = NULL;
+    gsize size = 0;
+
+    point = &g_array_index (self->points, AutoarDecoderPoint, i);
+    if (point->window != NULL)
+      data = g_bytes_get_data (point->window, &size);
+
+    g_variant_builder_add (&builder, "(xxy@ay)",
+                           point->in_offset, point->out_offset, point->bits,
+                           g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                      data, size, 1));
+  }
+
+  return g_variant_new (SEEK_POINTS_TYPE,
+                        (guint8) (self ? self->type : AUTOAR_DECODER_NONE),
+                        &builder);
+}
+
+/* Checks whether the offsets recorded while reading through a decoder, or
+ * without any decoder if @self is %NULL, are valid for @self. */
+gboolean
+autoar_decoder_check_seek_points (AutoarDecoder *self,
+                                  GVariant      *seek_points)
+{
+  guint8 type;
+
+  if (seek_points == NULL ||
+      !g_variant_is_of_type (seek_points, G_VARIANT_TYPE (SEEK_POINTS_TYPE)))
+    return FALSE;
+
+  g_variant_get_child (seek_points, 0, "y", &type);
+
+  return type == (self ? self->type : AUTOAR_DECODER_NONE);
+}
@@ -0,0 +1,59 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-decoder.h
+ * Seekable decompression of gzip, xz and zstd archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_DECODER_H
+#define AUTOAR_DECODER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _AutoarDecoder AutoarDecoder;
+
+AutoarDecoder* autoar_decoder_new                 (GInputStream *istream,
+                                                   GVariant *seek_points,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+void           autoar_decoder_free                (AutoarDecoder *self);
+
+gssize         autoar_decoder_read                (AutoarDecoder *self,
+                                                   void *buffer,
+                                                   gsize count,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+gboolean       autoar_decoder_seek                (AutoarDecoder *self,
+                                                   gint64 offset,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+gint64         autoar_decoder_tell                (AutoarDecoder *self);
+
+GVariant*      autoar_decoder_get_seek_points     (AutoarDecoder *self);
+gboolean       autoar_decoder_check_seek_points   (AutoarDecoder *self,
+                                                   GVariant *seek_points);
+
+G_END_DECLS
+
+#endif /* AUTOAR_DECODER_H */
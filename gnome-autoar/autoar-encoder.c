@@ -0,0 +1,549 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-encoder.c
+ * Parallel gzip and zstd compression
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-encoder.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#if defined HAVE_ZLIB || defined HAVE_ZSTD
+# define HAVE_ENCODER
+#endif
+
+/* AutoarEncoder writes a single gzip member the same way as pigz does. The
+ * input is split into chunks, which are compressed by a pool of threads as
+ * separate raw deflate streams. Each stream is primed with the last 32 KiB
+ * of the previous chunk as the dictionary, so the ratio is almost the same
+ * as of a single stream, and all but the last one end with a sync flush,
+ * which aligns them to bytes. The concatenated streams are one valid
+ * deflate stream. The CRC-32 of the chunks is combined in order.
+ *
+ * Rsyncable output is made by cutting the chunks where a rolling hash of
+ * the last bytes of the input, the shift-xor hash which pigz --rsyncable
+ * masks to its low bits, hits a given value, instead of at a fixed size.
+ * The chunks then only depend on the content, and the output of each one
+ * only depends on its input and on the dictionary, so a change of the input
+ * only changes the output of its chunk and of the next one. The chunks
+ * still have a minimum size, so repeated patterns don't cut them into tiny
+ * pieces, and a maximum one.
+ *
+ * zstd is only written this way when it is rsyncable, since libarchive
+ * uses the multithreaded encoder of libzstd otherwise. The chunks are
+ * compressed as separate frames, which are concatenated, so they are
+ * larger. */
+
+#define CHUNK_SIZE (128 * 1024)
+#define WINDOW_SIZE (32 * 1024)
+#define ZSTD_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* The hash hits every 2^bits bytes on average */
+#define RSYNC_BITS 15
+#define RSYNC_MIN_SIZE (16 * 1024)
+#define ZSTD_RSYNC_BITS 20
+#define ZSTD_RSYNC_MIN_SIZE (256 * 1024)
+
+typedef struct _AutoarEncoderJob AutoarEncoderJob;
+
+struct _AutoarEncoderJob
+{
+  guint8 *in;
+  gsize in_size;
+  guint8 *dictionary;
+  gsize dictionary_size;
+  gboolean last;
+
+  guint8 *out;
+  gsize out_size;
+  guint32 crc;
+
+  gboolean done;
+  gboolean failed;
+};
+
+struct _AutoarEncoder
+{
+  int level;
+  guint n_threads;
+  gboolean zstd;
+  gsize chunk_capacity;
+
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+  GQueue jobs;
+
+  /* Input of the next job */
+  guint8 *chunk;
+  gsize chunk_size;
+
+  /* Tail of the input of the last job */
+  guint8 window[WINDOW_SIZE];
+  gsize window_size;
+
+  gboolean rsyncable;
+  guint32 rsync_mask;
+  guint32 rsync_hash;
+  gsize rsync_min_size;
+
+  gboolean header_written;
+  guint32 crc;
+  guint64 size;
+};
+
+#ifdef HAVE_ENCODER
+static void
+autoar_encoder_job_free (AutoarEncoderJob *job)
+{
+  g_free (job->in);
+  g_free (job->dictionary);
+  g_free (job->out);
+  g_free (job);
+}
+
+#ifdef HAVE_ZLIB
+static gboolean
+autoar_encoder_deflate (AutoarEncoder    *self,
+                        AutoarEncoderJob *job)
+{
+  z_stream zs = { 0 };
+  gsize out_capacity;
+  int ret;
+
+  job->crc = crc32 (0, job->in, job->in_size);
+
+  ret = deflateInit2 (&zs, self->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  if (ret == Z_OK && job->dictionary_size > 0)
+    ret = deflateSetDictionary (&zs, job->dictionary, job->dictionary_size);
+
+  if (ret == Z_OK) {
+    /* A sync flush adds an empty stored block to the bound */
+    out_capacity = deflateBound (&zs, job->in_size) + 16;
+    job->out = g_malloc (out_capacity);
+    job->out_size = 0;
+
+    zs.next_in = job->in;
+    zs.avail_in = job->in_size;
+
+    /* The flush is only complete if deflate leaves space in the output */
+    do {
+      if (job->out_size == out_capacity) {
+        out_capacity *= 2;
+        job->out = g_realloc (job->out, out_capacity);
+      }
+
+      zs.next_out = job->out + job->out_size;
+      zs.avail_out = out_capacity - job->out_size;
+
+      ret = deflate (&zs, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+      job->out_size = out_capacity - zs.avail_out;
+    } while (ret == Z_OK && (job->last || zs.avail_out == 0));
+
+    if (ret == (job->last ? Z_STREAM_END : Z_OK) && zs.avail_in == 0)
+      ret = Z_OK;
+    else
+      ret = Z_STREAM_ERROR;
+  }
+
+  deflateEnd (&zs);
+
+  return ret == Z_OK;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static gboolean
+autoar_encoder_compress_zstd (AutoarEncoder    *self,
+                              AutoarEncoderJob *job)
+{
+  gsize out_capacity;
+  size_t ret;
+
+  out_capacity = ZSTD_compressBound (job->in_size);
+  job->out = g_malloc (out_capacity);
+
+  ret = ZSTD_compress (job->out, out_capacity, job->in, job->in_size,
+                       self->level >= 0 ? self->level : ZSTD_CLEVEL_DEFAULT);
+  if (ZSTD_isError (ret))
+    return FALSE;
+
+  job->out_size = ret;
+
+  return TRUE;
+}
+#endif
+
+static void
+autoar_encoder_job_run (gpointer data,
+                        gpointer user_data)
+{
+  AutoarEncoderJob *job = data;
+  AutoarEncoder *self = user_data;
+  gboolean ok = FALSE;
+
+#ifdef HAVE_ZSTD
+  if (self->zstd)
+    ok = autoar_encoder_compress_zstd (self, job);
+#endif
+#ifdef HAVE_ZLIB
+  if (!self->zstd)
+    ok = autoar_encoder_deflate (self, job);
+#endif
+
+  g_mutex_lock (&self->lock);
+  job->failed = !ok;
+  job->done = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Writes the compressed chunks in order, the first one is waited for if
+ * @wait is set */
+static gboolean
+autoar_encoder_flush (AutoarEncoder  *self,
+                      GOutputStream  *ostream,
+                      gboolean        wait,
+                      GCancellable   *cancellable,
+                      GError        **error)
+{
+  AutoarEncoderJob *job;
+
+  if (!self->header_written && !self->zstd) {
+    /* Magic, deflate, no flags, no time, no extra flags, unix */
+    static const guint8 header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+    if (!g_output_stream_write_all (ostream, header, sizeof (header),
+                                    NULL, cancellable, error))
+      return FALSE;
+
+    self->header_written = TRUE;
+  }
+
+  while ((job = g_queue_peek_head (&self->jobs)) != NULL) {
+    gboolean ok;
+
+    g_mutex_lock (&self->lock);
+    while (wait && !job->done)
+      g_cond_wait (&self->cond, &self->lock);
+    ok = job->done;
+    g_mutex_unlock (&self->lock);
+
+    if (!ok)
+      break;
+
+    wait = FALSE;
+    g_queue_pop_head (&self->jobs);
+
+    if (job->failed) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Failed to compress data");
+      autoar_encoder_job_free (job);
+      return FALSE;
+    }
+
+#ifdef HAVE_ZLIB
+    if (!self->zstd)
+      self->crc = crc32_combine (self->crc, job->crc, job->in_size);
+#endif
+    self->size += job->in_size;
+
+    ok = g_output_stream_write_all (ostream, job->out, job->out_size,
+                                    NULL, cancellable, error);
+    autoar_encoder_job_free (job);
+    if (!ok)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+autoar_encoder_push (AutoarEncoder *self,
+                     gboolean       last)
+{
+  AutoarEncoderJob *job;
+
+  job = g_new0 (AutoarEncoderJob, 1);
+  job->in = g_steal_pointer (&self->chunk);
+  job->in_size = self->chunk_size;
+  if (self->window_size > 0) {
+    job->dictionary = g_malloc (self->window_size);
+    memcpy (job->dictionary, self->window, self->window_size);
+    job->dictionary_size = self->window_size;
+  }
+  job->last = last;
+
+  /* The tail of this chunk is the dictionary of the next one, zstd frames
+   * have none */
+  if (self->zstd) {
+    self->window_size = 0;
+  } else if (job->in_size >= WINDOW_SIZE) {
+    memcpy (self->window, job->in + job->in_size - WINDOW_SIZE, WINDOW_SIZE);
+    self->window_size = WINDOW_SIZE;
+  } else {
+    gsize keep = MIN (self->window_size, WINDOW_SIZE - job->in_size);
+
+    memmove (self->window, self->window + self->window_size - keep, keep);
+    memcpy (self->window + keep, job->in, job->in_size);
+    self->window_size = keep + job->in_size;
+  }
+
+  self->chunk = g_malloc (self->chunk_capacity);
+  self->chunk_size = 0;
+
+  g_queue_push_tail (&self->jobs, job);
+  g_thread_pool_push (self->pool, job, NULL);
+}
+
+/* Returns how many of the @count bytes of @data belong to the current
+ * chunk, which ends after them if @boundary is set. Each byte is xored into
+ * the hash shifted by one bit, like in pigz, so the masked hash only
+ * depends on the last RSYNC_BITS bytes. */
+static gsize
+autoar_encoder_scan (AutoarEncoder *self,
+                     const guint8  *data,
+                     gsize          count,
+                     gboolean      *boundary)
+{
+  guint32 hit = self->rsync_mask >> 1;
+  gsize i;
+
+  *boundary = FALSE;
+
+  for (i = 0; i < count; i++) {
+    self->rsync_hash = ((self->rsync_hash << 1) ^ data[i]) & self->rsync_mask;
+    if (self->rsync_hash == hit &&
+        self->chunk_size + i + 1 >= self->rsync_min_size) {
+      *boundary = TRUE;
+      return i + 1;
+    }
+  }
+
+  return count;
+}
+
+static AutoarEncoder *
+autoar_encoder_new_full (int      level,
+                         guint    n_threads,
+                         gboolean zstd)
+{
+  AutoarEncoder *self;
+
+  self = g_new0 (AutoarEncoder, 1);
+  self->level = level;
+  self->n_threads = MAX (n_threads, 1);
+  self->zstd = zstd;
+  self->chunk_capacity = zstd ? ZSTD_CHUNK_SIZE : CHUNK_SIZE;
+  self->chunk = g_malloc (self->chunk_capacity);
+  self->rsync_mask = (1 << (zstd ? ZSTD_RSYNC_BITS : RSYNC_BITS)) - 1;
+  self->rsync_min_size = zstd ? ZSTD_RSYNC_MIN_SIZE : RSYNC_MIN_SIZE;
+#ifdef HAVE_ZLIB
+  self->crc = crc32 (0, NULL, 0);
+#endif
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->jobs);
+  self->pool = g_thread_pool_new (autoar_encoder_job_run, self,
+                                  self->n_threads, FALSE, NULL);
+
+  g_debug ("autoar_encoder_new: %s, level %d, %u threads",
+           zstd ? "zstd" : "gzip", level, self->n_threads);
+
+  return self;
+}
+#endif
+
+/**
+ * autoar_encoder_new:
+ * @level: the zlib compression level, or -1 for the default
+ * @n_threads: the number of threads
+ *
+ * Returns: (transfer full): a new #AutoarEncoder, or %NULL if gnome-autoar
+ * was built without zlib
+ **/
+AutoarEncoder *
+autoar_encoder_new (int   level,
+                    guint n_threads)
+{
+#ifdef HAVE_ZLIB
+  return autoar_encoder_new_full (level, n_threads, FALSE);
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * autoar_encoder_new_zstd:
+ * @level: the zstd compression level, or -1 for the default
+ * @n_threads: the number of threads
+ *
+ * Creates an encoder which writes a frame per chunk, which is only worth it
+ * if it is rsyncable. See autoar_encoder_set_rsyncable().
+ *
+ * Returns: (transfer full): a new #AutoarEncoder, or %NULL if gnome-autoar
+ * was built without libzstd
+ **/
+AutoarEncoder *
+autoar_encoder_new_zstd (int   level,
+                         guint n_threads)
+{
+#ifdef HAVE_ZSTD
+  return autoar_encoder_new_full (level, n_threads, TRUE);
+#else
+  return NULL;
+#endif
+}
+
+void
+autoar_encoder_free (AutoarEncoder *self)
+{
+#ifdef HAVE_ENCODER
+  AutoarEncoderJob *job;
+
+  if (self == NULL)
+    return;
+
+  /* Let the running jobs finish before freeing them */
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+  while ((job = g_queue_pop_head (&self->jobs)) != NULL)
+    autoar_encoder_job_free (job);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_free (self->chunk);
+  g_free (self);
+#endif
+}
+
+/**
+ * autoar_encoder_set_rsyncable:
+ * @self: an #AutoarEncoder
+ * @rsyncable: whether to reset the compressor at boundaries which only
+ * depend on the content
+ *
+ * Makes a change of the input only change the output up to the next
+ * boundary after it, at the cost of a slightly worse ratio. This function
+ * should only be called before writing.
+ **/
+void
+autoar_encoder_set_rsyncable (AutoarEncoder *self,
+                              gboolean       rsyncable)
+{
+  self->rsyncable = rsyncable;
+}
+
+gboolean
+autoar_encoder_write (AutoarEncoder  *self,
+                      GOutputStream  *ostream,
+                      const void     *buffer,
+                      gsize           count,
+                      GCancellable   *cancellable,
+                      GError        **error)
+{
+#ifdef HAVE_ENCODER
+  const guint8 *data = buffer;
+
+  while (count > 0) {
+    gboolean boundary = FALSE;
+    gsize size;
+
+    size = MIN (count, self->chunk_capacity - self->chunk_size);
+    if (self->rsyncable)
+      size = autoar_encoder_scan (self, data, size, &boundary);
+
+    memcpy (self->chunk + self->chunk_size, data, size);
+    self->chunk_size += size;
+    data += size;
+    count -= size;
+
+    if (!boundary && self->chunk_size < self->chunk_capacity)
+      break;
+
+    autoar_encoder_push (self, FALSE);
+
+    /* Keep all threads busy, but don't queue up the whole input */
+    if (!autoar_encoder_flush (self, ostream,
+                               self->jobs.length >= 2 * self->n_threads,
+                               cancellable, error))
+      return FALSE;
+  }
+
+  return TRUE;
+#else
+  g_assert_not_reached ();
+  return FALSE;
+#endif
+}
+
+/* Compresses the rest of the input and writes the gzip trailer */
+gboolean
+autoar_encoder_finish (AutoarEncoder  *self,
+                       GOutputStream  *ostream,
+                       GCancellable   *cancellable,
+                       GError        **error)
+{
+#ifdef HAVE_ENCODER
+  guint8 trailer[8];
+  guint32 size;
+
+  autoar_encoder_push (self, TRUE);
+
+  while (self->jobs.length > 0) {
+    if (!autoar_encoder_flush (self, ostream, TRUE, cancellable, error))
+      return FALSE;
+  }
+
+  g_debug ("autoar_encoder_finish: %" G_GUINT64_FORMAT " bytes", self->size);
+
+  if (self->zstd)
+    return TRUE;
+
+  /* CRC-32 and size modulo 2^32, both little endian */
+  size = (guint32) self->size;
+  trailer[0] = self->crc;
+  trailer[1] = self->crc >> 8;
+  trailer[2] = self->crc >> 16;
+  trailer[3] = self->crc >> 24;
+  trailer[4] = size;
+  trailer[5] = size >> 8;
+  trailer[6] = size >> 16;
+  trailer[7] = size >> 24;
+
+  return g_output_stream_write_all (ostream, trailer, sizeof (trailer),
+                                    NULL, cancellable, error);
+#else
+  g_assert_not_reached ();
+  return FALSE;
+#endif
+}
@@ -0,0 +1,58 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-encoder.h
+ * Parallel gzip and zstd compression
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_ENCODER_H
+#define AUTOAR_ENCODER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _AutoarEncoder AutoarEncoder;
+
+AutoarEncoder* autoar_encoder_new                 (int level,
+                                                   guint n_threads);
+AutoarEncoder* autoar_encoder_new_zstd            (int level,
+                                                   guint n_threads);
+void           autoar_encoder_free                (AutoarEncoder *self);
+
+void           autoar_encoder_set_rsyncable       (AutoarEncoder *self,
+                                                   gboolean rsyncable);
+
+gboolean       autoar_encoder_write               (AutoarEncoder *self,
+                                                   GOutputStream *ostream,
+                                                   const void *buffer,
+                                                   gsize count,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+gboolean       autoar_encoder_finish              (AutoarEncoder *self,
+                                                   GOutputStream *ostream,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+
+G_END_DECLS
+
+#endif /* AUTOAR_ENCODER_H */
@@ -26,8 +26,11 @@
 #include "config.h"
 #include "autoar-extractor.h"
 
+#include "autoar-decoder.h"
+#include "autoar-enum-types.h"
 #include "autoar-misc.h"
 #include "autoar-private.h"
+#include "autoar-volumes.h"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -96,6 +99,8 @@ G_DEFINE_QUARK (autoar-extractor, autoar_extractor)
 
 #define BUFFER_SIZE (64 * 1024)
 
+#define DEFAULT_RENAME_PATTERN "%b (%n)%e"
+
 typedef struct _GFileAndInfo GFileAndInfo;
 
 struct _AutoarExtractor
@@ -106,6 +111,8 @@ struct _AutoarExtractor
   GFile *output_file;
 
   char *source_basename;
+  /* The volumes of the source, if it is split */
+  GPtrArray *volumes;
 
   int output_is_dest : 1;
   gboolean delete_after_extraction;
@@ -146,6 +153,21 @@ struct _AutoarExtractor
 
   gchar *passphrase;
   gboolean passphrase_requested;
+
+  AutoarArchiveIndex *index;
+  gboolean use_index_cache;
+  gint64 start_offset;
+
+  /* Decompresses the source instead of libarchive, see AutoarDecoder */
+  AutoarDecoder *decoder;
+  gboolean use_decoder;
+  gboolean decode;
+
+  AutoarConflictPolicy conflict_policy;
+  char *rename_pattern;
+  AutoarConflictFunc conflict_func;
+  gpointer conflict_data;
+  GDestroyNotify conflict_notify;
 };
 
 G_DEFINE_TYPE (AutoarExtractor, autoar_extractor, G_TYPE_OBJECT)
@@ -180,7 +202,11 @@ enum
   PROP_COMPLETED_FILES,
   PROP_OUTPUT_IS_DEST,
   PROP_DELETE_AFTER_EXTRACTION,
-  PROP_NOTIFY_INTERVAL
+  PROP_NOTIFY_INTERVAL,
+  PROP_USE_INDEX_CACHE,
+  PROP_USE_DECODER,
+  PROP_CONFLICT_POLICY,
+  PROP_RENAME_PATTERN
 };
 
 static guint autoar_extractor_signals[LAST_SIGNAL] = { 0 };
@@ -223,6 +249,18 @@ autoar_extractor_get_property (GObject    *object,
     case PROP_NOTIFY_INTERVAL:
       g_value_set_int64 (value, self->notify_interval);
       break;
+    case PROP_USE_INDEX_CACHE:
+      g_value_set_boolean (value, self->use_index_cache);
+      break;
+    case PROP_USE_DECODER:
+      g_value_set_boolean (value, self->use_decoder);
+      break;
+    case PROP_CONFLICT_POLICY:
+      g_value_set_enum (value, self->conflict_policy);
+      break;
+    case PROP_RENAME_PATTERN:
+      g_value_set_string (value, self->rename_pattern);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -246,7 +284,7 @@ autoar_extractor_set_property (GObject      *object,
       break;
     case PROP_OUTPUT_FILE:
       g_clear_object (&(self->output_file));
-      self->output_file = g_object_ref (g_value_get_object (value));
+      self->output_file = g_value_dup_object (value);
       break;
     case PROP_OUTPUT_IS_DEST:
       autoar_extractor_set_output_is_dest (self,
@@ -260,6 +298,22 @@ autoar_extractor_set_property (GObject      *object,
       autoar_extractor_set_notify_interval (self,
                                             g_value_get_int64 (value));
       break;
+    case PROP_USE_INDEX_CACHE:
+      autoar_extractor_set_use_index_cache (self,
+                                            g_value_get_boolean (value));
+      break;
+    case PROP_USE_DECODER:
+      autoar_extractor_set_use_decoder (self,
+                                        g_value_get_boolean (value));
+      break;
+    case PROP_CONFLICT_POLICY:
+      autoar_extractor_set_conflict_policy (self,
+                                            g_value_get_enum (value));
+      break;
+    case PROP_RENAME_PATTERN:
+      autoar_extractor_set_rename_pattern (self,
+                                           g_value_get_string (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -408,6 +462,83 @@ autoar_extractor_get_notify_interval (AutoarExtractor *self)
   return self->notify_interval;
 }
 
+/**
+ * autoar_extractor_get_use_index_cache:
+ * @self: an #AutoarExtractor
+ *
+ * See autoar_extractor_set_use_index_cache().
+ *
+ * Returns: %TRUE if the on-disk cache of #AutoarArchiveIndex is used
+ **/
+gboolean
+autoar_extractor_get_use_index_cache (AutoarExtractor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), FALSE);
+  return self->use_index_cache;
+}
+
+/**
+ * autoar_extractor_get_use_decoder:
+ * @self: an #AutoarExtractor
+ *
+ * See autoar_extractor_set_use_decoder().
+ *
+ * Returns: %TRUE if gnome-autoar decompresses the source archive itself
+ **/
+gboolean
+autoar_extractor_get_use_decoder (AutoarExtractor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), FALSE);
+  return self->use_decoder;
+}
+
+/**
+ * autoar_extractor_get_index:
+ * @self: an #AutoarExtractor
+ *
+ * Gets the index of the source archive. It is available after the
+ * #AutoarExtractor::scanned signal or after autoar_extractor_list() is
+ * called.
+ *
+ * Returns: (transfer none) (nullable): an #AutoarArchiveIndex, or %NULL
+ **/
+AutoarArchiveIndex *
+autoar_extractor_get_index (AutoarExtractor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), NULL);
+  return self->index;
+}
+
+/**
+ * autoar_extractor_get_conflict_policy:
+ * @self: an #AutoarExtractor
+ *
+ * See autoar_extractor_set_conflict_policy().
+ *
+ * Returns: how the name conflicts are solved
+ **/
+AutoarConflictPolicy
+autoar_extractor_get_conflict_policy (AutoarExtractor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), AUTOAR_CONFLICT_POLICY_ASK);
+  return self->conflict_policy;
+}
+
+/**
+ * autoar_extractor_get_rename_pattern:
+ * @self: an #AutoarExtractor
+ *
+ * See autoar_extractor_set_rename_pattern().
+ *
+ * Returns: (transfer none): the pattern of the new names
+ **/
+const char *
+autoar_extractor_get_rename_pattern (AutoarExtractor *self)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), NULL);
+  return self->rename_pattern;
+}
+
 /**
  * autoar_extractor_set_output_is_dest:
  * @self: an #AutoarExtractor
@@ -473,6 +604,186 @@ autoar_extractor_set_notify_interval (AutoarExtractor *self,
   self->notify_interval = notify_interval;
 }
 
+/**
+ * autoar_extractor_set_use_index_cache:
+ * @self: an #AutoarExtractor
+ * @use_index_cache: %TRUE to use the on-disk cache of #AutoarArchiveIndex
+ *
+ * By default #AutoarExtractor:use-index-cache is set to %FALSE. If it is
+ * set to %TRUE, the index of a local archive is loaded from the user cache
+ * directory instead of scanning the archive, if the archive was not modified
+ * since the index was stored. Newly built indexes are stored there as well.
+ * Nothing removes the stored indexes, so the application should only enable
+ * the cache for archives which are listed again and again.
+ **/
+void
+autoar_extractor_set_use_index_cache (AutoarExtractor *self,
+                                      gboolean         use_index_cache)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+  self->use_index_cache = use_index_cache;
+}
+
+/**
+ * autoar_extractor_set_use_decoder:
+ * @self: an #AutoarExtractor
+ * @use_decoder: %TRUE to decompress gzip, xz and zstd archives without
+ * libarchive
+ *
+ * By default #AutoarExtractor:use-decoder is set to %FALSE, so libarchive
+ * decompresses the source archive. If it is set to %TRUE, gnome-autoar
+ * decompresses gzip, xz and zstd archives itself. It then records restart
+ * points in the #AutoarArchiveIndex, so autoar_extractor_read_entry() starts
+ * decompressing near the entry instead of at the beginning, and it decodes
+ * the independent blocks of xz archives and frames of zstd archives on
+ * several threads.
+ *
+ * This function should only be called before calling autoar_extractor_start(),
+ * autoar_extractor_start_async() or autoar_extractor_list().
+ **/
+void
+autoar_extractor_set_use_decoder (AutoarExtractor *self,
+                                  gboolean         use_decoder)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+  self->use_decoder = use_decoder;
+}
+
+/**
+ * autoar_extractor_set_index:
+ * @self: an #AutoarExtractor
+ * @index: an #AutoarArchiveIndex of the source archive
+ *
+ * Sets the index of the source archive, for example the one returned by
+ * autoar_extractor_list() on another #AutoarExtractor, so the archive is not
+ * scanned again. The caller is responsible for the archive not being
+ * modified since @index was created.
+ *
+ * This function should only be called before calling autoar_extractor_start()
+ * or autoar_extractor_start_async().
+ **/
+void
+autoar_extractor_set_index (AutoarExtractor    *self,
+                            AutoarArchiveIndex *index)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+  g_return_if_fail (AUTOAR_IS_ARCHIVE_INDEX (index));
+  g_return_if_fail (g_file_equal (autoar_archive_index_get_source_file (index),
+                                  self->source_file));
+
+  g_set_object (&self->index, index);
+}
+
+/**
+ * autoar_extractor_set_conflict_policy:
+ * @self: an #AutoarExtractor
+ * @conflict_policy: how the name conflicts are solved
+ *
+ * By default #AutoarExtractor:conflict-policy is set to
+ * %AUTOAR_CONFLICT_POLICY_ASK, so #AutoarExtractor::conflict is emitted for
+ * each name conflict. With autoar_extractor_start_async(), the thread which
+ * extracts the archive waits for the handler on the main loop. The other
+ * policies solve the conflicts on that thread without a round trip, which
+ * is faster when there are many of them.
+ *
+ * This function should only be called before calling autoar_extractor_start()
+ * or autoar_extractor_start_async().
+ **/
+void
+autoar_extractor_set_conflict_policy (AutoarExtractor     *self,
+                                      AutoarConflictPolicy conflict_policy)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+  self->conflict_policy = conflict_policy;
+}
+
+/* Whether @rename_pattern gives a new name for each number, which has an
+ * unescaped "%n" and no "/" */
+static gboolean
+autoar_extractor_is_rename_pattern (const char *rename_pattern)
+{
+  gboolean has_number = FALSE;
+  const char *p;
+
+  for (p = rename_pattern; *p != '\0'; p++) {
+    if (*p == '/')
+      return FALSE;
+
+    if (p[0] != '%' || p[1] == '\0')
+      continue;
+
+    p++;
+    if (*p == 'n')
+      has_number = TRUE;
+    else if (*p == '/')
+      return FALSE;
+  }
+
+  return has_number;
+}
+
+/**
+ * autoar_extractor_set_rename_pattern:
+ * @self: an #AutoarExtractor
+ * @rename_pattern: (nullable): the pattern of the new names, or %NULL for
+ * the default one
+ *
+ * Sets the names given to the entries with %AUTOAR_CONFLICT_POLICY_RENAME.
+ * In @rename_pattern, "%b" is replaced by the name of the file without its
+ * extension, "%e" by the extension with its dot, "%n" by a number counting
+ * from 1, and "%%" by "%". The pattern must contain "%n" and no "/", and the
+ * pattern is left unchanged otherwise. Directories have no extension. The
+ * first number which gives a free name is used. The default is "%b (%n)%e",
+ * which turns "file.txt" into "file (1).txt".
+ *
+ * This function should only be called before calling autoar_extractor_start()
+ * or autoar_extractor_start_async().
+ **/
+void
+autoar_extractor_set_rename_pattern (AutoarExtractor *self,
+                                     const char      *rename_pattern)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+  g_return_if_fail (rename_pattern == NULL ||
+                    autoar_extractor_is_rename_pattern (rename_pattern));
+
+  g_free (self->rename_pattern);
+  self->rename_pattern = g_strdup (rename_pattern != NULL ?
+                                   rename_pattern : DEFAULT_RENAME_PATTERN);
+}
+
+/**
+ * autoar_extractor_set_conflict_func:
+ * @self: an #AutoarExtractor
+ * @func: (nullable): the function which solves the name conflicts, or %NULL
+ * @user_data: data passed to @func
+ * @notify: (nullable): a function to free @user_data, or %NULL
+ *
+ * Sets a function which is called for each name conflict before
+ * #AutoarExtractor:conflict-policy is followed. Unlike
+ * #AutoarExtractor::conflict, it is called directly on the thread which
+ * extracts the archive, so it must be thread-safe with
+ * autoar_extractor_start_async().
+ *
+ * This function should only be called before calling autoar_extractor_start()
+ * or autoar_extractor_start_async().
+ **/
+void
+autoar_extractor_set_conflict_func (AutoarExtractor   *self,
+                                    AutoarConflictFunc func,
+                                    gpointer           user_data,
+                                    GDestroyNotify     notify)
+{
+  g_return_if_fail (AUTOAR_IS_EXTRACTOR (self));
+
+  if (self->conflict_notify != NULL)
+    self->conflict_notify (self->conflict_data);
+
+  self->conflict_func = func;
+  self->conflict_data = user_data;
+  self->conflict_notify = notify;
+}
+
 static void
 autoar_extractor_dispose (GObject *object)
 {
@@ -515,8 +826,17 @@ autoar_extractor_dispose (GObject *object)
     self->extracted_dir_list = NULL;
   }
 
+  g_clear_pointer (&self->decoder, autoar_decoder_free);
+  g_clear_object (&self->index);
   g_clear_pointer (&self->passphrase, g_free);
   g_clear_pointer (&self->source_basename, g_free);
+  g_clear_pointer (&self->volumes, g_ptr_array_unref);
+  g_clear_pointer (&self->rename_pattern, g_free);
+
+  if (self->conflict_notify != NULL)
+    self->conflict_notify (self->conflict_data);
+  self->conflict_func = NULL;
+  self->conflict_notify = NULL;
 
   G_OBJECT_CLASS (autoar_extractor_parent_class)->dispose (object);
 }
@@ -549,7 +869,6 @@ libarchive_read_open_cb (struct archive *ar_read,
                          void           *client_data)
 {
   AutoarExtractor *self;
-  GFileInputStream *istream;
 
   g_debug ("libarchive_read_open_cb: called");
 
@@ -558,14 +877,44 @@ libarchive_read_open_cb (struct archive *ar_read,
   if (self->error != NULL)
     return ARCHIVE_FATAL;
 
-  istream = g_file_read (self->source_file,
-                         self->cancellable,
-                         &(self->error));
-  self->istream = G_INPUT_STREAM (istream);
+  /* The volumes are read as one seekable stream */
+  if (self->volumes != NULL)
+    self->istream = autoar_volume_input_stream_new (self->volumes,
+                                                    self->cancellable,
+                                                    &(self->error));
+  else
+    self->istream = G_INPUT_STREAM (g_file_read (self->source_file,
+                                                 self->cancellable,
+                                                 &(self->error)));
 
   if (self->error != NULL)
     return ARCHIVE_FATAL;
 
+  if (self->decode) {
+    self->decoder = autoar_decoder_new (self->istream,
+                                        self->index ?
+                                          autoar_archive_index_get_seek_points (self->index) : NULL,
+                                        self->cancellable,
+                                        &(self->error));
+    if (self->error != NULL)
+      return ARCHIVE_FATAL;
+  }
+
+  /* Start reading at the header of an entry found in the index. The offsets
+   * are useless if they were recorded with a different decoder. */
+  if (self->start_offset > 0 &&
+      autoar_decoder_check_seek_points (self->decoder,
+                                        autoar_archive_index_get_seek_points (self->index))) {
+    if (self->decoder != NULL)
+      autoar_decoder_seek (self->decoder, self->start_offset,
+                           self->cancellable, &(self->error));
+    else
+      g_seekable_seek (G_SEEKABLE (self->istream), self->start_offset,
+                       G_SEEK_SET, self->cancellable, &(self->error));
+    if (self->error != NULL)
+      return ARCHIVE_FATAL;
+  }
+
   g_debug ("libarchive_read_open_cb: ARCHIVE_OK");
   return ARCHIVE_OK;
 }
@@ -580,6 +929,8 @@ libarchive_read_close_cb (struct archive *ar_read,
 
   self = AUTOAR_EXTRACTOR (client_data);
 
+  g_clear_pointer (&self->decoder, autoar_decoder_free);
+
   if (self->error != NULL)
     return ARCHIVE_FATAL;
 
@@ -609,11 +960,18 @@ libarchive_read_read_cb (struct archive  *ar_read,
     return -1;
 
   *buffer = self->buffer;
-  read_size = g_input_stream_read (self->istream,
-                                   self->buffer,
-                                   self->buffer_size,
-                                   self->cancellable,
-                                   &(self->error));
+  if (self->decoder != NULL)
+    read_size = autoar_decoder_read (self->decoder,
+                                     self->buffer,
+                                     self->buffer_size,
+                                     self->cancellable,
+                                     &(self->error));
+  else
+    read_size = g_input_stream_read (self->istream,
+                                     self->buffer,
+                                     self->buffer_size,
+                                     self->cancellable,
+                                     &(self->error));
   if (self->error != NULL)
     return -1;
 
@@ -653,6 +1011,20 @@ libarchive_read_seek_cb (struct archive *ar_read,
       return -1;
   }
 
+  /* The size of the uncompressed stream is not known in advance */
+  if (self->decoder != NULL) {
+    if (seektype == G_SEEK_END)
+      return -1;
+    if (seektype == G_SEEK_CUR)
+      request += autoar_decoder_tell (self->decoder);
+    if (!autoar_decoder_seek (self->decoder, request,
+                              self->cancellable, &(self->error)))
+      return -1;
+
+    g_debug ("libarchive_read_seek_cb: %" G_GINT64_FORMAT, request);
+    return request;
+  }
+
   g_seekable_seek (seekable,
                    request,
                    seektype,
@@ -683,7 +1055,8 @@ libarchive_read_skip_cb (struct archive *ar_read,
     return -1;
   }
 
-  old_offset = g_seekable_tell (seekable);
+  old_offset = self->decoder ? autoar_decoder_tell (self->decoder) :
+                               g_seekable_tell (seekable);
   new_offset = libarchive_read_seek_cb (ar_read, client_data, request, SEEK_CUR);
   if (new_offset > old_offset)
     return (new_offset - old_offset);
@@ -708,6 +1081,9 @@ libarchive_create_read_object (gboolean          use_raw_format,
                                AutoarExtractor  *self,
                                struct archive  **a)
 {
+  /* The raw format needs libarchive to see the compression filter */
+  self->decode = self->use_decoder && !use_raw_format;
+
   *a = archive_read_new ();
   archive_read_support_filter_all (*a);
   if (use_raw_format)
@@ -771,6 +1147,39 @@ autoar_extractor_signal_progress (AutoarExtractor *self)
   }
 }
 
+/* A conflict signal emitted on the main thread for the worker thread */
+typedef struct
+{
+  AutoarExtractor *self;
+  GFile *file;
+  GFile **new_file;
+  AutoarConflictAction action;
+
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+} AutoarExtractorConflict;
+
+static gboolean
+autoar_extractor_signal_conflict_main_context (gpointer data)
+{
+  AutoarExtractorConflict *conflict = data;
+  AutoarConflictAction action = AUTOAR_CONFLICT_UNHANDLED;
+
+  g_signal_emit (conflict->self, autoar_extractor_signals[CONFLICT], 0,
+                 conflict->file,
+                 conflict->new_file,
+                 &action);
+
+  g_mutex_lock (&conflict->lock);
+  conflict->action = action;
+  conflict->done = TRUE;
+  g_cond_signal (&conflict->cond);
+  g_mutex_unlock (&conflict->lock);
+
+  return FALSE;
+}
+
 static AutoarConflictAction
 autoar_extractor_signal_conflict (AutoarExtractor  *self,
                                   GFile            *file,
@@ -778,11 +1187,34 @@ autoar_extractor_signal_conflict (AutoarExtractor  *self,
 {
   AutoarConflictAction action = AUTOAR_CONFLICT_UNHANDLED;
 
-  autoar_common_g_signal_emit (self, self->in_thread,
-                               autoar_extractor_signals[CONFLICT], 0,
-                               file,
-                               new_file,
-                               &action);
+  /* Unlike the other signals, the worker thread needs the result, so it
+   * waits for the handler instead of going on */
+  if (self->in_thread) {
+    AutoarExtractorConflict conflict = { self, file, new_file,
+                                         AUTOAR_CONFLICT_UNHANDLED };
+
+    g_mutex_init (&conflict.lock);
+    g_cond_init (&conflict.cond);
+
+    g_main_context_invoke (NULL, autoar_extractor_signal_conflict_main_context,
+                           &conflict);
+
+    g_mutex_lock (&conflict.lock);
+    while (!conflict.done)
+      g_cond_wait (&conflict.cond, &conflict.lock);
+    g_mutex_unlock (&conflict.lock);
+
+    g_mutex_clear (&conflict.lock);
+    g_cond_clear (&conflict.cond);
+
+    action = conflict.action;
+  } else {
+    g_signal_emit (self, autoar_extractor_signals[CONFLICT], 0,
+                   file,
+                   new_file,
+                   &action);
+  }
+
   if (action == AUTOAR_CONFLICT_UNHANDLED)
     return AUTOAR_CONFLICT_SKIP;
 
@@ -972,6 +1404,147 @@ autoar_extractor_check_file_conflict (AutoarExtractor *self,
   return autoar_extractor_check_file_conflict (self, parent, AE_IFDIR);
 }
 
+/* Makes the first free name of @file with the rename pattern */
+static GFile *
+autoar_extractor_get_renamed_file (AutoarExtractor *self,
+                                   GFile           *file,
+                                   gboolean         is_dir)
+{
+  g_autoptr (GFile) parent = NULL;
+  g_autofree char *basename = NULL;
+  g_autofree char *name = NULL;
+  const char *extension = "";
+  guint n;
+
+  parent = g_file_get_parent (file);
+  basename = g_file_get_basename (file);
+  name = g_strdup (basename);
+
+  if (!is_dir) {
+    char *dot;
+
+    dot = autoar_common_get_filename_extension (name);
+    if (dot != name) {
+      extension = basename + (dot - name);
+      *dot = '\0';
+    }
+  }
+
+  for (n = 1; n < G_MAXUINT; n++) {
+    g_autoptr (GString) new_name = NULL;
+    g_autoptr (GFile) new_file = NULL;
+    const char *p;
+
+    new_name = g_string_new (NULL);
+    for (p = self->rename_pattern; *p != '\0'; p++) {
+      if (p[0] != '%' || p[1] == '\0') {
+        g_string_append_c (new_name, *p);
+        continue;
+      }
+
+      switch (*++p) {
+        case 'b':
+          g_string_append (new_name, name);
+          break;
+        case 'e':
+          g_string_append (new_name, extension);
+          break;
+        case 'n':
+          g_string_append_printf (new_name, "%u", n);
+          break;
+        default:
+          g_string_append_c (new_name, *p);
+          break;
+      }
+    }
+
+    new_file = g_file_get_child (parent, new_name->str);
+    if (g_file_query_file_type (new_file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                NULL) == G_FILE_TYPE_UNKNOWN)
+      return g_steal_pointer (&new_file);
+
+    /* The pattern always gives the same name */
+    if (g_str_equal (new_name->str, basename))
+      break;
+  }
+
+  return NULL;
+}
+
+/* Whether the entry was modified after the existing @file */
+static gboolean
+autoar_extractor_is_entry_newer (struct archive_entry *entry,
+                                 GFile                *file)
+{
+  g_autoptr (GFileInfo) info = NULL;
+  guint64 mtime;
+  guint32 mtime_usec;
+
+  if (!archive_entry_mtime_is_set (entry))
+    return FALSE;
+
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            NULL, NULL);
+  if (info == NULL ||
+      !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    return TRUE;
+
+  mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  mtime_usec = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+  if (archive_entry_mtime (entry) != (time_t) mtime)
+    return archive_entry_mtime (entry) > (time_t) mtime;
+
+  return archive_entry_mtime_nsec (entry) / 1000 > (long) mtime_usec;
+}
+
+/* Solves a name conflict with the conflict function, the conflict policy,
+ * or the conflict signal, in this order */
+static AutoarConflictAction
+autoar_extractor_resolve_conflict (AutoarExtractor      *self,
+                                   struct archive_entry *entry,
+                                   GFile                *file,
+                                   GFile               **new_file)
+{
+  AutoarConflictAction action = AUTOAR_CONFLICT_UNHANDLED;
+
+  if (self->conflict_func != NULL)
+    action = self->conflict_func (self, file, new_file, self->conflict_data);
+
+  if (action == AUTOAR_CONFLICT_UNHANDLED) {
+    switch (self->conflict_policy) {
+      case AUTOAR_CONFLICT_POLICY_SKIP:
+        action = AUTOAR_CONFLICT_SKIP;
+        break;
+      case AUTOAR_CONFLICT_POLICY_OVERWRITE:
+        action = AUTOAR_CONFLICT_OVERWRITE;
+        break;
+      case AUTOAR_CONFLICT_POLICY_RENAME:
+        *new_file =
+          autoar_extractor_get_renamed_file (self, file,
+                                             archive_entry_filetype (entry) == AE_IFDIR);
+        action = *new_file != NULL ? AUTOAR_CONFLICT_CHANGE_DESTINATION :
+                                     AUTOAR_CONFLICT_SKIP;
+        break;
+      case AUTOAR_CONFLICT_POLICY_KEEP_NEWER:
+        action = autoar_extractor_is_entry_newer (entry, file) ?
+                 AUTOAR_CONFLICT_OVERWRITE : AUTOAR_CONFLICT_SKIP;
+        break;
+      case AUTOAR_CONFLICT_POLICY_ASK:
+      default:
+        return autoar_extractor_signal_conflict (self, file, new_file);
+    }
+  }
+
+  g_debug ("autoar_extractor_resolve_conflict: %s => action %d",
+           archive_entry_pathname (entry), action);
+
+  return action;
+}
+
 static void
 autoar_extractor_do_write_entry (AutoarExtractor      *self,
                                  struct archive       *a,
@@ -1411,6 +1984,45 @@ autoar_extractor_class_init (AutoarExtractorClass *klass)
                                                        G_PARAM_CONSTRUCT |
                                                        G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_USE_INDEX_CACHE,
+                                   g_param_spec_boolean ("use-index-cache",
+                                                         "Use index cache",
+                                                         "Whether the index of the source archive is "
+                                                         "cached in the user cache directory",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_USE_DECODER,
+                                   g_param_spec_boolean ("use-decoder",
+                                                         "Use decoder",
+                                                         "Whether gzip, xz and zstd archives are "
+                                                         "decompressed without libarchive",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_CONFLICT_POLICY,
+                                   g_param_spec_enum ("conflict-policy",
+                                                      "Conflict policy",
+                                                      "How the name conflicts are solved",
+                                                      AUTOAR_TYPE_CONFLICT_POLICY,
+                                                      AUTOAR_CONFLICT_POLICY_ASK,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_RENAME_PATTERN,
+                                   g_param_spec_string ("rename-pattern",
+                                                        "Rename pattern",
+                                                        "The pattern of the names of the renamed entries",
+                                                        DEFAULT_RENAME_PATTERN,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_CONSTRUCT |
+                                                        G_PARAM_STATIC_STRINGS));
+
 /**
  * AutoarExtractor::scanned:
  * @self: the #AutoarExtractor
@@ -1483,7 +2095,8 @@ autoar_extractor_class_init (AutoarExtractorClass *klass)
  *
  * This signal is used to report and offer the possibility to solve name
  * conflicts when extracting files. If it is not handled, the @file will be
- * skipped.
+ * skipped. It is only emitted with %AUTOAR_CONFLICT_POLICY_ASK, see
+ * autoar_extractor_set_conflict_policy().
  **/
   autoar_extractor_signals[CONFLICT] =
     g_signal_new ("conflict",
@@ -1600,14 +2213,25 @@ autoar_extractor_init (AutoarExtractor *self)
 
   self->passphrase = NULL;
   self->passphrase_requested = FALSE;
+
+  self->index = NULL;
+  self->use_index_cache = FALSE;
+  self->start_offset = 0;
+
+  /* Kept if the construct property is invalid */
+  self->rename_pattern = g_strdup (DEFAULT_RENAME_PATTERN);
 }
 
 /**
  * autoar_extractor_new:
  * @source_file: a #GFile for the source archive
- * @output_file: a #GFile for the directory where the files will be extracted
+ * @output_file: (nullable): a #GFile for the directory where the files will be
+ * extracted, or %NULL if the object is only used to read single entries
  *
- * Create a new #AutoarExtractor object.
+ * Create a new #AutoarExtractor object. If the name of @source_file ends
+ * with ".001", it is read as the first volume of an archive, followed by the
+ * volumes numbered ".002", ".003" and so on which exist in the same
+ * directory, see autoar_compressor_set_volume_size().
  *
  * Returns: (transfer full): a new #AutoarExtractor object
  **/
@@ -1616,35 +2240,74 @@ autoar_extractor_new (GFile *source_file,
                       GFile *output_file)
 {
   AutoarExtractor *self;
+  g_autoptr (GFile) archive = NULL;
 
   g_return_val_if_fail (source_file != NULL, NULL);
-  g_return_val_if_fail (output_file != NULL, NULL);
 
   self = g_object_new (AUTOAR_TYPE_EXTRACTOR,
                        "source-file", source_file,
                        "output-file", output_file,
                        NULL);
 
-  self->source_basename = g_file_get_basename (self->source_file);
+  self->volumes = autoar_volume_find (self->source_file, &archive);
+  if (self->volumes != NULL)
+    self->source_basename = g_file_get_basename (archive);
+  else
+    self->source_basename = g_file_get_basename (self->source_file);
   self->suggested_destname = autoar_common_get_basename_remove_extension (self->source_basename);
 
   return self;
 }
 
-static void
-autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
+static GFileType
+autoar_extractor_get_entry_file_type (struct archive_entry *entry)
 {
-  /* Step 0: Scan all file names in the archive
-   * We have to check whether the archive contains a top-level directory
-   * before performing the extraction. We emit the "scanned" signal when
-   * the checking is completed. */
+  if (archive_entry_hardlink (entry) != NULL)
+    return G_FILE_TYPE_REGULAR;
 
+  switch (archive_entry_filetype (entry)) {
+    case AE_IFREG:
+      return G_FILE_TYPE_REGULAR;
+    case AE_IFDIR:
+      return G_FILE_TYPE_DIRECTORY;
+    case AE_IFLNK:
+      return G_FILE_TYPE_SYMBOLIC_LINK;
+    case AE_IFBLK:
+    case AE_IFCHR:
+    case AE_IFIFO:
+    case AE_IFSOCK:
+      return G_FILE_TYPE_SPECIAL;
+    default:
+      return G_FILE_TYPE_UNKNOWN;
+  }
+}
+
+static void
+autoar_extractor_do_build_index (AutoarExtractor *self)
+{
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autofree char *raw_pathname = NULL;
   struct archive *a;
   struct archive_entry *entry;
+  gboolean encrypted = FALSE;
+  gboolean seekable = FALSE;
+  guint n_entries = 0;
 
   int r;
 
-  g_debug ("autoar_extractor_step_scan_toplevel: called");
+  g_debug ("autoar_extractor_do_build_index: called");
+
+  /* The cache is keyed by the source file only */
+  if (self->use_index_cache && self->volumes == NULL) {
+    self->index = autoar_archive_index_load_cached (self->source_file,
+                                                    self->cancellable);
+    if (self->index != NULL) {
+      g_debug ("autoar_extractor_do_build_index: using cached index");
+      return;
+    }
+  }
+
+  index = autoar_archive_index_new (self->source_file, self->cancellable);
 
   r = libarchive_create_read_object (FALSE, self, &a);
   if (r != ARCHIVE_OK) {
@@ -1653,6 +2316,7 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
     if (r != ARCHIVE_OK) {
       if (self->error == NULL)
         self->error = autoar_common_g_error_new_a (a, NULL);
+      archive_read_free (a);
       return;
     } else if (archive_filter_count (a) <= 1){
       /* If we only use raw format and filter count is one, libarchive will
@@ -1662,11 +2326,12 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
         self->error = g_error_new_literal (AUTOAR_EXTRACTOR_ERROR,
                                            AUTOAR_NOT_AN_ARCHIVE_ERRNO,
                                            "not an archive");
+      archive_read_free (a);
       return;
     }
     self->use_raw_format = TRUE;
 
-    g_debug ("autoar_extractor_step_scan_toplevel: using raw format");
+    g_debug ("autoar_extractor_do_build_index: using raw format");
   }
 
   while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
@@ -1680,6 +2345,18 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
       return;
     }
 
+    /* Header offsets can be used to start reading at an entry only in
+     * archives without a central directory, which are uncompressed or
+     * decompressed by self->decoder. The format is known after the first
+     * header is read. */
+    if (n_entries == 0) {
+      int format = archive_format (a) & ARCHIVE_FORMAT_BASE_MASK;
+
+      seekable = !self->use_raw_format &&
+                 archive_filter_count (a) <= 1 &&
+                 (format == ARCHIVE_FORMAT_TAR || format == ARCHIVE_FORMAT_CPIO);
+    }
+
     /* The password is requested only for the ZIP format to avoid showing
      * password prompt for 7ZIP/RAR, where archive_entry_is_encrypted resp.
      * archive_entry_is_metadata_encrypted returns TRUE, but followup
@@ -1687,19 +2364,8 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
      * an error. See https://github.com/libarchive/libarchive/issues/1662.
      */
     if (archive_entry_is_encrypted (entry) &&
-        archive_format (a) == ARCHIVE_FORMAT_ZIP) {
-      autoar_extractor_request_passphrase (self);
-      if (g_cancellable_is_cancelled (self->cancellable)) {
-        archive_read_free (a);
-        return;
-      } else if (self->passphrase == NULL) {
-        self->error = g_error_new_literal (AUTOAR_EXTRACTOR_ERROR,
-                                           AUTOAR_PASSPHRASE_REQUIRED_ERRNO,
-                                           "A passphrase is required");
-        archive_read_free (a);
-        return;
-      }
-    }
+        archive_format (a) == ARCHIVE_FORMAT_ZIP)
+      encrypted = TRUE;
 
     pathname = archive_entry_pathname (entry);
     utf8_pathname = autoar_common_get_utf8_pathname (pathname);
@@ -1709,11 +2375,14 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
     /* The raw format usually doesn't propagate file name and the generic "data"
      * string is returned instead. Let's use source basename in that case.
      */
-    if (self->use_raw_format && g_str_equal (pathname, "data"))
-      pathname = autoar_common_get_basename_remove_extension (self->source_basename);
+    if (self->use_raw_format && g_str_equal (pathname, "data")) {
+      g_free (raw_pathname);
+      raw_pathname = autoar_common_get_basename_remove_extension (self->source_basename);
+      pathname = raw_pathname;
+    }
 
-    g_debug ("autoar_extractor_step_scan_toplevel: %d: pathname = %s%s%s%s%s%s%s",
-             self->total_files, pathname,
+    g_debug ("autoar_extractor_do_build_index: %u: pathname = %s%s%s%s%s%s%s",
+             n_entries, pathname,
              utf8_pathname ? " utf8 pathname = " : "",
              utf8_pathname ? utf8_pathname : "",
              symlink_pathname ? " symlink = " : "",
@@ -1721,12 +2390,14 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
              hardlink_pathname ? " hardlink = " : "",
              hardlink_pathname ? hardlink_pathname : "");
 
-    self->files_list =
-      g_list_prepend (self->files_list,
-                      autoar_extractor_do_sanitize_pathname (self,
-                                                             utf8_pathname ? utf8_pathname : pathname));
-    self->total_files++;
-    self->total_size += archive_entry_size (entry);
+    autoar_archive_index_add_entry (index,
+                                    utf8_pathname ? utf8_pathname : pathname,
+                                    autoar_extractor_get_entry_file_type (entry),
+                                    archive_entry_size_is_set (entry) ?
+                                      archive_entry_size (entry) : -1,
+                                    archive_entry_mtime (entry),
+                                    seekable ? archive_read_header_position (a) : -1);
+    n_entries++;
     archive_read_data_skip (a);
   }
 
@@ -1738,13 +2409,73 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
     return;
   }
 
+  /* The decoder is freed together with the archive */
+  autoar_archive_index_set_seek_points (index,
+                                        autoar_decoder_get_seek_points (self->decoder));
+  archive_read_free (a);
+
+  autoar_archive_index_set_flags (index, self->use_raw_format,
+                                  encrypted, seekable);
+  if (self->use_index_cache && self->volumes == NULL)
+    autoar_archive_index_save_cached (index);
+
+  self->index = g_steal_pointer (&index);
+}
+
+static void
+autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
+{
+  /* Step 0: Scan all file names in the archive
+   * We have to check whether the archive contains a top-level directory
+   * before performing the extraction. We emit the "scanned" signal when
+   * the checking is completed. The archive is not read again if its index
+   * is already known. */
+
+  guint i, n_entries;
+
+  g_debug ("autoar_extractor_step_scan_toplevel: called");
+
+  if (self->index == NULL)
+    autoar_extractor_do_build_index (self);
+  if (self->error != NULL || g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  self->use_raw_format = autoar_archive_index_get_raw (self->index);
+
+  if (autoar_archive_index_get_encrypted (self->index)) {
+    autoar_extractor_request_passphrase (self);
+    if (g_cancellable_is_cancelled (self->cancellable)) {
+      return;
+    } else if (self->passphrase == NULL) {
+      self->error = g_error_new_literal (AUTOAR_EXTRACTOR_ERROR,
+                                         AUTOAR_PASSPHRASE_REQUIRED_ERRNO,
+                                         "A passphrase is required");
+      return;
+    }
+  }
+
+  n_entries = autoar_archive_index_get_n_entries (self->index);
+  for (i = 0; i < n_entries; i++) {
+    const char *pathname;
+    gint64 size;
+
+    pathname = autoar_archive_index_get_entry_path (self->index, i);
+    size = autoar_archive_index_get_entry_size (self->index, i);
+
+    self->files_list =
+      g_list_prepend (self->files_list,
+                      autoar_extractor_do_sanitize_pathname (self, pathname));
+    self->total_files++;
+    if (size > 0)
+      self->total_size += size;
+  }
+
   if (self->files_list == NULL) {
     if (self->error == NULL) {
       self->error = g_error_new_literal (AUTOAR_EXTRACTOR_ERROR,
                                          AUTOAR_EMPTY_ARCHIVE_ERRNO,
                                          "empty archive");
     }
-    archive_read_free (a);
     return;
   }
 
@@ -1753,8 +2484,6 @@ autoar_extractor_step_scan_toplevel (AutoarExtractor *self)
   if (self->total_size <= 0)
     self->total_size = G_MAXUINT64;
 
-  archive_read_free (a);
-
   g_debug ("autoar_extractor_step_scan_toplevel: files = %d",
            self->total_files);
 
@@ -1939,9 +2668,9 @@ autoar_extractor_step_extract (AutoarExtractor *self) {
         return;
       }
 
-      action = autoar_extractor_signal_conflict (self,
-                                                 extracted_filename,
-                                                 &new_extracted_filename);
+      action = autoar_extractor_resolve_conflict (self, entry,
+                                                  extracted_filename,
+                                                  &new_extracted_filename);
 
       switch (action) {
         case AUTOAR_CONFLICT_OVERWRITE:
@@ -2049,7 +2778,14 @@ autoar_extractor_step_cleanup (AutoarExtractor *self) {
 
   if (self->delete_after_extraction) {
     g_debug ("autoar_extractor_step_cleanup: Delete");
-    g_file_delete (self->source_file, self->cancellable, NULL);
+    if (self->volumes != NULL) {
+      guint i;
+
+      for (i = 0; i < self->volumes->len; i++)
+        g_file_delete (self->volumes->pdata[i], self->cancellable, NULL);
+    } else {
+      g_file_delete (self->source_file, self->cancellable, NULL);
+    }
   }
 }
 
@@ -2177,3 +2913,419 @@ autoar_extractor_start_async (AutoarExtractor *self,
   g_task_set_task_data (task, NULL, NULL);
   g_task_run_in_thread (task, autoar_extractor_start_async_thread);
 }
+
+/* A #GInputStream returning the data of one archive entry. It owns the
+ * libarchive read object, which reads the source through the callbacks of
+ * the #AutoarExtractor it was created from, so the extractor is kept alive
+ * until the stream is closed. */
+#define AUTOAR_TYPE_ENTRY_STREAM autoar_entry_stream_get_type ()
+
+G_DECLARE_FINAL_TYPE (AutoarEntryStream, autoar_entry_stream, AUTOAR, ENTRY_STREAM, GInputStream)
+
+struct _AutoarEntryStream
+{
+  GInputStream parent_instance;
+
+  AutoarExtractor *extractor;
+  struct archive *a;
+};
+
+G_DEFINE_TYPE (AutoarEntryStream, autoar_entry_stream, G_TYPE_INPUT_STREAM)
+
+static gssize
+autoar_entry_stream_read (GInputStream  *stream,
+                          void          *buffer,
+                          gsize          count,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  AutoarEntryStream *self;
+  AutoarExtractor *extractor;
+  la_ssize_t read_size;
+
+  self = AUTOAR_ENTRY_STREAM (stream);
+  extractor = self->extractor;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return -1;
+
+  read_size = archive_read_data (self->a, buffer, count);
+  if (read_size < 0) {
+    if (extractor->error != NULL)
+      g_propagate_error (error, g_steal_pointer (&extractor->error));
+    else
+      g_propagate_error (error, autoar_common_g_error_new_a (self->a, NULL));
+    return -1;
+  }
+
+  return read_size;
+}
+
+static gboolean
+autoar_entry_stream_close (GInputStream  *stream,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  AutoarEntryStream *self;
+
+  self = AUTOAR_ENTRY_STREAM (stream);
+
+  /* archive_read_free () calls libarchive_read_close_cb, which closes the
+   * source stream of the extractor. */
+  if (self->a != NULL) {
+    archive_read_free (self->a);
+    self->a = NULL;
+  }
+
+  g_clear_error (&self->extractor->error);
+
+  return TRUE;
+}
+
+static void
+autoar_entry_stream_finalize (GObject *object)
+{
+  AutoarEntryStream *self;
+
+  self = AUTOAR_ENTRY_STREAM (object);
+
+  if (self->a != NULL)
+    archive_read_free (self->a);
+
+  g_clear_object (&self->extractor);
+
+  G_OBJECT_CLASS (autoar_entry_stream_parent_class)->finalize (object);
+}
+
+static void
+autoar_entry_stream_class_init (AutoarEntryStreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  object_class->finalize = autoar_entry_stream_finalize;
+
+  stream_class->read_fn = autoar_entry_stream_read;
+  stream_class->close_fn = autoar_entry_stream_close;
+}
+
+static void
+autoar_entry_stream_init (AutoarEntryStream *self)
+{
+}
+
+static void
+autoar_extractor_set_sync_cancellable (AutoarExtractor *self,
+                                       GCancellable    *cancellable)
+{
+  if (cancellable != NULL)
+    g_object_ref (cancellable);
+  g_clear_object (&self->cancellable);
+  self->cancellable = cancellable;
+  self->in_thread = FALSE;
+
+  g_clear_error (&self->error);
+}
+
+static gboolean
+autoar_extractor_entry_pathname_matches (const char *pathname,
+                                         const char *wanted)
+{
+  size_t len;
+
+  if (pathname == NULL)
+    return FALSE;
+
+  /* Entries are commonly stored as "./foo" or "foo/" */
+  while (g_str_has_prefix (pathname, "./"))
+    pathname += 2;
+  while (*pathname == '/')
+    pathname++;
+
+  len = strlen (pathname);
+  while (len > 0 && pathname[len - 1] == '/')
+    len--;
+
+  return len == strlen (wanted) && strncmp (pathname, wanted, len) == 0;
+}
+
+static struct archive *
+autoar_extractor_open_entry (AutoarExtractor       *self,
+                             const char            *pathname,
+                             struct archive_entry **entry_out,
+                             GCancellable          *cancellable,
+                             GError               **error)
+{
+  struct archive *a;
+  struct archive_entry *entry;
+  g_autofree char *wanted = NULL;
+  int r;
+
+  autoar_extractor_set_sync_cancellable (self, cancellable);
+
+  /* Normalize the requested name the same way as the entry names */
+  while (g_str_has_prefix (pathname, "./"))
+    pathname += 2;
+  while (*pathname == '/')
+    pathname++;
+  wanted = g_strdup (pathname);
+  while (*wanted != '\0' && wanted[strlen (wanted) - 1] == '/')
+    wanted[strlen (wanted) - 1] = '\0';
+
+  /* Formats which are able to seek, like ZIP or 7ZIP, look up the entries
+   * using their directory and archive_read_data_skip () below ends up in
+   * libarchive_read_seek_cb or libarchive_read_skip_cb instead of reading
+   * the data of the entries in front of the requested one. Tar and cpio
+   * archives are read from the header offset stored in the index, which
+   * is an offset in the decompressed data if they are compressed. */
+  if (self->index != NULL && autoar_archive_index_get_seekable (self->index)) {
+    guint i;
+
+    if (autoar_archive_index_lookup (self->index, wanted, &i))
+      self->start_offset = MAX (autoar_archive_index_get_entry_offset (self->index, i), 0);
+  }
+
+  r = libarchive_create_read_object (FALSE, self, &a);
+  self->start_offset = 0;
+  if (r != ARCHIVE_OK) {
+    if (self->error == NULL)
+      self->error = g_error_new_literal (AUTOAR_EXTRACTOR_ERROR,
+                                         AUTOAR_NOT_AN_ARCHIVE_ERRNO,
+                                         "not an archive");
+    g_propagate_error (error, g_steal_pointer (&self->error));
+    archive_read_free (a);
+    return NULL;
+  }
+
+  while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
+    const char *entry_pathname;
+    g_autofree char *utf8_pathname = NULL;
+
+    if (g_cancellable_set_error_if_cancelled (self->cancellable, error)) {
+      archive_read_free (a);
+      return NULL;
+    }
+
+    entry_pathname = archive_entry_pathname (entry);
+    utf8_pathname = autoar_common_get_utf8_pathname (entry_pathname);
+
+    if (!autoar_extractor_entry_pathname_matches (utf8_pathname ? utf8_pathname : entry_pathname,
+                                                  wanted)) {
+      archive_read_data_skip (a);
+      continue;
+    }
+
+    g_debug ("autoar_extractor_open_entry: found %s", wanted);
+
+    if (archive_entry_filetype (entry) != AE_IFREG) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                   "%s is not a regular file", wanted);
+      archive_read_free (a);
+      return NULL;
+    }
+
+    /* See autoar_extractor_step_scan_toplevel for why only ZIP is handled */
+    if (archive_entry_is_encrypted (entry) &&
+        archive_format (a) == ARCHIVE_FORMAT_ZIP) {
+      autoar_extractor_request_passphrase (self);
+      if (self->passphrase == NULL) {
+        g_set_error_literal (error, AUTOAR_EXTRACTOR_ERROR,
+                             AUTOAR_PASSPHRASE_REQUIRED_ERRNO,
+                             "A passphrase is required");
+        archive_read_free (a);
+        return NULL;
+      }
+      archive_read_add_passphrase (a, self->passphrase);
+    }
+
+    *entry_out = entry;
+    return a;
+  }
+
+  if (r != ARCHIVE_EOF) {
+    if (self->error == NULL)
+      self->error = autoar_common_g_error_new_a (a, NULL);
+    g_propagate_error (error, g_steal_pointer (&self->error));
+  } else {
+    g_set_error (error, AUTOAR_EXTRACTOR_ERROR,
+                 AUTOAR_ENTRY_NOT_FOUND_ERRNO,
+                 "%s not found in the archive", wanted);
+  }
+
+  archive_read_free (a);
+  return NULL;
+}
+
+/**
+ * autoar_extractor_read_entry:
+ * @self: an #AutoarExtractor object
+ * @pathname: the path of the entry inside the archive
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Opens the source archive and returns a stream with the contents of the
+ * regular file stored as @pathname, without writing anything to the disk.
+ * Leading "./" and "/" are ignored when comparing @pathname with the names of
+ * the entries. The source archive is read with the same callbacks as
+ * autoar_extractor_start(), so formats with a central directory like ZIP are
+ * read from the needed offset only. If the entry is encrypted and no
+ * passphrase is set, #AutoarExtractor::request-passphrase is emitted in the
+ * calling thread.
+ *
+ * The output file of @self is not used. The extraction must not be started
+ * while the returned stream is open.
+ *
+ * Returns: (transfer full): a #GInputStream, or %NULL on error
+ **/
+GInputStream *
+autoar_extractor_read_entry (AutoarExtractor  *self,
+                             const char       *pathname,
+                             GCancellable     *cancellable,
+                             GError          **error)
+{
+  AutoarEntryStream *stream;
+  struct archive *a;
+  struct archive_entry *entry;
+
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), NULL);
+  g_return_val_if_fail (pathname != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  a = autoar_extractor_open_entry (self, pathname, &entry, cancellable, error);
+  if (a == NULL)
+    return NULL;
+
+  stream = g_object_new (AUTOAR_TYPE_ENTRY_STREAM, NULL);
+  stream->extractor = g_object_ref (self);
+  stream->a = a;
+
+  return G_INPUT_STREAM (stream);
+}
+
+/**
+ * autoar_extractor_read_entry_bytes:
+ * @self: an #AutoarExtractor object
+ * @pathname: the path of the entry inside the archive
+ * @max_size: the maximal accepted size of the entry, or 0 for no limit
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads the whole contents of the entry stored as @pathname into memory. See
+ * autoar_extractor_read_entry() for details. If the entry is bigger than
+ * @max_size, %AUTOAR_ENTRY_TOO_LARGE_ERRNO is returned without reading more
+ * than @max_size bytes.
+ *
+ * Returns: (transfer full): a #GBytes, or %NULL on error
+ **/
+GBytes *
+autoar_extractor_read_entry_bytes (AutoarExtractor  *self,
+                                   const char       *pathname,
+                                   gsize             max_size,
+                                   GCancellable     *cancellable,
+                                   GError          **error)
+{
+  g_autoptr (GInputStream) stream = NULL;
+  g_autoptr (GByteArray) array = NULL;
+  struct archive *a;
+  struct archive_entry *entry;
+  gssize read_size;
+
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), NULL);
+  g_return_val_if_fail (pathname != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  a = autoar_extractor_open_entry (self, pathname, &entry, cancellable, error);
+  if (a == NULL)
+    return NULL;
+
+  stream = g_object_new (AUTOAR_TYPE_ENTRY_STREAM, NULL);
+  AUTOAR_ENTRY_STREAM (stream)->extractor = g_object_ref (self);
+  AUTOAR_ENTRY_STREAM (stream)->a = a;
+
+  if (max_size > 0 && archive_entry_size_is_set (entry) &&
+      archive_entry_size (entry) > max_size) {
+    g_set_error (error, AUTOAR_EXTRACTOR_ERROR,
+                 AUTOAR_ENTRY_TOO_LARGE_ERRNO,
+                 "%s is larger than %" G_GSIZE_FORMAT " bytes",
+                 pathname, max_size);
+    return NULL;
+  }
+
+  /* The size in the header is not trusted, the array grows with the data */
+  array = g_byte_array_sized_new (archive_entry_size_is_set (entry) ?
+                                  CLAMP (archive_entry_size (entry), 0, BUFFER_SIZE) :
+                                  BUFFER_SIZE);
+  do {
+    guint old_len = array->len;
+    gsize chunk = BUFFER_SIZE;
+
+    /* The length of a GByteArray is a guint */
+    if (chunk > G_MAXUINT - old_len) {
+      g_set_error (error, AUTOAR_EXTRACTOR_ERROR,
+                   AUTOAR_ENTRY_TOO_LARGE_ERRNO,
+                   "%s is larger than %u bytes", pathname, G_MAXUINT);
+      return NULL;
+    }
+
+    if (max_size > 0) {
+      if (array->len > max_size) {
+        g_set_error (error, AUTOAR_EXTRACTOR_ERROR,
+                     AUTOAR_ENTRY_TOO_LARGE_ERRNO,
+                     "%s is larger than %" G_GSIZE_FORMAT " bytes",
+                     pathname, max_size);
+        return NULL;
+      }
+      /* Read one byte more than allowed to detect oversized entries */
+      chunk = MIN (chunk, max_size - array->len + 1);
+    }
+
+    g_byte_array_set_size (array, old_len + chunk);
+    read_size = g_input_stream_read (stream, array->data + old_len, chunk,
+                                     cancellable, error);
+    if (read_size < 0)
+      return NULL;
+    g_byte_array_set_size (array, old_len + read_size);
+  } while (read_size > 0);
+
+  if (!g_input_stream_close (stream, cancellable, error))
+    return NULL;
+
+  return g_byte_array_free_to_bytes (g_steal_pointer (&array));
+}
+
+/**
+ * autoar_extractor_list:
+ * @self: an #AutoarExtractor object
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Lists the entries of the source archive without extracting them. The
+ * archive is scanned only if its index is not set yet and it is not found
+ * in the cache, see autoar_extractor_set_use_index_cache(). No signals are
+ * emitted.
+ *
+ * Returns: (transfer full): an #AutoarArchiveIndex, or %NULL on error
+ **/
+AutoarArchiveIndex *
+autoar_extractor_list (AutoarExtractor  *self,
+                       GCancellable     *cancellable,
+                       GError          **error)
+{
+  g_return_val_if_fail (AUTOAR_IS_EXTRACTOR (self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  autoar_extractor_set_sync_cancellable (self, cancellable);
+
+  if (self->index == NULL)
+    autoar_extractor_do_build_index (self);
+
+  if (self->error != NULL) {
+    g_propagate_error (error, g_steal_pointer (&self->error));
+    return NULL;
+  }
+
+  if (g_cancellable_set_error_if_cancelled (self->cancellable, error))
+    return NULL;
+
+  return g_object_ref (self->index);
+}
@@ -29,6 +29,8 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "autoar-archive-index.h"
+
 G_BEGIN_DECLS
 
 #define AUTOAR_TYPE_EXTRACTOR autoar_extractor_get_type ()
@@ -47,6 +49,8 @@ G_DECLARE_FINAL_TYPE (AutoarExtractor, autoar_extractor, AUTOAR, EXTRACTOR, GObj
 #define AUTOAR_NOT_AN_ARCHIVE_ERRNO 2013
 #define AUTOAR_EMPTY_ARCHIVE_ERRNO 2014
 #define AUTOAR_PASSPHRASE_REQUIRED_ERRNO 2015
+#define AUTOAR_ENTRY_NOT_FOUND_ERRNO 2016
+#define AUTOAR_ENTRY_TOO_LARGE_ERRNO 2017
 
 GQuark           autoar_extractor_quark                       (void);
 
@@ -67,6 +71,9 @@ guint            autoar_extractor_get_completed_files         (AutoarExtractor *
 gboolean         autoar_extractor_get_output_is_dest          (AutoarExtractor *self);
 gboolean         autoar_extractor_get_delete_after_extraction (AutoarExtractor *self);
 gint64           autoar_extractor_get_notify_interval         (AutoarExtractor *self);
+gboolean         autoar_extractor_get_use_index_cache         (AutoarExtractor *self);
+gboolean         autoar_extractor_get_use_decoder             (AutoarExtractor *self);
+AutoarArchiveIndex *autoar_extractor_get_index                (AutoarExtractor *self);
 
 void             autoar_extractor_set_output_is_dest          (AutoarExtractor *self,
                                                                gboolean         output_is_dest);
@@ -74,9 +81,29 @@ void             autoar_extractor_set_delete_after_extraction (AutoarExtractor *
                                                                gboolean         delete_after_extraction);
 void             autoar_extractor_set_notify_interval         (AutoarExtractor *self,
                                                                gint64           notify_interval);
+void             autoar_extractor_set_use_index_cache         (AutoarExtractor *self,
+                                                               gboolean         use_index_cache);
+void             autoar_extractor_set_use_decoder             (AutoarExtractor *self,
+                                                               gboolean         use_decoder);
+void             autoar_extractor_set_index                   (AutoarExtractor    *self,
+                                                               AutoarArchiveIndex *index);
 void             autoar_extractor_set_passphrase              (AutoarExtractor *self,
                                                                const gchar     *passphrase);
 
+AutoarArchiveIndex *autoar_extractor_list                     (AutoarExtractor  *self,
+                                                               GCancellable     *cancellable,
+                                                               GError          **error);
+
+GInputStream    *autoar_extractor_read_entry                  (AutoarExtractor  *self,
+                                                               const char       *pathname,
+                                                               GCancellable     *cancellable,
+                                                               GError          **error);
+GBytes          *autoar_extractor_read_entry_bytes            (AutoarExtractor  *self,
+                                                               const char       *pathname,
+                                                               gsize             max_size,
+                                                               GCancellable     *cancellable,
+                                                               GError          **error);
+
 typedef enum {
     AUTOAR_CONFLICT_UNHANDLED = 0,
     AUTOAR_CONFLICT_SKIP,
@@ -84,6 +111,59 @@ typedef enum {
     AUTOAR_CONFLICT_CHANGE_DESTINATION
 } AutoarConflictAction;
 
+/**
+ * AutoarConflictPolicy:
+ * @AUTOAR_CONFLICT_POLICY_ASK: #AutoarExtractor::conflict is emitted
+ * @AUTOAR_CONFLICT_POLICY_SKIP: the existing file is kept
+ * @AUTOAR_CONFLICT_POLICY_OVERWRITE: the existing file is replaced, unless
+ *   it is a non-empty directory
+ * @AUTOAR_CONFLICT_POLICY_RENAME: the entry is extracted under the first
+ *   free name made by #AutoarExtractor:rename-pattern
+ * @AUTOAR_CONFLICT_POLICY_KEEP_NEWER: the existing file is replaced if the
+ *   entry was modified after it
+ *
+ * How #AutoarExtractor solves the name conflicts on its own, see
+ * autoar_extractor_set_conflict_policy().
+ **/
+typedef enum {
+    AUTOAR_CONFLICT_POLICY_ASK = 0,
+    AUTOAR_CONFLICT_POLICY_SKIP,
+    AUTOAR_CONFLICT_POLICY_OVERWRITE,
+    AUTOAR_CONFLICT_POLICY_RENAME,
+    AUTOAR_CONFLICT_POLICY_KEEP_NEWER
+} AutoarConflictPolicy;
+
+/**
+ * AutoarConflictFunc:
+ * @self: the #AutoarExtractor
+ * @file: a #GFile for the file that caused a conflict
+ * @new_file: (out) (transfer full): return location for the new destination
+ *   of @file, for %AUTOAR_CONFLICT_CHANGE_DESTINATION
+ * @user_data: the data passed to autoar_extractor_set_conflict_func()
+ *
+ * Solves a name conflict like #AutoarExtractor::conflict, on the thread
+ * which extracts the archive.
+ *
+ * Returns: the #AutoarConflictAction to be performed, or
+ * %AUTOAR_CONFLICT_UNHANDLED to follow #AutoarExtractor:conflict-policy
+ **/
+typedef AutoarConflictAction (*AutoarConflictFunc) (AutoarExtractor *self,
+                                                    GFile           *file,
+                                                    GFile          **new_file,
+                                                    gpointer         user_data);
+
+AutoarConflictPolicy autoar_extractor_get_conflict_policy     (AutoarExtractor *self);
+const char      *autoar_extractor_get_rename_pattern          (AutoarExtractor *self);
+
+void             autoar_extractor_set_conflict_policy         (AutoarExtractor     *self,
+                                                               AutoarConflictPolicy conflict_policy);
+void             autoar_extractor_set_rename_pattern          (AutoarExtractor *self,
+                                                               const char      *rename_pattern);
+void             autoar_extractor_set_conflict_func           (AutoarExtractor   *self,
+                                                               AutoarConflictFunc func,
+                                                               gpointer           user_data,
+                                                               GDestroyNotify     notify);
+
 G_END_DECLS
 
 #endif /* AUTOAR_EXTRACTOR_H */
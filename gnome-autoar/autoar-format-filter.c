@@ -179,7 +179,17 @@ static AutoarFilterDescription autoar_filter_description[] = {
   { AUTOAR_FILTER_LRZIP,     ARCHIVE_FILTER_LRZIP,               "lrz",  "lrzip",
     "application/x-lrzip",   "Long Range ZIP (lrzip)",
     archive_read_support_filter_lrzip,
-    archive_write_add_filter_lrzip }
+    archive_write_add_filter_lrzip },
+
+  { AUTOAR_FILTER_ZSTD,      ARCHIVE_FILTER_ZSTD,                "zst",  "zstd",
+    "application/zstd",      "Zstandard",
+    archive_read_support_filter_zstd,
+    archive_write_add_filter_zstd },
+
+  { AUTOAR_FILTER_LZ4,       ARCHIVE_FILTER_LZ4,                 "lz4",  "lz4",
+    "application/x-lz4",     "LZ4",
+    archive_read_support_filter_lz4,
+    archive_write_add_filter_lz4 }
 };
 
 /**
@@ -275,6 +275,8 @@ autoar_gtk_chooser_simple_new (AutoarFormat default_format,
     { AUTOAR_FORMAT_TAR,   AUTOAR_FILTER_GZIP  },
     { AUTOAR_FORMAT_TAR,   AUTOAR_FILTER_BZIP2 },
     { AUTOAR_FORMAT_TAR,   AUTOAR_FILTER_XZ    },
+    { AUTOAR_FORMAT_TAR,   AUTOAR_FILTER_ZSTD  },
+    { AUTOAR_FORMAT_TAR,   AUTOAR_FILTER_LZ4   },
     { AUTOAR_FORMAT_CPIO,  AUTOAR_FILTER_NONE  },
     { AUTOAR_FORMAT_7ZIP,  AUTOAR_FILTER_NONE  },
   };
@@ -0,0 +1,330 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-ignore.c
+ * Patterns of the files which are excluded from archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-ignore.h"
+
+#include <glib.h>
+#include <string.h>
+
+/* AutoarIgnore holds the patterns of a .gitignore file, or of the options
+ * of AutoarCompressor, which use the same syntax. Each pattern is translated
+ * to a regular expression once. The patterns of the directories above are
+ * reached through the parent, so the subdirectories share them, and the
+ * patterns of the innermost file are looked at first. The patterns are not
+ * changed once the scanner has started, so they are matched on all of its
+ * threads without locks. */
+
+typedef struct
+{
+  GRegex *regex;
+  gboolean negated;
+  gboolean dir_only;
+  /* Matched against the path relative to the base instead of the name */
+  gboolean anchored;
+} AutoarIgnoreRule;
+
+struct _AutoarIgnore
+{
+  gint ref_count;
+
+  AutoarIgnore *parent;
+  /* The directory of the patterns relative to the root, ending with a
+   * slash, or empty for the root */
+  char *base;
+  GArray *rules;
+};
+
+static void
+autoar_ignore_rule_clear (gpointer data)
+{
+  AutoarIgnoreRule *rule = data;
+
+  g_regex_unref (rule->regex);
+}
+
+/**
+ * autoar_ignore_new:
+ * @parent: (nullable): the patterns of the directory above, or %NULL
+ * @base: the directory of the patterns, relative to the root
+ *
+ * Creates an empty set of patterns, which is looked at before @parent.
+ *
+ * Returns: (transfer full): a new #AutoarIgnore
+ **/
+AutoarIgnore *
+autoar_ignore_new (AutoarIgnore *parent,
+                   const char   *base)
+{
+  AutoarIgnore *self;
+
+  self = g_new0 (AutoarIgnore, 1);
+  self->ref_count = 1;
+  self->parent = parent != NULL ? autoar_ignore_ref (parent) : NULL;
+  self->base = *base != '\0' && !g_str_has_suffix (base, "/") ?
+               g_strconcat (base, "/", NULL) : g_strdup (base);
+  self->rules = g_array_new (FALSE, FALSE, sizeof (AutoarIgnoreRule));
+  g_array_set_clear_func (self->rules, autoar_ignore_rule_clear);
+
+  return self;
+}
+
+AutoarIgnore *
+autoar_ignore_ref (AutoarIgnore *self)
+{
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+autoar_ignore_unref (AutoarIgnore *self)
+{
+  if (self == NULL || !g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_clear_pointer (&self->parent, autoar_ignore_unref);
+  g_array_unref (self->rules);
+  g_free (self->base);
+  g_free (self);
+}
+
+/* Translates the wildcards of a pattern, where "*" and "?" don't match
+ * slashes and "**" matches any number of directories */
+static char *
+autoar_ignore_translate (const char *pattern)
+{
+  GString *regex;
+  const char *p;
+
+  regex = g_string_new ("^");
+
+  for (p = pattern; *p != '\0'; p++) {
+    if (p[0] == '*' && p[1] == '*' &&
+        (p == pattern || p[-1] == '/') &&
+        (p[2] == '/' || p[2] == '\0')) {
+      /* "**" as a whole component */
+      if (p[2] == '/') {
+        g_string_append (regex, "(?:.*/)?");
+        p += 2;
+      } else {
+        g_string_append (regex, ".*");
+        p += 1;
+      }
+    } else if (*p == '*') {
+      g_string_append (regex, "[^/]*");
+    } else if (*p == '?') {
+      g_string_append (regex, "[^/]");
+    } else if (*p == '[') {
+      const char *first;
+      const char *end;
+
+      /* A bracket right after the opening one belongs to the class */
+      first = p + (p[1] == '!' || p[1] == '^' ? 2 : 1);
+      end = *first != '\0' ? strchr (first + 1, ']') : NULL;
+      if (end == NULL) {
+        g_string_append (regex, "\\[");
+        continue;
+      }
+
+      g_string_append_c (regex, '[');
+      p++;
+      if (*p == '!' || *p == '^') {
+        g_string_append_c (regex, '^');
+        p++;
+      }
+      for (; p < end; p++) {
+        if (*p == '\\' || *p == '[')
+          g_string_append_c (regex, '\\');
+        g_string_append_c (regex, *p);
+      }
+      g_string_append_c (regex, ']');
+    } else {
+      g_autofree char *escaped = NULL;
+
+      if (*p == '\\' && p[1] != '\0')
+        p++;
+
+      escaped = g_regex_escape_string (p, 1);
+      g_string_append (regex, escaped);
+    }
+  }
+
+  g_string_append_c (regex, '$');
+
+  return g_string_free (regex, FALSE);
+}
+
+/**
+ * autoar_ignore_add_pattern:
+ * @self: an #AutoarIgnore
+ * @pattern: a pattern in the syntax of .gitignore files
+ *
+ * Adds a pattern, which is looked at before the ones added before it. Blank
+ * patterns and comments are skipped.
+ **/
+void
+autoar_ignore_add_pattern (AutoarIgnore *self,
+                           const char   *pattern)
+{
+  g_autofree char *copy = NULL;
+  g_autofree char *translated = NULL;
+  g_autoptr (GError) error = NULL;
+  AutoarIgnoreRule rule = { NULL, FALSE, FALSE, FALSE };
+  char *start;
+  gsize length;
+
+  copy = g_strdup (pattern);
+  start = copy;
+
+  /* Trailing spaces are ignored unless they are escaped */
+  length = strlen (start);
+  while (length > 0 && start[length - 1] == ' ' &&
+         (length < 2 || start[length - 2] != '\\'))
+    start[--length] = '\0';
+
+  if (*start == '\0' || *start == '#')
+    return;
+
+  if (*start == '!') {
+    rule.negated = TRUE;
+    start++;
+  } else if (*start == '\\' && (start[1] == '!' || start[1] == '#')) {
+    start++;
+  }
+
+  length = strlen (start);
+  if (length > 0 && start[length - 1] == '/') {
+    rule.dir_only = TRUE;
+    start[--length] = '\0';
+  }
+
+  if (*start == '\0')
+    return;
+
+  /* A slash at the beginning or in the middle anchors the pattern */
+  rule.anchored = strchr (start, '/') != NULL;
+  if (*start == '/')
+    start++;
+
+  /* Names are bytes, which don't have to be valid UTF-8 */
+  translated = autoar_ignore_translate (start);
+  rule.regex = g_regex_new (translated,
+                            G_REGEX_DOTALL | G_REGEX_OPTIMIZE | G_REGEX_RAW,
+                            0, &error);
+  if (rule.regex == NULL) {
+    g_debug ("autoar_ignore_add_pattern: %s: %s", pattern, error->message);
+    return;
+  }
+
+  g_array_append_val (self->rules, rule);
+}
+
+/**
+ * autoar_ignore_add_patterns:
+ * @self: an #AutoarIgnore
+ * @contents: the contents of a .gitignore file
+ * @length: the length of @contents
+ *
+ * Adds the patterns of each line of @contents.
+ **/
+void
+autoar_ignore_add_patterns (AutoarIgnore *self,
+                            const char   *contents,
+                            gsize         length)
+{
+  const char *line;
+  const char *end;
+
+  line = contents;
+  end = contents + length;
+  while (line < end) {
+    g_autofree char *pattern = NULL;
+    const char *eol;
+
+    eol = memchr (line, '\n', end - line);
+    if (eol == NULL)
+      eol = end;
+
+    pattern = g_strndup (line, eol - line);
+    if (g_str_has_suffix (pattern, "\r"))
+      pattern[strlen (pattern) - 1] = '\0';
+
+    autoar_ignore_add_pattern (self, pattern);
+    line = eol + 1;
+  }
+}
+
+gboolean
+autoar_ignore_is_empty (AutoarIgnore *self)
+{
+  return self == NULL ||
+         (self->rules->len == 0 && autoar_ignore_is_empty (self->parent));
+}
+
+/**
+ * autoar_ignore_match:
+ * @self: (nullable): an #AutoarIgnore
+ * @path: the path of a file relative to the root
+ * @is_dir: whether the file is a directory
+ *
+ * Looks for the last pattern which matches @path, from the innermost
+ * patterns to the ones of the root.
+ *
+ * Returns: whether a pattern matched, and whether it was negated
+ **/
+AutoarIgnoreMatch
+autoar_ignore_match (AutoarIgnore *self,
+                     const char   *path,
+                     gboolean      is_dir)
+{
+  const char *name;
+  guint i;
+
+  name = strrchr (path, '/');
+  name = name != NULL ? name + 1 : path;
+
+  for (; self != NULL; self = self->parent) {
+    const char *relative;
+
+    if (!g_str_has_prefix (path, self->base))
+      continue;
+    relative = path + strlen (self->base);
+
+    for (i = self->rules->len; i > 0; i--) {
+      AutoarIgnoreRule *rule;
+
+      rule = &g_array_index (self->rules, AutoarIgnoreRule, i - 1);
+      if (rule->dir_only && !is_dir)
+        continue;
+
+      if (g_regex_match (rule->regex, rule->anchored ? relative : name,
+                         0, NULL))
+        return rule->negated ? AUTOAR_IGNORE_NEGATED : AUTOAR_IGNORE_MATCHED;
+    }
+  }
+
+  return AUTOAR_IGNORE_NONE;
+}
@@ -0,0 +1,61 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-ignore.h
+ * Patterns of the files which are excluded from archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_IGNORE_H
+#define AUTOAR_IGNORE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  AUTOAR_IGNORE_NONE = 0,
+  AUTOAR_IGNORE_MATCHED,
+  AUTOAR_IGNORE_NEGATED
+} AutoarIgnoreMatch;
+
+typedef struct _AutoarIgnore AutoarIgnore;
+
+AutoarIgnore*  autoar_ignore_new                  (AutoarIgnore *parent,
+                                                   const char *base);
+AutoarIgnore*  autoar_ignore_ref                  (AutoarIgnore *self);
+void           autoar_ignore_unref                (AutoarIgnore *self);
+
+void           autoar_ignore_add_pattern          (AutoarIgnore *self,
+                                                   const char *pattern);
+void           autoar_ignore_add_patterns         (AutoarIgnore *self,
+                                                   const char *contents,
+                                                   gsize length);
+gboolean       autoar_ignore_is_empty             (AutoarIgnore *self);
+
+AutoarIgnoreMatch autoar_ignore_match             (AutoarIgnore *self,
+                                                   const char *path,
+                                                   gboolean is_dir);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (AutoarIgnore, autoar_ignore_unref)
+
+G_END_DECLS
+
+#endif /* AUTOAR_IGNORE_H */
@@ -34,6 +34,8 @@ static gchar *supported_mime_types[] = {
   "application/x-lha",
   "application/x-lzip",
   "application/x-lzip-compressed-tar",
+  "application/x-lz4",
+  "application/x-lz4-compressed-tar",
   "application/x-lzma",
   "application/x-lzma-compressed-tar",
   "application/x-tar",
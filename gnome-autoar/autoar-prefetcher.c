@@ -0,0 +1,812 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-prefetcher.c
+ * Reading files ahead of the archive
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+
+#include "config.h"
+#include "autoar-prefetcher.h"
+
+#include <gio/gio.h>
+
+#if defined(HAVE_POSIX_FADVISE) || defined(HAVE_LINUX_FIEMAP_H)
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#ifdef HAVE_LINUX_FIEMAP_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+# include <linux/fiemap.h>
+#endif
+
+#ifdef __linux__
+# include <sys/sysmacros.h>
+#endif
+
+/* AutoarPrefetcher keeps a window of the entries which are going to be
+ * added to the archive next, and reads their files on a pool of threads in
+ * the meantime, so the writer doesn't wait for slow or remote storage
+ * between files. Small files are read into memory as a whole, as long as
+ * the data which hasn't been consumed yet fits in the budget. The larger
+ * local files are still read by the writer itself, but the kernel is asked
+ * to read a window at their start ahead, which moves forward as the writer
+ * reads them, so a large file doesn't fill the page cache at once.
+ *
+ * On rotational disks, the reads are started in batches sorted by the
+ * physical location of the files, so the disk doesn't seek back and forth
+ * between the directories. The entries are still popped in the order they
+ * were pushed.
+ *
+ * The files which are read into memory may also be hashed by the pool, so
+ * the duplicated files are found without hashing them on the writer. */
+
+/* Larger files are not buffered */
+#define READ_AHEAD_FILE_SIZE (1024 * 1024)
+/* Limits the window if the files are small */
+#define MAX_FILES_PER_THREAD 64
+/* Amount of the larger files which is read ahead, unless the budget is
+ * smaller */
+#define ADVISE_SIZE (4 * 1024 * 1024)
+
+typedef struct
+{
+  GFile *file;
+  GFileInfo *info;
+  /* Whether the file is read by the pool */
+  gboolean queued;
+  /* Whether the file is read into memory, or only advised */
+  gboolean buffered;
+  /* Whether the job waits for its batch to be sorted */
+  gboolean pending;
+  /* Sort keys of the batch */
+  guint64 physical;
+  guint64 inode;
+
+  /* Set by the job */
+  GBytes *bytes;
+  char *digest;
+  GError *error;
+  gboolean done;
+} AutoarPrefetcherJob;
+
+struct _AutoarPrefetcher
+{
+  GThreadPool *pool;
+  GCancellable *cancellable;
+  guint max_files;
+  guint64 budget;
+  guint64 advise_size;
+  AutoarReadOrder read_order;
+  guint batch_size;
+  gboolean digests;
+
+  GMutex lock;
+  GCond cond;
+
+  /* Entries which haven't been popped yet, in order */
+  GQueue window;
+  /* Queued jobs which haven't been read yet, by their files */
+  GHashTable *jobs;
+  /* Size of the buffered files which haven't been read yet */
+  guint64 buffered_size;
+  /* Queued jobs which haven't been started yet, if they are sorted */
+  GPtrArray *pending;
+};
+
+static void
+autoar_prefetcher_job_free (AutoarPrefetcherJob *job)
+{
+  g_object_unref (job->file);
+  g_object_unref (job->info);
+  g_clear_pointer (&job->bytes, g_bytes_unref);
+  g_free (job->digest);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+#ifdef HAVE_POSIX_FADVISE
+/* A #GInputStream reading a large file, which asks the kernel to read the
+ * next window of the file ahead whenever half of the current one has been
+ * read. The page cache is shared, so the advice is given on a descriptor
+ * of its own. */
+#define AUTOAR_TYPE_ADVISE_STREAM autoar_advise_stream_get_type ()
+
+G_DECLARE_FINAL_TYPE (AutoarAdviseStream, autoar_advise_stream, AUTOAR, ADVISE_STREAM, GInputStream)
+
+struct _AutoarAdviseStream
+{
+  GInputStream parent_instance;
+
+  GInputStream *base;
+  int fd;
+  guint64 size;
+  guint64 window;
+
+  goffset offset;
+  /* The end of the data which has been advised */
+  guint64 advised;
+};
+
+static void autoar_advise_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (AutoarAdviseStream, autoar_advise_stream, G_TYPE_INPUT_STREAM,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                autoar_advise_stream_seekable_iface_init))
+
+static void
+autoar_advise_stream_advise (AutoarAdviseStream *self)
+{
+  if (self->fd < 0 || self->advised >= self->size ||
+      self->offset + self->window / 2 < self->advised)
+    return;
+
+  posix_fadvise (self->fd, self->advised, self->window, POSIX_FADV_WILLNEED);
+  self->advised += self->window;
+}
+
+static gssize
+autoar_advise_stream_read (GInputStream  *stream,
+                           void          *buffer,
+                           gsize          count,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  AutoarAdviseStream *self;
+  gssize read_size;
+
+  self = AUTOAR_ADVISE_STREAM (stream);
+
+  read_size = g_input_stream_read (self->base, buffer, count,
+                                   cancellable, error);
+  if (read_size <= 0)
+    return read_size;
+
+  self->offset += read_size;
+  autoar_advise_stream_advise (self);
+
+  return read_size;
+}
+
+static gboolean
+autoar_advise_stream_close (GInputStream  *stream,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  AutoarAdviseStream *self;
+
+  self = AUTOAR_ADVISE_STREAM (stream);
+
+  if (self->fd >= 0) {
+    close (self->fd);
+    self->fd = -1;
+  }
+
+  return g_input_stream_close (self->base, cancellable, error);
+}
+
+static goffset
+autoar_advise_stream_tell (GSeekable *seekable)
+{
+  return AUTOAR_ADVISE_STREAM (seekable)->offset;
+}
+
+static gboolean
+autoar_advise_stream_can_seek (GSeekable *seekable)
+{
+  AutoarAdviseStream *self;
+
+  self = AUTOAR_ADVISE_STREAM (seekable);
+
+  return G_IS_SEEKABLE (self->base) &&
+         g_seekable_can_seek (G_SEEKABLE (self->base));
+}
+
+static gboolean
+autoar_advise_stream_seek (GSeekable     *seekable,
+                           goffset        offset,
+                           GSeekType      type,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  AutoarAdviseStream *self;
+
+  self = AUTOAR_ADVISE_STREAM (seekable);
+
+  if (!G_IS_SEEKABLE (self->base)) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                         "Seek not supported on stream");
+    return FALSE;
+  }
+
+  if (!g_seekable_seek (G_SEEKABLE (self->base), offset, type,
+                        cancellable, error))
+    return FALSE;
+
+  self->offset = g_seekable_tell (G_SEEKABLE (self->base));
+
+  /* The window starts again from where the data is read */
+  if ((guint64) self->offset > self->advised ||
+      (guint64) self->offset + self->window < self->advised)
+    self->advised = self->offset;
+  autoar_advise_stream_advise (self);
+
+  return TRUE;
+}
+
+static gboolean
+autoar_advise_stream_can_truncate (GSeekable *seekable)
+{
+  return FALSE;
+}
+
+static gboolean
+autoar_advise_stream_truncate (GSeekable     *seekable,
+                               goffset        offset,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Cannot truncate input streams");
+  return FALSE;
+}
+
+static void
+autoar_advise_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = autoar_advise_stream_tell;
+  iface->can_seek = autoar_advise_stream_can_seek;
+  iface->seek = autoar_advise_stream_seek;
+  iface->can_truncate = autoar_advise_stream_can_truncate;
+  iface->truncate_fn = autoar_advise_stream_truncate;
+}
+
+static void
+autoar_advise_stream_finalize (GObject *object)
+{
+  AutoarAdviseStream *self;
+
+  self = AUTOAR_ADVISE_STREAM (object);
+
+  if (self->fd >= 0)
+    close (self->fd);
+  g_clear_object (&self->base);
+
+  G_OBJECT_CLASS (autoar_advise_stream_parent_class)->finalize (object);
+}
+
+static void
+autoar_advise_stream_class_init (AutoarAdviseStreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  object_class->finalize = autoar_advise_stream_finalize;
+
+  stream_class->read_fn = autoar_advise_stream_read;
+  stream_class->close_fn = autoar_advise_stream_close;
+}
+
+static void
+autoar_advise_stream_init (AutoarAdviseStream *self)
+{
+  self->fd = -1;
+}
+
+/* Takes @base, whose first @window bytes have been advised already */
+static GInputStream *
+autoar_advise_stream_new (GInputStream *base,
+                          GFile        *file,
+                          guint64       size,
+                          guint64       window)
+{
+  AutoarAdviseStream *self;
+
+  self = g_object_new (AUTOAR_TYPE_ADVISE_STREAM, NULL);
+  self->base = base;
+  self->fd = open (g_file_peek_path (file), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  self->size = size;
+  self->window = window;
+  self->advised = window;
+
+  return G_INPUT_STREAM (self);
+}
+#endif
+
+static void
+autoar_prefetcher_advise (AutoarPrefetcher    *self,
+                          AutoarPrefetcherJob *job)
+{
+#ifdef HAVE_POSIX_FADVISE
+  const char *path;
+  int fd;
+
+  path = g_file_peek_path (job->file);
+  if (path == NULL)
+    return;
+
+  /* The page cache keeps the data after the file is closed. The rest of
+   * the file is advised by AutoarAdviseStream. */
+  fd = open (path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0)
+    return;
+
+  posix_fadvise (fd, 0, self->advise_size, POSIX_FADV_WILLNEED);
+  close (fd);
+#endif
+}
+
+static void
+autoar_prefetcher_buffer (AutoarPrefetcher    *self,
+                          AutoarPrefetcherJob *job)
+{
+  GFileInputStream *istream;
+  gsize size, bytes_read;
+  guint8 *buffer;
+
+  istream = g_file_read (job->file, self->cancellable, &job->error);
+  if (istream == NULL)
+    return;
+
+  size = g_file_info_get_size (job->info);
+  buffer = g_malloc (size);
+  if (g_input_stream_read_all (G_INPUT_STREAM (istream), buffer, size,
+                               &bytes_read, self->cancellable, &job->error))
+    job->bytes = g_bytes_new_take (buffer, bytes_read);
+  else
+    g_free (buffer);
+
+  if (job->bytes != NULL && self->digests)
+    job->digest = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, job->bytes);
+
+  g_input_stream_close (G_INPUT_STREAM (istream), NULL, NULL);
+  g_object_unref (istream);
+}
+
+/* Returns the physical offset of the first extent of the file on its disk,
+ * or G_MAXUINT64 if it is unknown */
+static guint64
+autoar_prefetcher_get_physical (GFile *file)
+{
+  guint64 physical = G_MAXUINT64;
+#ifdef HAVE_LINUX_FIEMAP_H
+  guint64 buffer[(sizeof (struct fiemap) +
+                  sizeof (struct fiemap_extent)) / sizeof (guint64)] = { 0 };
+  struct fiemap *map = (struct fiemap *) buffer;
+  const char *path;
+  int fd;
+
+  path = g_file_peek_path (file);
+  if (path == NULL)
+    return physical;
+
+  fd = open (path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0)
+    return physical;
+
+  map->fm_start = 0;
+  map->fm_length = FIEMAP_MAX_OFFSET;
+  map->fm_extent_count = 1;
+  if (ioctl (fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+    physical = map->fm_extents[0].fe_physical;
+
+  close (fd);
+#endif
+
+  return physical;
+}
+
+static gint
+autoar_prefetcher_job_compare (gconstpointer a,
+                               gconstpointer b)
+{
+  const AutoarPrefetcherJob *job_a = *(AutoarPrefetcherJob **) a;
+  const AutoarPrefetcherJob *job_b = *(AutoarPrefetcherJob **) b;
+
+  if (job_a->physical != job_b->physical)
+    return job_a->physical < job_b->physical ? -1 : 1;
+  if (job_a->inode != job_b->inode)
+    return job_a->inode < job_b->inode ? -1 : 1;
+
+  return 0;
+}
+
+/* Starts the pending jobs, in the order of their location on the disk */
+static void
+autoar_prefetcher_flush (AutoarPrefetcher *self)
+{
+  guint i;
+
+  if (self->pending == NULL || self->pending->len == 0)
+    return;
+
+  g_debug ("autoar_prefetcher_flush: %u files", self->pending->len);
+
+  g_ptr_array_sort (self->pending, autoar_prefetcher_job_compare);
+  for (i = 0; i < self->pending->len; i++) {
+    AutoarPrefetcherJob *job = g_ptr_array_index (self->pending, i);
+
+    job->pending = FALSE;
+    g_thread_pool_push (self->pool, job, NULL);
+  }
+
+  g_ptr_array_set_size (self->pending, 0);
+}
+
+static void
+autoar_prefetcher_job_run (gpointer data,
+                           gpointer user_data)
+{
+  AutoarPrefetcherJob *job = data;
+  AutoarPrefetcher *self = user_data;
+
+  if (job->buffered)
+    autoar_prefetcher_buffer (self, job);
+  else
+    autoar_prefetcher_advise (self, job);
+
+  g_mutex_lock (&self->lock);
+  job->done = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * autoar_prefetcher_new:
+ * @n_threads: the number of threads, or 0 to read nothing ahead
+ * @budget: the size of the files which may be kept in memory
+ * @read_order: the order in which the files are read, which must not be
+ * %AUTOAR_READ_ORDER_AUTO
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ *
+ * Returns: (transfer full): a new #AutoarPrefetcher
+ **/
+AutoarPrefetcher *
+autoar_prefetcher_new (guint            n_threads,
+                       guint64          budget,
+                       AutoarReadOrder  read_order,
+                       GCancellable    *cancellable)
+{
+  AutoarPrefetcher *self;
+
+  g_return_val_if_fail (read_order != AUTOAR_READ_ORDER_AUTO, NULL);
+
+  self = g_new0 (AutoarPrefetcher, 1);
+  self->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+  self->max_files = MAX (n_threads * MAX_FILES_PER_THREAD, 1);
+  self->budget = budget;
+  self->advise_size = MIN (budget, ADVISE_SIZE);
+  self->read_order = read_order;
+  /* Half of the window is read while the other half is collected */
+  self->batch_size = MAX (self->max_files / 2, 1);
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->window);
+  self->jobs = g_hash_table_new_full (g_file_hash,
+                                      (GEqualFunc) g_file_equal,
+                                      NULL,
+                                      (GDestroyNotify) autoar_prefetcher_job_free);
+  if (n_threads > 0)
+    self->pool = g_thread_pool_new (autoar_prefetcher_job_run, self,
+                                    n_threads, FALSE, NULL);
+  /* The pending jobs are owned by the hash table */
+  if (n_threads > 0 && read_order != AUTOAR_READ_ORDER_TRAVERSAL)
+    self->pending = g_ptr_array_new ();
+
+  g_debug ("autoar_prefetcher_new: %u threads, read order %d",
+           n_threads, read_order);
+
+  return self;
+}
+
+void
+autoar_prefetcher_free (AutoarPrefetcher *self)
+{
+  AutoarPrefetcherJob *job;
+
+  if (self == NULL)
+    return;
+
+  /* Drop the jobs which haven't been started yet */
+  if (self->pool != NULL)
+    g_thread_pool_free (self->pool, TRUE, TRUE);
+  g_clear_pointer (&self->pending, g_ptr_array_unref);
+
+  /* The queued jobs are freed with the hash table */
+  while ((job = g_queue_pop_head (&self->window)) != NULL) {
+    if (!job->queued)
+      autoar_prefetcher_job_free (job);
+  }
+  g_hash_table_unref (self->jobs);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_clear_object (&self->cancellable);
+  g_free (self);
+}
+
+/**
+ * autoar_prefetcher_set_digests:
+ * @self: an #AutoarPrefetcher
+ * @digests: whether to hash the files which are read into memory
+ *
+ * Computes the SHA-256 digests of the files which are read into memory on
+ * the pool, which are returned by autoar_prefetcher_read(). This function
+ * should only be called before pushing entries.
+ **/
+void
+autoar_prefetcher_set_digests (AutoarPrefetcher *self,
+                               gboolean          digests)
+{
+  self->digests = digests;
+}
+
+/**
+ * autoar_prefetcher_is_rotational:
+ * @device: the ID of a device, as in %G_FILE_ATTRIBUTE_UNIX_DEVICE
+ *
+ * Returns: %TRUE if the kernel reports that @device is a rotational disk
+ **/
+gboolean
+autoar_prefetcher_is_rotational (guint32 device)
+{
+#ifdef __linux__
+  g_autofree char *path = NULL;
+  g_autofree char *contents = NULL;
+
+  path = g_strdup_printf ("/sys/dev/block/%u:%u/queue/rotational",
+                          major (device), minor (device));
+  if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+    /* Partitions use the queue of their disk */
+    g_free (path);
+    path = g_strdup_printf ("/sys/dev/block/%u:%u/../queue/rotational",
+                            major (device), minor (device));
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+      return FALSE;
+  }
+
+  return contents[0] == '1';
+#else
+  return FALSE;
+#endif
+}
+
+/**
+ * autoar_prefetcher_is_full:
+ * @self: an #AutoarPrefetcher
+ *
+ * Returns: %TRUE if no more entries should be pushed before popping some
+ **/
+gboolean
+autoar_prefetcher_is_full (AutoarPrefetcher *self)
+{
+  /* Files which are never read must not stall the window */
+  if (self->window.length == 0)
+    return FALSE;
+
+  return self->window.length >= self->max_files ||
+         self->buffered_size >= self->budget;
+}
+
+/**
+ * autoar_prefetcher_push:
+ * @self: an #AutoarPrefetcher
+ * @file: the file of the entry
+ * @info: the info of @file
+ *
+ * Appends an entry to the window, and starts reading @file if it is a
+ * regular file.
+ **/
+void
+autoar_prefetcher_push (AutoarPrefetcher *self,
+                        GFile            *file,
+                        GFileInfo        *info)
+{
+  AutoarPrefetcherJob *job;
+  guint64 size;
+
+  job = g_new0 (AutoarPrefetcherJob, 1);
+  job->file = g_object_ref (file);
+  job->info = g_object_ref (info);
+  g_queue_push_tail (&self->window, job);
+
+  size = g_file_info_get_size (info);
+  if (self->pool == NULL ||
+      g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR || size == 0 ||
+      g_hash_table_contains (self->jobs, file))
+    return;
+
+  /* Hard links may be written much later, so they aren't kept in memory */
+  job->buffered =
+    size <= READ_AHEAD_FILE_SIZE &&
+    self->buffered_size < self->budget &&
+    g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_NLINK) <= 1;
+
+  if (job->buffered) {
+    self->buffered_size += size;
+  } else {
+#ifdef HAVE_POSIX_FADVISE
+    if (!g_file_is_native (file))
+      return;
+#else
+    return;
+#endif
+  }
+
+  job->queued = TRUE;
+  g_hash_table_insert (self->jobs, job->file, job);
+
+  if (self->pending == NULL) {
+    g_thread_pool_push (self->pool, job, NULL);
+    return;
+  }
+
+  job->pending = TRUE;
+  job->inode = g_file_info_get_attribute_uint64 (info,
+                                                 G_FILE_ATTRIBUTE_UNIX_INODE);
+  job->physical = self->read_order == AUTOAR_READ_ORDER_EXTENT ?
+                  autoar_prefetcher_get_physical (file) : G_MAXUINT64;
+  g_ptr_array_add (self->pending, job);
+
+  if (self->pending->len >= self->batch_size)
+    autoar_prefetcher_flush (self);
+}
+
+/**
+ * autoar_prefetcher_pop:
+ * @self: an #AutoarPrefetcher
+ * @file: (out) (transfer full): return location for the file of the entry
+ * @info: (out) (transfer full): return location for its info
+ *
+ * Removes the first entry from the window. Its data is read by
+ * autoar_prefetcher_read().
+ *
+ * Returns: %FALSE if the window is empty
+ **/
+gboolean
+autoar_prefetcher_pop (AutoarPrefetcher  *self,
+                       GFile            **file,
+                       GFileInfo        **info)
+{
+  AutoarPrefetcherJob *job;
+
+  job = g_queue_pop_head (&self->window);
+  if (job == NULL) {
+    *file = NULL;
+    *info = NULL;
+    return FALSE;
+  }
+
+  *file = g_object_ref (job->file);
+  *info = g_object_ref (job->info);
+
+  /* The entry is going to be written, so its batch is started as it is */
+  if (job->pending)
+    autoar_prefetcher_flush (self);
+
+  if (!job->queued)
+    autoar_prefetcher_job_free (job);
+
+  return TRUE;
+}
+
+/* Removes the job of @file once it is done, or returns %NULL if @file is
+ * not read ahead */
+static AutoarPrefetcherJob *
+autoar_prefetcher_take (AutoarPrefetcher *self,
+                        GFile            *file)
+{
+  AutoarPrefetcherJob *job;
+
+  job = g_hash_table_lookup (self->jobs, file);
+  if (job == NULL)
+    return NULL;
+
+  g_hash_table_steal (self->jobs, file);
+
+  if (job->pending)
+    autoar_prefetcher_flush (self);
+
+  g_mutex_lock (&self->lock);
+  while (!job->done)
+    g_cond_wait (&self->cond, &self->lock);
+  g_mutex_unlock (&self->lock);
+
+  if (job->buffered)
+    self->buffered_size -= g_file_info_get_size (job->info);
+
+  return job;
+}
+
+/**
+ * autoar_prefetcher_read:
+ * @self: an #AutoarPrefetcher
+ * @file: the file to read
+ * @digest: (out) (optional) (nullable): return location for the SHA-256
+ * digest of the data, if it has been computed ahead
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Opens @file for reading, from memory if it has been read ahead. The
+ * memory is released once the stream is freed. See
+ * autoar_prefetcher_set_digests().
+ *
+ * Returns: (transfer full): a new #GInputStream, or %NULL on error
+ **/
+GInputStream *
+autoar_prefetcher_read (AutoarPrefetcher  *self,
+                        GFile             *file,
+                        char             **digest,
+                        GCancellable      *cancellable,
+                        GError           **error)
+{
+  AutoarPrefetcherJob *job;
+  GInputStream *istream = NULL;
+
+  if (digest != NULL)
+    *digest = NULL;
+
+  job = autoar_prefetcher_take (self, file);
+  if (job == NULL)
+    return G_INPUT_STREAM (g_file_read (file, cancellable, error));
+
+  if (job->error != NULL)
+    g_propagate_error (error, g_steal_pointer (&job->error));
+  else if (job->bytes != NULL)
+    istream = g_memory_input_stream_new_from_bytes (job->bytes);
+  else
+    istream = G_INPUT_STREAM (g_file_read (file, cancellable, error));
+
+#ifdef HAVE_POSIX_FADVISE
+  if (istream != NULL && !job->buffered)
+    istream = autoar_advise_stream_new (istream, file,
+                                        g_file_info_get_size (job->info),
+                                        self->advise_size);
+#endif
+
+  if (istream != NULL && digest != NULL)
+    *digest = g_steal_pointer (&job->digest);
+
+  autoar_prefetcher_job_free (job);
+
+  return istream;
+}
+
+/**
+ * autoar_prefetcher_skip:
+ * @self: an #AutoarPrefetcher
+ * @file: a file which is not going to be read
+ *
+ * Releases the data of @file which has been read ahead.
+ **/
+void
+autoar_prefetcher_skip (AutoarPrefetcher *self,
+                        GFile            *file)
+{
+  AutoarPrefetcherJob *job;
+
+  job = autoar_prefetcher_take (self, file);
+  if (job != NULL)
+    autoar_prefetcher_job_free (job);
+}
@@ -0,0 +1,69 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-prefetcher.h
+ * Reading files ahead of the archive
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+
+#ifndef AUTOAR_PREFETCHER_H
+#define AUTOAR_PREFETCHER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "autoar-compressor.h"
+
+G_BEGIN_DECLS
+
+typedef struct _AutoarPrefetcher AutoarPrefetcher;
+
+AutoarPrefetcher* autoar_prefetcher_new           (guint n_threads,
+                                                   guint64 budget,
+                                                   AutoarReadOrder read_order,
+                                                   GCancellable *cancellable);
+void              autoar_prefetcher_free          (AutoarPrefetcher *self);
+
+void              autoar_prefetcher_set_digests   (AutoarPrefetcher *self,
+                                                   gboolean digests);
+
+gboolean          autoar_prefetcher_is_rotational (guint32 device);
+
+gboolean          autoar_prefetcher_is_full       (AutoarPrefetcher *self);
+void              autoar_prefetcher_push          (AutoarPrefetcher *self,
+                                                   GFile *file,
+                                                   GFileInfo *info);
+gboolean          autoar_prefetcher_pop           (AutoarPrefetcher *self,
+                                                   GFile **file,
+                                                   GFileInfo **info);
+GInputStream*     autoar_prefetcher_read          (AutoarPrefetcher *self,
+                                                   GFile *file,
+                                                   char **digest,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+void              autoar_prefetcher_skip          (AutoarPrefetcher *self,
+                                                   GFile *file);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (AutoarPrefetcher, autoar_prefetcher_free)
+
+G_END_DECLS
+
+#endif /* AUTOAR_PREFETCHER_H */
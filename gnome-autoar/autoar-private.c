@@ -32,6 +32,7 @@
 
 #include <glib.h>
 #include <gobject/gvaluecollector.h>
+#include <math.h>
 #include <string.h>
 
 /**
@@ -312,3 +313,142 @@ autoar_common_get_utf8_pathname (const char *pathname)
 
   return utf8_pathname;
 }
+
+/* Extensions of formats which are compressed already */
+static const char *compressed_extensions[] = {
+  "7z", "aac", "apk", "avi", "avif", "br", "bz2", "cab", "deb", "docx",
+  "epub", "flac", "gif", "gz", "heic", "heif", "jar", "jpeg", "jpg", "lz",
+  "lz4", "lzma", "m4a", "m4v", "mkv", "mov", "mp3", "mp4", "odp", "ods",
+  "odt", "oga", "ogg", "ogv", "opus", "png", "pptx", "rar", "rpm", "tbz2",
+  "tgz", "txz", "webm", "webp", "woff", "woff2", "xlsx", "xz", "zip", "zst",
+};
+
+/* Signatures of formats which are compressed already */
+static const struct {
+  gsize offset;
+  gsize size;
+  const char *magic;
+} compressed_magics[] = {
+  { 0, 3, "\xff\xd8\xff" },             /* JPEG */
+  { 0, 8, "\x89PNG\r\n\x1a\n" },
+  { 0, 4, "GIF8" },
+  { 0, 4, "PK\x03\x04" },               /* Zip and its derivatives */
+  { 0, 2, "\x1f\x8b" },                 /* gzip */
+  { 0, 3, "BZh" },
+  { 0, 6, "\xfd" "7zXZ\0" },
+  { 0, 4, "\x28\xb5\x2f\xfd" },         /* zstd */
+  { 0, 4, "\x04\x22\x4d\x18" },         /* LZ4 */
+  { 0, 6, "7z\xbc\xaf\x27\x1c" },
+  { 0, 4, "Rar!" },
+  { 4, 4, "ftyp" },                     /* MP4, QuickTime, HEIF */
+  { 0, 4, "\x1a\x45\xdf\xa3" },         /* Matroska, WebM */
+  { 0, 4, "OggS" },
+  { 0, 4, "fLaC" },
+  { 0, 3, "ID3" },                      /* MP3 */
+  { 8, 4, "WEBP" },
+  { 0, 4, "wOFF" },
+  { 0, 4, "wOF2" },
+};
+
+/* Deflate barely shrinks data above this entropy in bits per byte, which
+ * is only measured for blocks large enough to tell */
+#define ENTROPY_THRESHOLD 7.8
+#define ENTROPY_MIN_SIZE (4 * 1024)
+#define ENTROPY_MAX_SIZE (64 * 1024)
+
+static gboolean
+autoar_common_has_compressed_extension (const char *pathname)
+{
+  const char *basename, *extension;
+  guint i;
+
+  basename = strrchr (pathname, '/');
+  basename = basename != NULL ? basename + 1 : pathname;
+  extension = strrchr (basename, '.');
+  if (extension == NULL || extension == basename)
+    return FALSE;
+
+  for (i = 0; i < G_N_ELEMENTS (compressed_extensions); i++) {
+    if (g_ascii_strcasecmp (extension + 1, compressed_extensions[i]) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+autoar_common_has_compressed_magic (const guint8 *data,
+                                    gsize         size)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (compressed_magics); i++) {
+    if (size >= compressed_magics[i].offset + compressed_magics[i].size &&
+        memcmp (data + compressed_magics[i].offset, compressed_magics[i].magic,
+                compressed_magics[i].size) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+autoar_common_has_high_entropy (const guint8 *data,
+                                gsize         size)
+{
+  guint32 counts[256] = { 0 };
+  double entropy = 0;
+  gsize i;
+
+  if (size < ENTROPY_MIN_SIZE)
+    return FALSE;
+
+  size = MIN (size, ENTROPY_MAX_SIZE);
+  for (i = 0; i < size; i++)
+    counts[data[i]]++;
+
+  for (i = 0; i < G_N_ELEMENTS (counts); i++) {
+    double p;
+
+    if (counts[i] == 0)
+      continue;
+
+    p = (double) counts[i] / size;
+    entropy -= p * log2 (p);
+  }
+
+  return entropy >= ENTROPY_THRESHOLD;
+}
+
+/**
+ * autoar_common_is_compressed:
+ * @pathname: the pathname of an entry
+ * @data: (nullable): the first block of the data of the entry
+ * @size: the size of @data
+ * @detection: the checks to do
+ *
+ * Checks whether the data of an entry is compressed already, so it should
+ * be stored rather than compressed again.
+ *
+ * Returns: %TRUE if one of the checks in @detection matches
+ **/
+G_GNUC_INTERNAL gboolean
+autoar_common_is_compressed (const char           *pathname,
+                             const void           *data,
+                             gsize                 size,
+                             AutoarStoreDetection  detection)
+{
+  if ((detection & AUTOAR_STORE_DETECTION_EXTENSION) && pathname != NULL &&
+      autoar_common_has_compressed_extension (pathname))
+    return TRUE;
+
+  if ((detection & AUTOAR_STORE_DETECTION_MAGIC) &&
+      autoar_common_has_compressed_magic (data, size))
+    return TRUE;
+
+  if ((detection & AUTOAR_STORE_DETECTION_ENTROPY) &&
+      autoar_common_has_high_entropy (data, size))
+    return TRUE;
+
+  return FALSE;
+}
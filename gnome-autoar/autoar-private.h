@@ -37,6 +37,9 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "autoar-archive-index.h"
+#include "autoar-compressor.h"
+
 G_BEGIN_DECLS
 
 char*     autoar_common_get_basename_remove_extension  (const char *filename);
@@ -56,6 +59,32 @@ GError*   autoar_common_g_error_new_a_entry            (struct archive *a,
 
 char*     autoar_common_g_file_get_name                (GFile *file);
 char*     autoar_common_get_utf8_pathname              (const char *pathname);
+gboolean  autoar_common_is_compressed                  (const char *pathname,
+                                                        const void *data,
+                                                        gsize size,
+                                                        AutoarStoreDetection detection);
+
+AutoarArchiveIndex* autoar_archive_index_new           (GFile *source_file,
+                                                        GCancellable *cancellable);
+void      autoar_archive_index_add_entry               (AutoarArchiveIndex *self,
+                                                        const char *path,
+                                                        GFileType file_type,
+                                                        gint64 size,
+                                                        gint64 mtime,
+                                                        gint64 offset);
+void      autoar_archive_index_set_flags               (AutoarArchiveIndex *self,
+                                                        gboolean raw,
+                                                        gboolean encrypted,
+                                                        gboolean seekable);
+gboolean  autoar_archive_index_get_raw                 (AutoarArchiveIndex *self);
+gboolean  autoar_archive_index_get_encrypted           (AutoarArchiveIndex *self);
+gboolean  autoar_archive_index_get_seekable            (AutoarArchiveIndex *self);
+void      autoar_archive_index_set_seek_points         (AutoarArchiveIndex *self,
+                                                        GVariant *seek_points);
+GVariant* autoar_archive_index_get_seek_points         (AutoarArchiveIndex *self);
+AutoarArchiveIndex* autoar_archive_index_load_cached   (GFile *source_file,
+                                                        GCancellable *cancellable);
+void      autoar_archive_index_save_cached             (AutoarArchiveIndex *self);
 
 G_END_DECLS
 
@@ -0,0 +1,896 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-scanner.c
+ * Parallel traversal of directories
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/* For statx () */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "config.h"
+#include "autoar-scanner.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined HAVE_STATX && defined HAVE_FDOPENDIR
+# include <dirent.h>
+# include <fcntl.h>
+# include <grp.h>
+# include <pwd.h>
+# include <sys/sysmacros.h>
+# define USE_NATIVE_TRAVERSAL
+#endif
+
+/* AutoarScanner lists directories on a pool of threads. Every directory is
+ * a job, which queues the jobs of its subdirectories as soon as it has
+ * listed them, so all threads keep busy as long as there are directories
+ * left, no matter how the tree is shaped. The entries are returned by
+ * autoar_scanner_next() in the depth-first order of a sequential
+ * traversal, which waits only for the directories it reaches before they
+ * are listed.
+ *
+ * The listing runs ahead of the traversal by at most MAX_PENDING_ENTRIES
+ * entries and as many jobs as there are threads. The subdirectories found
+ * beyond that are deferred until the traversal catches up, or until it
+ * reaches one of them.
+ *
+ * The excluded entries are dropped by the job as they are listed, so the
+ * excluded directories are neither queued nor listed. */
+
+#define MAX_PENDING_ENTRIES 65536
+
+/* See https://bford.info/cachedir/ */
+#define CACHEDIR_TAG_NAME "CACHEDIR.TAG"
+#define CACHEDIR_TAG_SIGNATURE "Signature: 8a477f597d28d172789f06886806bc55"
+
+typedef struct _AutoarScannerDir AutoarScannerDir;
+
+typedef struct
+{
+  GFileInfo *info;
+  /* The listing of the child if it is a directory */
+  AutoarScannerDir *dir;
+} AutoarScannerChild;
+
+struct _AutoarScannerDir
+{
+  GFile *file;
+  /* Relative to the directory which was added, or empty for it */
+  char *path;
+  /* The patterns of the ignore files of the directory and the ones above */
+  AutoarIgnore *ignore;
+
+  /* In AutoarScanner.deferred while it waits to be queued */
+  GList *deferred_link;
+
+  /* Set by the job */
+  GArray *children;
+  GError *error;
+  gboolean done;
+};
+
+typedef struct
+{
+  AutoarScannerDir *dir;
+  guint index;
+} AutoarScannerFrame;
+
+struct _AutoarScanner
+{
+  GThreadPool *pool;
+  GCancellable *cancellable;
+
+  /* Set before the first directory is added */
+  AutoarIgnore *excludes;
+  AutoarIgnore *includes;
+  gboolean exclude_caches;
+  char *ignore_file_name;
+  gboolean sorted;
+
+  GMutex lock;
+  GCond cond;
+  guint64 size;
+  guint files;
+  gboolean stopping;
+  /* Entries listed and not returned by autoar_scanner_next() yet */
+  guint pending;
+  /* Jobs queued or running */
+  guint queued;
+  /* Directories which will be queued once the traversal catches up */
+  GQueue deferred;
+
+  /* Directories added and not walked yet */
+  GQueue roots;
+  /* Path to the next entry of the directory being walked */
+  GArray *stack;
+
+  GMutex owner_lock;
+  GHashTable *user_names;
+  GHashTable *group_names;
+};
+
+static AutoarScannerDir *
+autoar_scanner_dir_new (GFile        *file,
+                        const char   *path,
+                        AutoarIgnore *ignore)
+{
+  AutoarScannerDir *dir;
+
+  dir = g_new0 (AutoarScannerDir, 1);
+  dir->file = g_object_ref (file);
+  dir->path = g_strdup (path);
+  dir->ignore = ignore != NULL ? autoar_ignore_ref (ignore) : NULL;
+
+  return dir;
+}
+
+/* Frees @dir, and the directories of its children from @first on, which
+ * haven't been walked yet */
+static void
+autoar_scanner_dir_free (AutoarScannerDir *dir,
+                         guint             first)
+{
+  guint i;
+
+  if (dir->children != NULL) {
+    for (i = 0; i < dir->children->len; i++) {
+      AutoarScannerChild *child;
+
+      child = &g_array_index (dir->children, AutoarScannerChild, i);
+      if (i >= first && child->dir != NULL)
+        autoar_scanner_dir_free (child->dir, 0);
+      g_object_unref (child->info);
+    }
+
+    g_array_unref (dir->children);
+  }
+
+  g_clear_error (&dir->error);
+  g_clear_pointer (&dir->ignore, autoar_ignore_unref);
+  g_object_unref (dir->file);
+  g_free (dir->path);
+  g_free (dir);
+}
+
+static gboolean
+autoar_scanner_is_filtered (AutoarScanner *self)
+{
+  return self->excludes != NULL || self->includes != NULL ||
+         self->ignore_file_name != NULL;
+}
+
+/* The exclude patterns come first, then the ignore files from the innermost
+ * one, and the include patterns select the files which are left */
+static gboolean
+autoar_scanner_is_excluded (AutoarScanner    *self,
+                            AutoarScannerDir *dir,
+                            const char       *path,
+                            gboolean          is_dir)
+{
+  AutoarIgnoreMatch match;
+
+  match = autoar_ignore_match (self->excludes, path, is_dir);
+  if (match == AUTOAR_IGNORE_NONE)
+    match = autoar_ignore_match (dir->ignore, path, is_dir);
+  if (match == AUTOAR_IGNORE_MATCHED)
+    return TRUE;
+
+  return !is_dir && self->includes != NULL &&
+         autoar_ignore_match (self->includes, path, FALSE) != AUTOAR_IGNORE_MATCHED;
+}
+
+/* Takes @info, and drops it if it is excluded */
+static void
+autoar_scanner_dir_append (AutoarScanner    *self,
+                           AutoarScannerDir *dir,
+                           GFileInfo        *info)
+{
+  AutoarScannerChild child = { info, NULL };
+  g_autofree char *path = NULL;
+  gboolean is_dir;
+
+  is_dir = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY;
+
+  if (autoar_scanner_is_filtered (self)) {
+    path = *dir->path != '\0' ?
+           g_strconcat (dir->path, "/", g_file_info_get_name (info), NULL) :
+           g_strdup (g_file_info_get_name (info));
+    if (autoar_scanner_is_excluded (self, dir, path, is_dir)) {
+      g_debug ("autoar_scanner_dir_append: excluding %s", path);
+      g_object_unref (info);
+      return;
+    }
+  }
+
+  if (is_dir) {
+    g_autoptr (GFile) file = NULL;
+
+    file = g_file_get_child (dir->file, g_file_info_get_name (info));
+    child.dir = autoar_scanner_dir_new (file, path != NULL ? path : "",
+                                        dir->ignore);
+  }
+
+  g_array_append_val (dir->children, child);
+}
+
+static void
+autoar_scanner_list_gio (AutoarScanner     *self,
+                         AutoarScannerDir  *dir,
+                         GError           **error)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
+
+  enumerator = g_file_enumerate_children (dir->file,
+                                          AUTOAR_SCANNER_ATTRIBUTES,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          self->cancellable,
+                                          error);
+  if (enumerator == NULL)
+    return;
+
+  while ((info = g_file_enumerator_next_file (enumerator,
+                                              self->cancellable,
+                                              error)) != NULL)
+    autoar_scanner_dir_append (self, dir, info);
+
+  g_object_unref (enumerator);
+}
+
+#ifdef USE_NATIVE_TRAVERSAL
+static const char *
+autoar_scanner_lookup_owner (AutoarScanner  *self,
+                             GHashTable    **names,
+                             guint           id,
+                             gboolean        group)
+{
+  gpointer name;
+
+  g_mutex_lock (&self->owner_lock);
+
+  if (*names == NULL)
+    *names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  /* Unknown IDs are cached too, as NULL */
+  if (!g_hash_table_lookup_extended (*names, GUINT_TO_POINTER (id),
+                                     NULL, &name)) {
+    char buffer[4096];
+
+    name = NULL;
+    if (group) {
+      struct group grp, *result = NULL;
+
+      if (getgrgid_r (id, &grp, buffer, sizeof (buffer), &result) == 0 &&
+          result != NULL)
+        name = g_strdup (result->gr_name);
+    } else {
+      struct passwd pwd, *result = NULL;
+
+      if (getpwuid_r (id, &pwd, buffer, sizeof (buffer), &result) == 0 &&
+          result != NULL)
+        name = g_strdup (result->pw_name);
+    }
+
+    g_hash_table_insert (*names, GUINT_TO_POINTER (id), name);
+  }
+
+  g_mutex_unlock (&self->owner_lock);
+
+  /* The names stay until the scanner is freed */
+  return name;
+}
+
+static void
+autoar_scanner_set_native_time (GFileInfo                    *info,
+                                const char                   *attribute,
+                                const char                   *attribute_usec,
+                                const struct statx_timestamp *timestamp)
+{
+  g_file_info_set_attribute_uint64 (info, attribute, timestamp->tv_sec);
+  g_file_info_set_attribute_uint32 (info, attribute_usec,
+                                    timestamp->tv_nsec / 1000);
+}
+
+/* Fills AUTOAR_SCANNER_ATTRIBUTES the same way as GIO, but with a single
+ * statx () */
+static GFileInfo *
+autoar_scanner_native_query_info (AutoarScanner  *self,
+                                  int             dir_fd,
+                                  const char     *name,
+                                  GError        **error)
+{
+  GFileInfo *info;
+  struct statx stx;
+  const char *owner;
+  int errsv;
+
+  if (statx (dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+             STATX_BASIC_STATS | STATX_BTIME, &stx) < 0) {
+    errsv = errno;
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                 "Error when getting information for file “%s”: %s",
+                 name, g_strerror (errsv));
+    return NULL;
+  }
+
+  info = g_file_info_new ();
+  g_file_info_set_name (info, name);
+  g_file_info_set_size (info, stx.stx_size);
+
+  switch (stx.stx_mode & S_IFMT) {
+    case S_IFREG:
+      g_file_info_set_file_type (info, G_FILE_TYPE_REGULAR);
+      break;
+    case S_IFDIR:
+      g_file_info_set_file_type (info, G_FILE_TYPE_DIRECTORY);
+      break;
+    case S_IFLNK:
+      {
+        g_autofree char *target = NULL;
+        gsize target_size;
+        ssize_t length;
+
+        g_file_info_set_file_type (info, G_FILE_TYPE_SYMBOLIC_LINK);
+
+        /* Some file systems report 0 as the size of links */
+        target_size = stx.stx_size > 0 ? stx.stx_size + 1 : 4096;
+        target = g_malloc (target_size);
+        length = readlinkat (dir_fd, name, target, target_size - 1);
+        if (length >= 0) {
+          target[length] = '\0';
+          g_file_info_set_symlink_target (info, target);
+        }
+      }
+      break;
+    default:
+      g_file_info_set_file_type (info, G_FILE_TYPE_SPECIAL);
+      break;
+  }
+
+  autoar_scanner_set_native_time (info, G_FILE_ATTRIBUTE_TIME_ACCESS,
+                                  G_FILE_ATTRIBUTE_TIME_ACCESS_USEC,
+                                  &stx.stx_atime);
+  autoar_scanner_set_native_time (info, G_FILE_ATTRIBUTE_TIME_CHANGED,
+                                  G_FILE_ATTRIBUTE_TIME_CHANGED_USEC,
+                                  &stx.stx_ctime);
+  autoar_scanner_set_native_time (info, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                  &stx.stx_mtime);
+  if (stx.stx_mask & STATX_BTIME)
+    autoar_scanner_set_native_time (info, G_FILE_ATTRIBUTE_TIME_CREATED,
+                                    G_FILE_ATTRIBUTE_TIME_CREATED_USEC,
+                                    &stx.stx_btime);
+
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE,
+                                    makedev (stx.stx_dev_major,
+                                             stx.stx_dev_minor));
+  g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE,
+                                    stx.stx_ino);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE,
+                                    stx.stx_mode);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_NLINK,
+                                    stx.stx_nlink);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID,
+                                    stx.stx_uid);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID,
+                                    stx.stx_gid);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_RDEV,
+                                    makedev (stx.stx_rdev_major,
+                                             stx.stx_rdev_minor));
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_BLOCK_SIZE,
+                                    stx.stx_blksize);
+  if (stx.stx_mask & STATX_BLOCKS)
+    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS,
+                                      stx.stx_blocks);
+
+  owner = autoar_scanner_lookup_owner (self, &self->user_names,
+                                       stx.stx_uid, FALSE);
+  if (owner != NULL)
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER, owner);
+
+  owner = autoar_scanner_lookup_owner (self, &self->group_names,
+                                       stx.stx_gid, TRUE);
+  if (owner != NULL)
+    g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP, owner);
+
+  return info;
+}
+
+/* Lists local directories with a single statx () per file, which is much
+ * faster than GIO for large trees. Falls back to GIO for the directories
+ * which can't be opened directly. */
+static void
+autoar_scanner_list_native (AutoarScanner     *self,
+                            AutoarScannerDir  *dir,
+                            GError           **error)
+{
+  struct dirent *dirent;
+  DIR *dirp;
+  int fd;
+  int errsv;
+
+  if (!g_file_is_native (dir->file) || g_file_peek_path (dir->file) == NULL) {
+    autoar_scanner_list_gio (self, dir, error);
+    return;
+  }
+
+  fd = open (g_file_peek_path (dir->file),
+             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    autoar_scanner_list_gio (self, dir, error);
+    return;
+  }
+
+  dirp = fdopendir (fd);
+  if (dirp == NULL) {
+    close (fd);
+    autoar_scanner_list_gio (self, dir, error);
+    return;
+  }
+
+  while (TRUE) {
+    GError *query_error = NULL;
+    GFileInfo *info;
+    const char *name;
+
+    errno = 0;
+    dirent = readdir (dirp);
+    if (dirent == NULL) {
+      errsv = errno;
+      if (errsv != 0)
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "Error reading directory “%s”: %s",
+                     g_file_peek_path (dir->file), g_strerror (errsv));
+      break;
+    }
+
+    name = dirent->d_name;
+    if (strcmp (name, ".") == 0 || strcmp (name, "..") == 0)
+      continue;
+
+    info = autoar_scanner_native_query_info (self, dirfd (dirp), name,
+                                             &query_error);
+    if (info == NULL) {
+      /* The entry was removed or replaced since it was listed */
+      if (g_error_matches (query_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) ||
+          g_error_matches (query_error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY)) {
+        g_debug ("autoar_scanner_list_native: %s", query_error->message);
+        g_clear_error (&query_error);
+        continue;
+      }
+
+      g_propagate_error (error, query_error);
+      break;
+    }
+
+    autoar_scanner_dir_append (self, dir, info);
+  }
+
+  closedir (dirp);
+}
+#endif
+
+/* Gets the info of the tag if @dir is tagged as a cache */
+static GFileInfo *
+autoar_scanner_get_cache_tag (AutoarScanner    *self,
+                              AutoarScannerDir *dir)
+{
+  g_autoptr (GFile) tag = NULL;
+  g_autoptr (GFileInputStream) stream = NULL;
+  char signature[sizeof (CACHEDIR_TAG_SIGNATURE) - 1];
+  gsize bytes_read;
+
+  tag = g_file_get_child (dir->file, CACHEDIR_TAG_NAME);
+  stream = g_file_read (tag, self->cancellable, NULL);
+  if (stream == NULL)
+    return NULL;
+
+  if (!g_input_stream_read_all (G_INPUT_STREAM (stream),
+                                signature, sizeof (signature), &bytes_read,
+                                self->cancellable, NULL) ||
+      bytes_read != sizeof (signature) ||
+      memcmp (signature, CACHEDIR_TAG_SIGNATURE, sizeof (signature)) != 0)
+    return NULL;
+
+  return g_file_query_info (tag,
+                            AUTOAR_SCANNER_ATTRIBUTES,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            self->cancellable,
+                            NULL);
+}
+
+/* Adds the patterns of the ignore file of @dir, if there is one, to the ones
+ * which are inherited by its entries */
+static void
+autoar_scanner_load_ignore_file (AutoarScanner    *self,
+                                 AutoarScannerDir *dir)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *contents = NULL;
+  AutoarIgnore *ignore;
+  gsize length;
+
+  file = g_file_get_child (dir->file, self->ignore_file_name);
+  if (!g_file_load_contents (file, self->cancellable, &contents, &length,
+                             NULL, &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+      g_debug ("autoar_scanner_load_ignore_file: %s", error->message);
+    return;
+  }
+
+  ignore = autoar_ignore_new (dir->ignore, dir->path);
+  autoar_ignore_add_patterns (ignore, contents, length);
+  g_clear_pointer (&dir->ignore, autoar_ignore_unref);
+  dir->ignore = ignore;
+}
+
+static int
+autoar_scanner_compare_children (gconstpointer a,
+                                 gconstpointer b)
+{
+  const AutoarScannerChild *child_a = a;
+  const AutoarScannerChild *child_b = b;
+
+  return strcmp (g_file_info_get_name (child_a->info),
+                 g_file_info_get_name (child_b->info));
+}
+
+static void
+autoar_scanner_push_locked (AutoarScanner    *self,
+                            AutoarScannerDir *dir)
+{
+  self->queued++;
+  g_thread_pool_push (self->pool, dir, NULL);
+}
+
+static gboolean
+autoar_scanner_is_ahead_locked (AutoarScanner *self)
+{
+  return self->pending >= MAX_PENDING_ENTRIES ||
+         self->queued >= (guint) g_thread_pool_get_max_threads (self->pool);
+}
+
+/* Queues the deferred directories as long as the listing isn't too far
+ * ahead of the traversal */
+static void
+autoar_scanner_release_locked (AutoarScanner *self)
+{
+  AutoarScannerDir *dir;
+
+  while (!self->stopping && !autoar_scanner_is_ahead_locked (self) &&
+         (dir = g_queue_pop_head (&self->deferred)) != NULL) {
+    dir->deferred_link = NULL;
+    autoar_scanner_push_locked (self, dir);
+  }
+}
+
+static void
+autoar_scanner_list (gpointer data,
+                     gpointer user_data)
+{
+  AutoarScannerDir *dir = data;
+  AutoarScanner *self = user_data;
+  GFileInfo *tag_info;
+  GError *error = NULL;
+  guint64 size = 0;
+  guint i;
+
+  dir->children = g_array_new (FALSE, FALSE, sizeof (AutoarScannerChild));
+
+  if (self->exclude_caches &&
+      (tag_info = autoar_scanner_get_cache_tag (self, dir)) != NULL) {
+    /* Only the tag is kept, like with --exclude-caches of GNU tar */
+    g_debug ("autoar_scanner_list: %s is a cache", dir->path);
+    autoar_scanner_dir_append (self, dir, tag_info);
+  } else if (!g_cancellable_set_error_if_cancelled (self->cancellable, &error)) {
+    if (self->ignore_file_name != NULL)
+      autoar_scanner_load_ignore_file (self, dir);
+
+#ifdef USE_NATIVE_TRAVERSAL
+    autoar_scanner_list_native (self, dir, &error);
+#else
+    autoar_scanner_list_gio (self, dir, &error);
+#endif
+  }
+
+  if (self->sorted)
+    g_array_sort (dir->children, autoar_scanner_compare_children);
+
+  g_mutex_lock (&self->lock);
+
+  self->queued--;
+  self->pending += dir->children->len;
+
+  /* The directory may be freed as soon as it is marked as done */
+  for (i = 0; i < dir->children->len; i++) {
+    AutoarScannerChild *child;
+
+    child = &g_array_index (dir->children, AutoarScannerChild, i);
+    size += g_file_info_get_size (child->info);
+    if (child->dir == NULL || error != NULL || self->stopping)
+      continue;
+
+    if (autoar_scanner_is_ahead_locked (self)) {
+      g_queue_push_tail (&self->deferred, child->dir);
+      child->dir->deferred_link = self->deferred.tail;
+    } else {
+      autoar_scanner_push_locked (self, child->dir);
+    }
+  }
+
+  self->size += size;
+  self->files += dir->children->len;
+  dir->error = error;
+  dir->done = TRUE;
+  autoar_scanner_release_locked (self);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+AutoarScanner *
+autoar_scanner_new (guint         n_threads,
+                    GCancellable *cancellable)
+{
+  AutoarScanner *self;
+
+  self = g_new0 (AutoarScanner, 1);
+  self->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+  self->stack = g_array_new (FALSE, FALSE, sizeof (AutoarScannerFrame));
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_mutex_init (&self->owner_lock);
+  g_queue_init (&self->roots);
+  g_queue_init (&self->deferred);
+  self->pool = g_thread_pool_new (autoar_scanner_list, self,
+                                  MAX (n_threads, 1), FALSE, NULL);
+
+  return self;
+}
+
+void
+autoar_scanner_free (AutoarScanner *self)
+{
+  AutoarScannerDir *dir;
+  guint i;
+
+  if (self == NULL)
+    return;
+
+  /* Drop the directories which haven't been listed yet */
+  g_mutex_lock (&self->lock);
+  self->stopping = TRUE;
+  g_mutex_unlock (&self->lock);
+  g_thread_pool_free (self->pool, TRUE, TRUE);
+
+  /* The deferred directories are freed with their parents */
+  g_queue_clear (&self->deferred);
+
+  for (i = 0; i < self->stack->len; i++) {
+    AutoarScannerFrame *frame;
+
+    frame = &g_array_index (self->stack, AutoarScannerFrame, i);
+    autoar_scanner_dir_free (frame->dir, frame->index);
+  }
+  g_array_unref (self->stack);
+
+  while ((dir = g_queue_pop_head (&self->roots)) != NULL)
+    autoar_scanner_dir_free (dir, 0);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->owner_lock);
+  g_clear_pointer (&self->user_names, g_hash_table_unref);
+  g_clear_pointer (&self->group_names, g_hash_table_unref);
+  g_clear_pointer (&self->excludes, autoar_ignore_unref);
+  g_clear_pointer (&self->includes, autoar_ignore_unref);
+  g_free (self->ignore_file_name);
+  g_clear_object (&self->cancellable);
+  g_free (self);
+}
+
+/**
+ * autoar_scanner_set_filters:
+ * @self: an #AutoarScanner
+ * @excludes: (nullable): the patterns of the entries to skip, or %NULL
+ * @includes: (nullable): the patterns of the files to keep, or %NULL
+ * @exclude_caches: whether to skip the contents of the directories tagged
+ *   by a CACHEDIR.TAG file
+ * @ignore_file_name: (nullable): the name of the files whose patterns
+ *   apply to the directories they are in, like ".gitignore", or %NULL
+ *
+ * Sets which entries are skipped. The patterns are matched against the
+ * paths relative to the directories which are added, and a file is only
+ * kept if it matches @includes when it is set. This function should only be
+ * called before autoar_scanner_add().
+ **/
+void
+autoar_scanner_set_filters (AutoarScanner *self,
+                            AutoarIgnore  *excludes,
+                            AutoarIgnore  *includes,
+                            gboolean       exclude_caches,
+                            const char    *ignore_file_name)
+{
+  g_clear_pointer (&self->excludes, autoar_ignore_unref);
+  g_clear_pointer (&self->includes, autoar_ignore_unref);
+  g_clear_pointer (&self->ignore_file_name, g_free);
+
+  if (!autoar_ignore_is_empty (excludes))
+    self->excludes = autoar_ignore_ref (excludes);
+  if (!autoar_ignore_is_empty (includes))
+    self->includes = autoar_ignore_ref (includes);
+  self->exclude_caches = exclude_caches;
+  self->ignore_file_name = g_strdup (ignore_file_name);
+}
+
+/**
+ * autoar_scanner_set_sorted:
+ * @self: an #AutoarScanner
+ * @sorted: whether to sort the entries
+ *
+ * Sorts the entries of each directory by the bytes of their names, instead
+ * of returning them in the order of the file system. This function should
+ * only be called before autoar_scanner_add().
+ **/
+void
+autoar_scanner_set_sorted (AutoarScanner *self,
+                           gboolean       sorted)
+{
+  self->sorted = sorted;
+}
+
+/**
+ * autoar_scanner_add:
+ * @self: an #AutoarScanner
+ * @dir: the directory to scan
+ *
+ * Starts listing @dir and its subdirectories in the background. The entries
+ * are returned by autoar_scanner_next() after those of the directories which
+ * were added before.
+ **/
+void
+autoar_scanner_add (AutoarScanner *self,
+                    GFile         *dir)
+{
+  AutoarScannerDir *root;
+
+  root = autoar_scanner_dir_new (dir, "", NULL);
+  g_queue_push_tail (&self->roots, root);
+
+  g_mutex_lock (&self->lock);
+  autoar_scanner_push_locked (self, root);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * autoar_scanner_next:
+ * @self: an #AutoarScanner
+ * @file: (out) (transfer full): return location for the next file
+ * @info: (out) (transfer full): return location for its info
+ * @error: return location for a #GError, or %NULL
+ *
+ * Gets the next entry of the directory which was added first. Every
+ * directory is followed by its contents.
+ *
+ * Returns: %FALSE at the end of the directory, or if an error occurred
+ **/
+gboolean
+autoar_scanner_next (AutoarScanner  *self,
+                     GFile         **file,
+                     GFileInfo     **info,
+                     GError        **error)
+{
+  *file = NULL;
+  *info = NULL;
+
+  if (self->stack->len == 0) {
+    AutoarScannerFrame frame = { NULL, 0 };
+
+    frame.dir = g_queue_pop_head (&self->roots);
+    if (frame.dir == NULL)
+      return FALSE;
+
+    g_array_append_val (self->stack, frame);
+  }
+
+  while (self->stack->len > 0) {
+    AutoarScannerFrame *frame;
+    AutoarScannerDir *dir;
+
+    frame = &g_array_index (self->stack, AutoarScannerFrame,
+                            self->stack->len - 1);
+    dir = frame->dir;
+
+    g_mutex_lock (&self->lock);
+    /* The traversal can't wait for the listing to catch up with itself */
+    if (dir->deferred_link != NULL) {
+      g_queue_delete_link (&self->deferred, dir->deferred_link);
+      dir->deferred_link = NULL;
+      autoar_scanner_push_locked (self, dir);
+    }
+    while (!dir->done)
+      g_cond_wait (&self->cond, &self->lock);
+    g_mutex_unlock (&self->lock);
+
+    if (dir->error != NULL) {
+      g_propagate_error (error, g_steal_pointer (&dir->error));
+      return FALSE;
+    }
+
+    if (frame->index < dir->children->len) {
+      AutoarScannerChild *child;
+
+      child = &g_array_index (dir->children, AutoarScannerChild,
+                              frame->index++);
+
+      g_mutex_lock (&self->lock);
+      self->pending--;
+      autoar_scanner_release_locked (self);
+      g_mutex_unlock (&self->lock);
+
+      *file = g_file_get_child (dir->file, g_file_info_get_name (child->info));
+      *info = g_object_ref (child->info);
+
+      if (child->dir != NULL) {
+        AutoarScannerFrame child_frame = { child->dir, 0 };
+
+        g_array_append_val (self->stack, child_frame);
+      }
+
+      return TRUE;
+    }
+
+    /* The subdirectories have been walked and freed already */
+    g_array_set_size (self->stack, self->stack->len - 1);
+    autoar_scanner_dir_free (dir, dir->children->len);
+  }
+
+  return FALSE;
+}
+
+/**
+ * autoar_scanner_get_totals:
+ * @self: an #AutoarScanner
+ * @size: (out): return location for the size of the entries found so far
+ * @files: (out): return location for the number of the entries found so far
+ *
+ * Gets the totals of the directories which have been listed already. They
+ * are final once all the entries have been returned by autoar_scanner_next().
+ **/
+void
+autoar_scanner_get_totals (AutoarScanner *self,
+                           guint64       *size,
+                           guint         *files)
+{
+  g_mutex_lock (&self->lock);
+  *size = self->size;
+  *files = self->files;
+  g_mutex_unlock (&self->lock);
+}
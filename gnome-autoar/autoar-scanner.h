@@ -0,0 +1,74 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-scanner.h
+ * Parallel traversal of directories
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_SCANNER_H
+#define AUTOAR_SCANNER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "autoar-ignore.h"
+
+G_BEGIN_DECLS
+
+/* The attributes which are stored in archives. Querying "*" would also
+ * read extended attributes and sniff the content type. */
+#define AUTOAR_SCANNER_ATTRIBUTES \
+  G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+  G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET "," \
+  "time::*,unix::*," \
+  G_FILE_ATTRIBUTE_OWNER_USER "," \
+  G_FILE_ATTRIBUTE_OWNER_GROUP
+
+typedef struct _AutoarScanner AutoarScanner;
+
+AutoarScanner* autoar_scanner_new                 (guint n_threads,
+                                                   GCancellable *cancellable);
+void           autoar_scanner_free                (AutoarScanner *self);
+
+void           autoar_scanner_set_filters         (AutoarScanner *self,
+                                                   AutoarIgnore *excludes,
+                                                   AutoarIgnore *includes,
+                                                   gboolean exclude_caches,
+                                                   const char *ignore_file_name);
+void           autoar_scanner_set_sorted          (AutoarScanner *self,
+                                                   gboolean sorted);
+void           autoar_scanner_add                 (AutoarScanner *self,
+                                                   GFile *dir);
+gboolean       autoar_scanner_next                (AutoarScanner *self,
+                                                   GFile **file,
+                                                   GFileInfo **info,
+                                                   GError **error);
+void           autoar_scanner_get_totals          (AutoarScanner *self,
+                                                   guint64 *size,
+                                                   guint *files);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (AutoarScanner, autoar_scanner_free)
+
+G_END_DECLS
+
+#endif /* AUTOAR_SCANNER_H */
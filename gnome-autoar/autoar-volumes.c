@@ -0,0 +1,547 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-volumes.c
+ * Archives split into volumes
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-volumes.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/* The volumes of an archive are the archive cut in pieces of the same size,
+ * except for the last one, which are named after the archive followed by
+ * their number, starting with ".001", like the volumes of 7-Zip. The archive
+ * is the concatenation of its volumes, so the streams below only switch
+ * files at their boundaries, and any format can be written and read without
+ * copying the data again to join the volumes. */
+
+#define FIRST_VOLUME_SUFFIX ".001"
+
+/**
+ * autoar_volume_get_file:
+ * @archive: the archive
+ * @number: the number of the volume, starting with 1
+ *
+ * Gets a volume of @archive, which is in the same directory.
+ *
+ * Returns: (transfer full): the volume
+ **/
+GFile *
+autoar_volume_get_file (GFile *archive,
+                        guint  number)
+{
+  g_autofree char *basename = NULL;
+  g_autofree char *volume_basename = NULL;
+  g_autoptr (GFile) parent = NULL;
+
+  basename = g_file_get_basename (archive);
+  volume_basename = g_strdup_printf ("%s.%03u", basename, number);
+  parent = g_file_get_parent (archive);
+
+  return g_file_get_child (parent, volume_basename);
+}
+
+/**
+ * autoar_volume_find:
+ * @first_volume: a file which may be the first volume of an archive
+ * @archive: (out) (optional): return location for the archive
+ *
+ * Finds the volumes which follow @first_volume, if its name ends with
+ * ".001".
+ *
+ * Returns: (transfer full) (element-type GFile) (nullable): the volumes of
+ * the archive, or %NULL if @first_volume is not a volume
+ **/
+GPtrArray *
+autoar_volume_find (GFile  *first_volume,
+                    GFile **archive)
+{
+  g_autofree char *basename = NULL;
+  g_autoptr (GFile) parent = NULL;
+  g_autoptr (GFile) archive_file = NULL;
+  GPtrArray *volumes;
+  GFile *volume;
+  guint number;
+
+  basename = g_file_get_basename (first_volume);
+  parent = g_file_get_parent (first_volume);
+  if (basename == NULL || parent == NULL ||
+      !g_str_has_suffix (basename, FIRST_VOLUME_SUFFIX) ||
+      strlen (basename) == strlen (FIRST_VOLUME_SUFFIX))
+    return NULL;
+
+  basename[strlen (basename) - strlen (FIRST_VOLUME_SUFFIX)] = '\0';
+  archive_file = g_file_get_child (parent, basename);
+
+  volumes = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (volumes, g_object_ref (first_volume));
+  for (number = 2; ; number++) {
+    volume = autoar_volume_get_file (archive_file, number);
+    if (!g_file_query_exists (volume, NULL)) {
+      g_object_unref (volume);
+      break;
+    }
+
+    g_ptr_array_add (volumes, volume);
+  }
+
+  g_debug ("autoar_volume_find: %s: %u volumes", basename, volumes->len);
+
+  if (archive != NULL)
+    *archive = g_steal_pointer (&archive_file);
+
+  return volumes;
+}
+
+struct _AutoarVolumeOutputStream
+{
+  GOutputStream parent_instance;
+
+  GFile *archive;
+  guint64 volume_size;
+
+  /* The volume being written */
+  GOutputStream *volume;
+  guint number;
+  guint64 written;
+};
+
+G_DEFINE_TYPE (AutoarVolumeOutputStream, autoar_volume_output_stream, G_TYPE_OUTPUT_STREAM)
+
+/* Closes the full volume, and creates the next one */
+static gboolean
+autoar_volume_output_stream_next (AutoarVolumeOutputStream  *self,
+                                  GCancellable              *cancellable,
+                                  GError                   **error)
+{
+  g_autoptr (GFile) file = NULL;
+
+  if (self->volume != NULL) {
+    if (!g_output_stream_close (self->volume, cancellable, error))
+      return FALSE;
+    g_clear_object (&self->volume);
+  }
+
+  file = autoar_volume_get_file (self->archive, ++self->number);
+  self->volume = G_OUTPUT_STREAM (g_file_create (file, G_FILE_CREATE_NONE,
+                                                 cancellable, error));
+  self->written = 0;
+
+  g_debug ("autoar_volume_output_stream_next: volume %u", self->number);
+
+  return self->volume != NULL;
+}
+
+static gssize
+autoar_volume_output_stream_write (GOutputStream  *stream,
+                                   const void     *buffer,
+                                   gsize           count,
+                                   GCancellable   *cancellable,
+                                   GError        **error)
+{
+  AutoarVolumeOutputStream *self;
+  gssize written;
+
+  self = AUTOAR_VOLUME_OUTPUT_STREAM (stream);
+
+  /* The next volume is only created once there is data for it */
+  if (self->written == self->volume_size &&
+      !autoar_volume_output_stream_next (self, cancellable, error))
+    return -1;
+
+  written = g_output_stream_write (self->volume, buffer,
+                                   MIN (count, self->volume_size - self->written),
+                                   cancellable, error);
+  if (written > 0)
+    self->written += written;
+
+  return written;
+}
+
+static gboolean
+autoar_volume_output_stream_flush (GOutputStream  *stream,
+                                   GCancellable   *cancellable,
+                                   GError        **error)
+{
+  AutoarVolumeOutputStream *self;
+
+  self = AUTOAR_VOLUME_OUTPUT_STREAM (stream);
+
+  return g_output_stream_flush (self->volume, cancellable, error);
+}
+
+static gboolean
+autoar_volume_output_stream_close (GOutputStream  *stream,
+                                   GCancellable   *cancellable,
+                                   GError        **error)
+{
+  AutoarVolumeOutputStream *self;
+
+  self = AUTOAR_VOLUME_OUTPUT_STREAM (stream);
+
+  return g_output_stream_close (self->volume, cancellable, error);
+}
+
+static void
+autoar_volume_output_stream_finalize (GObject *object)
+{
+  AutoarVolumeOutputStream *self;
+
+  self = AUTOAR_VOLUME_OUTPUT_STREAM (object);
+
+  g_clear_object (&self->volume);
+  g_clear_object (&self->archive);
+
+  G_OBJECT_CLASS (autoar_volume_output_stream_parent_class)->finalize (object);
+}
+
+static void
+autoar_volume_output_stream_class_init (AutoarVolumeOutputStreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+
+  object_class->finalize = autoar_volume_output_stream_finalize;
+
+  stream_class->write_fn = autoar_volume_output_stream_write;
+  stream_class->flush = autoar_volume_output_stream_flush;
+  stream_class->close_fn = autoar_volume_output_stream_close;
+}
+
+static void
+autoar_volume_output_stream_init (AutoarVolumeOutputStream *self)
+{
+}
+
+/**
+ * autoar_volume_output_stream_new:
+ * @archive: the archive to write
+ * @volume_size: the size of the volumes in bytes
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates the first volume of @archive. The data which is written to the
+ * returned stream is split into volumes of @volume_size bytes, which must
+ * not exist yet.
+ *
+ * Returns: (transfer full) (nullable): a new #GOutputStream, or %NULL if
+ * the first volume couldn't be created
+ **/
+GOutputStream *
+autoar_volume_output_stream_new (GFile         *archive,
+                                 guint64        volume_size,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  g_autoptr (AutoarVolumeOutputStream) self = NULL;
+
+  g_return_val_if_fail (volume_size > 0, NULL);
+
+  self = g_object_new (AUTOAR_TYPE_VOLUME_OUTPUT_STREAM, NULL);
+  self->archive = g_object_ref (archive);
+  self->volume_size = volume_size;
+
+  if (!autoar_volume_output_stream_next (self, cancellable, error))
+    return NULL;
+
+  return G_OUTPUT_STREAM (g_steal_pointer (&self));
+}
+
+struct _AutoarVolumeInputStream
+{
+  GInputStream parent_instance;
+
+  GPtrArray *volumes;
+  /* The offset of each volume in the archive, followed by its size */
+  guint64 *starts;
+
+  goffset offset;
+
+  /* The volume being read, which is opened on demand */
+  GInputStream *volume;
+  guint current;
+  gboolean moved;
+};
+
+static void autoar_volume_input_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (AutoarVolumeInputStream, autoar_volume_input_stream, G_TYPE_INPUT_STREAM,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE,
+                                                autoar_volume_input_stream_seekable_iface_init))
+
+/* Opens the volume which contains the offset, and seeks there. Returns
+ * %TRUE with no volume at the end of the archive. */
+static gboolean
+autoar_volume_input_stream_prepare (AutoarVolumeInputStream  *self,
+                                    GCancellable             *cancellable,
+                                    GError                  **error)
+{
+  guint64 start;
+  guint i;
+
+  if (self->volume != NULL && !self->moved)
+    return TRUE;
+
+  for (i = 0; i < self->volumes->len; i++) {
+    if (self->offset < self->starts[i + 1])
+      break;
+  }
+
+  if (self->volume != NULL && i != self->current) {
+    g_input_stream_close (self->volume, cancellable, NULL);
+    g_clear_object (&self->volume);
+  }
+
+  if (i == self->volumes->len)
+    return TRUE;
+
+  if (self->volume == NULL) {
+    self->volume = G_INPUT_STREAM (g_file_read (self->volumes->pdata[i],
+                                                cancellable, error));
+    if (self->volume == NULL)
+      return FALSE;
+
+    self->current = i;
+    self->moved = TRUE;
+
+    g_debug ("autoar_volume_input_stream_prepare: volume %u", i + 1);
+  }
+
+  start = self->starts[self->current];
+  if (self->moved &&
+      !g_seekable_seek (G_SEEKABLE (self->volume), self->offset - start,
+                        G_SEEK_SET, cancellable, error))
+    return FALSE;
+
+  self->moved = FALSE;
+
+  return TRUE;
+}
+
+static gssize
+autoar_volume_input_stream_read (GInputStream  *stream,
+                                 void          *buffer,
+                                 gsize          count,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  AutoarVolumeInputStream *self;
+  guint64 end;
+  gssize read_size;
+
+  self = AUTOAR_VOLUME_INPUT_STREAM (stream);
+
+  if (!autoar_volume_input_stream_prepare (self, cancellable, error))
+    return -1;
+
+  if (self->volume == NULL || count == 0)
+    return 0;
+
+  end = self->starts[self->current + 1];
+  read_size = g_input_stream_read (self->volume, buffer,
+                                   MIN (count, end - self->offset),
+                                   cancellable, error);
+  if (read_size < 0)
+    return -1;
+
+  /* The sizes were queried when the stream was created */
+  if (read_size == 0) {
+    g_autofree char *name = NULL;
+
+    name = g_file_get_parse_name (self->volumes->pdata[self->current]);
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                 "The volume “%s” is shorter than expected", name);
+    return -1;
+  }
+
+  self->offset += read_size;
+  /* Switch to the next volume on the next read */
+  if ((guint64) self->offset == end)
+    self->moved = TRUE;
+
+  return read_size;
+}
+
+static gboolean
+autoar_volume_input_stream_close (GInputStream  *stream,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  AutoarVolumeInputStream *self;
+
+  self = AUTOAR_VOLUME_INPUT_STREAM (stream);
+
+  if (self->volume == NULL)
+    return TRUE;
+
+  return g_input_stream_close (self->volume, cancellable, error);
+}
+
+static goffset
+autoar_volume_input_stream_tell (GSeekable *seekable)
+{
+  return AUTOAR_VOLUME_INPUT_STREAM (seekable)->offset;
+}
+
+static gboolean
+autoar_volume_input_stream_can_seek (GSeekable *seekable)
+{
+  return TRUE;
+}
+
+static gboolean
+autoar_volume_input_stream_seek (GSeekable     *seekable,
+                                 goffset        offset,
+                                 GSeekType      type,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  AutoarVolumeInputStream *self;
+  goffset new_offset;
+
+  self = AUTOAR_VOLUME_INPUT_STREAM (seekable);
+
+  switch (type) {
+    case G_SEEK_CUR:
+      new_offset = self->offset + offset;
+      break;
+    case G_SEEK_END:
+      new_offset = self->starts[self->volumes->len] + offset;
+      break;
+    case G_SEEK_SET:
+    default:
+      new_offset = offset;
+      break;
+  }
+
+  if (new_offset < 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                         "Invalid seek request");
+    return FALSE;
+  }
+
+  self->offset = new_offset;
+  self->moved = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+autoar_volume_input_stream_can_truncate (GSeekable *seekable)
+{
+  return FALSE;
+}
+
+static gboolean
+autoar_volume_input_stream_truncate (GSeekable     *seekable,
+                                     goffset        offset,
+                                     GCancellable  *cancellable,
+                                     GError       **error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Cannot truncate volumes");
+  return FALSE;
+}
+
+static void
+autoar_volume_input_stream_seekable_iface_init (GSeekableIface *iface)
+{
+  iface->tell = autoar_volume_input_stream_tell;
+  iface->can_seek = autoar_volume_input_stream_can_seek;
+  iface->seek = autoar_volume_input_stream_seek;
+  iface->can_truncate = autoar_volume_input_stream_can_truncate;
+  iface->truncate_fn = autoar_volume_input_stream_truncate;
+}
+
+static void
+autoar_volume_input_stream_finalize (GObject *object)
+{
+  AutoarVolumeInputStream *self;
+
+  self = AUTOAR_VOLUME_INPUT_STREAM (object);
+
+  g_clear_object (&self->volume);
+  g_clear_pointer (&self->volumes, g_ptr_array_unref);
+  g_free (self->starts);
+
+  G_OBJECT_CLASS (autoar_volume_input_stream_parent_class)->finalize (object);
+}
+
+static void
+autoar_volume_input_stream_class_init (AutoarVolumeInputStreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  object_class->finalize = autoar_volume_input_stream_finalize;
+
+  stream_class->read_fn = autoar_volume_input_stream_read;
+  stream_class->close_fn = autoar_volume_input_stream_close;
+}
+
+static void
+autoar_volume_input_stream_init (AutoarVolumeInputStream *self)
+{
+}
+
+/**
+ * autoar_volume_input_stream_new:
+ * @volumes: (element-type GFile): the volumes of an archive, in order
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Creates a seekable stream which reads the archive from its volumes.
+ *
+ * Returns: (transfer full) (nullable): a new #GInputStream, or %NULL if the
+ * size of a volume couldn't be queried
+ **/
+GInputStream *
+autoar_volume_input_stream_new (GPtrArray     *volumes,
+                                GCancellable  *cancellable,
+                                GError       **error)
+{
+  g_autoptr (AutoarVolumeInputStream) self = NULL;
+  guint i;
+
+  g_return_val_if_fail (volumes != NULL && volumes->len > 0, NULL);
+
+  self = g_object_new (AUTOAR_TYPE_VOLUME_INPUT_STREAM, NULL);
+  self->volumes = g_ptr_array_ref (volumes);
+  self->starts = g_new0 (guint64, volumes->len + 1);
+
+  for (i = 0; i < volumes->len; i++) {
+    g_autoptr (GFileInfo) info = NULL;
+
+    info = g_file_query_info (volumes->pdata[i],
+                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                              G_FILE_QUERY_INFO_NONE,
+                              cancellable, error);
+    if (info == NULL)
+      return NULL;
+
+    self->starts[i + 1] = self->starts[i] + g_file_info_get_size (info);
+  }
+
+  return G_INPUT_STREAM (g_steal_pointer (&self));
+}
@@ -0,0 +1,57 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-volumes.h
+ * Archives split into volumes
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_VOLUMES_H
+#define AUTOAR_VOLUMES_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define AUTOAR_TYPE_VOLUME_OUTPUT_STREAM autoar_volume_output_stream_get_type ()
+
+G_DECLARE_FINAL_TYPE (AutoarVolumeOutputStream, autoar_volume_output_stream, AUTOAR, VOLUME_OUTPUT_STREAM, GOutputStream)
+
+#define AUTOAR_TYPE_VOLUME_INPUT_STREAM autoar_volume_input_stream_get_type ()
+
+G_DECLARE_FINAL_TYPE (AutoarVolumeInputStream, autoar_volume_input_stream, AUTOAR, VOLUME_INPUT_STREAM, GInputStream)
+
+GFile*         autoar_volume_get_file             (GFile *archive,
+                                                   guint number);
+GPtrArray*     autoar_volume_find                 (GFile *first_volume,
+                                                   GFile **archive);
+
+GOutputStream* autoar_volume_output_stream_new    (GFile *archive,
+                                                   guint64 volume_size,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+GInputStream*  autoar_volume_input_stream_new     (GPtrArray *volumes,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+
+G_END_DECLS
+
+#endif /* AUTOAR_VOLUMES_H */
@@ -0,0 +1,1362 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-zip-writer.c
+ * Parallel creation of zip archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+#include "autoar-zip-writer.h"
+
+#include "autoar-private.h"
+
+#include <archive_entry.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+/* Every entry of a zip archive is compressed on its own, so AutoarZipWriter
+ * compresses them on a pool of threads. Entries up to CHUNK_SIZE are read
+ * and deflated by the workers as a whole. Larger files are read here in
+ * chunks, which the workers deflate with the tail of the previous chunk as
+ * the dictionary, and which end with a sync flush so that they concatenate
+ * into one deflate stream. Their sizes and CRC-32 follow the data in a data
+ * descriptor. Their local header always has a zip64 extra field, since the
+ * file may grow while it is read.
+ *
+ * The jobs are queued in the order of the entries and the oldest ones are
+ * written out as soon as they are done, so the archive is the same as if it
+ * was written sequentially. The input size of the queued jobs is limited by
+ * the in-flight budget, the output is at most slightly larger.
+ *
+ * Files which are compressed already are stored. The workers decide for the
+ * entries they read, the first chunk decides for the larger files. The end
+ * of stored data can't be found without its size, so the local header of
+ * the larger stored files is written again after their data instead of
+ * using a data descriptor. If the archive can't seek, they are deflated
+ * without compression.
+ *
+ * Entries can be appended to an existing archive, from the offset of its
+ * central directory. The records of its central directory are copied as
+ * they are, except for the entries which are replaced by new ones. */
+
+#define CHUNK_SIZE (1024 * 1024)
+#define WINDOW_SIZE (32 * 1024)
+#define MAX_JOBS_PER_THREAD 16
+
+#define ZIP_VERSION 20
+#define ZIP_VERSION_ZIP64 45
+#define ZIP_MADE_BY_UNIX (3 << 8)
+
+#define ZIP_FLAG_DATA_DESCRIPTOR (1 << 3)
+#define ZIP_FLAG_UTF8 (1 << 11)
+
+#define ZIP_METHOD_STORE 0
+#define ZIP_METHOD_DEFLATE 8
+
+typedef struct
+{
+  char *name;
+  guint16 flags;
+  guint16 method;
+  guint16 dos_time;
+  guint16 dos_date;
+  gint64 mtime;
+  guint32 mode;
+  guint32 uid;
+  guint32 gid;
+  gboolean regular;
+  gboolean zip64;
+  /* The data is written in chunks */
+  gboolean chunked;
+  /* Position of the local header, which is written again after the data */
+  goffset header_position;
+
+  guint32 crc;
+  guint64 compressed_size;
+  guint64 size;
+  guint64 offset;
+} AutoarZipEntry;
+
+/* A record of the central directory of an existing archive */
+typedef struct
+{
+  char *name;
+  gsize offset;
+  gsize size;
+} AutoarZipRecord;
+
+typedef struct
+{
+  /* The local header of the entry is written before the data if set */
+  AutoarZipEntry *entry;
+  /* The entry is complete after the data */
+  gboolean last;
+
+  /* The whole file is read by the worker if set */
+  GFile *file;
+  GCancellable *cancellable;
+
+  guint8 *in;
+  gsize in_size;
+  guint8 *dictionary;
+  gsize dictionary_size;
+  gsize cost;
+
+  /* The data is stored instead of deflated if set */
+  gboolean store;
+  /* The data is deflated without compression if set */
+  gboolean no_compression;
+  /* The worker decides whether to store the whole file */
+  gboolean detect;
+
+  guint8 *out;
+  gsize out_size;
+  guint32 crc;
+  gint64 deflate_time;
+
+  gboolean done;
+  GError *error;
+} AutoarZipJob;
+
+struct _AutoarZipWriter
+{
+  int level;
+  guint n_threads;
+  guint64 in_flight_budget;
+  AutoarStoreDetection store_detection;
+  /* The MS-DOS times are in UTC instead of the local time */
+  gboolean utc;
+
+  AutoarZipWriterProgressFunc progress;
+  gpointer user_data;
+
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+  GQueue jobs;
+  guint64 in_flight;
+
+  guint64 offset;
+  GPtrArray *entries;
+  AutoarZipEntry *current;
+
+  /* Central directory of the existing archive */
+  GBytes *existing;
+  GPtrArray *records;
+
+  /* Tail of the previous chunk of a large file */
+  guint8 window[WINDOW_SIZE];
+  gsize window_size;
+
+  guint stored_files;
+  guint64 stored_size;
+  guint64 deflated_size;
+  gint64 deflate_time;
+};
+
+#ifdef HAVE_ZLIB
+static void
+put16 (GByteArray *buffer,
+       guint16     value)
+{
+  guint8 data[2] = { value, value >> 8 };
+
+  g_byte_array_append (buffer, data, sizeof (data));
+}
+
+static void
+put32 (GByteArray *buffer,
+       guint32     value)
+{
+  put16 (buffer, value);
+  put16 (buffer, value >> 16);
+}
+
+static void
+put64 (GByteArray *buffer,
+       guint64     value)
+{
+  put32 (buffer, value);
+  put32 (buffer, value >> 32);
+}
+
+static guint16
+get16 (const guint8 *data)
+{
+  return data[0] | data[1] << 8;
+}
+
+static guint32
+get32 (const guint8 *data)
+{
+  return get16 (data) | (guint32) get16 (data + 2) << 16;
+}
+
+static guint64
+get64 (const guint8 *data)
+{
+  return get32 (data) | (guint64) get32 (data + 4) << 32;
+}
+
+static void
+autoar_zip_entry_free (AutoarZipEntry *zentry)
+{
+  g_free (zentry->name);
+  g_free (zentry);
+}
+
+static void
+autoar_zip_record_free (AutoarZipRecord *record)
+{
+  g_free (record->name);
+  g_free (record);
+}
+
+static AutoarZipEntry *
+autoar_zip_entry_new (struct archive_entry *entry,
+                      gboolean              utc)
+{
+  AutoarZipEntry *zentry;
+  g_autoptr (GDateTime) date = NULL;
+
+  zentry = g_new0 (AutoarZipEntry, 1);
+
+  if (archive_entry_filetype (entry) == AE_IFDIR &&
+      !g_str_has_suffix (archive_entry_pathname (entry), "/"))
+    zentry->name = g_strconcat (archive_entry_pathname (entry), "/", NULL);
+  else
+    zentry->name = g_strdup (archive_entry_pathname (entry));
+
+  if (g_utf8_validate (zentry->name, -1, NULL))
+    zentry->flags |= ZIP_FLAG_UTF8;
+
+  zentry->method = ZIP_METHOD_STORE;
+  zentry->mtime = archive_entry_mtime (entry);
+  zentry->mode = archive_entry_mode (entry);
+  zentry->uid = archive_entry_uid (entry);
+  zentry->gid = archive_entry_gid (entry);
+
+  /* MS-DOS time can't represent anything before 1980 */
+  date = utc ? g_date_time_new_from_unix_utc (zentry->mtime) :
+               g_date_time_new_from_unix_local (zentry->mtime);
+  if (date != NULL && g_date_time_get_year (date) >= 1980 &&
+      g_date_time_get_year (date) <= 2107) {
+    zentry->dos_time = g_date_time_get_hour (date) << 11 |
+                       g_date_time_get_minute (date) << 5 |
+                       g_date_time_get_second (date) / 2;
+    zentry->dos_date = (g_date_time_get_year (date) - 1980) << 9 |
+                       g_date_time_get_month (date) << 5 |
+                       g_date_time_get_day_of_month (date);
+  } else {
+    zentry->dos_date = 1 << 5 | 1;
+  }
+
+  return zentry;
+}
+
+/* Extended timestamp and Info-ZIP Unix extra fields */
+static void
+autoar_zip_entry_put_extra (AutoarZipEntry *zentry,
+                            GByteArray     *buffer)
+{
+  put16 (buffer, 0x5455);
+  put16 (buffer, 5);
+  g_byte_array_append (buffer, (guint8 *) "\1", 1);
+  put32 (buffer, CLAMP (zentry->mtime, G_MININT32, G_MAXINT32));
+
+  put16 (buffer, 0x7875);
+  put16 (buffer, 11);
+  g_byte_array_append (buffer, (guint8 *) "\1\4", 2);
+  put32 (buffer, zentry->uid);
+  g_byte_array_append (buffer, (guint8 *) "\4", 1);
+  put32 (buffer, zentry->gid);
+}
+
+static GByteArray *
+autoar_zip_entry_get_local_header (AutoarZipEntry *zentry)
+{
+  GByteArray *buffer;
+  gsize name_size;
+  gboolean descriptor;
+
+  descriptor = (zentry->flags & ZIP_FLAG_DATA_DESCRIPTOR) != 0;
+  name_size = strlen (zentry->name);
+
+  buffer = g_byte_array_new ();
+  put32 (buffer, 0x04034b50);
+  put16 (buffer, zentry->zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION);
+  put16 (buffer, zentry->flags);
+  put16 (buffer, zentry->method);
+  put16 (buffer, zentry->dos_time);
+  put16 (buffer, zentry->dos_date);
+  put32 (buffer, descriptor ? 0 : zentry->crc);
+  put32 (buffer, zentry->zip64 ? 0xffffffff : descriptor ? 0 : zentry->compressed_size);
+  put32 (buffer, zentry->zip64 ? 0xffffffff : descriptor ? 0 : zentry->size);
+  put16 (buffer, name_size);
+  put16 (buffer, 24 + (zentry->zip64 ? 20 : 0));
+  g_byte_array_append (buffer, (guint8 *) zentry->name, name_size);
+
+  /* The sizes are zero until they are known */
+  if (zentry->zip64) {
+    put16 (buffer, 0x0001);
+    put16 (buffer, 16);
+    put64 (buffer, descriptor ? 0 : zentry->size);
+    put64 (buffer, descriptor ? 0 : zentry->compressed_size);
+  }
+
+  autoar_zip_entry_put_extra (zentry, buffer);
+
+  return buffer;
+}
+
+static void
+autoar_zip_entry_put_central_header (AutoarZipEntry *zentry,
+                                     GByteArray     *buffer)
+{
+  gsize name_size;
+  guint16 zip64_size = 0;
+
+  if (zentry->size >= 0xffffffff)
+    zip64_size += 8;
+  if (zentry->compressed_size >= 0xffffffff)
+    zip64_size += 8;
+  if (zentry->offset >= 0xffffffff)
+    zip64_size += 8;
+
+  name_size = strlen (zentry->name);
+
+  put32 (buffer, 0x02014b50);
+  put16 (buffer, ZIP_MADE_BY_UNIX | ZIP_VERSION_ZIP64);
+  put16 (buffer, zentry->zip64 || zip64_size > 0 ? ZIP_VERSION_ZIP64 : ZIP_VERSION);
+  put16 (buffer, zentry->flags);
+  put16 (buffer, zentry->method);
+  put16 (buffer, zentry->dos_time);
+  put16 (buffer, zentry->dos_date);
+  put32 (buffer, zentry->crc);
+  put32 (buffer, MIN (zentry->compressed_size, 0xffffffff));
+  put32 (buffer, MIN (zentry->size, 0xffffffff));
+  put16 (buffer, name_size);
+  put16 (buffer, 24 + (zip64_size > 0 ? 4 + zip64_size : 0));
+  put16 (buffer, 0);
+  put16 (buffer, 0);
+  put16 (buffer, 0);
+  put32 (buffer, zentry->mode << 16 | (S_ISDIR (zentry->mode) ? 0x10 : 0));
+  put32 (buffer, MIN (zentry->offset, 0xffffffff));
+  g_byte_array_append (buffer, (guint8 *) zentry->name, name_size);
+
+  if (zip64_size > 0) {
+    put16 (buffer, 0x0001);
+    put16 (buffer, zip64_size);
+    if (zentry->size >= 0xffffffff)
+      put64 (buffer, zentry->size);
+    if (zentry->compressed_size >= 0xffffffff)
+      put64 (buffer, zentry->compressed_size);
+    if (zentry->offset >= 0xffffffff)
+      put64 (buffer, zentry->offset);
+  }
+
+  autoar_zip_entry_put_extra (zentry, buffer);
+}
+
+static AutoarZipJob *
+autoar_zip_job_new (AutoarZipEntry *entry,
+                    gboolean        last)
+{
+  AutoarZipJob *job;
+
+  job = g_new0 (AutoarZipJob, 1);
+  job->entry = entry;
+  job->last = last;
+
+  return job;
+}
+
+static void
+autoar_zip_job_free (AutoarZipJob *job)
+{
+  g_clear_object (&job->file);
+  g_clear_object (&job->cancellable);
+  g_free (job->in);
+  g_free (job->dictionary);
+  g_free (job->out);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+static gboolean
+autoar_zip_job_read (AutoarZipJob  *job,
+                     GError       **error)
+{
+  GInputStream *istream;
+  gsize bytes_read;
+  gboolean ok;
+
+  istream = (GInputStream *) g_file_read (job->file, job->cancellable, error);
+  if (istream == NULL)
+    return FALSE;
+
+  /* Like libarchive, the size is the one the entry was created with */
+  job->in = g_malloc (job->in_size);
+  ok = g_input_stream_read_all (istream, job->in, job->in_size, &bytes_read,
+                                job->cancellable, error);
+  job->in_size = bytes_read;
+
+  g_input_stream_close (istream, NULL, NULL);
+  g_object_unref (istream);
+
+  return ok;
+}
+
+static gboolean
+autoar_zip_job_deflate (AutoarZipJob *job,
+                        int           level)
+{
+  z_stream zs = { 0 };
+  gsize out_capacity;
+  int ret;
+
+  job->crc = crc32 (0, job->in, job->in_size);
+
+  ret = deflateInit2 (&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  if (ret == Z_OK && job->dictionary_size > 0)
+    ret = deflateSetDictionary (&zs, job->dictionary, job->dictionary_size);
+
+  if (ret == Z_OK) {
+    /* A sync flush adds an empty stored block to the bound */
+    out_capacity = deflateBound (&zs, job->in_size) + 16;
+    job->out = g_malloc (out_capacity);
+    job->out_size = 0;
+
+    zs.next_in = job->in;
+    zs.avail_in = job->in_size;
+
+    /* The flush is only complete if deflate leaves space in the output */
+    do {
+      if (job->out_size == out_capacity) {
+        out_capacity *= 2;
+        job->out = g_realloc (job->out, out_capacity);
+      }
+
+      zs.next_out = job->out + job->out_size;
+      zs.avail_out = out_capacity - job->out_size;
+
+      ret = deflate (&zs, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+      job->out_size = out_capacity - zs.avail_out;
+    } while (ret == Z_OK && (job->last || zs.avail_out == 0));
+
+    if (ret == (job->last ? Z_STREAM_END : Z_OK) && zs.avail_in == 0)
+      ret = Z_OK;
+    else
+      ret = Z_STREAM_ERROR;
+  }
+
+  deflateEnd (&zs);
+
+  g_clear_pointer (&job->in, g_free);
+  g_clear_pointer (&job->dictionary, g_free);
+
+  return ret == Z_OK;
+}
+
+static void
+autoar_zip_job_store (AutoarZipJob *job)
+{
+  job->crc = crc32 (0, job->in, job->in_size);
+  job->out = g_steal_pointer (&job->in);
+  job->out_size = job->in_size;
+
+  g_clear_pointer (&job->dictionary, g_free);
+}
+
+static void
+autoar_zip_job_run (gpointer data,
+                    gpointer user_data)
+{
+  AutoarZipJob *job = data;
+  AutoarZipWriter *self = user_data;
+  GError *error = NULL;
+
+  if (!g_cancellable_set_error_if_cancelled (job->cancellable, &error) &&
+      (job->file == NULL || autoar_zip_job_read (job, &error))) {
+    /* The entry is complete, its name is only read by the writer */
+    if (job->detect)
+      job->store = autoar_common_is_compressed (job->entry->name,
+                                                job->in, job->in_size,
+                                                self->store_detection);
+
+    if (job->store) {
+      autoar_zip_job_store (job);
+    } else {
+      gint64 start = g_get_monotonic_time ();
+
+      if (!autoar_zip_job_deflate (job, job->no_compression ?
+                                          Z_NO_COMPRESSION : self->level))
+        g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Failed to compress data");
+      job->deflate_time = g_get_monotonic_time () - start;
+    }
+  }
+
+  g_mutex_lock (&self->lock);
+  job->error = error;
+  job->done = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static gboolean
+autoar_zip_writer_write (AutoarZipWriter  *self,
+                         GOutputStream    *ostream,
+                         const void       *buffer,
+                         gsize             size,
+                         GCancellable     *cancellable,
+                         GError          **error)
+{
+  if (!g_output_stream_write_all (ostream, buffer, size,
+                                  NULL, cancellable, error))
+    return FALSE;
+
+  self->offset += size;
+
+  return TRUE;
+}
+
+static gboolean
+autoar_zip_writer_can_seek (GOutputStream *ostream)
+{
+  return G_IS_SEEKABLE (ostream) && g_seekable_can_seek (G_SEEKABLE (ostream));
+}
+
+/* Writes the local header of a stored chunked entry again, now that its
+ * sizes and CRC-32 are known, and returns to the end of the archive */
+static gboolean
+autoar_zip_writer_rewrite_local_header (AutoarZipEntry  *zentry,
+                                        GOutputStream   *ostream,
+                                        GCancellable    *cancellable,
+                                        GError         **error)
+{
+  g_autoptr (GByteArray) header = NULL;
+  goffset end;
+
+  end = g_seekable_tell (G_SEEKABLE (ostream));
+
+  header = autoar_zip_entry_get_local_header (zentry);
+  if (!g_seekable_seek (G_SEEKABLE (ostream), zentry->header_position,
+                        G_SEEK_SET, cancellable, error) ||
+      !g_output_stream_write_all (ostream, header->data, header->len,
+                                  NULL, cancellable, error) ||
+      !g_seekable_seek (G_SEEKABLE (ostream), end,
+                        G_SEEK_SET, cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+autoar_zip_writer_write_job (AutoarZipWriter  *self,
+                             GOutputStream    *ostream,
+                             AutoarZipJob     *job,
+                             GCancellable     *cancellable,
+                             GError          **error)
+{
+  AutoarZipEntry *zentry;
+
+  if (job->error != NULL) {
+    g_propagate_error (error, g_steal_pointer (&job->error));
+    return FALSE;
+  }
+
+  if (job->entry != NULL) {
+    g_autoptr (GByteArray) header = NULL;
+
+    zentry = job->entry;
+    zentry->offset = self->offset;
+    if (job->store)
+      zentry->method = ZIP_METHOD_STORE;
+
+    /* The whole data of the entry is here */
+    if (!zentry->chunked) {
+      zentry->crc = job->crc;
+      zentry->compressed_size = job->out_size;
+      zentry->size = job->in_size;
+    } else if (!(zentry->flags & ZIP_FLAG_DATA_DESCRIPTOR)) {
+      zentry->header_position = g_seekable_tell (G_SEEKABLE (ostream));
+    }
+
+    header = autoar_zip_entry_get_local_header (zentry);
+    if (!autoar_zip_writer_write (self, ostream, header->data, header->len,
+                                  cancellable, error))
+      return FALSE;
+
+    self->current = zentry;
+  }
+
+  zentry = self->current;
+  if (zentry->chunked) {
+    zentry->crc = crc32_combine (zentry->crc, job->crc, job->in_size);
+    zentry->compressed_size += job->out_size;
+    zentry->size += job->in_size;
+  }
+
+  if (!autoar_zip_writer_write (self, ostream, job->out, job->out_size,
+                                cancellable, error))
+    return FALSE;
+
+  if (job->last && (zentry->flags & ZIP_FLAG_DATA_DESCRIPTOR)) {
+    g_autoptr (GByteArray) descriptor = NULL;
+
+    /* Chunked entries always have the zip64 extra field */
+    descriptor = g_byte_array_new ();
+    put32 (descriptor, 0x08074b50);
+    put32 (descriptor, zentry->crc);
+    put64 (descriptor, zentry->compressed_size);
+    put64 (descriptor, zentry->size);
+
+    if (!autoar_zip_writer_write (self, ostream, descriptor->data, descriptor->len,
+                                  cancellable, error))
+      return FALSE;
+  } else if (job->last && zentry->chunked &&
+             !autoar_zip_writer_rewrite_local_header (zentry, ostream,
+                                                      cancellable, error)) {
+    return FALSE;
+  }
+
+  if (job->store || job->no_compression) {
+    self->stored_size += job->in_size;
+    self->stored_files += job->last ? 1 : 0;
+  } else if (zentry->method == ZIP_METHOD_DEFLATE) {
+    self->deflated_size += job->in_size;
+    self->deflate_time += job->deflate_time;
+  }
+
+  if (self->progress != NULL)
+    self->progress (zentry->regular ? job->in_size : 0, job->last ? 1 : 0,
+                    self->user_data);
+
+  if (job->last)
+    self->current = NULL;
+
+  return TRUE;
+}
+
+/* Writes the done jobs in order, the oldest one is waited for if @wait is
+ * set */
+static gboolean
+autoar_zip_writer_flush (AutoarZipWriter  *self,
+                         GOutputStream    *ostream,
+                         gboolean          wait,
+                         GCancellable     *cancellable,
+                         GError          **error)
+{
+  AutoarZipJob *job;
+
+  while ((job = g_queue_peek_head (&self->jobs)) != NULL) {
+    gboolean ok;
+
+    g_mutex_lock (&self->lock);
+    while (wait && !job->done)
+      g_cond_wait (&self->cond, &self->lock);
+    ok = job->done;
+    g_mutex_unlock (&self->lock);
+
+    if (!ok)
+      break;
+
+    wait = FALSE;
+    g_queue_pop_head (&self->jobs);
+    self->in_flight -= job->cost;
+
+    ok = autoar_zip_writer_write_job (self, ostream, job, cancellable, error);
+    autoar_zip_job_free (job);
+    if (!ok)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+autoar_zip_writer_push (AutoarZipWriter  *self,
+                        GOutputStream    *ostream,
+                        AutoarZipJob     *job,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  /* A job larger than the budget is queued alone */
+  while (self->jobs.length > 0 &&
+         (self->in_flight + job->cost > self->in_flight_budget ||
+          self->jobs.length >= MAX_JOBS_PER_THREAD * self->n_threads)) {
+    if (!autoar_zip_writer_flush (self, ostream, TRUE, cancellable, error)) {
+      autoar_zip_job_free (job);
+      return FALSE;
+    }
+  }
+
+  self->in_flight += job->cost;
+  g_queue_push_tail (&self->jobs, job);
+  if (!job->done)
+    g_thread_pool_push (self->pool, job, NULL);
+
+  return autoar_zip_writer_flush (self, ostream, FALSE, cancellable, error);
+}
+
+static gboolean
+autoar_zip_writer_add_chunks (AutoarZipWriter  *self,
+                              GOutputStream    *ostream,
+                              AutoarZipEntry   *zentry,
+                              GInputStream     *istream,
+                              gint64            length,
+                              GCancellable     *cancellable,
+                              GError          **error)
+{
+  gboolean last = FALSE;
+  gboolean store = FALSE;
+  gboolean no_compression = FALSE;
+  gboolean ok = TRUE;
+
+  self->window_size = 0;
+
+  while (ok && !last) {
+    AutoarZipJob *job;
+    gsize size, bytes_read;
+    guint8 *buffer;
+
+    size = length < 0 ? CHUNK_SIZE : MIN (length, CHUNK_SIZE);
+    buffer = g_malloc (size);
+    if (!g_input_stream_read_all (istream, buffer, size, &bytes_read,
+                                  cancellable, error)) {
+      g_free (buffer);
+      ok = FALSE;
+      break;
+    }
+
+    if (length > 0)
+      length -= bytes_read;
+    last = bytes_read < CHUNK_SIZE || length == 0;
+
+    /* The first chunk decides for the whole file */
+    if (zentry != NULL &&
+        autoar_common_is_compressed (zentry->name, buffer, bytes_read,
+                                     self->store_detection)) {
+      if (autoar_zip_writer_can_seek (ostream)) {
+        store = TRUE;
+        zentry->method = ZIP_METHOD_STORE;
+        zentry->flags &= ~ZIP_FLAG_DATA_DESCRIPTOR;
+      } else {
+        no_compression = TRUE;
+      }
+    }
+
+    job = autoar_zip_job_new (zentry, last);
+    job->store = store;
+    job->no_compression = no_compression;
+    zentry = NULL;
+    job->in = buffer;
+    job->in_size = bytes_read;
+    job->cost = CHUNK_SIZE;
+    job->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+    if (self->window_size > 0) {
+      job->dictionary = g_malloc (self->window_size);
+      memcpy (job->dictionary, self->window, self->window_size);
+      job->dictionary_size = self->window_size;
+    }
+
+    /* The tail of this chunk is the dictionary of the next one */
+    if (bytes_read >= WINDOW_SIZE) {
+      memcpy (self->window, buffer + bytes_read - WINDOW_SIZE, WINDOW_SIZE);
+      self->window_size = WINDOW_SIZE;
+    }
+
+    ok = autoar_zip_writer_push (self, ostream, job, cancellable, error);
+  }
+
+  return ok;
+}
+#endif
+
+/**
+ * autoar_zip_writer_new:
+ * @level: the zlib compression level, or -1 for the default
+ * @n_threads: the number of threads
+ * @in_flight_budget: the maximal size of the data which is read but not
+ * written yet
+ * @progress: (nullable): the progress callback
+ * @user_data: data for @progress
+ *
+ * Returns: (transfer full): a new #AutoarZipWriter, or %NULL if gnome-autoar
+ * was built without zlib
+ **/
+AutoarZipWriter *
+autoar_zip_writer_new (int                          level,
+                       guint                        n_threads,
+                       guint64                      in_flight_budget,
+                       AutoarZipWriterProgressFunc  progress,
+                       gpointer                     user_data)
+{
+#ifdef HAVE_ZLIB
+  AutoarZipWriter *self;
+
+  self = g_new0 (AutoarZipWriter, 1);
+  self->level = level;
+  self->n_threads = MAX (n_threads, 1);
+  self->in_flight_budget = in_flight_budget;
+  self->progress = progress;
+  self->user_data = user_data;
+  self->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) autoar_zip_entry_free);
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->jobs);
+  self->pool = g_thread_pool_new (autoar_zip_job_run, self,
+                                  self->n_threads, FALSE, NULL);
+
+  g_debug ("autoar_zip_writer_new: level %d, %u threads, budget %" G_GUINT64_FORMAT,
+           level, self->n_threads, in_flight_budget);
+
+  return self;
+#else
+  return NULL;
+#endif
+}
+
+void
+autoar_zip_writer_free (AutoarZipWriter *self)
+{
+#ifdef HAVE_ZLIB
+  AutoarZipJob *job;
+
+  if (self == NULL)
+    return;
+
+  /* Drop the jobs which haven't started yet */
+  g_thread_pool_free (self->pool, TRUE, TRUE);
+  while ((job = g_queue_pop_head (&self->jobs)) != NULL)
+    autoar_zip_job_free (job);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_ptr_array_unref (self->entries);
+  g_clear_pointer (&self->existing, g_bytes_unref);
+  g_clear_pointer (&self->records, g_ptr_array_unref);
+  g_free (self);
+#endif
+}
+
+#ifdef HAVE_ZLIB
+static gboolean
+autoar_zip_writer_read_at (GInputStream  *istream,
+                           guint64        offset,
+                           void          *buffer,
+                           gsize          size,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  gsize bytes_read;
+
+  if (!g_seekable_seek (G_SEEKABLE (istream), offset, G_SEEK_SET,
+                        cancellable, error) ||
+      !g_input_stream_read_all (istream, buffer, size, &bytes_read,
+                                cancellable, error))
+    return FALSE;
+
+  if (bytes_read < size) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Unexpected end of the zip archive");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Finds the central directory in the end of central directory record, or
+ * in the zip64 one, and checks that it is in front of the record */
+static gboolean
+autoar_zip_writer_find_central_directory (GInputStream  *istream,
+                                          guint64       *cd_offset,
+                                          guint64       *cd_size,
+                                          GCancellable  *cancellable,
+                                          GError       **error)
+{
+  g_autofree guint8 *tail = NULL;
+  guint8 record[56];
+  goffset size;
+  guint64 end, locator;
+  gsize tail_size;
+  gssize i;
+
+  if (!g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_END,
+                        cancellable, error))
+    return FALSE;
+  size = g_seekable_tell (G_SEEKABLE (istream));
+
+  /* The record is followed by a comment of up to 64 KiB */
+  tail_size = MIN (size, 0xffff + 22 + 20);
+  tail = g_malloc (tail_size);
+  if (!autoar_zip_writer_read_at (istream, size - tail_size, tail, tail_size,
+                                  cancellable, error))
+    return FALSE;
+
+  for (i = (gssize) tail_size - 22; i >= 0; i--) {
+    if (get32 (tail + i) == 0x06054b50 &&
+        i + 22 + get16 (tail + i + 20) <= tail_size)
+      break;
+  }
+
+  if (i < 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "The end of the central directory of the zip archive is not found");
+    return FALSE;
+  }
+
+  end = size - tail_size + i;
+  *cd_size = get32 (tail + i + 12);
+  *cd_offset = get32 (tail + i + 16);
+  if (*cd_size == 0xffffffff || *cd_offset == 0xffffffff ||
+      get16 (tail + i + 10) == 0xffff) {
+    if (i < 20 || get32 (tail + i - 20) != 0x07064b50) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The zip64 end of central directory locator is not found");
+      return FALSE;
+    }
+
+    /* The record is in front of the locator */
+    locator = size - tail_size + i - 20;
+    end = get64 (tail + i - 20 + 8);
+    if (end > locator || locator - end < sizeof (record)) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The zip64 end of central directory record is out of bounds");
+      return FALSE;
+    }
+
+    if (!autoar_zip_writer_read_at (istream, end, record, sizeof (record),
+                                    cancellable, error))
+      return FALSE;
+
+    if (get32 (record) != 0x06064b50) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The zip64 end of central directory record is not found");
+      return FALSE;
+    }
+
+    *cd_size = get64 (record + 40);
+    *cd_offset = get64 (record + 48);
+  }
+
+  /* The values come from the archive, so they can't be trusted */
+  if (*cd_offset > end || *cd_size > end - *cd_offset) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "The central directory of the zip archive is out of bounds");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+#endif
+
+/**
+ * autoar_zip_writer_load:
+ * @self: an #AutoarZipWriter
+ * @file: an existing zip archive
+ * @offset: (out): return location for the offset of its central directory
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads the central directory of @file, so that the entries which are
+ * added are appended to it. The archive should be truncated to @offset,
+ * where the new entries start. It should only be called before adding
+ * entries.
+ *
+ * Returns: %FALSE if an error occurred
+ **/
+gboolean
+autoar_zip_writer_load (AutoarZipWriter  *self,
+                        GFile            *file,
+                        guint64          *offset,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+#ifdef HAVE_ZLIB
+  g_autoptr (GFileInputStream) istream = NULL;
+  guint64 cd_offset, cd_size;
+  const guint8 *data;
+  guint8 *buffer;
+  gsize position;
+
+  istream = g_file_read (file, cancellable, error);
+  if (istream == NULL)
+    return FALSE;
+
+  if (!autoar_zip_writer_find_central_directory (G_INPUT_STREAM (istream),
+                                                 &cd_offset, &cd_size,
+                                                 cancellable, error))
+    return FALSE;
+
+  buffer = NULL;
+  if ((gsize) cd_size == cd_size)
+    buffer = g_try_malloc (MAX (cd_size, 1));
+  if (buffer == NULL) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "The central directory of the zip archive is too large");
+    return FALSE;
+  }
+
+  if (!autoar_zip_writer_read_at (G_INPUT_STREAM (istream), cd_offset,
+                                  buffer, cd_size, cancellable, error)) {
+    g_free (buffer);
+    return FALSE;
+  }
+
+  g_clear_pointer (&self->existing, g_bytes_unref);
+  g_clear_pointer (&self->records, g_ptr_array_unref);
+  self->existing = g_bytes_new_take (buffer, cd_size);
+  self->records = g_ptr_array_new_with_free_func ((GDestroyNotify) autoar_zip_record_free);
+
+  data = buffer;
+  for (position = 0; position < cd_size;) {
+    AutoarZipRecord *record;
+    gsize size;
+
+    if (cd_size - position < 46 || get32 (data + position) != 0x02014b50) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Malformed central directory of the zip archive");
+      return FALSE;
+    }
+
+    size = 46 + get16 (data + position + 28) + get16 (data + position + 30) +
+           get16 (data + position + 32);
+    if (size > cd_size - position) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Malformed central directory of the zip archive");
+      return FALSE;
+    }
+
+    record = g_new0 (AutoarZipRecord, 1);
+    record->name = g_strndup ((const char *) data + position + 46,
+                              get16 (data + position + 28));
+    record->offset = position;
+    record->size = size;
+    g_ptr_array_add (self->records, record);
+
+    position += size;
+  }
+
+  g_debug ("autoar_zip_writer_load: %u entries at %" G_GUINT64_FORMAT,
+           self->records->len, cd_offset);
+
+  self->offset = cd_offset;
+  *offset = cd_offset;
+
+  return TRUE;
+#else
+  g_assert_not_reached ();
+  return FALSE;
+#endif
+}
+
+/**
+ * autoar_zip_writer_set_store_detection:
+ * @self: an #AutoarZipWriter
+ * @store_detection: the checks for the files to store
+ *
+ * Sets how the files which are compressed already are detected. It should
+ * only be called before adding entries.
+ **/
+void
+autoar_zip_writer_set_store_detection (AutoarZipWriter      *self,
+                                       AutoarStoreDetection  store_detection)
+{
+#ifdef HAVE_ZLIB
+  self->store_detection = store_detection;
+#endif
+}
+
+/**
+ * autoar_zip_writer_set_utc:
+ * @self: an #AutoarZipWriter
+ * @utc: whether to write the MS-DOS times in UTC
+ *
+ * Writes the MS-DOS times of the entries in UTC instead of the local time,
+ * so the archive doesn't depend on the time zone. The extractors which
+ * know the extended timestamp field use it instead anyway. It should only
+ * be called before adding entries.
+ **/
+void
+autoar_zip_writer_set_utc (AutoarZipWriter *self,
+                           gboolean         utc)
+{
+#ifdef HAVE_ZLIB
+  self->utc = utc;
+#endif
+}
+
+/**
+ * autoar_zip_writer_get_stats:
+ * @self: an #AutoarZipWriter
+ * @stored_files: (out): return location for the number of stored files
+ * @stored_size: (out): return location for the size of the stored files
+ * @deflated_size: (out): return location for the size of the deflated files
+ * @deflate_time: (out): return location for the time spent deflating them,
+ * in microseconds
+ *
+ * Gets the statistics of the entries which have been written.
+ **/
+void
+autoar_zip_writer_get_stats (AutoarZipWriter *self,
+                             guint           *stored_files,
+                             guint64         *stored_size,
+                             guint64         *deflated_size,
+                             gint64          *deflate_time)
+{
+#ifdef HAVE_ZLIB
+  *stored_files = self->stored_files;
+  *stored_size = self->stored_size;
+  *deflated_size = self->deflated_size;
+  *deflate_time = self->deflate_time;
+#endif
+}
+
+/**
+ * autoar_zip_writer_add:
+ * @self: an #AutoarZipWriter
+ * @ostream: the stream of the new archive
+ * @entry: the entry to add
+ * @file: (nullable): the file with the data of a regular @entry
+ * @source: (nullable): the data of a regular @entry, read instead of @file
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Queues @entry and writes the entries which are done already. Only the
+ * pathname, type, size, mode, owner and mtime of @entry are used. At most
+ * the size of @entry is read from @source, while @file is read to its end.
+ *
+ * Returns: %FALSE if an error occurred
+ **/
+gboolean
+autoar_zip_writer_add (AutoarZipWriter       *self,
+                       GOutputStream         *ostream,
+                       struct archive_entry  *entry,
+                       GFile                 *file,
+                       GInputStream          *source,
+                       GCancellable          *cancellable,
+                       GError               **error)
+{
+#ifdef HAVE_ZLIB
+  AutoarZipEntry *zentry;
+  AutoarZipJob *job;
+  gint64 size;
+
+  zentry = autoar_zip_entry_new (entry, self->utc);
+  g_ptr_array_add (self->entries, zentry);
+
+  g_debug ("autoar_zip_writer_add: %s", zentry->name);
+
+  size = archive_entry_size (entry);
+  if (archive_entry_filetype (entry) == AE_IFREG && size > 0 &&
+      (file != NULL || source != NULL)) {
+    zentry->method = ZIP_METHOD_DEFLATE;
+    zentry->regular = TRUE;
+
+    if (size > CHUNK_SIZE) {
+      g_autoptr (GInputStream) istream = NULL;
+      gboolean ok;
+
+      zentry->flags |= ZIP_FLAG_DATA_DESCRIPTOR;
+      zentry->chunked = TRUE;
+      zentry->zip64 = TRUE;
+
+      if (source != NULL)
+        istream = g_object_ref (source);
+      else
+        istream = (GInputStream *) g_file_read (file, cancellable, error);
+      if (istream == NULL)
+        return FALSE;
+
+      ok = autoar_zip_writer_add_chunks (self, ostream, zentry, istream,
+                                         source != NULL ? size : -1,
+                                         cancellable, error);
+      g_input_stream_close (istream, NULL, NULL);
+
+      return ok;
+    }
+
+    job = autoar_zip_job_new (zentry, TRUE);
+    job->detect = TRUE;
+    job->cancellable = cancellable != NULL ? g_object_ref (cancellable) : NULL;
+    job->in_size = size;
+    job->cost = size;
+
+    /* Streams can't be read by the workers, since the caller may use them
+     * from this thread */
+    if (source != NULL) {
+      gsize bytes_read;
+
+      job->in = g_malloc (size);
+      if (!g_input_stream_read_all (source, job->in, size, &bytes_read,
+                                    cancellable, error)) {
+        autoar_zip_job_free (job);
+        return FALSE;
+      }
+      job->in_size = bytes_read;
+    } else {
+      job->file = g_object_ref (file);
+    }
+
+    return autoar_zip_writer_push (self, ostream, job, cancellable, error);
+  }
+
+  /* Other entries are stored, the data of symbolic links is their target */
+  job = autoar_zip_job_new (zentry, TRUE);
+  if (archive_entry_filetype (entry) == AE_IFLNK &&
+      archive_entry_symlink (entry) != NULL) {
+    job->out = (guint8 *) g_strdup (archive_entry_symlink (entry));
+    job->out_size = job->in_size = strlen ((char *) job->out);
+    job->crc = crc32 (0, job->out, job->out_size);
+  } else {
+    zentry->regular = archive_entry_filetype (entry) == AE_IFREG;
+  }
+  job->done = TRUE;
+
+  return autoar_zip_writer_push (self, ostream, job, cancellable, error);
+#else
+  g_assert_not_reached ();
+  return FALSE;
+#endif
+}
+
+/**
+ * autoar_zip_writer_finish:
+ * @self: an #AutoarZipWriter
+ * @ostream: the stream of the new archive
+ * @cancellable: optional #GCancellable object, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Writes the queued entries and the central directory.
+ *
+ * Returns: %FALSE if an error occurred
+ **/
+gboolean
+autoar_zip_writer_finish (AutoarZipWriter  *self,
+                          GOutputStream    *ostream,
+                          GCancellable     *cancellable,
+                          GError          **error)
+{
+#ifdef HAVE_ZLIB
+  g_autoptr (GByteArray) buffer = NULL;
+  guint64 offset, size, n_entries;
+  guint i;
+
+  while (self->jobs.length > 0) {
+    if (!autoar_zip_writer_flush (self, ostream, TRUE, cancellable, error))
+      return FALSE;
+  }
+
+  offset = self->offset;
+  buffer = g_byte_array_new ();
+  n_entries = self->entries->len;
+
+  /* The existing entries come first, unless they have been replaced */
+  if (self->records != NULL) {
+    g_autoptr (GHashTable) names = NULL;
+    const guint8 *data;
+
+    names = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < self->entries->len; i++)
+      g_hash_table_add (names, ((AutoarZipEntry *) self->entries->pdata[i])->name);
+
+    data = g_bytes_get_data (self->existing, NULL);
+    for (i = 0; i < self->records->len; i++) {
+      AutoarZipRecord *record = self->records->pdata[i];
+
+      if (g_hash_table_contains (names, record->name))
+        continue;
+
+      g_byte_array_append (buffer, data + record->offset, record->size);
+      n_entries++;
+
+      if (buffer->len >= CHUNK_SIZE) {
+        if (!autoar_zip_writer_write (self, ostream, buffer->data, buffer->len,
+                                      cancellable, error))
+          return FALSE;
+
+        g_byte_array_set_size (buffer, 0);
+      }
+    }
+  }
+
+  for (i = 0; i < self->entries->len; i++) {
+    autoar_zip_entry_put_central_header (self->entries->pdata[i], buffer);
+
+    if (buffer->len >= CHUNK_SIZE) {
+      if (!autoar_zip_writer_write (self, ostream, buffer->data, buffer->len,
+                                    cancellable, error))
+        return FALSE;
+
+      g_byte_array_set_size (buffer, 0);
+    }
+  }
+
+  size = self->offset + buffer->len - offset;
+
+  if (n_entries >= 0xffff ||
+      offset >= 0xffffffff || size >= 0xffffffff) {
+    guint64 record_offset = self->offset + buffer->len;
+
+    /* Zip64 end of central directory record and locator */
+    put32 (buffer, 0x06064b50);
+    put64 (buffer, 44);
+    put16 (buffer, ZIP_MADE_BY_UNIX | ZIP_VERSION_ZIP64);
+    put16 (buffer, ZIP_VERSION_ZIP64);
+    put32 (buffer, 0);
+    put32 (buffer, 0);
+    put64 (buffer, n_entries);
+    put64 (buffer, n_entries);
+    put64 (buffer, size);
+    put64 (buffer, offset);
+
+    put32 (buffer, 0x07064b50);
+    put32 (buffer, 0);
+    put64 (buffer, record_offset);
+    put32 (buffer, 1);
+  }
+
+  put32 (buffer, 0x06054b50);
+  put16 (buffer, 0);
+  put16 (buffer, 0);
+  put16 (buffer, MIN (n_entries, 0xffff));
+  put16 (buffer, MIN (n_entries, 0xffff));
+  put32 (buffer, MIN (size, 0xffffffff));
+  put32 (buffer, MIN (offset, 0xffffffff));
+  put16 (buffer, 0);
+
+  g_debug ("autoar_zip_writer_finish: %" G_GUINT64_FORMAT " entries", n_entries);
+
+  return autoar_zip_writer_write (self, ostream, buffer->data, buffer->len,
+                                  cancellable, error);
+#else
+  g_assert_not_reached ();
+  return FALSE;
+#endif
+}
@@ -0,0 +1,81 @@
+/* vim: set sw=2 ts=2 sts=2 et: */
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * autoar-zip-writer.h
+ * Parallel creation of zip archives
+ *
+ * Copyright (C) 2026  The gnome-autoar authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef AUTOAR_ZIP_WRITER_H
+#define AUTOAR_ZIP_WRITER_H
+
+#include <archive_entry.h>
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "autoar-compressor.h"
+
+G_BEGIN_DECLS
+
+typedef struct _AutoarZipWriter AutoarZipWriter;
+
+/* Called when the data of regular files has been written, @files is the
+ * number of finished entries */
+typedef void (*AutoarZipWriterProgressFunc) (guint64  size,
+                                             guint    files,
+                                             gpointer user_data);
+
+AutoarZipWriter* autoar_zip_writer_new            (int level,
+                                                   guint n_threads,
+                                                   guint64 in_flight_budget,
+                                                   AutoarZipWriterProgressFunc progress,
+                                                   gpointer user_data);
+void             autoar_zip_writer_free           (AutoarZipWriter *self);
+
+void             autoar_zip_writer_set_store_detection (AutoarZipWriter *self,
+                                                   AutoarStoreDetection store_detection);
+void             autoar_zip_writer_set_utc        (AutoarZipWriter *self,
+                                                   gboolean utc);
+void             autoar_zip_writer_get_stats      (AutoarZipWriter *self,
+                                                   guint *stored_files,
+                                                   guint64 *stored_size,
+                                                   guint64 *deflated_size,
+                                                   gint64 *deflate_time);
+
+gboolean         autoar_zip_writer_load           (AutoarZipWriter *self,
+                                                   GFile *file,
+                                                   guint64 *offset,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+gboolean         autoar_zip_writer_add            (AutoarZipWriter *self,
+                                                   GOutputStream *ostream,
+                                                   struct archive_entry *entry,
+                                                   GFile *file,
+                                                   GInputStream *source,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+gboolean         autoar_zip_writer_finish         (AutoarZipWriter *self,
+                                                   GOutputStream *ostream,
+                                                   GCancellable *cancellable,
+                                                   GError **error);
+
+G_END_DECLS
+
+#endif /* AUTOAR_ZIP_WRITER_H */
@@ -23,6 +23,7 @@
 #ifndef AUTOARCHIVE_H
 #define AUTOARCHIVE_H
 
+#include <gnome-autoar/autoar-archive-index.h>
 #include <gnome-autoar/autoar-compressor.h>
 #include <gnome-autoar/autoar-format-filter.h>
 #include <gnome-autoar/autoar-extractor.h>
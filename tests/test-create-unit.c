@@ -0,0 +1,2878 @@
+#include <gnome-autoar/gnome-autoar.h>
+#include <archive_entry.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+typedef struct {
+  GFile *work_directory;
+  GFile *input;
+  GFile *output;
+  GFile *extracted;
+} CreateTest;
+
+static void create_test_free (CreateTest *test);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(CreateTest, create_test_free);
+
+
+typedef struct {
+  GFile *destination;
+
+  GError *error;
+
+  gboolean completed_signalled;
+  gboolean cancelled_signalled;
+} CreateTestData;
+
+static void create_test_data_free (CreateTestData *data);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(CreateTestData, create_test_data_free);
+
+
+/* A #GOutputStream which can't seek and counts how often it is flushed,
+ * like the body of a response */
+#define CREATE_TEST_TYPE_OUTPUT_STREAM create_test_output_stream_get_type ()
+
+G_DECLARE_FINAL_TYPE (CreateTestOutputStream, create_test_output_stream, CREATE_TEST, OUTPUT_STREAM, GFilterOutputStream)
+
+struct _CreateTestOutputStream
+{
+  GFilterOutputStream parent_instance;
+
+  guint n_flushes;
+};
+
+G_DEFINE_TYPE (CreateTestOutputStream, create_test_output_stream, G_TYPE_FILTER_OUTPUT_STREAM)
+
+static gboolean
+create_test_output_stream_flush (GOutputStream  *stream,
+                                 GCancellable   *cancellable,
+                                 GError        **error)
+{
+  CreateTestOutputStream *self = CREATE_TEST_OUTPUT_STREAM (stream);
+
+  self->n_flushes++;
+
+  return G_OUTPUT_STREAM_CLASS (create_test_output_stream_parent_class)->flush (stream, cancellable, error);
+}
+
+static void
+create_test_output_stream_class_init (CreateTestOutputStreamClass *klass)
+{
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
+
+  stream_class->flush = create_test_output_stream_flush;
+}
+
+static void
+create_test_output_stream_init (CreateTestOutputStream *self)
+{
+}
+
+
+static gboolean
+remove_directory (GFile *directory)
+{
+  gboolean success = TRUE;
+  GError *error = NULL;
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+
+  enumerator = g_file_enumerate_children (directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, NULL);
+
+  if (enumerator) {
+    GFileInfo *info;
+
+    while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+      g_autoptr (GFile) child = NULL;
+
+      child = g_file_get_child (directory, g_file_info_get_name (info));
+
+      if (!g_file_delete (child, NULL, &error)) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_EMPTY)) {
+          success = success && remove_directory (child);
+        } else {
+          success = FALSE;
+        }
+
+        g_clear_error (&error);
+      }
+
+      g_object_unref (info);
+    }
+  }
+
+  g_file_delete (directory, NULL, &error);
+
+  if (error) {
+    success = FALSE;
+    g_error_free (error);
+  }
+
+  return success;
+}
+
+static CreateTest*
+create_test_new (void)
+{
+  CreateTest *create_test;
+  g_autofree char *path = NULL;
+  g_autoptr (GError) error = NULL;
+
+  path = g_dir_make_tmp ("test-create-unit-XXXXXX", &error);
+  if (path == NULL) {
+    g_printerr ("Failed to create the work directory: %s\n", error->message);
+
+    return NULL;
+  }
+
+  create_test = g_new0 (CreateTest, 1);
+
+  create_test->work_directory = g_file_new_for_path (path);
+  create_test->input = g_file_get_child (create_test->work_directory, "input");
+  create_test->output = g_file_get_child (create_test->work_directory, "output");
+  create_test->extracted = g_file_get_child (create_test->work_directory, "extracted");
+
+  g_file_make_directory (create_test->input, NULL, NULL);
+  g_file_make_directory (create_test->output, NULL, NULL);
+  g_file_make_directory (create_test->extracted, NULL, NULL);
+
+  return create_test;
+}
+
+static void
+create_test_free (CreateTest *create_test)
+{
+  remove_directory (create_test->work_directory);
+
+  g_object_unref (create_test->work_directory);
+  g_object_unref (create_test->input);
+  g_object_unref (create_test->output);
+  g_object_unref (create_test->extracted);
+
+  g_free (create_test);
+}
+
+/* Writes @size bytes of @data to @path below the input directory */
+static GFile *
+create_test_write_file (CreateTest *create_test,
+                        const char *path,
+                        const void *data,
+                        gsize       size)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFile) parent = NULL;
+  g_autoptr (GError) error = NULL;
+
+  file = g_file_resolve_relative_path (create_test->input, path);
+  parent = g_file_get_parent (file);
+  g_file_make_directory_with_parents (parent, NULL, NULL);
+
+  g_file_replace_contents (file, data, size, NULL, FALSE,
+                           G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_steal_pointer (&file);
+}
+
+/* Writes a file of @size bytes below the input directory, with the data of
+ * @n_offsets lines at @offsets and holes everywhere else. Returns %FALSE if
+ * the file system didn't keep the holes. */
+static gboolean
+create_test_write_sparse (CreateTest    *create_test,
+                          const char    *path,
+                          goffset        size,
+                          const goffset *offsets,
+                          guint          n_offsets)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFileOutputStream) ostream = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+  guint i;
+
+  file = g_file_resolve_relative_path (create_test->input, path);
+  ostream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE,
+                            NULL, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < n_offsets; i++) {
+    g_seekable_seek (G_SEEKABLE (ostream), offsets[i], G_SEEK_SET,
+                     NULL, &error);
+    g_assert_no_error (error);
+    g_output_stream_write_all (G_OUTPUT_STREAM (ostream), "AutoarCreate\n", 13,
+                               NULL, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  g_seekable_truncate (G_SEEKABLE (ostream), size, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_close (G_OUTPUT_STREAM (ostream), NULL, &error);
+  g_assert_no_error (error);
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_UNIX_BLOCKS,
+                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS) &&
+         g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS) * 512 < (guint64) size;
+}
+
+/* Returns @size bytes of text, which is compressible, but not as trivially
+ * as a repeated line */
+static char *
+generate_text (gsize   size,
+               guint32 seed)
+{
+  static const char *words[] = {
+    "autoar", "archive", "compressor", "extractor", "entry", "gzip",
+    "deflate", "chunk", "window", "stream", "header", "directory", "file",
+    "offset", "volume", "snapshot"
+  };
+  g_autoptr (GRand) rand = NULL;
+  char *text;
+  gsize i = 0;
+
+  rand = g_rand_new_with_seed (seed);
+  text = g_malloc (size);
+
+  while (i < size) {
+    const char *word = words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))];
+    gsize len = MIN (strlen (word), size - i);
+
+    memcpy (text + i, word, len);
+    i += len;
+    if (i < size)
+      text[i++] = g_rand_int_range (rand, 0, 8) == 0 ? '\n' : ' ';
+  }
+
+  return text;
+}
+
+/* Returns @size bytes which can't be compressed */
+static guint8 *
+generate_random (gsize   size,
+                 guint32 seed)
+{
+  g_autoptr (GRand) rand = NULL;
+  guint8 *data;
+  gsize i;
+
+  rand = g_rand_new_with_seed (seed);
+  data = g_malloc (size);
+
+  for (i = 0; i < size; i++)
+    data[i] = g_rand_int (rand);
+
+  return data;
+}
+
+static void
+create_test_data_free (CreateTestData *data)
+{
+  g_clear_object (&data->destination);
+  g_clear_error (&data->error);
+
+  g_free (data);
+}
+
+static void
+compressor_decide_dest_cb (AutoarCompressor *compressor,
+                           GFile            *destination,
+                           gpointer          user_data)
+{
+  CreateTestData *data = user_data;
+
+  g_set_object (&data->destination, destination);
+}
+
+static void
+compressor_error_cb (AutoarCompressor *compressor,
+                     GError           *error,
+                     gpointer          user_data)
+{
+  CreateTestData *data = user_data;
+
+  data->error = g_error_copy (error);
+}
+
+static void
+compressor_completed_cb (AutoarCompressor *compressor,
+                         gpointer          user_data)
+{
+  CreateTestData *data = user_data;
+
+  data->completed_signalled = TRUE;
+}
+
+static void
+compressor_cancelled_cb (AutoarCompressor *compressor,
+                         gpointer          user_data)
+{
+  CreateTestData *data = user_data;
+
+  data->cancelled_signalled = TRUE;
+}
+
+/* Cancels the compression once some data has been written */
+static void
+compressor_cancel_progress_cb (AutoarCompressor *compressor,
+                               guint64           completed_size,
+                               guint             completed_files,
+                               gpointer          user_data)
+{
+  GCancellable *cancellable = user_data;
+
+  if (completed_size > 0)
+    g_cancellable_cancel (cancellable);
+}
+
+static AutoarCompressor *
+create_test_compressor_new (CreateTest  *create_test,
+                            AutoarFormat format,
+                            AutoarFilter filter)
+{
+  GList *source_files;
+  AutoarCompressor *compressor;
+
+  source_files = g_list_prepend (NULL, g_object_ref (create_test->input));
+
+  compressor = autoar_compressor_new (source_files, create_test->output,
+                                      format, filter, FALSE);
+
+  g_list_free_full (source_files, g_object_unref);
+
+  return compressor;
+}
+
+/* Creates a compressor which writes the input directory to @destination
+ * with @write_mode */
+static AutoarCompressor *
+create_test_append_compressor_new (CreateTest      *create_test,
+                                   GFile           *destination,
+                                   AutoarFormat     format,
+                                   AutoarWriteMode  write_mode)
+{
+  GList *source_files;
+  AutoarCompressor *compressor;
+
+  source_files = g_list_prepend (NULL, g_object_ref (create_test->input));
+
+  compressor = autoar_compressor_new (source_files, destination,
+                                      format, AUTOAR_FILTER_NONE, FALSE);
+  autoar_compressor_set_output_is_dest (compressor, TRUE);
+  autoar_compressor_set_write_mode (compressor, write_mode);
+
+  g_list_free_full (source_files, g_object_unref);
+
+  return compressor;
+}
+
+static CreateTestData *
+create_test_compress_cancellable (AutoarCompressor *compressor,
+                                  GCancellable     *cancellable)
+{
+  CreateTestData *data;
+
+  data = g_new0 (CreateTestData, 1);
+
+  g_signal_connect (compressor, "decide-dest",
+                    G_CALLBACK (compressor_decide_dest_cb), data);
+  g_signal_connect (compressor, "error",
+                    G_CALLBACK (compressor_error_cb), data);
+  g_signal_connect (compressor, "completed",
+                    G_CALLBACK (compressor_completed_cb), data);
+  g_signal_connect (compressor, "cancelled",
+                    G_CALLBACK (compressor_cancelled_cb), data);
+
+  autoar_compressor_start (compressor, cancellable);
+
+  return data;
+}
+
+static CreateTestData *
+create_test_compress (AutoarCompressor *compressor)
+{
+  return create_test_compress_cancellable (compressor, NULL);
+}
+
+static void
+extractor_error_cb (AutoarExtractor *extractor,
+                    GError          *error,
+                    gpointer         user_data)
+{
+  GError **error_out = user_data;
+
+  *error_out = g_error_copy (error);
+}
+
+/* Extracts @archive to the extracted directory, below which the input
+ * directory is expected to be recreated */
+static void
+create_test_extract (CreateTest *create_test,
+                     GFile      *archive)
+{
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GError) error = NULL;
+
+  extractor = autoar_extractor_new (archive, create_test->extracted);
+  autoar_extractor_set_output_is_dest (extractor, TRUE);
+
+  g_signal_connect (extractor, "error",
+                    G_CALLBACK (extractor_error_cb), &error);
+
+  autoar_extractor_start (extractor, NULL);
+
+  g_assert_no_error (error);
+}
+
+static void
+assert_directories_match (GFile *expected,
+                          GFile *actual)
+{
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+  g_autoptr (GError) error = NULL;
+  GFileInfo *info;
+  guint n_expected = 0;
+  guint n_actual = 0;
+
+  enumerator = g_file_enumerate_children (expected,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                          G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, &error);
+  g_assert_no_error (error);
+
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+    g_autoptr (GFile) expected_child = NULL;
+    g_autoptr (GFile) actual_child = NULL;
+    g_autoptr (GFileInfo) actual_info = NULL;
+
+    expected_child = g_file_get_child (expected, g_file_info_get_name (info));
+    actual_child = g_file_get_child (actual, g_file_info_get_name (info));
+
+    actual_info = g_file_query_info (actual_child,
+                                     G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                     G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                     NULL, &error);
+    g_assert_no_error (error);
+    if (actual_info == NULL) {
+      g_object_unref (info);
+      continue;
+    }
+
+    g_assert_cmpint (g_file_info_get_file_type (actual_info), ==,
+                     g_file_info_get_file_type (info));
+
+    switch (g_file_info_get_file_type (info)) {
+      case G_FILE_TYPE_DIRECTORY:
+        assert_directories_match (expected_child, actual_child);
+        break;
+
+      case G_FILE_TYPE_SYMBOLIC_LINK:
+        g_assert_cmpstr (g_file_info_get_symlink_target (actual_info), ==,
+                         g_file_info_get_symlink_target (info));
+        break;
+
+      default:
+        {
+          g_autofree char *expected_contents = NULL;
+          g_autofree char *actual_contents = NULL;
+          gsize expected_size, actual_size;
+
+          g_file_load_contents (expected_child, NULL,
+                                &expected_contents, &expected_size,
+                                NULL, &error);
+          g_assert_no_error (error);
+          g_file_load_contents (actual_child, NULL,
+                                &actual_contents, &actual_size,
+                                NULL, &error);
+          g_assert_no_error (error);
+
+          g_assert_cmpmem (actual_contents, actual_size,
+                           expected_contents, expected_size);
+        }
+        break;
+    }
+
+    n_expected++;
+    g_object_unref (info);
+  }
+
+  g_clear_object (&enumerator);
+  enumerator = g_file_enumerate_children (actual,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, &error);
+  g_assert_no_error (error);
+
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+    n_actual++;
+    g_object_unref (info);
+  }
+
+  g_assert_cmpuint (n_actual, ==, n_expected);
+}
+
+/* Extracts @archive and compares the result with the input directory */
+static void
+assert_round_trip (CreateTest *create_test,
+                   GFile      *archive)
+{
+  g_autoptr (GFile) extracted_input = NULL;
+
+  create_test_extract (create_test, archive);
+
+  extracted_input = g_file_get_child (create_test->extracted, "input");
+  assert_directories_match (create_test->input, extracted_input);
+}
+
+static void
+test_parallel_gzip (void)
+{
+  /* input
+   * ├── large.txt
+   * ├── nested
+   * │   └── small.txt
+   * └── empty.txt
+   *
+   * large.txt is split into many chunks by AutoarEncoder
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GFile) empty = NULL;
+  g_autoptr (GInputStream) istream = NULL;
+  g_autoptr (GZlibDecompressor) decompressor = NULL;
+  g_autoptr (GInputStream) zstream = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+  char buffer[64 * 1024];
+  guint64 total_size = 0;
+  gssize read_size;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (3 * 1024 * 1024, 1);
+  large = create_test_write_file (create_test, "large.txt", text, 3 * 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+  empty = create_test_write_file (create_test, "empty.txt", "", 0);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_threads (compressor, 4);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_nonnull (data->destination);
+
+  /* The concatenated chunks must be a single valid gzip member for zlib */
+  istream = G_INPUT_STREAM (g_file_read (data->destination, NULL, &error));
+  g_assert_no_error (error);
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  zstream = g_converter_input_stream_new (istream, G_CONVERTER (decompressor));
+
+  while ((read_size = g_input_stream_read (zstream, buffer, sizeof (buffer),
+                                           NULL, &error)) > 0)
+    total_size += read_size;
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (total_size, >, 3 * 1024 * 1024);
+  g_assert_cmpuint (total_size % 512, ==, 0);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+/* Returns the offset of the local header of @name in the zip archive
+ * @data, or -1 */
+static gssize
+find_local_header (const guint8 *data,
+                   gsize         size,
+                   const char   *name)
+{
+  gsize name_size = strlen (name);
+  gsize i;
+
+  for (i = 0; i + 30 + name_size <= size; i++) {
+    if (memcmp (data + i, "PK\3\4", 4) == 0 &&
+        (gsize) (data[i + 26] | data[i + 27] << 8) == name_size &&
+        memcmp (data + i + 30, name, name_size) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+static void
+test_zip_deflated (void)
+{
+  /* input
+   * ├── large.txt
+   * └── nested
+   *     └── small.txt
+   *
+   * large.txt is deflated in chunks by AutoarZipWriter
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (3 * 1024 * 1024, 2);
+  large = create_test_write_file (create_test, "large.txt", text, 3 * 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_ZIP,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_cmpuint (autoar_compressor_get_stored_files (compressor), ==, 0);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_zip_stored (void)
+{
+  /* input
+   * ├── photo.jpg
+   * ├── icon.png
+   * └── notes.txt
+   *
+   * photo.jpg is stored in chunks, icon.png as a whole
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) photo = NULL;
+  g_autoptr (GFile) icon = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree guint8 *photo_data = NULL;
+  g_autofree guint8 *icon_data = NULL;
+  g_autofree char *contents = NULL;
+  const guint8 *header;
+  gsize size;
+  gssize offset;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  photo_data = generate_random (3 * 1024 * 1024, 3);
+  photo = create_test_write_file (create_test, "photo.jpg", photo_data, 3 * 1024 * 1024);
+  icon_data = generate_random (1000, 4);
+  icon = create_test_write_file (create_test, "icon.png", icon_data, 1000);
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_ZIP,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+  autoar_compressor_set_store_detection (compressor,
+                                         AUTOAR_STORE_DETECTION_EXTENSION);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_cmpuint (autoar_compressor_get_stored_files (compressor), ==, 2);
+
+  /* Stored data can't be read without its sizes in the local header */
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+
+  offset = find_local_header ((guint8 *) contents, size, "input/photo.jpg");
+  g_assert_cmpint (offset, >=, 0);
+  header = (guint8 *) contents + offset;
+
+  g_assert_cmpuint (header[6] & (1 << 3), ==, 0);
+  g_assert_cmpuint (header[8] | header[9] << 8, ==, 0);
+  g_assert_cmpuint (header[30 + 15] | header[30 + 15 + 1] << 8, ==, 0x0001);
+  g_assert_cmpuint (header[30 + 15 + 4] | header[30 + 15 + 5] << 8 |
+                    header[30 + 15 + 6] << 16, ==, 3 * 1024 * 1024);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_zip_store_detection (void)
+{
+  /* input
+   * ├── image.dat
+   * ├── noise.bin
+   * ├── short.bin
+   * └── notes.txt
+   *
+   * image.dat starts with the signature of PNG and noise.bin is random, so
+   * both are stored. short.bin is too short to measure its entropy.
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) image = NULL;
+  g_autoptr (GFile) noise = NULL;
+  g_autoptr (GFile) short_noise = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *image_data = NULL;
+  g_autofree guint8 *noise_data = NULL;
+  g_autofree guint8 *short_data = NULL;
+  g_autofree char *text = NULL;
+  g_autofree char *contents = NULL;
+  gsize size;
+  gssize offset;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  image_data = generate_text (64 * 1024, 6);
+  memcpy (image_data, "\x89PNG\r\n\x1a\n", 8);
+  image = create_test_write_file (create_test, "image.dat", image_data, 64 * 1024);
+  noise_data = generate_random (64 * 1024, 7);
+  noise = create_test_write_file (create_test, "noise.bin", noise_data, 64 * 1024);
+  short_data = generate_random (1000, 8);
+  short_noise = create_test_write_file (create_test, "short.bin", short_data, 1000);
+  text = generate_text (64 * 1024, 9);
+  notes = create_test_write_file (create_test, "notes.txt", text, 64 * 1024);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_ZIP,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_store_detection (compressor,
+                                         AUTOAR_STORE_DETECTION_MAGIC |
+                                         AUTOAR_STORE_DETECTION_ENTROPY);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_cmpuint (autoar_compressor_get_stored_files (compressor), ==, 2);
+
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The compression method of each local header */
+  offset = find_local_header ((guint8 *) contents, size, "input/image.dat");
+  g_assert_cmpint (offset, >=, 0);
+  g_assert_cmpuint (contents[offset + 8], ==, 0);
+  offset = find_local_header ((guint8 *) contents, size, "input/noise.bin");
+  g_assert_cmpint (offset, >=, 0);
+  g_assert_cmpuint (contents[offset + 8], ==, 0);
+  offset = find_local_header ((guint8 *) contents, size, "input/short.bin");
+  g_assert_cmpint (offset, >=, 0);
+  g_assert_cmpuint (contents[offset + 8], ==, 8);
+  offset = find_local_header ((guint8 *) contents, size, "input/notes.txt");
+  g_assert_cmpint (offset, >=, 0);
+  g_assert_cmpuint (contents[offset + 8], ==, 8);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_zip_zip64 (void)
+{
+  /* input
+   * └── notes.txt
+   * many
+   * ├── 00000.txt
+   * ├── ...
+   * └── 69999.txt
+   *
+   * There are too many entries for the end of central directory record
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+  guint i;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_ZIP,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+
+  for (i = 0; i < 70000; i++) {
+    g_autofree char *pathname = g_strdup_printf ("many/%05u.txt", i);
+    g_autoptr (GBytes) contents = NULL;
+
+    contents = g_bytes_new_take (g_strdup_printf ("%05u\n", i), 6);
+    autoar_compressor_add_bytes (compressor, pathname, contents, NULL);
+  }
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  extractor = autoar_extractor_new (data->destination, create_test->extracted);
+
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (index), ==, 70002);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor, "many/69999.txt",
+                                             0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   "69999\n", 6);
+}
+
+static void
+test_zip_append (void)
+{
+  /* input
+   * ├── first.txt
+   * └── large.txt, added by the second compressor
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) append_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) append_data = NULL;
+  g_autoptr (GFile) first = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_ZIP,
+                                           AUTOAR_FILTER_NONE);
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  /* Only the new file is in the input while appending */
+  g_file_delete (first, NULL, &error);
+  g_assert_no_error (error);
+  text = generate_text (3 * 1024 * 1024, 5);
+  large = create_test_write_file (create_test, "large.txt", text, 3 * 1024 * 1024);
+
+  append_compressor =
+    create_test_append_compressor_new (create_test, data->destination,
+                                       AUTOAR_FORMAT_ZIP,
+                                       AUTOAR_WRITE_MODE_APPEND);
+  autoar_compressor_set_threads (append_compressor, 4);
+
+  append_data = create_test_compress (append_compressor);
+
+  g_assert_no_error (append_data->error);
+  g_assert_true (append_data->completed_signalled);
+
+  g_clear_object (&first);
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+/* Counts the entries of @archive whose path is @path */
+static guint
+count_entries (GFile      *archive,
+               const char *path)
+{
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (GFile) output = NULL;
+  g_autoptr (GError) error = NULL;
+  guint count = 0;
+  guint i;
+
+  output = g_file_get_parent (archive);
+  extractor = autoar_extractor_new (archive, output);
+
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < autoar_archive_index_get_n_entries (index); i++) {
+    if (g_strcmp0 (autoar_archive_index_get_entry_path (index, i), path) == 0)
+      count++;
+  }
+
+  return count;
+}
+
+static void
+test_append (AutoarFormat format)
+{
+  /* input
+   * ├── first.txt
+   * ├── second.txt, added by the second compressor
+   * └── nested
+   *     └── third.txt, added by the second compressor
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) append_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) append_data = NULL;
+  g_autoptr (GFile) first = NULL;
+  g_autoptr (GFile) second = NULL;
+  g_autoptr (GFile) third = NULL;
+  g_autoptr (GError) error = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, format,
+                                           AUTOAR_FILTER_NONE);
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  /* Only the new files are in the input while appending */
+  g_file_delete (first, NULL, &error);
+  g_assert_no_error (error);
+  second = create_test_write_file (create_test, "second.txt", "AutoarAppend\n", 13);
+  third = create_test_write_file (create_test, "nested/third.txt", "AutoarNested\n", 13);
+
+  append_compressor =
+    create_test_append_compressor_new (create_test, data->destination,
+                                       format, AUTOAR_WRITE_MODE_APPEND);
+  append_data = create_test_compress (append_compressor);
+
+  g_assert_no_error (append_data->error);
+  g_assert_true (append_data->completed_signalled);
+
+  /* The entries after an end marker which was left would not be listed */
+  g_assert_cmpuint (count_entries (data->destination, "input/first.txt"), ==, 1);
+  g_assert_cmpuint (count_entries (data->destination, "input/nested/third.txt"), ==, 1);
+
+  g_clear_object (&first);
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_append_pax (void)
+{
+  test_append (AUTOAR_FORMAT_PAX);
+}
+
+static void
+test_append_cpio (void)
+{
+  test_append (AUTOAR_FORMAT_CPIO);
+}
+
+static void
+test_append_cancelled (AutoarFormat format)
+{
+  /* input
+   * ├── first.txt
+   * └── many
+   *     └── file-*.bin, added by the cancelled compressor
+   *
+   * The appended entries overwrite the end of the archive, like the
+   * central directory of zip archives, which is written back once they
+   * are cancelled
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) append_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) append_data = NULL;
+  g_autoptr (GCancellable) cancellable = NULL;
+  g_autoptr (GFile) first = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *contents = NULL;
+  g_autofree char *appended_contents = NULL;
+  gsize size, appended_size;
+  guint i;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, format,
+                                           AUTOAR_FILTER_NONE);
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Only the new files are in the input while appending */
+  g_file_delete (first, NULL, &error);
+  g_assert_no_error (error);
+  for (i = 0; i < 200; i++) {
+    g_autofree char *path = g_strdup_printf ("many/file-%u.bin", i);
+    g_autofree guint8 *random = generate_random (64 * 1024, i);
+    g_autoptr (GFile) file = NULL;
+
+    file = create_test_write_file (create_test, path, random, 64 * 1024);
+  }
+
+  append_compressor =
+    create_test_append_compressor_new (create_test, data->destination,
+                                       format, AUTOAR_WRITE_MODE_APPEND);
+  autoar_compressor_set_threads (append_compressor, 4);
+  autoar_compressor_set_notify_interval (append_compressor, 0);
+
+  cancellable = g_cancellable_new ();
+  g_signal_connect (append_compressor, "progress",
+                    G_CALLBACK (compressor_cancel_progress_cb), cancellable);
+
+  append_data = create_test_compress_cancellable (append_compressor,
+                                                  cancellable);
+
+  g_assert_no_error (append_data->error);
+  g_assert_true (append_data->cancelled_signalled);
+  g_assert_false (append_data->completed_signalled);
+
+  g_file_load_contents (data->destination, NULL,
+                        &appended_contents, &appended_size, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (appended_contents, appended_size, contents, size);
+
+  g_assert_cmpuint (count_entries (data->destination, "input/first.txt"), ==, 1);
+}
+
+static void
+test_append_cancelled_pax (void)
+{
+  test_append_cancelled (AUTOAR_FORMAT_PAX);
+}
+
+static void
+test_append_cancelled_zip (void)
+{
+  test_append_cancelled (AUTOAR_FORMAT_ZIP);
+}
+
+/* Checks whether @path was extracted below the extracted directory */
+static void
+assert_extracted (CreateTest *create_test,
+                  const char *path,
+                  gboolean    extracted)
+{
+  g_autoptr (GFile) file = NULL;
+
+  file = g_file_resolve_relative_path (create_test->extracted, path);
+  if (extracted)
+    g_assert_true (g_file_query_exists (file, NULL));
+  else
+    g_assert_false (g_file_query_exists (file, NULL));
+}
+
+static void
+test_exclude (void)
+{
+  /* input
+   * ├── keep.txt
+   * ├── object.o, excluded by a pattern
+   * ├── build, excluded by a pattern
+   * │   └── out.txt
+   * ├── cache, tagged as a cache
+   * │   ├── CACHEDIR.TAG
+   * │   └── data.bin
+   * ├── .gitignore, listing secret.txt and logs/
+   * ├── secret.txt
+   * ├── logs
+   * │   └── log.txt
+   * └── nested
+   *     ├── .gitignore, listing *.tmp and !secret.txt
+   *     ├── scratch.tmp
+   *     └── secret.txt
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) tag_file = NULL;
+  g_autoptr (GFile) ignore_file = NULL;
+  g_autoptr (GFile) nested_ignore_file = NULL;
+  const char * const paths[] = {
+    "keep.txt",
+    "object.o",
+    "build/out.txt",
+    "cache/data.bin",
+    "secret.txt",
+    "logs/log.txt",
+    "nested/scratch.tmp",
+    "nested/secret.txt",
+  };
+  const char tag[] = "Signature: 8a477f597d28d172789f06886806bc55\n";
+  const char ignore[] = "secret.txt\nlogs/\n";
+  const char nested_ignore[] = "*.tmp\n!secret.txt\n";
+  guint i;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (paths); i++) {
+    g_autoptr (GFile) file = NULL;
+
+    file = create_test_write_file (create_test, paths[i], "AutoarCreate\n", 13);
+  }
+  tag_file = create_test_write_file (create_test, "cache/CACHEDIR.TAG",
+                                     tag, strlen (tag));
+  ignore_file = create_test_write_file (create_test, ".gitignore",
+                                        ignore, strlen (ignore));
+  nested_ignore_file = create_test_write_file (create_test, "nested/.gitignore",
+                                               nested_ignore, strlen (nested_ignore));
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_add_exclude_pattern (compressor, "*.o");
+  autoar_compressor_add_exclude_pattern (compressor, "/build/");
+  autoar_compressor_set_exclude_caches (compressor, TRUE);
+  autoar_compressor_set_ignore_file_name (compressor, ".gitignore");
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  create_test_extract (create_test, data->destination);
+
+  assert_extracted (create_test, "input/keep.txt", TRUE);
+  assert_extracted (create_test, "input/object.o", FALSE);
+  assert_extracted (create_test, "input/build", FALSE);
+  assert_extracted (create_test, "input/cache/CACHEDIR.TAG", TRUE);
+  assert_extracted (create_test, "input/cache/data.bin", FALSE);
+  assert_extracted (create_test, "input/.gitignore", TRUE);
+  assert_extracted (create_test, "input/secret.txt", FALSE);
+  assert_extracted (create_test, "input/logs", FALSE);
+  assert_extracted (create_test, "input/nested/.gitignore", TRUE);
+  assert_extracted (create_test, "input/nested/scratch.tmp", FALSE);
+  assert_extracted (create_test, "input/nested/secret.txt", TRUE);
+}
+
+static void
+test_include (void)
+{
+  /* input
+   * ├── top.txt
+   * ├── top.png
+   * └── docs
+   *     ├── readme.md
+   *     ├── empty
+   *     └── deep
+   *         └── deep.txt
+   *
+   * Only the text files are included, but the directories are kept
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) top_txt = NULL;
+  g_autoptr (GFile) top_png = NULL;
+  g_autoptr (GFile) readme = NULL;
+  g_autoptr (GFile) empty = NULL;
+  g_autoptr (GFile) deep = NULL;
+  g_autoptr (GError) error = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  top_txt = create_test_write_file (create_test, "top.txt", "AutoarCreate\n", 13);
+  top_png = create_test_write_file (create_test, "top.png", "AutoarCreate\n", 13);
+  readme = create_test_write_file (create_test, "docs/readme.md", "AutoarCreate\n", 13);
+  deep = create_test_write_file (create_test, "docs/deep/deep.txt", "AutoarCreate\n", 13);
+  empty = g_file_resolve_relative_path (create_test->input, "docs/empty");
+  g_file_make_directory (empty, NULL, &error);
+  g_assert_no_error (error);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_add_include_pattern (compressor, "*.txt");
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  create_test_extract (create_test, data->destination);
+
+  assert_extracted (create_test, "input/top.txt", TRUE);
+  assert_extracted (create_test, "input/top.png", FALSE);
+  assert_extracted (create_test, "input/docs/readme.md", FALSE);
+  assert_extracted (create_test, "input/docs/empty", TRUE);
+  assert_extracted (create_test, "input/docs/deep/deep.txt", TRUE);
+}
+
+static void
+test_update (void)
+{
+  /* input
+   * ├── first.txt, which isn't appended again
+   * └── second.txt, added by the second compressor
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) update_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) update_data = NULL;
+  g_autoptr (GFile) first = NULL;
+  g_autoptr (GFile) second = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  first = create_test_write_file (create_test, "first.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  second = create_test_write_file (create_test, "second.txt", "AutoarUpdate\n", 13);
+
+  update_compressor =
+    create_test_append_compressor_new (create_test, data->destination,
+                                       AUTOAR_FORMAT_PAX,
+                                       AUTOAR_WRITE_MODE_UPDATE);
+  update_data = create_test_compress (update_compressor);
+
+  g_assert_no_error (update_data->error);
+  g_assert_true (update_data->completed_signalled);
+
+  g_assert_cmpuint (count_entries (data->destination, "input/first.txt"), ==, 1);
+  g_assert_cmpuint (count_entries (data->destination, "input/second.txt"), ==, 1);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_incremental (void)
+{
+  /* input
+   * ├── unchanged.txt, only in the full archive
+   * ├── changed.txt
+   * ├── removed.txt, listed as deleted by the incremental archive
+   * └── new.txt, added before the incremental archive
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) incremental_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) incremental_data = NULL;
+  g_autoptr (GFile) snapshot = NULL;
+  g_autoptr (GFile) unchanged = NULL;
+  g_autoptr (GFile) changed = NULL;
+  g_autoptr (GFile) removed = NULL;
+  g_autoptr (GFile) new_file = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GBytes) snapshot_bytes = NULL;
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GVariant) swapped = NULL;
+  g_autoptr (GBytes) deleted = NULL;
+  g_autoptr (GError) error = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  snapshot = g_file_get_child (create_test->work_directory, "snapshot");
+  unchanged = create_test_write_file (create_test, "unchanged.txt", "AutoarCreate\n", 13);
+  changed = create_test_write_file (create_test, "changed.txt", "AutoarCreate\n", 13);
+  removed = create_test_write_file (create_test, "removed.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_snapshot_file (compressor, snapshot);
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_cmpuint (count_entries (data->destination, "input/unchanged.txt"), ==, 1);
+
+  g_file_delete (data->destination, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The snapshot is read back on a machine of the other byte order */
+  snapshot_bytes = g_file_load_bytes (snapshot, NULL, NULL, &error);
+  g_assert_no_error (error);
+  variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("(uua(sutxxx))"),
+                                      snapshot_bytes, FALSE);
+  swapped = g_variant_byteswap (variant);
+  g_file_replace_contents (snapshot,
+                           g_variant_get_data (swapped),
+                           g_variant_get_size (swapped),
+                           NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  g_clear_object (&changed);
+  changed = create_test_write_file (create_test, "changed.txt", "AutoarIncremental\n", 18);
+  g_file_delete (removed, NULL, &error);
+  g_assert_no_error (error);
+  new_file = create_test_write_file (create_test, "new.txt", "AutoarNew\n", 10);
+
+  incremental_compressor =
+    create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                AUTOAR_FILTER_NONE);
+  autoar_compressor_set_snapshot_file (incremental_compressor, snapshot);
+  incremental_data = create_test_compress (incremental_compressor);
+
+  g_assert_no_error (incremental_data->error);
+  g_assert_true (incremental_data->completed_signalled);
+
+  g_assert_cmpuint (count_entries (incremental_data->destination, "input/unchanged.txt"), ==, 0);
+  g_assert_cmpuint (count_entries (incremental_data->destination, "input/changed.txt"), ==, 1);
+  g_assert_cmpuint (count_entries (incremental_data->destination, "input/new.txt"), ==, 1);
+
+  extractor = autoar_extractor_new (incremental_data->destination,
+                                    create_test->extracted);
+  deleted = autoar_extractor_read_entry_bytes (extractor, ".autoar-deleted",
+                                               0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (g_bytes_get_data (deleted, NULL), g_bytes_get_size (deleted),
+                   "input/removed.txt", sizeof ("input/removed.txt"));
+}
+
+/* Returns the volume @number of @archive, like "archive.tar.001" */
+static GFile *
+get_volume (GFile *archive,
+            guint  number)
+{
+  g_autoptr (GFile) parent = NULL;
+  g_autofree char *basename = NULL;
+  g_autofree char *volume_basename = NULL;
+
+  parent = g_file_get_parent (archive);
+  basename = g_file_get_basename (archive);
+  volume_basename = g_strdup_printf ("%s.%03u", basename, number);
+
+  return g_file_get_child (parent, volume_basename);
+}
+
+static void
+test_volumes (AutoarFormat format,
+              AutoarFilter filter)
+{
+  /* input
+   * ├── photo.bin
+   * └── nested
+   *     └── small.txt
+   *
+   * photo.bin can't be compressed, so the archive spans 4 volumes of 1 MiB
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) photo = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GFile) first_volume = NULL;
+  g_autoptr (GFile) last_volume = NULL;
+  g_autoptr (GFile) next_volume = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree guint8 *photo_data = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  photo_data = generate_random (3 * 1024 * 1024, 10);
+  photo = create_test_write_file (create_test, "photo.bin", photo_data, 3 * 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, format, filter);
+  autoar_compressor_set_volume_size (compressor, 1024 * 1024);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  /* Only the volumes are written */
+  g_assert_false (g_file_query_exists (data->destination, NULL));
+
+  first_volume = get_volume (data->destination, 1);
+  info = g_file_query_info (first_volume, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_file_info_get_size (info), ==, 1024 * 1024);
+
+  last_volume = get_volume (data->destination, 4);
+  g_assert_true (g_file_query_exists (last_volume, NULL));
+  next_volume = get_volume (data->destination, 5);
+  g_assert_false (g_file_query_exists (next_volume, NULL));
+
+  assert_round_trip (create_test, first_volume);
+}
+
+static void
+test_volumes_tar (void)
+{
+  test_volumes (AUTOAR_FORMAT_PAX, AUTOAR_FILTER_GZIP);
+}
+
+static void
+test_volumes_zip (void)
+{
+  test_volumes (AUTOAR_FORMAT_ZIP, AUTOAR_FILTER_NONE);
+}
+
+static void
+test_deduplicate (void)
+{
+  /* input
+   * ├── a.bin
+   * ├── copy
+   * │   └── b.bin, with the data of a.bin
+   * ├── c.bin, of the same size as a.bin
+   * └── notes.txt
+   *
+   * b.bin is archived as a hard link to a.bin, or the other way around
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) a = NULL;
+  g_autoptr (GFile) b = NULL;
+  g_autoptr (GFile) c = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree guint8 *a_data = NULL;
+  g_autofree guint8 *c_data = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  a_data = generate_random (64 * 1024, 11);
+  a = create_test_write_file (create_test, "a.bin", a_data, 64 * 1024);
+  b = create_test_write_file (create_test, "copy/b.bin", a_data, 64 * 1024);
+  c_data = generate_random (64 * 1024, 12);
+  c = create_test_write_file (create_test, "c.bin", c_data, 64 * 1024);
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_deduplicate (compressor, TRUE);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  /* The data of a.bin and b.bin is only stored once */
+  info = g_file_query_info (data->destination, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_file_info_get_size (info), <, 3 * 64 * 1024);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_rsyncable (void)
+{
+  /* input
+   * └── large.txt, edited in its middle before the second archive
+   *
+   * Only the chunks around the edit are compressed differently
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (AutoarCompressor) edited_compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (CreateTestData) edited_data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+  g_autofree char *edit = NULL;
+  g_autofree char *contents = NULL;
+  g_autofree char *edited_contents = NULL;
+  gsize size, edited_size, prefix, suffix;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (4 * 1024 * 1024, 13);
+  large = create_test_write_file (create_test, "large.txt", text, 4 * 1024 * 1024);
+
+  /* The times of the headers must not change with the edit */
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_rsyncable (compressor, TRUE);
+  autoar_compressor_set_reproducible (compressor, TRUE);
+  autoar_compressor_set_source_date_epoch (compressor, 1000000000);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+  g_file_delete (data->destination, NULL, &error);
+  g_assert_no_error (error);
+
+  edit = generate_text (100, 14);
+  memcpy (text + 2 * 1024 * 1024, edit, 100);
+  g_clear_object (&large);
+  large = create_test_write_file (create_test, "large.txt", text, 4 * 1024 * 1024);
+
+  edited_compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                                  AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_rsyncable (edited_compressor, TRUE);
+  autoar_compressor_set_reproducible (edited_compressor, TRUE);
+  autoar_compressor_set_source_date_epoch (edited_compressor, 1000000000);
+
+  edited_data = create_test_compress (edited_compressor);
+
+  g_assert_no_error (edited_data->error);
+  g_assert_true (edited_data->completed_signalled);
+
+  g_file_load_contents (edited_data->destination, NULL,
+                        &edited_contents, &edited_size, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The trailer of gzip has the CRC-32 of the whole input */
+  g_assert_cmpuint (size, >, 8);
+  g_assert_cmpuint (edited_size, >, 8);
+  size -= 8;
+  edited_size -= 8;
+
+  for (prefix = 0; prefix < MIN (size, edited_size); prefix++) {
+    if (contents[prefix] != edited_contents[prefix])
+      break;
+  }
+  for (suffix = 0; suffix < MIN (size, edited_size) - prefix; suffix++) {
+    if (contents[size - suffix - 1] != edited_contents[edited_size - suffix - 1])
+      break;
+  }
+
+  /* Only the edited chunk and the next one, whose dictionary changed,
+   * differ */
+  g_assert_cmpuint (prefix, >, 64 * 1024);
+  g_assert_cmpuint (suffix, >, 64 * 1024);
+  g_assert_cmpuint (MAX (size, edited_size) - prefix - suffix, <, 256 * 1024);
+
+  assert_round_trip (create_test, edited_data->destination);
+}
+
+/* Compresses the input directory reproducibly with @threads, and returns
+ * the archive, which is deleted */
+static GBytes *
+create_test_compress_reproducible (CreateTest *create_test,
+                                   guint       threads)
+{
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_reproducible (compressor, TRUE);
+  autoar_compressor_set_source_date_epoch (compressor, 1000000000);
+  autoar_compressor_set_threads (compressor, threads);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  bytes = g_file_load_bytes (data->destination, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_file_delete (data->destination, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_steal_pointer (&bytes);
+}
+
+static void
+test_reproducible_threads (void)
+{
+  /* input
+   * ├── large.txt
+   * └── nested
+   *     └── small.txt
+   *
+   * The archive is the same whatever the number of threads
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GBytes) single = NULL;
+  g_autoptr (GBytes) parallel = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (1024 * 1024, 15);
+  large = create_test_write_file (create_test, "large.txt", text, 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  single = create_test_compress_reproducible (create_test, 1);
+  parallel = create_test_compress_reproducible (create_test, 4);
+
+  g_assert_cmpmem (g_bytes_get_data (single, NULL), g_bytes_get_size (single),
+                   g_bytes_get_data (parallel, NULL), g_bytes_get_size (parallel));
+}
+
+static void
+test_sparse (void)
+{
+  /* input
+   * ├── disk.img
+   * ├── holes.img
+   * └── notes.txt
+   *
+   * disk.img has data at its start and in its middle, holes.img has none
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+  const goffset offsets[] = { 0, 8 * 1024 * 1024 };
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  if (!create_test_write_sparse (create_test, "disk.img", 16 * 1024 * 1024,
+                                 offsets, G_N_ELEMENTS (offsets)) ||
+      !create_test_write_sparse (create_test, "holes.img", 4 * 1024 * 1024,
+                                 NULL, 0)) {
+    g_test_skip ("The file system doesn't support sparse files");
+    return;
+  }
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  /* Neither the holes nor their zeros are in the archive */
+  info = g_file_query_info (data->destination, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_file_info_get_size (info), <, 1024 * 1024);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+/* Creates @n_files files and, unless @depth is 0, @n_dirs directories with
+ * the same contents in @directory */
+static void
+create_test_write_tree (CreateTest *create_test,
+                        const char *directory,
+                        guint       depth,
+                        guint       n_dirs,
+                        guint       n_files)
+{
+  guint i;
+
+  for (i = 0; i < n_files; i++) {
+    g_autoptr (GFile) file = NULL;
+    g_autofree char *path = NULL;
+    g_autofree char *text = NULL;
+    gsize size = (i * 37 + depth * 101) % 2000 + 1;
+
+    path = g_strdup_printf ("%s/file-%u.txt", directory, i);
+    text = generate_text (size, i + depth);
+    file = create_test_write_file (create_test, path, text, size);
+  }
+
+  for (i = 0; depth > 0 && i < n_dirs; i++) {
+    g_autofree char *path = NULL;
+
+    path = g_strdup_printf ("%s/dir-%u", directory, i);
+    create_test_write_tree (create_test, path, depth - 1, n_dirs, n_files);
+  }
+}
+
+/* Appends the paths of the entries below @directory, in the order of a
+ * sequential traversal, to @paths and their sizes to @size */
+static void
+walk_directory (GFile      *directory,
+                const char *path,
+                GPtrArray  *paths,
+                guint64    *size)
+{
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+  g_autoptr (GError) error = NULL;
+  GFileInfo *info;
+
+  enumerator = g_file_enumerate_children (directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                          G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, &error);
+  g_assert_no_error (error);
+
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL) {
+    char *child_path;
+
+    child_path = g_strconcat (path, "/", g_file_info_get_name (info), NULL);
+    g_ptr_array_add (paths, child_path);
+    *size += g_file_info_get_size (info);
+
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+      g_autoptr (GFile) child = NULL;
+
+      child = g_file_get_child (directory, g_file_info_get_name (info));
+      walk_directory (child, child_path, paths, size);
+    }
+
+    g_object_unref (info);
+  }
+  g_assert_no_error (error);
+}
+
+/* Checks that the entries of @archive are the ones of the input directory,
+ * in the order of a sequential traversal, and returns the size of the
+ * entries and their number */
+static void
+assert_traversal_order (CreateTest *create_test,
+                        GFile      *archive,
+                        guint64    *size,
+                        guint      *files)
+{
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GPtrArray) paths = NULL;
+  g_autoptr (GError) error = NULL;
+  guint i;
+
+  /* The source directory is the first entry */
+  paths = g_ptr_array_new_with_free_func (g_free);
+  info = g_file_query_info (create_test->input, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+  g_assert_no_error (error);
+  g_ptr_array_add (paths, g_strdup ("input"));
+  *size = g_file_info_get_size (info);
+  walk_directory (create_test->input, "input", paths, size);
+  *files = paths->len;
+
+  extractor = autoar_extractor_new (archive, create_test->extracted);
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (index), ==, paths->len);
+  for (i = 0; i < paths->len && i < autoar_archive_index_get_n_entries (index); i++) {
+    g_autofree char *path = NULL;
+
+    /* Directories may end with a slash */
+    path = g_strdup (autoar_archive_index_get_entry_path (index, i));
+    if (g_str_has_suffix (path, "/"))
+      path[strlen (path) - 1] = '\0';
+
+    g_assert_cmpstr (path, ==, paths->pdata[i]);
+  }
+}
+
+static void
+test_traversal_order (void)
+{
+  /* input
+   * ├── wide
+   * │   └── file-0.txt … file-999.txt
+   * └── deep
+   *     ├── file-0.txt … file-4.txt
+   *     └── dir-0 … dir-3, four levels deep with the same files
+   *
+   * The directories are listed by several threads, but their entries are
+   * archived in the order of a sequential traversal
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  guint64 size;
+  guint files;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  create_test_write_tree (create_test, "wide", 0, 0, 1000);
+  create_test_write_tree (create_test, "deep", 4, 4, 5);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  assert_traversal_order (create_test, data->destination, &size, &files);
+
+  g_assert_cmpuint (autoar_compressor_get_size (compressor), ==, size);
+  g_assert_cmpuint (autoar_compressor_get_files (compressor), ==, files);
+}
+
+static void
+test_read_order (AutoarReadOrder read_order)
+{
+  /* input
+   * └── deep
+   *     ├── file-0.txt … file-19.txt
+   *     └── dir-0 … dir-2, three levels deep with the same files
+   *
+   * The files are read in another order, but archived in the order of a
+   * sequential traversal
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  guint64 size;
+  guint files;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  create_test_write_tree (create_test, "deep", 3, 3, 20);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_read_order (compressor, read_order);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  assert_traversal_order (create_test, data->destination, &size, &files);
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_read_order_inode (void)
+{
+  test_read_order (AUTOAR_READ_ORDER_INODE);
+}
+
+static void
+test_read_order_extent (void)
+{
+  test_read_order (AUTOAR_READ_ORDER_EXTENT);
+}
+
+static void
+test_prefetch (void)
+{
+  /* input
+   * ├── large.bin, larger than the files which are read into memory
+   * └── small
+   *     └── file-0.txt … file-499.txt
+   *
+   * The budget only holds a few of the small files at once
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autofree guint8 *large_data = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  create_test_write_tree (create_test, "small", 0, 0, 500);
+  large_data = generate_random (3 * 1024 * 1024, 19);
+  large = create_test_write_file (create_test, "large.bin", large_data,
+                                  3 * 1024 * 1024);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+  autoar_compressor_set_in_flight_budget (compressor, 8 * 1024);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+/* Makes @path below the input directory a hard link to @target */
+static GFile *
+create_test_link (CreateTest *create_test,
+                  GFile      *target,
+                  const char *path)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFile) parent = NULL;
+
+  file = g_file_resolve_relative_path (create_test->input, path);
+  parent = g_file_get_parent (file);
+  g_file_make_directory_with_parents (parent, NULL, NULL);
+
+  g_assert_cmpint (link (g_file_peek_path (target), g_file_peek_path (file)), ==, 0);
+
+  return g_steal_pointer (&file);
+}
+
+static guint64
+get_inode (GFile *file)
+{
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GError) error = NULL;
+
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_UNIX_INODE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+}
+
+static void
+test_hard_links (AutoarFormat format)
+{
+  /* input
+   * ├── a.txt
+   * ├── nested
+   * │   └── b.txt, a hard link to a.txt
+   * └── notes.txt
+   *
+   * The link resolver writes the data once, the links are extracted as
+   * hard links again
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) a = NULL;
+  g_autoptr (GFile) b = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GFile) extracted_a = NULL;
+  g_autoptr (GFile) extracted_b = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (64 * 1024, 20);
+  a = create_test_write_file (create_test, "a.txt", text, 64 * 1024);
+  b = create_test_link (create_test, a, "nested/b.txt");
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, format,
+                                           AUTOAR_FILTER_NONE);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  assert_round_trip (create_test, data->destination);
+
+  extracted_a = g_file_resolve_relative_path (create_test->extracted, "input/a.txt");
+  extracted_b = g_file_resolve_relative_path (create_test->extracted, "input/nested/b.txt");
+  g_assert_cmpuint (get_inode (extracted_a), ==, get_inode (extracted_b));
+}
+
+static void
+test_hard_links_pax (void)
+{
+  test_hard_links (AUTOAR_FORMAT_PAX);
+}
+
+static void
+test_hard_links_cpio (void)
+{
+  test_hard_links (AUTOAR_FORMAT_CPIO);
+}
+
+static void
+test_hard_links_deferred (void)
+{
+  /* outside.txt
+   * input
+   * ├── c.txt, a hard link to outside.txt
+   * └── notes.txt
+   *
+   * newc cpio archives have the data of a file with its last link, so the
+   * entry of c.txt waits for a link which never comes. It is written with
+   * the data of c.txt when the link resolver is flushed at the end.
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) outside = NULL;
+  g_autoptr (GFile) c = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (64 * 1024, 21);
+  outside = g_file_get_child (create_test->work_directory, "outside.txt");
+  g_file_replace_contents (outside, text, 64 * 1024, NULL, FALSE,
+                           G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+  c = create_test_link (create_test, outside, "c.txt");
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_CPIO_NEWC,
+                                           AUTOAR_FILTER_NONE);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_to_stream (AutoarFormat  format,
+                AutoarFilter  filter,
+                const char   *extension)
+{
+  /* input
+   * ├── large.txt
+   * └── nested
+   *     └── small.txt
+   *
+   * The archive is written to a stream which can't seek, so the entries of
+   * zip archives which are compressed in chunks have data descriptors. The
+   * stream is flushed, but the caller closes it.
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GOutputStream) memory = NULL;
+  g_autoptr (GOutputStream) ostream = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+  g_autofree char *name = NULL;
+  GList *source_files;
+  const char *archive_data;
+  gsize archive_size;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (3 * 1024 * 1024, 30);
+  large = create_test_write_file (create_test, "large.txt", text, 3 * 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  memory = g_memory_output_stream_new_resizable ();
+  ostream = g_object_new (CREATE_TEST_TYPE_OUTPUT_STREAM,
+                          "base-stream", memory,
+                          NULL);
+
+  source_files = g_list_prepend (NULL, g_object_ref (create_test->input));
+  compressor = autoar_compressor_new_to_stream (source_files, ostream,
+                                                format, filter, FALSE);
+  g_list_free_full (source_files, g_object_unref);
+  autoar_compressor_set_threads (compressor, 4);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  g_assert_null (data->destination);
+
+  g_assert_cmpuint (CREATE_TEST_OUTPUT_STREAM (ostream)->n_flushes, >, 0);
+  g_assert_false (g_output_stream_is_closed (ostream));
+  g_assert_false (g_output_stream_is_closed (memory));
+
+  archive_data = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (memory));
+  archive_size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (memory));
+  g_assert_cmpuint (archive_size, >, 0);
+
+  if (format == AUTOAR_FORMAT_ZIP) {
+    gboolean found_descriptor = FALSE;
+    gsize i;
+
+    for (i = 0; i + 4 <= archive_size && !found_descriptor; i++)
+      found_descriptor = memcmp (archive_data + i, "PK\007\010", 4) == 0;
+    g_assert_true (found_descriptor);
+  }
+
+  name = g_strconcat ("output", extension, NULL);
+  archive = g_file_get_child (create_test->work_directory, name);
+  g_file_replace_contents (archive, archive_data, archive_size, NULL, FALSE,
+                           G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  assert_round_trip (create_test, archive);
+}
+
+static void
+test_to_stream_gzip (void)
+{
+  test_to_stream (AUTOAR_FORMAT_TAR, AUTOAR_FILTER_GZIP, ".tar.gz");
+}
+
+static void
+test_to_stream_zip (void)
+{
+  test_to_stream (AUTOAR_FORMAT_ZIP, AUTOAR_FILTER_NONE, ".zip");
+}
+
+/* Returns a copy of the header of the entry of @archive whose path is
+ * @path, read by libarchive */
+static struct archive_entry *
+read_entry_header (GFile      *archive,
+                   const char *path)
+{
+  struct archive *a;
+  struct archive_entry *entry;
+  struct archive_entry *found = NULL;
+
+  a = archive_read_new ();
+  archive_read_support_format_all (a);
+  archive_read_support_filter_all (a);
+  g_assert_cmpint (archive_read_open_filename (a, g_file_peek_path (archive),
+                                               10240), ==, ARCHIVE_OK);
+
+  while (found == NULL && archive_read_next_header (a, &entry) == ARCHIVE_OK) {
+    if (g_strcmp0 (archive_entry_pathname (entry), path) == 0)
+      found = archive_entry_clone (entry);
+  }
+
+  archive_read_free (a);
+
+  return found;
+}
+
+static void
+assert_entry_data (AutoarExtractor *extractor,
+                   const char      *path,
+                   const void      *data,
+                   gsize            size)
+{
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  bytes = autoar_extractor_read_entry_bytes (extractor, path, 0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (bytes);
+  if (bytes == NULL)
+    return;
+
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   data, size);
+}
+
+static void
+test_add_stream (AutoarFormat format)
+{
+  /* input
+   * └── notes.txt
+   * generated
+   * ├── large.bin, from a stream which is compressed in chunks
+   * ├── short.txt, from a stream with less data than its size
+   * └── long.txt, from a stream with more data than its size
+   *
+   * At most the given size is read from the streams. Tar archives store
+   * the size first, so the entries of short streams are padded with zeros.
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GInputStream) large_stream = NULL;
+  g_autoptr (GInputStream) short_stream = NULL;
+  g_autoptr (GInputStream) long_stream = NULL;
+  g_autofree guint8 *large = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, format,
+                                           AUTOAR_FILTER_NONE);
+  autoar_compressor_set_threads (compressor, 4);
+
+  large = generate_random (3 * 1024 * 1024, 40);
+  large_stream = g_memory_input_stream_new_from_data (large, 3 * 1024 * 1024, NULL);
+  autoar_compressor_add_stream (compressor, "generated/large.bin",
+                                large_stream, 3 * 1024 * 1024, NULL);
+
+  short_stream = g_memory_input_stream_new_from_data ("short", 5, NULL);
+  autoar_compressor_add_stream (compressor, "generated/short.txt",
+                                short_stream, 10, NULL);
+
+  long_stream = g_memory_input_stream_new_from_data ("long stream", 11, NULL);
+  autoar_compressor_add_stream (compressor, "generated/long.txt",
+                                long_stream, 4, NULL);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  extractor = autoar_extractor_new (data->destination, create_test->extracted);
+
+  assert_entry_data (extractor, "input/notes.txt", "AutoarCreate\n", 13);
+  assert_entry_data (extractor, "generated/large.bin", large, 3 * 1024 * 1024);
+  if (format == AUTOAR_FORMAT_ZIP)
+    assert_entry_data (extractor, "generated/short.txt", "short", 5);
+  else
+    assert_entry_data (extractor, "generated/short.txt", "short\0\0\0\0\0", 10);
+  assert_entry_data (extractor, "generated/long.txt", "long", 4);
+}
+
+static void
+test_add_stream_pax (void)
+{
+  test_add_stream (AUTOAR_FORMAT_PAX);
+}
+
+static void
+test_add_stream_zip (void)
+{
+  test_add_stream (AUTOAR_FORMAT_ZIP);
+}
+
+static void
+test_add_stream_info (void)
+{
+  /* The mode, owner and times of the entry are the ones of the info */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GBytes) contents = NULL;
+  struct archive_entry *entry;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+
+  info = g_file_info_new ();
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE, 0640);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, 1234);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, 5678);
+  g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER, "autoar");
+  g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP, "autoar-group");
+  g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED, 1000000000);
+  g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC, 500000);
+
+  contents = g_bytes_new_static ("AutoarCreate\n", 13);
+  autoar_compressor_add_bytes (compressor, "generated/report.txt", contents, info);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  entry = read_entry_header (data->destination, "generated/report.txt");
+  g_assert_nonnull (entry);
+  if (entry == NULL)
+    return;
+
+  g_assert_cmpint (archive_entry_filetype (entry), ==, AE_IFREG);
+  g_assert_cmpint (archive_entry_perm (entry), ==, 0640);
+  g_assert_cmpint (archive_entry_uid (entry), ==, 1234);
+  g_assert_cmpint (archive_entry_gid (entry), ==, 5678);
+  g_assert_cmpstr (archive_entry_uname (entry), ==, "autoar");
+  g_assert_cmpstr (archive_entry_gname (entry), ==, "autoar-group");
+  g_assert_cmpint (archive_entry_mtime (entry), ==, 1000000000);
+  g_assert_cmpint (archive_entry_mtime_nsec (entry), ==, 500000000);
+  g_assert_cmpint (archive_entry_size (entry), ==, 13);
+
+  archive_entry_free (entry);
+}
+
+static void
+test_add_stream_invalid_pathname (void)
+{
+  /* Paths which could be extracted outside of the destination are
+   * rejected */
+
+  const char * const pathnames[] = {
+    "",
+    "/absolute.txt",
+    "../parent.txt",
+    "nested/../../parent.txt",
+    "./current.txt",
+    "empty//component.txt",
+    "directory/",
+  };
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) notes = NULL;
+  g_autoptr (GBytes) contents = NULL;
+  guint i;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  notes = create_test_write_file (create_test, "notes.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_NONE);
+
+  contents = g_bytes_new_static ("AutoarCreate\n", 13);
+  for (i = 0; i < G_N_ELEMENTS (pathnames); i++) {
+    g_test_expect_message (NULL, G_LOG_LEVEL_CRITICAL,
+                           "*autoar_compressor_is_entry_pathname*");
+    autoar_compressor_add_bytes (compressor, pathnames[i], contents, NULL);
+    g_test_assert_expected_messages ();
+  }
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  g_assert_cmpuint (count_entries (data->destination, "input/notes.txt"), ==, 1);
+  for (i = 0; i < G_N_ELEMENTS (pathnames); i++)
+    g_assert_cmpuint (count_entries (data->destination, pathnames[i]), ==, 0);
+}
+
+/* Compresses the input directory at @level with @threads, and returns the
+ * archive, which is deleted */
+static GBytes *
+create_test_compress_level (CreateTest             *create_test,
+                            AutoarFormat            format,
+                            AutoarFilter            filter,
+                            AutoarCompressionLevel  level,
+                            guint                   threads)
+{
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  compressor = create_test_compressor_new (create_test, format, filter);
+  autoar_compressor_set_compression_level (compressor, level);
+  autoar_compressor_set_threads (compressor, threads);
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  bytes = g_file_load_bytes (data->destination, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  assert_round_trip (create_test, data->destination);
+
+  g_file_delete (data->destination, NULL, &error);
+  g_assert_no_error (error);
+  remove_directory (create_test->extracted);
+  g_file_make_directory (create_test->extracted, NULL, NULL);
+
+  return g_steal_pointer (&bytes);
+}
+
+static void
+test_compression_level (AutoarFormat format,
+                        AutoarFilter filter,
+                        guint        threads)
+{
+  /* input
+   * ├── large.txt
+   * └── nested
+   *     └── small.txt
+   *
+   * The tar archives are ustar, which has no access times, so only the level
+   * changes between the archives
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GBytes) fastest = NULL;
+  g_autoptr (GBytes) best = NULL;
+  g_autoptr (GBytes) standard = NULL;
+  g_autofree char *text = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (2 * 1024 * 1024, 17);
+  large = create_test_write_file (create_test, "large.txt", text, 2 * 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  fastest = create_test_compress_level (create_test, format, filter,
+                                        AUTOAR_COMPRESSION_LEVEL_FASTEST,
+                                        threads);
+  best = create_test_compress_level (create_test, format, filter,
+                                     AUTOAR_COMPRESSION_LEVEL_BEST, threads);
+  standard = create_test_compress_level (create_test, format, filter,
+                                         AUTOAR_COMPRESSION_LEVEL_DEFAULT,
+                                         threads);
+
+  g_assert_cmpuint (g_bytes_get_size (best), <, g_bytes_get_size (fastest));
+  g_assert_cmpuint (g_bytes_get_size (best), <=, g_bytes_get_size (standard));
+  g_assert_cmpuint (g_bytes_get_size (standard), <=, g_bytes_get_size (fastest));
+}
+
+static void
+test_compression_level_gzip (void)
+{
+  test_compression_level (AUTOAR_FORMAT_USTAR, AUTOAR_FILTER_GZIP, 1);
+}
+
+static void
+test_compression_level_gzip_threads (void)
+{
+  test_compression_level (AUTOAR_FORMAT_USTAR, AUTOAR_FILTER_GZIP, 4);
+}
+
+static void
+test_compression_level_zip (void)
+{
+  test_compression_level (AUTOAR_FORMAT_ZIP, AUTOAR_FILTER_NONE, 1);
+}
+
+static void
+test_compression_level_zip_threads (void)
+{
+  test_compression_level (AUTOAR_FORMAT_ZIP, AUTOAR_FILTER_NONE, 4);
+}
+
+static void
+test_compression_level_default (void)
+{
+  /* input
+   * └── large.txt
+   *
+   * The default level is the one of libarchive, 6 for gzip
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GBytes) standard = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+  g_autofree char *contents = NULL;
+  gsize size;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (1024 * 1024, 18);
+  large = create_test_write_file (create_test, "large.txt", text, 1024 * 1024);
+
+  standard = create_test_compress_level (create_test, AUTOAR_FORMAT_USTAR,
+                                         AUTOAR_FILTER_GZIP,
+                                         AUTOAR_COMPRESSION_LEVEL_DEFAULT, 1);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_USTAR,
+                                           AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_threads (compressor, 1);
+  autoar_compressor_set_filter_option (compressor, "compression-level", "6");
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The gzip header has the time of compression */
+  g_assert_cmpuint (size, ==, g_bytes_get_size (standard));
+  g_assert_cmpuint (size, >, 10);
+  g_assert_cmpmem (contents + 10, size - 10,
+                   (const char *) g_bytes_get_data (standard, NULL) + 10, size - 10);
+}
+
+/* Returns whether libarchive can write @filter by itself */
+static gboolean
+filter_is_supported (AutoarFilter filter)
+{
+  AutoarFilterFunc filter_func;
+  struct archive *a;
+  gboolean supported;
+
+  filter_func = autoar_filter_get_libarchive_write (filter);
+
+  a = archive_write_new ();
+  supported = (*filter_func)(a) == ARCHIVE_OK;
+  archive_write_free (a);
+
+  return supported;
+}
+
+static void
+test_filter (AutoarFilter  filter,
+             const char   *extension,
+             const char   *magic)
+{
+  /* input
+   * ├── large.txt
+   * └── nested
+   *     └── small.txt
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *text = NULL;
+  g_autofree char *basename = NULL;
+  g_autofree char *contents = NULL;
+  gsize size;
+
+  if (!filter_is_supported (filter)) {
+    g_test_skip ("libarchive can't write the filter");
+    return;
+  }
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  text = generate_text (1024 * 1024, 16);
+  large = create_test_write_file (create_test, "large.txt", text, 1024 * 1024);
+  small = create_test_write_file (create_test, "nested/small.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           filter);
+  autoar_compressor_set_filter_option (compressor, "compression-level", "1");
+
+  data = create_test_compress (compressor);
+
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  basename = g_file_get_basename (data->destination);
+  g_assert_true (g_str_has_suffix (basename, extension));
+
+  g_file_load_contents (data->destination, NULL, &contents, &size, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (size, >, 4);
+  g_assert_cmpuint (size, <, 1024 * 1024);
+  g_assert_cmpmem (contents, 4, magic, 4);
+
+  assert_round_trip (create_test, data->destination);
+}
+
+static void
+test_filter_zstd (void)
+{
+  test_filter (AUTOAR_FILTER_ZSTD, ".tar.zst", "\x28\xb5\x2f\xfd");
+}
+
+static void
+test_filter_lz4 (void)
+{
+  test_filter (AUTOAR_FILTER_LZ4, ".tar.lz4", "\x04\x22\x4d\x18");
+}
+
+static void
+test_filter_unknown_option (void)
+{
+  /* input
+   * └── small.txt
+   *
+   * No filter knows the option, so nothing is written
+   */
+
+  g_autoptr (CreateTest) create_test = NULL;
+  g_autoptr (AutoarCompressor) compressor = NULL;
+  g_autoptr (CreateTestData) data = NULL;
+  g_autoptr (GFile) small = NULL;
+
+  create_test = create_test_new ();
+
+  if (!create_test) {
+    g_assert_nonnull (create_test);
+    return;
+  }
+
+  small = create_test_write_file (create_test, "small.txt", "AutoarCreate\n", 13);
+
+  compressor = create_test_compressor_new (create_test, AUTOAR_FORMAT_PAX,
+                                           AUTOAR_FILTER_GZIP);
+  autoar_compressor_set_filter_option (compressor, "autoar-unknown", "1");
+
+  data = create_test_compress (compressor);
+
+  g_assert_nonnull (data->error);
+  g_assert_true (data->error->domain == AUTOAR_COMPRESSOR_ERROR);
+  g_assert_nonnull (strstr (data->error->message, "autoar-unknown"));
+  g_assert_false (data->completed_signalled);
+  g_assert_null (data->destination);
+}
+
+static void
+setup_test_suite (void)
+{
+  g_test_add_func ("/autoar-create/test-parallel-gzip",
+                   test_parallel_gzip);
+  g_test_add_func ("/autoar-create/test-zip-deflated",
+                   test_zip_deflated);
+  g_test_add_func ("/autoar-create/test-zip-stored",
+                   test_zip_stored);
+  g_test_add_func ("/autoar-create/test-zip-store-detection",
+                   test_zip_store_detection);
+  g_test_add_func ("/autoar-create/test-zip-zip64",
+                   test_zip_zip64);
+  g_test_add_func ("/autoar-create/test-zip-append",
+                   test_zip_append);
+  g_test_add_func ("/autoar-create/test-append-pax",
+                   test_append_pax);
+  g_test_add_func ("/autoar-create/test-append-cpio",
+                   test_append_cpio);
+  g_test_add_func ("/autoar-create/test-update",
+                   test_update);
+  g_test_add_func ("/autoar-create/test-incremental",
+                   test_incremental);
+  g_test_add_func ("/autoar-create/test-volumes-tar",
+                   test_volumes_tar);
+  g_test_add_func ("/autoar-create/test-volumes-zip",
+                   test_volumes_zip);
+  g_test_add_func ("/autoar-create/test-deduplicate",
+                   test_deduplicate);
+  g_test_add_func ("/autoar-create/test-rsyncable",
+                   test_rsyncable);
+  g_test_add_func ("/autoar-create/test-reproducible-threads",
+                   test_reproducible_threads);
+  g_test_add_func ("/autoar-create/test-filter-zstd",
+                   test_filter_zstd);
+  g_test_add_func ("/autoar-create/test-filter-lz4",
+                   test_filter_lz4);
+  g_test_add_func ("/autoar-create/test-filter-unknown-option",
+                   test_filter_unknown_option);
+  g_test_add_func ("/autoar-create/test-compression-level-gzip",
+                   test_compression_level_gzip);
+  g_test_add_func ("/autoar-create/test-compression-level-gzip-threads",
+                   test_compression_level_gzip_threads);
+  g_test_add_func ("/autoar-create/test-compression-level-zip",
+                   test_compression_level_zip);
+  g_test_add_func ("/autoar-create/test-compression-level-zip-threads",
+                   test_compression_level_zip_threads);
+  g_test_add_func ("/autoar-create/test-compression-level-default",
+                   test_compression_level_default);
+  g_test_add_func ("/autoar-create/test-traversal-order",
+                   test_traversal_order);
+  g_test_add_func ("/autoar-create/test-read-order-inode",
+                   test_read_order_inode);
+  g_test_add_func ("/autoar-create/test-read-order-extent",
+                   test_read_order_extent);
+  g_test_add_func ("/autoar-create/test-prefetch",
+                   test_prefetch);
+  g_test_add_func ("/autoar-create/test-hard-links-pax",
+                   test_hard_links_pax);
+  g_test_add_func ("/autoar-create/test-hard-links-cpio",
+                   test_hard_links_cpio);
+  g_test_add_func ("/autoar-create/test-hard-links-deferred",
+                   test_hard_links_deferred);
+  g_test_add_func ("/autoar-create/test-to-stream-gzip",
+                   test_to_stream_gzip);
+  g_test_add_func ("/autoar-create/test-to-stream-zip",
+                   test_to_stream_zip);
+  g_test_add_func ("/autoar-create/test-add-stream-pax",
+                   test_add_stream_pax);
+  g_test_add_func ("/autoar-create/test-add-stream-zip",
+                   test_add_stream_zip);
+  g_test_add_func ("/autoar-create/test-add-stream-info",
+                   test_add_stream_info);
+  g_test_add_func ("/autoar-create/test-add-stream-invalid-pathname",
+                   test_add_stream_invalid_pathname);
+  g_test_add_func ("/autoar-create/test-append-cancelled-pax",
+                   test_append_cancelled_pax);
+  g_test_add_func ("/autoar-create/test-append-cancelled-zip",
+                   test_append_cancelled_zip);
+  g_test_add_func ("/autoar-create/test-exclude",
+                   test_exclude);
+  g_test_add_func ("/autoar-create/test-include",
+                   test_include);
+  g_test_add_func ("/autoar-create/test-sparse",
+                   test_sparse);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_set_nonfatal_assertions ();
+
+  setup_test_suite ();
+
+  return g_test_run ();
+}
@@ -1,5 +1,6 @@
 #include <gnome-autoar/gnome-autoar.h>
 #include <gio/gio.h>
+#include <string.h>
 
 
 typedef void (*FileScannedCallback) (GFile *scanned_file,
@@ -671,6 +672,55 @@ test_multiple_files_different_name (void)
   assert_reference_and_output_match (extract_test);
 }
 
+static void
+test_volumes (void)
+{
+  /* arextract.zip.001
+   * arextract.zip.002
+   * arextract.zip.003
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   *
+   *
+   * ref
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (ExtractTestData) data = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+
+  extract_test = extract_test_new ("test-volumes");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip.001");
+
+  extractor = autoar_extractor_new (archive, extract_test->output);
+
+  data = extract_test_data_new_for_extract (extractor);
+
+  autoar_extractor_start (extractor, data->cancellable);
+
+  g_assert_cmpuint (data->number_of_files, ==, 4);
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  assert_reference_and_output_match (extract_test);
+}
+
 static void
 test_raw_named (void)
 {
@@ -1154,6 +1204,342 @@ test_conflict_skip_file_default (void)
   assert_reference_and_output_match (extract_test);
 }
 
+static void
+test_conflict_policy_rename (void)
+{
+  /* arextract.zip
+   * └── arextract.txt
+   *
+   * 0 directories, 1 file
+   *
+   *
+   * ref
+   * ├── arextract (1).txt
+   * └── arextract.txt
+   *
+   * 0 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (ExtractTestData) data = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFile) conflict_file = NULL;
+  g_autoptr (GFile) reference_file = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+
+  extract_test = extract_test_new ("test-conflict-policy-rename");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  reference_file = g_file_get_child (extract_test->reference,
+                                     "arextract.txt");
+  conflict_file = g_file_get_child (extract_test->output,
+                                    "arextract.txt");
+
+  g_assert_true (g_file_copy (reference_file, conflict_file, G_FILE_COPY_NONE,
+                 NULL, NULL, NULL, NULL));
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  extractor = autoar_extractor_new (archive, extract_test->output);
+  autoar_extractor_set_conflict_policy (extractor,
+                                        AUTOAR_CONFLICT_POLICY_RENAME);
+
+  data = extract_test_data_new_for_extract (extractor);
+
+  autoar_extractor_start (extractor, data->cancellable);
+
+  g_assert_cmpuint (data->number_of_files, ==, 1);
+  g_assert_cmpuint (g_hash_table_size (data->conflict_files), ==, 0);
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  assert_reference_and_output_match (extract_test);
+}
+
+static AutoarConflictAction
+conflict_func_overwrite (AutoarExtractor *extractor,
+                         GFile *file,
+                         GFile **new_file,
+                         gpointer user_data)
+{
+  guint *calls = user_data;
+
+  (*calls)++;
+
+  return AUTOAR_CONFLICT_OVERWRITE;
+}
+
+/* The conflict function is called before the policy is followed. */
+static void
+test_conflict_func (void)
+{
+  /* arextract.zip
+   * └── arextract.txt
+   *
+   * 0 directories, 1 file
+   *
+   *
+   * ref
+   * └── arextract.txt
+   *
+   * 0 directories, 1 file
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (ExtractTestData) data = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFile) conflict_file = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  guint calls = 0;
+
+  extract_test = extract_test_new ("test-conflict-func");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  conflict_file = g_file_get_child (extract_test->output,
+                                    "arextract.txt");
+
+  g_assert_true (g_file_replace_contents (conflict_file,
+                                          "this file should be overwritten", 31,
+                                          NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+                                          NULL, NULL));
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  extractor = autoar_extractor_new (archive, extract_test->output);
+  autoar_extractor_set_conflict_policy (extractor,
+                                        AUTOAR_CONFLICT_POLICY_SKIP);
+  autoar_extractor_set_conflict_func (extractor, conflict_func_overwrite,
+                                      &calls, NULL);
+
+  data = extract_test_data_new_for_extract (extractor);
+
+  autoar_extractor_start (extractor, data->cancellable);
+
+  g_assert_cmpuint (calls, ==, 1);
+  g_assert_cmpuint (data->number_of_files, ==, 1);
+  g_assert_cmpuint (g_hash_table_size (data->conflict_files), ==, 0);
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  assert_reference_and_output_match (extract_test);
+}
+
+/* The conflict signal is emitted in the main context while the files are
+ * extracted in a thread. */
+static void
+test_conflict_new_destination_async (void)
+{
+  /* arextract.zip
+   * └── arextract.txt
+   *
+   * 0 directories, 1 file
+   *
+   *
+   * ref
+   * ├── arextract_new.txt
+   * └── arextract.txt
+   *
+   * 0 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (ExtractTestData) data = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFile) conflict_file = NULL;
+  g_autoptr (GFile) reference_file = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+
+  extract_test = extract_test_new ("test-conflict-new-destination-async");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  reference_file = g_file_get_child (extract_test->reference,
+                                     "arextract.txt");
+  conflict_file = g_file_get_child (extract_test->output,
+                                    "arextract.txt");
+
+  g_assert_true (g_file_copy (reference_file, conflict_file, G_FILE_COPY_NONE,
+                 NULL, NULL, NULL, NULL));
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  extractor = autoar_extractor_new (archive, extract_test->output);
+
+  data = extract_test_data_new_for_extract (extractor);
+
+  g_hash_table_insert (data->conflict_files_actions,
+                       g_object_ref (conflict_file),
+                       GUINT_TO_POINTER (AUTOAR_CONFLICT_CHANGE_DESTINATION));
+
+  g_hash_table_insert (data->conflict_files_destinations,
+                       g_object_ref (conflict_file),
+                       g_file_get_child (extract_test->output,
+                                         "arextract_new.txt"));
+
+  autoar_extractor_start_async (extractor, data->cancellable);
+
+  while (!data->completed_signalled && !data->cancelled_signalled &&
+         data->error == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (data->number_of_files, ==, 1);
+  g_assert_true (g_hash_table_contains (data->conflict_files,
+                                        conflict_file));
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+  assert_reference_and_output_match (extract_test);
+}
+
+static void
+set_modification_time (GFile  *file,
+                       guint64 mtime)
+{
+  g_autoptr (GError) error = NULL;
+
+  g_file_set_attribute_uint64 (file, G_FILE_ATTRIBUTE_TIME_MODIFIED, mtime,
+                               G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                               NULL, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_conflict_policy_keep_newer (void)
+{
+  /* arextract.zip
+   * └── arextract.txt, modified in 2016
+   *
+   * 0 directories, 1 file
+   *
+   *
+   * ref
+   * └── arextract.txt
+   *
+   * 0 directories, 1 file
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (ExtractTestData) data = NULL;
+  g_autoptr (ExtractTestData) older_data = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFile) conflict_file = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarExtractor) older_extractor = NULL;
+  g_autofree char *contents = NULL;
+  gsize size;
+
+  extract_test = extract_test_new ("test-conflict-policy-keep-newer");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  conflict_file = g_file_get_child (extract_test->output,
+                                    "arextract.txt");
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  /* The existing file is newer than the entry, in 2100 */
+  g_assert_true (g_file_replace_contents (conflict_file,
+                                          "this file should be kept", 24,
+                                          NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+                                          NULL, NULL));
+  set_modification_time (conflict_file, 4102444800);
+
+  extractor = autoar_extractor_new (archive, extract_test->output);
+  autoar_extractor_set_conflict_policy (extractor,
+                                        AUTOAR_CONFLICT_POLICY_KEEP_NEWER);
+
+  data = extract_test_data_new_for_extract (extractor);
+
+  autoar_extractor_start (extractor, data->cancellable);
+
+  g_assert_cmpuint (g_hash_table_size (data->conflict_files), ==, 0);
+  g_assert_no_error (data->error);
+  g_assert_true (data->completed_signalled);
+
+  g_assert_true (g_file_load_contents (conflict_file, NULL, &contents, &size,
+                                       NULL, NULL));
+  g_assert_cmpmem (contents, size, "this file should be kept", 24);
+
+  /* The existing file is older than the entry, in 2000 */
+  g_assert_true (g_file_replace_contents (conflict_file,
+                                          "this file should be overwritten", 31,
+                                          NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+                                          NULL, NULL));
+  set_modification_time (conflict_file, 946684800);
+
+  older_extractor = autoar_extractor_new (archive, extract_test->output);
+  autoar_extractor_set_conflict_policy (older_extractor,
+                                        AUTOAR_CONFLICT_POLICY_KEEP_NEWER);
+
+  older_data = extract_test_data_new_for_extract (older_extractor);
+
+  autoar_extractor_start (older_extractor, older_data->cancellable);
+
+  g_assert_cmpuint (g_hash_table_size (older_data->conflict_files), ==, 0);
+  g_assert_no_error (older_data->error);
+  g_assert_true (older_data->completed_signalled);
+  assert_reference_and_output_match (extract_test);
+}
+
+/* Patterns which would always give the same name are rejected. */
+static void
+test_rename_pattern_invalid (void)
+{
+  const char * const patterns[] = {
+    "%b",
+    "%b%%n%e",
+    "%b (%%n)%e",
+    "%n/%b",
+    "%b%/%n",
+  };
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFile) output = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  guint i;
+
+  archive = g_file_get_child (extract_tests_dir, "arextract.zip");
+  output = g_file_get_child (extract_tests_dir, "output");
+
+  /* An invalid construct property leaves the default pattern */
+  g_test_expect_message (NULL, G_LOG_LEVEL_CRITICAL,
+                         "*autoar_extractor_is_rename_pattern*");
+  extractor = g_object_new (AUTOAR_TYPE_EXTRACTOR,
+                            "source-file", archive,
+                            "output-file", output,
+                            "rename-pattern", "%b%%n%e",
+                            NULL);
+  g_test_assert_expected_messages ();
+  g_assert_cmpstr (autoar_extractor_get_rename_pattern (extractor), ==,
+                   "%b (%n)%e");
+
+  autoar_extractor_set_rename_pattern (extractor, "%b-%%-%n%e");
+  g_assert_cmpstr (autoar_extractor_get_rename_pattern (extractor), ==,
+                   "%b-%%-%n%e");
+
+  for (i = 0; i < G_N_ELEMENTS (patterns); i++) {
+    g_test_expect_message (NULL, G_LOG_LEVEL_CRITICAL,
+                           "*autoar_extractor_is_rename_pattern*");
+    autoar_extractor_set_rename_pattern (extractor, patterns[i]);
+    g_test_assert_expected_messages ();
+    g_assert_cmpstr (autoar_extractor_get_rename_pattern (extractor), ==,
+                     "%b-%%-%n%e");
+  }
+
+  autoar_extractor_set_rename_pattern (extractor, NULL);
+  g_assert_cmpstr (autoar_extractor_get_rename_pattern (extractor), ==,
+                   "%b (%n)%e");
+}
+
 static void
 test_change_extract_destination (void)
 {
@@ -1528,6 +1914,411 @@ test_encrypted_wrong_passphrase (void)
   assert_reference_and_output_match (extract_test);
 }
 
+static void
+test_read_entry (void)
+{
+  /* arextract.zip
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GInputStream) stream = NULL;
+  g_autoptr (GError) error = NULL;
+  char buffer[64];
+  gsize bytes_read;
+
+  extract_test = extract_test_new ("test-read-entry");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  extractor = autoar_extractor_new (archive, NULL);
+
+  stream = autoar_extractor_read_entry (extractor,
+                                        "arextract/arextract_nested/arextract.txt",
+                                        NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (stream);
+
+  g_input_stream_read_all (stream, buffer, sizeof (buffer), &bytes_read,
+                           NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (buffer, bytes_read, "AutoarExtractNested\n", 20);
+
+  g_input_stream_close (stream, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_read_entry_bytes (void)
+{
+  /* arextract.zip
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  extract_test = extract_test_new ("test-read-entry");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  archive = g_file_get_child (extract_test->input, "arextract.zip");
+
+  extractor = autoar_extractor_new (archive, NULL);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "./arextract/arextract.txt",
+                                             14, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (bytes);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   "AutoarExtract\n", 14);
+  g_clear_pointer (&bytes, g_bytes_unref);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract_nested/arextract.txt",
+                                             14, NULL, &error);
+  g_assert_error (error, AUTOAR_EXTRACTOR_ERROR, AUTOAR_ENTRY_TOO_LARGE_ERRNO);
+  g_assert_null (bytes);
+  g_clear_error (&error);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/missing.txt",
+                                             0, NULL, &error);
+  g_assert_error (error, AUTOAR_EXTRACTOR_ERROR, AUTOAR_ENTRY_NOT_FOUND_ERRNO);
+  g_assert_null (bytes);
+  g_clear_error (&error);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract_nested",
+                                             0, NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE);
+  g_assert_null (bytes);
+}
+
+static void
+test_read_entry_bytes_truncated (void)
+{
+  /* arextract.tar
+   * └── arextract
+   *     └── arextract.txt, whose header declares 8 GiB of data
+   *
+   * 1 directory, 1 file
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  extract_test = extract_test_new ("test-read-entry-truncated");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  archive = g_file_get_child (extract_test->input, "arextract.tar");
+
+  extractor = autoar_extractor_new (archive, NULL);
+
+  /* The declared size must not be allocated up front */
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract.txt",
+                                             0, NULL, &error);
+  g_assert_nonnull (error);
+  g_assert_null (bytes);
+  g_clear_error (&error);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract.txt",
+                                             1024, NULL, &error);
+  g_assert_error (error, AUTOAR_EXTRACTOR_ERROR, AUTOAR_ENTRY_TOO_LARGE_ERRNO);
+  g_assert_null (bytes);
+}
+
+static void
+test_read_entry_compressed (void)
+{
+  /* arextract.tar.gz
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+
+  extract_test = extract_test_new ("test-read-entry");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  archive = g_file_get_child (extract_test->input, "arextract.tar.gz");
+
+  extractor = autoar_extractor_new (archive, NULL);
+  autoar_extractor_set_use_decoder (extractor, TRUE);
+
+  /* The entries are read from the offsets stored in the index */
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (index), ==, 4);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract_nested/arextract.txt",
+                                             0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   "AutoarExtractNested\n", 20);
+  g_clear_pointer (&bytes, g_bytes_unref);
+
+  bytes = autoar_extractor_read_entry_bytes (extractor,
+                                             "arextract/arextract.txt",
+                                             0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   "AutoarExtract\n", 14);
+}
+
+static void
+read_entry_seek (const char *name)
+{
+  /* arextract.tar.xz, arextract.tar.zst, arextract-stream.tar.zst
+   * └── arextract
+   *     ├── filler.txt
+   *     └── arextract.txt
+   *
+   * 1 directory, 2 files (only the files are stored)
+   *
+   * The 2.5 MiB of filler.txt are compressed in blocks or frames of 1 MiB,
+   * so arextract.txt is stored after the last restart point. The frames of
+   * arextract-stream.tar.zst don't store the size of their content.
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) source = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFileIOStream) iostream = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarExtractor) seek_extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GError) error = NULL;
+  guint8 type;
+  char garbage[20];
+
+  extract_test = extract_test_new ("test-read-entry-seek");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  source = g_file_get_child (extract_test->input, name);
+  archive = g_file_get_child (extract_test->output, name);
+  g_assert_true (g_file_copy (source, archive, G_FILE_COPY_NONE,
+                              NULL, NULL, NULL, NULL));
+
+  extractor = autoar_extractor_new (archive, NULL);
+  autoar_extractor_set_use_decoder (extractor, TRUE);
+
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (index), ==, 2);
+
+  g_variant_get_child (autoar_archive_index_get_seek_points (index), 0, "y", &type);
+  if (type == 0) {
+    g_test_skip ("The decoder is built without support for this format");
+    return;
+  }
+
+  /* Garble the first block or frame, which must not be read again */
+  memset (garbage, 'x', sizeof (garbage));
+  iostream = g_file_open_readwrite (archive, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_seekable_seek (G_SEEKABLE (iostream), 40, G_SEEK_SET,
+                                  NULL, &error));
+  g_assert_true (g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (iostream)),
+                                            garbage, sizeof (garbage),
+                                            NULL, NULL, &error));
+  g_assert_true (g_io_stream_close (G_IO_STREAM (iostream), NULL, &error));
+  g_assert_no_error (error);
+
+  seek_extractor = autoar_extractor_new (archive, NULL);
+  autoar_extractor_set_use_decoder (seek_extractor, TRUE);
+  autoar_extractor_set_index (seek_extractor, index);
+
+  bytes = autoar_extractor_read_entry_bytes (seek_extractor,
+                                             "arextract/arextract.txt",
+                                             0, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                   "AutoarExtract\n", 14);
+}
+
+static void
+test_read_entry_seek_xz (void)
+{
+  read_entry_seek ("arextract.tar.xz");
+}
+
+static void
+test_read_entry_seek_zstd (void)
+{
+  read_entry_seek ("arextract.tar.zst");
+}
+
+static void
+test_read_entry_seek_zstd_stream (void)
+{
+  read_entry_seek ("arextract-stream.tar.zst");
+}
+
+static void
+test_list (void)
+{
+  /* arextract.zip
+   * └── arextract
+   *     ├── arextract_nested
+   *     │   └── arextract.txt
+   *     └── arextract.txt
+   *
+   * 2 directories, 2 files
+   */
+
+  g_autoptr (ExtractTest) extract_test = NULL;
+  g_autoptr (GFile) source = NULL;
+  g_autoptr (GFile) archive = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GFileIOStream) iostream = NULL;
+  g_autoptr (AutoarExtractor) extractor = NULL;
+  g_autoptr (AutoarExtractor) cached_extractor = NULL;
+  g_autoptr (AutoarExtractor) uncached_extractor = NULL;
+  g_autoptr (AutoarArchiveIndex) index = NULL;
+  g_autoptr (AutoarArchiveIndex) cached_index = NULL;
+  g_autoptr (AutoarArchiveIndex) uncached_index = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *garbage = NULL;
+  gsize size;
+  guint i;
+
+  extract_test = extract_test_new ("test-read-entry");
+
+  if (!extract_test) {
+    g_assert_nonnull (extract_test);
+    return;
+  }
+
+  /* The copy is garbled later, so a successful listing must be cached */
+  source = g_file_get_child (extract_test->input, "arextract.zip");
+  archive = g_file_get_child (extract_test->output, "arextract.zip");
+  g_assert_true (g_file_copy (source, archive, G_FILE_COPY_NONE,
+                              NULL, NULL, NULL, NULL));
+
+  extractor = autoar_extractor_new (archive, NULL);
+  autoar_extractor_set_use_index_cache (extractor, TRUE);
+
+  index = autoar_extractor_list (extractor, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (index);
+
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (index), ==, 4);
+  g_assert_cmpuint (autoar_archive_index_get_total_size (index), ==, 34);
+
+  g_assert_true (autoar_archive_index_lookup (index, "arextract/arextract_nested/arextract.txt", &i));
+  g_assert_cmpint (autoar_archive_index_get_entry_file_type (index, i), ==, G_FILE_TYPE_REGULAR);
+  g_assert_cmpint (autoar_archive_index_get_entry_size (index, i), ==, 20);
+
+  g_assert_true (autoar_archive_index_lookup (index, "arextract/arextract_nested/", &i));
+  g_assert_cmpint (autoar_archive_index_get_entry_file_type (index, i), ==, G_FILE_TYPE_DIRECTORY);
+
+  g_assert_false (autoar_archive_index_lookup (index, "arextract/missing.txt", NULL));
+
+  /* Overwrite the archive in place, keeping its inode, size and mtime */
+  info = g_file_query_info (archive,
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  size = g_file_info_get_size (info);
+  garbage = g_malloc (size);
+  memset (garbage, 'x', size);
+  iostream = g_file_open_readwrite (archive, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (iostream)),
+                                            garbage, size, NULL, NULL, &error));
+  g_assert_true (g_io_stream_close (G_IO_STREAM (iostream), NULL, &error));
+  g_assert_no_error (error);
+
+  g_file_set_attribute_uint64 (archive, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                               g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                               G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_file_set_attribute_uint32 (archive, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                               g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC),
+                               G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  /* Without the cache the garbled archive doesn't have these entries */
+  uncached_extractor = autoar_extractor_new (archive, NULL);
+
+  uncached_index = autoar_extractor_list (uncached_extractor, NULL, &error);
+  g_assert_true (uncached_index == NULL ||
+                 autoar_archive_index_get_n_entries (uncached_index) != 4);
+  g_clear_error (&error);
+
+  /* The second listing is loaded from the cache */
+  cached_extractor = autoar_extractor_new (archive, NULL);
+  autoar_extractor_set_use_index_cache (cached_extractor, TRUE);
+
+  cached_index = autoar_extractor_list (cached_extractor, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cached_index);
+
+  g_assert_cmpuint (autoar_archive_index_get_n_entries (cached_index), ==, 4);
+  for (i = 0; i < 4; i++) {
+    g_assert_cmpstr (autoar_archive_index_get_entry_path (cached_index, i), ==,
+                     autoar_archive_index_get_entry_path (index, i));
+    g_assert_cmpint (autoar_archive_index_get_entry_size (cached_index, i), ==,
+                     autoar_archive_index_get_entry_size (index, i));
+  }
+}
+
 static void
 setup_test_suite (void)
 {
@@ -1541,6 +2332,8 @@ setup_test_suite (void)
                    test_multiple_files_same_name);
   g_test_add_func ("/autoar-extract/test-multiple-files-different-name",
                    test_multiple_files_different_name);
+  g_test_add_func ("/autoar-extract/test-volumes",
+                   test_volumes);
 
   g_test_add_func ("/autoar-extract/test-raw-named",
                    test_raw_named);
@@ -1561,6 +2354,16 @@ setup_test_suite (void)
                    test_conflict_skip_file);
   g_test_add_func ("/autoar-extract/test-conflict-skip-file-default",
                    test_conflict_skip_file_default);
+  g_test_add_func ("/autoar-extract/test-conflict-policy-rename",
+                   test_conflict_policy_rename);
+  g_test_add_func ("/autoar-extract/test-conflict-func",
+                   test_conflict_func);
+  g_test_add_func ("/autoar-extract/test-conflict-new-destination-async",
+                   test_conflict_new_destination_async);
+  g_test_add_func ("/autoar-extract/test-conflict-policy-keep-newer",
+                   test_conflict_policy_keep_newer);
+  g_test_add_func ("/autoar-extract/test-rename-pattern-invalid",
+                   test_rename_pattern_invalid);
 
   g_test_add_func ("/autoar-extract/test-change-extract-destination",
                    test_change_extract_destination);
@@ -1581,6 +2384,23 @@ setup_test_suite (void)
                    test_encrypted_request_passphrase);
   g_test_add_func ("/autoar-extract/test-encrypted-wrong-passphrase",
                    test_encrypted_wrong_passphrase);
+
+  g_test_add_func ("/autoar-extract/test-read-entry",
+                   test_read_entry);
+  g_test_add_func ("/autoar-extract/test-read-entry-bytes",
+                   test_read_entry_bytes);
+  g_test_add_func ("/autoar-extract/test-read-entry-bytes-truncated",
+                   test_read_entry_bytes_truncated);
+  g_test_add_func ("/autoar-extract/test-read-entry-compressed",
+                   test_read_entry_compressed);
+  g_test_add_func ("/autoar-extract/test-read-entry-seek-xz",
+                   test_read_entry_seek_xz);
+  g_test_add_func ("/autoar-extract/test-read-entry-seek-zstd",
+                   test_read_entry_seek_zstd);
+  g_test_add_func ("/autoar-extract/test-read-entry-seek-zstd-stream",
+                   test_read_entry_seek_zstd_stream);
+  g_test_add_func ("/autoar-extract/test-list",
+                   test_list);
 }
 
 int
@@ -0,0 +1,186 @@
+#include <gnome-autoar/autoar-ignore.h>
+#include <glib.h>
+
+
+static AutoarIgnore *
+ignore_new (const char * const *patterns)
+{
+  AutoarIgnore *ignore;
+
+  ignore = autoar_ignore_new (NULL, "");
+  for (; *patterns != NULL; patterns++)
+    autoar_ignore_add_pattern (ignore, *patterns);
+
+  return ignore;
+}
+
+static void
+test_basename (void)
+{
+  const char * const patterns[] = { "*.o", "core", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  /* Patterns without a slash match the name at any depth */
+  g_assert_cmpint (autoar_ignore_match (ignore, "main.o", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "src/lib/util.o", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "src/core", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "main.c", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+  g_assert_cmpint (autoar_ignore_match (ignore, "core.c", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+}
+
+static void
+test_anchored (void)
+{
+  const char * const patterns[] = { "/build", "doc/*.html", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  /* A leading or inner slash anchors the pattern to the root */
+  g_assert_cmpint (autoar_ignore_match (ignore, "build", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "src/build", TRUE), ==,
+                   AUTOAR_IGNORE_NONE);
+  g_assert_cmpint (autoar_ignore_match (ignore, "doc/index.html", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "src/doc/index.html", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+
+  /* "*" doesn't match slashes */
+  g_assert_cmpint (autoar_ignore_match (ignore, "doc/api/index.html", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+}
+
+static void
+test_double_star (void)
+{
+  const char * const patterns[] = { "**/cache", "logs/**", "a/**/b", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  g_assert_cmpint (autoar_ignore_match (ignore, "cache", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "x/y/cache", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "logs/2026/10/app.log", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "logs", TRUE), ==,
+                   AUTOAR_IGNORE_NONE);
+  g_assert_cmpint (autoar_ignore_match (ignore, "a/b", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "a/x/y/b", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "a/xb", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+}
+
+static void
+test_negation (void)
+{
+  const char * const patterns[] = { "*.log", "!keep.log", "\\!bang", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  /* The last matching pattern wins */
+  g_assert_cmpint (autoar_ignore_match (ignore, "debug.log", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "keep.log", FALSE), ==,
+                   AUTOAR_IGNORE_NEGATED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "!bang", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+}
+
+static void
+test_dir_only (void)
+{
+  const char * const patterns[] = { "out/", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  g_assert_cmpint (autoar_ignore_match (ignore, "out", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "src/out", TRUE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "out", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+}
+
+static void
+test_nested (void)
+{
+  const char * const patterns[] = { "*.tmp", NULL };
+  g_autoptr (AutoarIgnore) root = NULL;
+  g_autoptr (AutoarIgnore) nested = NULL;
+
+  root = ignore_new (patterns);
+
+  /* The patterns of a subdirectory come first, and are relative to it */
+  nested = autoar_ignore_new (root, "sub");
+  autoar_ignore_add_pattern (nested, "!/draft.tmp");
+  autoar_ignore_add_pattern (nested, "/local");
+
+  g_assert_cmpint (autoar_ignore_match (nested, "sub/draft.tmp", FALSE), ==,
+                   AUTOAR_IGNORE_NEGATED);
+  g_assert_cmpint (autoar_ignore_match (nested, "sub/other.tmp", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (nested, "sub/local", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (nested, "local", FALSE), ==,
+                   AUTOAR_IGNORE_NONE);
+}
+
+static void
+test_raw_names (void)
+{
+  const char * const patterns[] = { "caf?.txt", "*.bin", NULL };
+  g_autoptr (AutoarIgnore) ignore = NULL;
+
+  ignore = ignore_new (patterns);
+
+  /* Names in Latin-1 are not valid UTF-8 */
+  g_assert_cmpint (autoar_ignore_match (ignore, "caf\xe9.txt", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+  g_assert_cmpint (autoar_ignore_match (ignore, "d\xe9j\xe0/data.bin", FALSE), ==,
+                   AUTOAR_IGNORE_MATCHED);
+}
+
+static void
+setup_test_suite (void)
+{
+  g_test_add_func ("/autoar-ignore/test-basename",
+                   test_basename);
+  g_test_add_func ("/autoar-ignore/test-anchored",
+                   test_anchored);
+  g_test_add_func ("/autoar-ignore/test-double-star",
+                   test_double_star);
+  g_test_add_func ("/autoar-ignore/test-negation",
+                   test_negation);
+  g_test_add_func ("/autoar-ignore/test-dir-only",
+                   test_dir_only);
+  g_test_add_func ("/autoar-ignore/test-nested",
+                   test_nested);
+  g_test_add_func ("/autoar-ignore/test-raw-names",
+                   test_raw_names);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_set_nonfatal_assertions ();
+
+  setup_test_suite ();
+
+  return g_test_run ();
+}
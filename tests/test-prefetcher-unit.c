@@ -0,0 +1,340 @@
+#include <gnome-autoar/autoar-prefetcher.h>
+#include <gio/gio.h>
+#include <string.h>
+
+
+/* The size of the files which are read into memory, see
+ * READ_AHEAD_FILE_SIZE */
+#define BUFFERED_FILE_SIZE 1000
+#define LARGE_FILE_SIZE (2 * 1024 * 1024)
+
+#define ATTRIBUTES \
+  G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+  G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+  G_FILE_ATTRIBUTE_UNIX_NLINK "," \
+  G_FILE_ATTRIBUTE_UNIX_INODE
+
+
+typedef struct {
+  GFile *work_directory;
+} PrefetcherTest;
+
+static void prefetcher_test_free (PrefetcherTest *test);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PrefetcherTest, prefetcher_test_free);
+
+
+static PrefetcherTest *
+prefetcher_test_new (void)
+{
+  PrefetcherTest *test;
+  g_autofree char *path = NULL;
+  g_autoptr (GError) error = NULL;
+
+  path = g_dir_make_tmp ("test-prefetcher-unit-XXXXXX", &error);
+  if (path == NULL) {
+    g_printerr ("Failed to create the work directory: %s\n", error->message);
+
+    return NULL;
+  }
+
+  test = g_new0 (PrefetcherTest, 1);
+  test->work_directory = g_file_new_for_path (path);
+
+  return test;
+}
+
+static void
+prefetcher_test_free (PrefetcherTest *test)
+{
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+  GFileInfo *info;
+
+  /* The work directory is flat */
+  enumerator = g_file_enumerate_children (test->work_directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, NULL);
+  while (enumerator != NULL &&
+         (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+    g_autoptr (GFile) child = NULL;
+
+    child = g_file_get_child (test->work_directory, g_file_info_get_name (info));
+    g_file_delete (child, NULL, NULL);
+    g_object_unref (info);
+  }
+  g_file_delete (test->work_directory, NULL, NULL);
+
+  g_object_unref (test->work_directory);
+  g_free (test);
+}
+
+/* Returns @size bytes which depend on @seed */
+static guint8 *
+generate_data (gsize   size,
+               guint32 seed)
+{
+  g_autoptr (GRand) rand = NULL;
+  guint8 *data;
+  gsize i;
+
+  rand = g_rand_new_with_seed (seed);
+  data = g_malloc (size);
+
+  for (i = 0; i < size; i++)
+    data[i] = g_rand_int (rand);
+
+  return data;
+}
+
+static GFile *
+prefetcher_test_write_file (PrefetcherTest *test,
+                            const char     *name,
+                            const void     *data,
+                            gsize           size)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GError) error = NULL;
+
+  file = g_file_get_child (test->work_directory, name);
+  g_file_replace_contents (file, data, size, NULL, FALSE,
+                           G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_steal_pointer (&file);
+}
+
+static GFileInfo *
+query_info (GFile *file)
+{
+  g_autoptr (GError) error = NULL;
+  GFileInfo *info;
+
+  info = g_file_query_info (file, ATTRIBUTES,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                            NULL, &error);
+  g_assert_no_error (error);
+
+  return info;
+}
+
+/* Pops the next entry, which must be @expected_file, and checks that its
+ * data is @data */
+static void
+assert_pop_read (AutoarPrefetcher *prefetcher,
+                 GFile            *expected_file,
+                 const void       *data,
+                 gsize             size)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFileInfo) info = NULL;
+  g_autoptr (GInputStream) istream = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree guint8 *buffer = NULL;
+  gsize bytes_read;
+
+  g_assert_true (autoar_prefetcher_pop (prefetcher, &file, &info));
+  g_assert_true (g_file_equal (file, expected_file));
+
+  istream = autoar_prefetcher_read (prefetcher, file, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (istream);
+
+  /* One more byte shows that the stream ends where it should */
+  buffer = g_malloc (size + 1);
+  g_input_stream_read_all (istream, buffer, size + 1, &bytes_read,
+                           NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (buffer, bytes_read, data, size);
+
+  g_input_stream_close (istream, NULL, NULL);
+}
+
+static void
+test_budget (void)
+{
+  /* Files are read into memory until their size reaches the budget, which
+   * is given back as they are read */
+
+  g_autoptr (PrefetcherTest) test = NULL;
+  g_autoptr (AutoarPrefetcher) prefetcher = NULL;
+  g_autoptr (GPtrArray) files = NULL;
+  g_autoptr (GPtrArray) datas = NULL;
+  GFile *last_file;
+  GFileInfo *last_info;
+  guint i;
+
+  test = prefetcher_test_new ();
+
+  if (!test) {
+    g_assert_nonnull (test);
+    return;
+  }
+
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  datas = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < 5; i++) {
+    g_autofree char *name = g_strdup_printf ("file-%u", i);
+    guint8 *data = generate_data (BUFFERED_FILE_SIZE, i);
+
+    g_ptr_array_add (datas, data);
+    g_ptr_array_add (files, prefetcher_test_write_file (test, name, data,
+                                                        BUFFERED_FILE_SIZE));
+  }
+
+  prefetcher = autoar_prefetcher_new (2, 3 * BUFFERED_FILE_SIZE,
+                                      AUTOAR_READ_ORDER_TRAVERSAL, NULL);
+
+  for (i = 0; i < 3; i++) {
+    g_autoptr (GFileInfo) info = query_info (files->pdata[i]);
+
+    g_assert_false (autoar_prefetcher_is_full (prefetcher));
+    autoar_prefetcher_push (prefetcher, files->pdata[i], info);
+  }
+  g_assert_true (autoar_prefetcher_is_full (prefetcher));
+
+  /* Popping an entry gives nothing back until its data is read */
+  assert_pop_read (prefetcher, files->pdata[0], datas->pdata[0],
+                   BUFFERED_FILE_SIZE);
+  g_assert_false (autoar_prefetcher_is_full (prefetcher));
+
+  for (i = 3; i < 5; i++) {
+    g_autoptr (GFileInfo) info = query_info (files->pdata[i]);
+
+    autoar_prefetcher_push (prefetcher, files->pdata[i], info);
+  }
+  g_assert_true (autoar_prefetcher_is_full (prefetcher));
+
+  for (i = 1; i < 5; i++)
+    assert_pop_read (prefetcher, files->pdata[i], datas->pdata[i],
+                     BUFFERED_FILE_SIZE);
+
+  g_assert_false (autoar_prefetcher_pop (prefetcher, &last_file, &last_info));
+  g_assert_false (autoar_prefetcher_is_full (prefetcher));
+}
+
+static void
+test_large_file (void)
+{
+  /* Files larger than READ_AHEAD_FILE_SIZE are read by the caller and take
+   * nothing from the budget */
+
+  g_autoptr (PrefetcherTest) test = NULL;
+  g_autoptr (AutoarPrefetcher) prefetcher = NULL;
+  g_autoptr (GFile) large = NULL;
+  g_autoptr (GFile) small = NULL;
+  g_autoptr (GFileInfo) large_info = NULL;
+  g_autoptr (GFileInfo) small_info = NULL;
+  g_autofree guint8 *large_data = NULL;
+  g_autofree guint8 *small_data = NULL;
+
+  test = prefetcher_test_new ();
+
+  if (!test) {
+    g_assert_nonnull (test);
+    return;
+  }
+
+  large_data = generate_data (LARGE_FILE_SIZE, 10);
+  large = prefetcher_test_write_file (test, "large", large_data, LARGE_FILE_SIZE);
+  small_data = generate_data (BUFFERED_FILE_SIZE, 11);
+  small = prefetcher_test_write_file (test, "small", small_data, BUFFERED_FILE_SIZE);
+
+  prefetcher = autoar_prefetcher_new (2, 2 * BUFFERED_FILE_SIZE,
+                                      AUTOAR_READ_ORDER_TRAVERSAL, NULL);
+
+  large_info = query_info (large);
+  autoar_prefetcher_push (prefetcher, large, large_info);
+  g_assert_false (autoar_prefetcher_is_full (prefetcher));
+  small_info = query_info (small);
+  autoar_prefetcher_push (prefetcher, small, small_info);
+  g_assert_false (autoar_prefetcher_is_full (prefetcher));
+
+  assert_pop_read (prefetcher, large, large_data, LARGE_FILE_SIZE);
+  assert_pop_read (prefetcher, small, small_data, BUFFERED_FILE_SIZE);
+}
+
+static void
+test_changed_size (void)
+{
+  /* The files change after their info is found: the data is the one of
+   * the file, up to the size of the info, and the budget is given back
+   * by the size of the info */
+
+  g_autoptr (PrefetcherTest) test = NULL;
+  g_autoptr (AutoarPrefetcher) prefetcher = NULL;
+  g_autoptr (GFile) grown = NULL;
+  g_autoptr (GFile) shrunk = NULL;
+  g_autoptr (GFile) next = NULL;
+  g_autoptr (GFileInfo) grown_info = NULL;
+  g_autoptr (GFileInfo) shrunk_info = NULL;
+  g_autoptr (GFileInfo) next_info = NULL;
+  g_autoptr (GFileOutputStream) ostream = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree guint8 *data = NULL;
+
+  test = prefetcher_test_new ();
+
+  if (!test) {
+    g_assert_nonnull (test);
+    return;
+  }
+
+  data = generate_data (2 * BUFFERED_FILE_SIZE, 20);
+  grown = prefetcher_test_write_file (test, "grown", data, BUFFERED_FILE_SIZE);
+  shrunk = prefetcher_test_write_file (test, "shrunk", data, BUFFERED_FILE_SIZE);
+  next = prefetcher_test_write_file (test, "next", data, BUFFERED_FILE_SIZE);
+  grown_info = query_info (grown);
+  shrunk_info = query_info (shrunk);
+  next_info = query_info (next);
+
+  /* Whether it is buffered before or after, the start of the grown file
+   * is the same */
+  prefetcher = autoar_prefetcher_new (2, 2 * BUFFERED_FILE_SIZE,
+                                      AUTOAR_READ_ORDER_TRAVERSAL, NULL);
+  autoar_prefetcher_push (prefetcher, grown, grown_info);
+
+  ostream = g_file_append_to (grown, G_FILE_CREATE_NONE, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (G_OUTPUT_STREAM (ostream),
+                             data + BUFFERED_FILE_SIZE, BUFFERED_FILE_SIZE,
+                             NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_close (G_OUTPUT_STREAM (ostream), NULL, &error);
+  g_assert_no_error (error);
+
+  g_clear_object (&shrunk);
+  shrunk = prefetcher_test_write_file (test, "shrunk", data, 10);
+  autoar_prefetcher_push (prefetcher, shrunk, shrunk_info);
+  g_assert_true (autoar_prefetcher_is_full (prefetcher));
+
+  assert_pop_read (prefetcher, grown, data, BUFFERED_FILE_SIZE);
+  assert_pop_read (prefetcher, shrunk, data, 10);
+
+  /* Nothing is left of the budget of the changed files */
+  autoar_prefetcher_push (prefetcher, next, next_info);
+  g_assert_false (autoar_prefetcher_is_full (prefetcher));
+  assert_pop_read (prefetcher, next, data, BUFFERED_FILE_SIZE);
+}
+
+static void
+setup_test_suite (void)
+{
+  g_test_add_func ("/autoar-prefetcher/test-budget",
+                   test_budget);
+  g_test_add_func ("/autoar-prefetcher/test-large-file",
+                   test_large_file);
+  g_test_add_func ("/autoar-prefetcher/test-changed-size",
+                   test_changed_size);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_set_nonfatal_assertions ();
+
+  setup_test_suite ();
+
+  return g_test_run ();
+}
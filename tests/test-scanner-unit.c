@@ -0,0 +1,234 @@
+#include <gnome-autoar/autoar-scanner.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+static gboolean
+remove_directory (GFile *directory)
+{
+  gboolean success = TRUE;
+  GError *error = NULL;
+  g_autoptr (GFileEnumerator) enumerator = NULL;
+
+  enumerator = g_file_enumerate_children (directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          NULL, NULL);
+
+  if (enumerator) {
+    GFileInfo *info;
+
+    while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL) {
+      g_autoptr (GFile) child = NULL;
+
+      child = g_file_get_child (directory, g_file_info_get_name (info));
+
+      if (!g_file_delete (child, NULL, &error)) {
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_EMPTY)) {
+          success = success && remove_directory (child);
+        } else {
+          success = FALSE;
+        }
+
+        g_clear_error (&error);
+      }
+
+      g_object_unref (info);
+    }
+  }
+
+  g_file_delete (directory, NULL, &error);
+
+  if (error) {
+    success = FALSE;
+    g_error_free (error);
+  }
+
+  return success;
+}
+
+/* Writes @contents to @path below @directory */
+static void
+write_file (GFile      *directory,
+            const char *path,
+            const char *contents)
+{
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFile) parent = NULL;
+  g_autoptr (GError) error = NULL;
+
+  file = g_file_resolve_relative_path (directory, path);
+  parent = g_file_get_parent (file);
+  g_file_make_directory_with_parents (parent, NULL, NULL);
+
+  g_file_replace_contents (file, contents, strlen (contents), NULL, FALSE,
+                           G_FILE_CREATE_NONE, NULL, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static void
+assert_attribute_matches (GFileInfo  *expected,
+                          GFileInfo  *actual,
+                          const char *attribute)
+{
+  g_autofree char *expected_value = NULL;
+  g_autofree char *actual_value = NULL;
+
+  g_assert_true (g_file_info_has_attribute (actual, attribute));
+
+  expected_value = g_file_info_get_attribute_as_string (expected, attribute);
+  actual_value = g_file_info_get_attribute_as_string (actual, attribute);
+  g_assert_cmpstr (actual_value, ==, expected_value);
+}
+
+static void
+test_native_info (void)
+{
+  /* input
+   * ├── file.txt
+   * ├── link -> file.txt
+   * ├── nested
+   * │   └── nested.txt
+   * ├── fifo
+   * └── caf\xe9.txt, whose name isn't UTF-8
+   *
+   * The info found while listing the directories must be the same as the
+   * one of GIO
+   */
+
+  const char * const required[] = {
+    G_FILE_ATTRIBUTE_STANDARD_NAME,
+    G_FILE_ATTRIBUTE_STANDARD_TYPE,
+    G_FILE_ATTRIBUTE_STANDARD_SIZE,
+    G_FILE_ATTRIBUTE_UNIX_MODE,
+    G_FILE_ATTRIBUTE_UNIX_UID,
+    G_FILE_ATTRIBUTE_UNIX_GID,
+    G_FILE_ATTRIBUTE_UNIX_INODE,
+    G_FILE_ATTRIBUTE_UNIX_DEVICE,
+    G_FILE_ATTRIBUTE_TIME_MODIFIED,
+    G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+    G_FILE_ATTRIBUTE_TIME_ACCESS,
+    G_FILE_ATTRIBUTE_TIME_ACCESS_USEC,
+    G_FILE_ATTRIBUTE_TIME_CHANGED,
+    G_FILE_ATTRIBUTE_TIME_CHANGED_USEC,
+  };
+  g_autoptr (AutoarScanner) scanner = NULL;
+  g_autoptr (GFile) work_directory = NULL;
+  g_autoptr (GFile) input = NULL;
+  g_autoptr (GFile) link_file = NULL;
+  g_autoptr (GFile) fifo_file = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *path = NULL;
+  GFile *file;
+  GFileInfo *info;
+  gboolean found_link = FALSE;
+  gboolean found_fifo = FALSE;
+  gboolean found_raw = FALSE;
+  guint n_entries = 0;
+  guint i;
+
+  path = g_dir_make_tmp ("test-scanner-unit-XXXXXX", &error);
+  g_assert_no_error (error);
+  if (path == NULL)
+    return;
+
+  work_directory = g_file_new_for_path (path);
+  input = g_file_get_child (work_directory, "input");
+
+  write_file (input, "file.txt", "AutoarScanner\n");
+  write_file (input, "nested/nested.txt", "AutoarScanner\n");
+  write_file (input, "caf\xe9.txt", "AutoarScanner\n");
+
+  link_file = g_file_get_child (input, "link");
+  g_file_make_symbolic_link (link_file, "file.txt", NULL, &error);
+  g_assert_no_error (error);
+
+  fifo_file = g_file_get_child (input, "fifo");
+  g_assert_cmpint (mkfifo (g_file_peek_path (fifo_file), 0600), ==, 0);
+
+  scanner = autoar_scanner_new (1, NULL);
+  autoar_scanner_add (scanner, input);
+
+  while (autoar_scanner_next (scanner, &file, &info, &error)) {
+    g_autoptr (GFileInfo) expected = NULL;
+    g_auto (GStrv) attributes = NULL;
+    g_autofree char *owner = NULL;
+
+    expected = g_file_query_info (file, AUTOAR_SCANNER_ATTRIBUTES,
+                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                  NULL, &error);
+    g_assert_no_error (error);
+
+    for (i = 0; i < G_N_ELEMENTS (required); i++)
+      assert_attribute_matches (expected, info, required[i]);
+
+    /* Whatever else is found must be what GIO finds, if the version of
+     * GIO finds it, like the creation time */
+    attributes = g_file_info_list_attributes (info, NULL);
+    for (i = 0; attributes[i] != NULL; i++) {
+      if (g_file_info_has_attribute (expected, attributes[i]))
+        assert_attribute_matches (expected, info, attributes[i]);
+    }
+
+    /* The owner is only missing if the system doesn't know it */
+    owner = g_file_info_get_attribute_as_string (expected,
+                                                 G_FILE_ATTRIBUTE_OWNER_USER);
+    g_assert_cmpstr (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_USER),
+                     ==, owner);
+    g_clear_pointer (&owner, g_free);
+    owner = g_file_info_get_attribute_as_string (expected,
+                                                 G_FILE_ATTRIBUTE_OWNER_GROUP);
+    g_assert_cmpstr (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_OWNER_GROUP),
+                     ==, owner);
+
+    switch (g_file_info_get_file_type (info)) {
+      case G_FILE_TYPE_SYMBOLIC_LINK:
+        g_assert_cmpstr (g_file_info_get_symlink_target (info), ==, "file.txt");
+        found_link = TRUE;
+        break;
+
+      case G_FILE_TYPE_SPECIAL:
+        g_assert_true (S_ISFIFO (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE)));
+        found_fifo = TRUE;
+        break;
+
+      default:
+        break;
+    }
+
+    if (strcmp (g_file_info_get_name (info), "caf\xe9.txt") == 0)
+      found_raw = TRUE;
+
+    n_entries++;
+    g_object_unref (file);
+    g_object_unref (info);
+  }
+
+  g_assert_no_error (error);
+  g_assert_true (found_link);
+  g_assert_true (found_fifo);
+  g_assert_true (found_raw);
+  g_assert_cmpuint (n_entries, ==, 6);
+
+  remove_directory (work_directory);
+}
+
+static void
+setup_test_suite (void)
+{
+  g_test_add_func ("/autoar-scanner/test-native-info",
+                   test_native_info);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_set_nonfatal_assertions ();
+
+  setup_test_suite ();
+
+  return g_test_run ();
+}